@@ -9,12 +9,25 @@
 #include "device/input_manager.h"
 #include "world/camera.h"
 
+/* written when F12 is pressed */
+#define CPU_TRACE_PATH "cpu_trace.json"
+
 typedef struct {
     InputManager* input_manager;
     FpsCamera camera;
     sx_rect viewport;
 } Device;
 
+typedef struct HeadlessRun {
+    uint32_t width;
+    uint32_t height;
+    uint32_t frames;
+    uint32_t frames_in_flight;
+    /* directory the frames are written to as PNG, NULL to only time them */
+    const char* output_dir;
+} HeadlessRun;
+
 int device_run(void* win, void* data);
+int device_run_headless(const HeadlessRun* run);
 
 Device* device();
@@ -1,5 +1,6 @@
 #pragma once
 #include <stdint.h>
+#include <stdbool.h>
 
 #if defined(GB_USE_XCB)
 #include <xcb/xcb.h>
@@ -18,6 +19,10 @@ typedef struct DeviceWindow {
 #endif
     uint32_t width;
     uint32_t height;
+    /* no surface nor swapchain, frames are rendered offscreen and read back */
+    bool headless;
+    /* frames the CPU may record ahead of the GPU, 0 picks RENDERING_RESOURCES_DEFAULT */
+    uint32_t frames_in_flight;
 } DeviceWindow;
 
 typedef enum MouseCursor
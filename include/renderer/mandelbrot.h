@@ -5,7 +5,6 @@
 typedef struct MandelbrotInfo {
     Buffer buffer;
 
-    VkDescriptorPool descriptor_pool;
     VkDescriptorSetLayout descriptor_layout;
     VkDescriptorSet descriptor_set;
 
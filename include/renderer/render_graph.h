@@ -0,0 +1,204 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sx/allocator.h"
+#include "renderer/vk_renderer.h"
+
+#include "vulkan/vulkan_core.h"
+
+/*
+ * Frame graph of the graphics command buffer. Passes declare the images they
+ * read and write, in execution order, and the graph records the barriers, layout
+ * transitions and queue family ownership acquires in front of each pass.
+ * Passes whose writes are never read by a live pass, nor exported, are culled.
+ * Transient images only live inside the graph, the ones whose lifetimes do not
+ * overlap share memory.
+ * Imported images keep their state in memory owned by the caller, so it carries
+ * over between frames and to work recorded outside the graph.
+ */
+
+#define RG_MAX_PASSES 16
+#define RG_MAX_IMAGES 32
+#define RG_MAX_PASS_ACCESSES 16
+#define RG_INVALID UINT32_MAX
+
+typedef uint32_t RgImage;
+typedef uint32_t RgPass;
+
+typedef void(*rg_execute_callback)(VkCommandBuffer cmdbuffer, void* user);
+
+typedef enum RgUsage {
+    RG_USAGE_SAMPLED_COMPUTE,
+    RG_USAGE_SAMPLED_FRAGMENT,
+    RG_USAGE_STORAGE_WRITE_COMPUTE,
+    RG_USAGE_COLOR_ATTACHMENT,
+    RG_USAGE_DEPTH_ATTACHMENT,
+    RG_USAGE_TRANSFER_SRC,
+    RG_USAGE_PRESENT,
+    RG_USAGE_COUNT
+} RgUsage;
+
+/* image flags */
+/* every access uses VK_IMAGE_LAYOUT_GENERAL, for storage images that are sampled as well */
+#define RG_IMAGE_GENERAL_LAYOUT 0x1
+/*
+ * attachment only used inside render passes that never loads or stores it, backed by
+ * lazily allocated memory where the device has it so tile memory is all it takes
+ */
+#define RG_IMAGE_LAZILY_ALLOCATED 0x2
+
+/* pass flags */
+/* never culled, for passes with effects the graph does not see */
+#define RG_PASS_SIDE_EFFECTS 0x1
+
+/* last access to an image as seen by the queue that recorded it */
+typedef struct RgImageState {
+    VkImageLayout layout;
+    VkPipelineStageFlags write_stages;
+    /* write accesses of the last write, 0 when only the layout changed since */
+    VkAccessFlags write_access;
+    /* reads since the last write, a write has to wait for them */
+    VkPipelineStageFlags read_stages;
+    /* stages the last write is already visible to */
+    VkPipelineStageFlags visible_stages;
+    /* family that released the image to the graph, VK_QUEUE_FAMILY_IGNORED when it owns it */
+    uint32_t queue_family;
+} RgImageState;
+
+typedef struct RgImageDesc {
+    uint32_t width;
+    uint32_t height;
+    VkFormat format;
+    VkImageAspectFlags aspect;
+    /* on top of the usage derived from the passes */
+    VkImageUsageFlags usage;
+    /* RG_IMAGE_* */
+    uint32_t flags;
+} RgImageDesc;
+
+typedef struct RgAccess {
+    RgImage image;
+    VkPipelineStageFlags stages;
+    VkAccessFlags access;
+    VkImageLayout layout;
+    bool write;
+} RgAccess;
+
+typedef struct RgPassNode {
+    const char* name;
+    rg_execute_callback callback;
+    void* user;
+    uint32_t flags;
+    bool enabled;
+    bool live;
+    RgAccess accesses[RG_MAX_PASS_ACCESSES];
+    uint32_t accesses_count;
+} RgPassNode;
+
+typedef struct RgImageNode {
+    const char* name;
+    uint32_t flags;
+    bool imported;
+    VkImage image;
+    VkImageAspectFlags aspect;
+    RgImageState* state;
+    /* transient images only */
+    RgImageDesc desc;
+    /* derived from the accesses of the passes */
+    VkImageUsageFlags usage;
+    ImageBuffer buffer;
+    RgImageState transient_state;
+    uint32_t slot;
+    uint32_t first_pass;
+    uint32_t last_pass;
+    /* export at the end of the graph */
+    bool exported;
+    RgUsage export_usage;
+    uint32_t export_queue_family;
+} RgImageNode;
+
+/* memory shared by transient images with disjoint lifetimes */
+typedef struct RgMemorySlot {
+    GpuAllocation allocation;
+    VkMemoryRequirements requirements;
+    VkMemoryPropertyFlags properties;
+    uint32_t last_pass;
+    /* stages and writes of the last image that used the memory, the next one waits on them */
+    VkPipelineStageFlags stages;
+    VkAccessFlags write_access;
+} RgMemorySlot;
+
+/* transient images and memory replaced by rg_compile, the frames recorded before still use them */
+typedef struct RgRetired {
+    ImageBuffer buffers[RG_MAX_IMAGES];
+    uint32_t buffers_count;
+    GpuAllocation allocations[RG_MAX_IMAGES];
+    uint32_t allocations_count;
+    /* rg_execute calls when retired */
+    uint64_t frame;
+} RgRetired;
+
+typedef struct RenderGraph {
+    const sx_alloc* alloc;
+    uint32_t queue_family;
+
+    RgPassNode passes[RG_MAX_PASSES];
+    uint32_t passes_count;
+    RgImageNode images[RG_MAX_IMAGES];
+    uint32_t images_count;
+
+    RgMemorySlot slots[RG_MAX_IMAGES];
+    uint32_t slots_count;
+    /* culling is redone when passes change, memory when transient images change */
+    bool dirty;
+    bool memory_dirty;
+
+    /* rg_execute calls so far */
+    uint64_t frame;
+    RgRetired retired[RENDERING_RESOURCES_MAX];
+    uint32_t retired_count;
+} RenderGraph;
+
+/* queue_family is the family of the command buffers passed to rg_execute */
+RenderGraph* rg_create(const sx_alloc* alloc, uint32_t queue_family);
+void rg_destroy(RenderGraph* graph);
+
+RgImage rg_import_image(RenderGraph* graph, const char* name, VkImage image, VkImageAspectFlags aspect,
+        RgImageState* state, uint32_t flags);
+/* swaps the image behind an import, e.g. the swapchain image of this frame */
+void rg_set_imported_image(RenderGraph* graph, RgImage image, VkImage vk_image, RgImageState* state);
+RgImage rg_create_image(RenderGraph* graph, const char* name, const RgImageDesc* desc);
+void rg_set_image_desc(RenderGraph* graph, RgImage image, const RgImageDesc* desc);
+const RgImageDesc* rg_image_desc(RenderGraph* graph, RgImage image);
+/* the image and view of a transient image, valid after rg_compile */
+const ImageBuffer* rg_image_buffer(RenderGraph* graph, RgImage image);
+RgImage rg_find_image(RenderGraph* graph, const char* name);
+/* leaves the image in the layout of usage, released to queue_family when it differs from the graph's */
+void rg_export_image(RenderGraph* graph, RgImage image, RgUsage usage, uint32_t queue_family);
+
+/* passes run in the order they are added, name is their GPU profiler scope */
+RgPass rg_add_pass(RenderGraph* graph, const char* name, rg_execute_callback callback, void* user, uint32_t flags);
+void rg_read(RenderGraph* graph, RgPass pass, RgImage image, RgUsage usage);
+void rg_write(RenderGraph* graph, RgPass pass, RgImage image, RgUsage usage);
+/* disabled passes are skipped, and so are the passes only they consume */
+void rg_set_pass_enabled(RenderGraph* graph, RgPass pass, bool enabled);
+
+/*
+ * Culls the passes and (re)allocates transient memory when needed. Returns true when
+ * transient images were recreated, descriptors pointing at them must be rewritten.
+ * The old images are destroyed frames_in_flight() rg_execute calls later, so the
+ * caller has to wait for the fence of a frame before recording the one that reuses
+ * its resources.
+ */
+bool rg_compile(RenderGraph* graph);
+void rg_execute(RenderGraph* graph, VkCommandBuffer cmdbuffer);
+
+/*
+ * Records the release half of an ownership transfer on a queue outside the graph, after
+ * writes in src_stages/src_access left image in state->layout. state then tells the graph
+ * to acquire it on first use, the submit of cmdbuffer must be waited on by a semaphore.
+ */
+void rg_release_image(VkCommandBuffer cmdbuffer, VkImage image, VkImageAspectFlags aspect,
+        VkPipelineStageFlags src_stages, VkAccessFlags src_access, RgImageState* state,
+        uint32_t src_queue_family, uint32_t dst_queue_family);
@@ -7,6 +7,7 @@
 #include "sx/math.h"
 #include "sx/allocator.h"
 #include "sx/hash.h"
+#include "sx/jobs.h"
 #include "device/types.h"
 //#include "vulkan/vulkan_core.h"
 #include <stdio.h>
@@ -39,7 +40,10 @@
 } 
 
 #define MAX_NUM_ATTACHMENTS 8
-#define RENDERING_RESOURCES_SIZE 2
+/* frames the CPU may record ahead of the GPU, picked at init with DeviceWindow.frames_in_flight */
+#define RENDERING_RESOURCES_MAX 4
+#define RENDERING_RESOURCES_DEFAULT 2
+#define MAX_SWAPCHAIN_IMAGES 8
 
 
 typedef struct DeviceVk {
@@ -61,15 +65,84 @@ typedef struct DescriptorLayoutInfo {
 } DescriptorLayoutInfo;
 
 
+#define GPU_MEMORY_BLOCK_SIZE (64ull << 20)
+#define GPU_MEMORY_MAX_BLOCKS 64
+#define GPU_MEMORY_MAX_ALIGNMENT (64u << 10)
+/* free ranges a block can be split into */
+#define GPU_MEMORY_MAX_FREE_RANGES 1024
+#define STAGING_RING_SIZE (32ull << 20)
+#define STAGING_MAX_ACQUIRES 64
+#define UNIFORM_ARENA_SLICE_SIZE (64u << 10)
+#define DESCRIPTOR_POOL_MAX_SETS 64
+#define DESCRIPTOR_ALLOCATOR_MAX_POOLS 32
+#define DESCRIPTOR_LAYOUT_MAX_BINDINGS 16
+#define DESCRIPTOR_LAYOUT_CACHE_SIZE 64
+#define PSO_CACHE_SIZE 64
+/* requests compiling at the same time */
+#define PSO_MAX_BUILDS 16
+/* pipelines of one request, one per render pass/subpass pair */
+#define PSO_MAX_VARIANTS 4
+/* shader modules created and not yet consumed by a pipeline */
+#define PSO_MAX_SHADER_MODULES 64
+#define PSO_MAX_SHADER_STAGES 4
+#define PSO_MAX_VERTEX_BINDINGS 4
+#define PSO_MAX_VERTEX_ATTRIBUTES 8
+#define PSO_MAX_SPECIALIZATION_ENTRIES 16
+#define PSO_MAX_SPECIALIZATION_SIZE 64
+#define GPU_PROFILER_MAX_SCOPES 32
+/* timestamps per frame, two per recorded scope */
+#define GPU_PROFILER_MAX_QUERIES 64
+/* timestamps per frame written on the compute queue */
+#define GPU_PROFILER_MAX_COMPUTE_QUERIES 8
+#define GPU_PROFILER_MAX_DEPTH 8
+#define GPU_PROFILER_HISTORY 128
+/* stages of the graphics submit that wait on the staging semaphores */
+#define STAGING_WAIT_STAGES (VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | \
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+
+/* range of a VkDeviceMemory block shared with other resources, see gpu_memory_alloc */
+typedef struct GpuAllocation {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    /* persistently mapped pointer to offset, NULL unless host visible */
+    void* mapped;
+    /* -1 for a dedicated vkAllocateMemory */
+    int32_t block;
+} GpuAllocation;
+
 typedef struct Buffer {
     VkBuffer buffer;
-    VkDeviceMemory memory;
+    GpuAllocation allocation;
     uint32_t size;
 } Buffer;
 
+/* range of every per-frame slice of the uniform arena */
+typedef struct UniformBlock {
+    uint32_t offset;
+    uint32_t size;
+} UniformBlock;
+
+/* rolling history of a named GPU scope, in milliseconds */
+typedef struct GpuProfileScope {
+    const char* name;
+    float history[GPU_PROFILER_HISTORY];
+    /* next history entry written */
+    uint32_t head;
+    uint32_t count;
+} GpuProfileScope;
+
+#ifdef GPU_PROFILER
+#define GPU_SCOPE_BEGIN(_cmdbuffer, _name) gpu_profiler_begin((_cmdbuffer), (_name))
+#define GPU_SCOPE_END(_cmdbuffer) gpu_profiler_end((_cmdbuffer))
+#else
+#define GPU_SCOPE_BEGIN(_cmdbuffer, _name)
+#define GPU_SCOPE_END(_cmdbuffer)
+#endif
+
 typedef struct ImageBuffer {
 	VkImage image;
-	VkDeviceMemory memory;
+	GpuAllocation allocation;
 	VkImageView image_view;
     VkFormat format;
 } ImageBuffer;
@@ -105,8 +178,12 @@ typedef struct DescriptorSetUpdateInfo {
 typedef struct Swapchain {
     VkSwapchainKHR swapchain;
     VkSurfaceFormatKHR format;
-    VkImage images[4];
-    VkImageView image_views[4];
+    /* layout the frame has to be left in for present_image */
+    VkImageLayout present_layout;
+    /* may differ from the size asked for, the surface has the last word */
+    VkExtent2D extent;
+    VkImage images[MAX_SWAPCHAIN_IMAGES];
+    VkImageView image_views[MAX_SWAPCHAIN_IMAGES];
 } Swapchain;
 
 typedef enum QueueType {
@@ -135,7 +212,7 @@ typedef struct CommandSubmitInfo {
     VkCommandBuffer* command_buffers;
     uint32_t wait_semaphores_count;
     VkSemaphore* wait_semaphores;
-    VkPipelineStageFlags wait_dst_stage_mask;
+    VkPipelineStageFlags* wait_dst_stage_masks;
     uint32_t signal_semaphores_count;
     VkSemaphore* signal_semaphores;
     VkFence fence;
@@ -219,29 +296,141 @@ typedef struct PresentInfo {
 } PresentInfo;
 
 
+/* pipelines compiled in earlier runs on the same device and driver are loaded from here */
+#define PIPELINE_CACHE_PATH "pipeline_cache.bin"
+
 bool vk_renderer_init(DeviceWindow win);
 bool vk_resize(uint32_t width, uint32_t height);
+/* waits for the device and writes the pipeline cache back to PIPELINE_CACHE_PATH */
 void vk_renderer_cleanup();
 char* vk_error_code(uint32_t cod);
+/* number of per-frame resource sets, fixed between init and cleanup */
+uint32_t frames_in_flight();
+/* DeviceWindow.headless of vk_renderer_init, frames go to offscreen images instead of a surface */
+bool is_headless();
 
 
+/*
+ * replaces the current swapchain, which is retired and has to be destroyed with
+ * destroy_swapchain once no frame in flight uses its images anymore
+ */
 Swapchain create_swapchain(uint32_t width, uint32_t height);
+void destroy_swapchain(Swapchain* swapchain);
 
 VkResult create_command_pool(QueueType type, VkCommandPoolCreateFlags flags, VkCommandPool* pool);
+void destroy_command_pool(VkCommandPool pool);
+VkResult reset_command_pool(VkCommandPool pool);
+/* for pools owned by the caller, e.g. one per recording thread */
+VkResult allocate_command_buffers(VkCommandPool pool, VkCommandBufferLevel level, uint32_t count,
+        VkCommandBuffer* cmdbuffer);
 
 VkResult create_command_buffer(QueueType type, VkCommandBufferLevel level, uint32_t count, VkCommandBuffer* cmdbuffer);
 
 void destroy_command_buffer(QueueType type, VkCommandBuffer* cmdbuffer);
 
+/*
+ * sub allocates from GPU_MEMORY_BLOCK_SIZE blocks per memory type, linear is true for
+ * buffers and keeps them in separate blocks from optimal tiled images so that
+ * bufferImageGranularity never applies. Large requests get a dedicated allocation.
+ */
+VkResult gpu_memory_alloc(VkMemoryRequirements requirements, VkMemoryPropertyFlags properties,
+        bool linear, GpuAllocation* allocation);
+void gpu_memory_free(GpuAllocation* allocation);
+/* last memory type of requirements with any of properties, UINT32_MAX when there is none */
+uint32_t get_memory_type(VkMemoryRequirements requirements, VkMemoryPropertyFlags properties);
+
 VkResult create_buffer(Buffer* buffer, VkBufferUsageFlags usage, 
                        VkMemoryPropertyFlags memory_properties_flags, VkDeviceSize size);
 
+/*
+ * Uploads go through a persistently mapped ring and run on the transfer queue.
+ * staging_alloc hands out host memory and its place in buffer, the copy is recorded into
+ * staging_command_buffer (fetch it after the alloc, an alloc may submit) and the
+ * destination is handed to the graphics queue family with staging_release_*.
+ * staging_flush submits once per frame: it records the acquire barriers into cmdbuffer and
+ * returns the semaphores its submit has to wait on at STAGING_WAIT_STAGES.
+ * A frame with more than STAGING_MAX_ACQUIRES releases, or more than frames_in_flight()
+ * submits between two flushes, falls back to staging_wait_idle.
+ */
+void* staging_alloc(VkDeviceSize size, VkBuffer* buffer, VkDeviceSize* offset);
+VkCommandBuffer staging_command_buffer();
+/* image must be in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, it ends up in layout */
+void staging_release_image(VkImage image, VkImageSubresourceRange range, VkImageLayout layout);
+void staging_release_buffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+/* wait_semaphores holds RENDERING_RESOURCES_MAX entries */
+uint32_t staging_flush(VkCommandBuffer cmdbuffer, VkSemaphore* wait_semaphores);
+/* blocks until every upload is done and owned by the graphics queue, for load time code */
+void staging_wait_idle();
+
+/*
+ * Uniform data lives in one persistently mapped buffer split in frames_in_flight()
+ * slices. Blocks are reserved once and bound as VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+ * with uniform_arena_dynamic_offset, so writes for this frame never touch the slice the
+ * GPU may still read for the previous one. uniform_arena_begin_frame is called once the
+ * fence of frame was waited on.
+ */
+UniformBlock uniform_arena_reserve(uint32_t size);
+VkDescriptorBufferInfo uniform_block_descriptor(UniformBlock block);
+void uniform_block_write(UniformBlock block, const void* data);
+void uniform_arena_begin_frame(uint32_t frame);
+uint32_t uniform_arena_dynamic_offset();
+
+/*
+ * Timestamp queries around GPU_SCOPE_BEGIN/GPU_SCOPE_END pairs of the graphics command
+ * buffer. gpu_profiler_begin_frame reads back the frame that last used the same resource
+ * index and must be recorded outside of a render pass, before any scope of the frame.
+ */
+void gpu_profiler_begin_frame(VkCommandBuffer cmdbuffer, uint32_t frame);
+void gpu_profiler_begin(VkCommandBuffer cmdbuffer, const char* name);
+void gpu_profiler_end(VkCommandBuffer cmdbuffer);
+/*
+ * For scopes recorded on other threads, e.g. in secondary command buffers: the query pair
+ * is reserved on the thread recording the frame and written from anywhere until it is
+ * submitted. Returns UINT32_MAX when the profiler is off or full, the writes then do nothing.
+ */
+uint32_t gpu_profiler_reserve(const char* name);
+void gpu_profiler_begin_reserved(VkCommandBuffer cmdbuffer, uint32_t pair);
+void gpu_profiler_end_reserved(VkCommandBuffer cmdbuffer, uint32_t pair);
+/*
+ * Scopes of the frame's compute queue work use their own query pool, the graphics command
+ * buffer never touches it. gpu_profiler_begin_compute resets the frame's compute queries
+ * and is recorded first in the compute command buffer; both are read back together with
+ * the graphics scopes since the graphics submit waits on the compute work.
+ */
+void gpu_profiler_begin_compute(VkCommandBuffer cmdbuffer);
+uint32_t gpu_profiler_compute_begin(VkCommandBuffer cmdbuffer, const char* name);
+void gpu_profiler_compute_end(VkCommandBuffer cmdbuffer, uint32_t pair);
+uint32_t gpu_profiler_scopes(const GpuProfileScope** scopes);
+float gpu_profile_scope_average(const GpuProfileScope* scope);
+
+/*
+ * Headless mode: frame number frame as width * height B8G8R8A8 texels with rows tightly
+ * packed, waiting for its readback when it is still in flight. NULL when it was not
+ * presented yet or its readback was reused, which happens frames_in_flight() presents
+ * later. It stays valid until then. headless_wait_idle finishes every readback.
+ */
+const uint8_t* headless_frame(uint64_t frame);
+void headless_wait_idle();
+
 VkResult copy_buffer(Buffer* dst_buffer, void* data, VkDeviceSize size);
 
+/* recorded into the staging ring, the data is in dst_buffer after the next staging_flush */
 VkResult copy_buffer_staged(Buffer* dst_buffer, void* data, VkDeviceSize size);
 
 VkResult create_image(uint32_t width, uint32_t height, VkImageUsageFlags usage, 
         VkImageAspectFlags aspect, uint32_t mip_levels, ImageBuffer* image);
+/* depth > 1 creates a 3D image and view */
+VkResult create_image_3d(uint32_t width, uint32_t height, uint32_t depth, VkImageUsageFlags usage,
+        VkImageAspectFlags aspect, uint32_t mip_levels, ImageBuffer* image_buffer);
+/*
+ * Image without memory or view. bind_image_memory does not take ownership of allocation,
+ * several images may alias it, and clear_image then leaves it to its owner.
+ */
+VkResult create_unbound_image(uint32_t width, uint32_t height, uint32_t depth, VkImageUsageFlags usage,
+        uint32_t mip_levels, ImageBuffer* image_buffer);
+void get_image_memory_requirements(VkImage image, VkMemoryRequirements* requirements);
+VkResult bind_image_memory(ImageBuffer* image_buffer, const GpuAllocation* allocation,
+        VkImageViewType view_type, VkImageAspectFlags aspect);
 
 void clear_image(ImageBuffer* image);
 
@@ -249,6 +438,14 @@ VkResult create_depth_image(uint32_t width, uint32_t height, ImageBuffer* depth_
 VkResult create_texture(Texture* texture, VkSamplerAddressMode sampler_address_mode, const sx_alloc* alloc, const char* filepath);
 VkResult create_texture_from_data(Texture* texture, VkSamplerAddressMode sampler_address_mode, const sx_alloc* alloc, 
         const void* data, uint32_t width, uint32_t height);
+/* copies an RGBA8 texture back to host memory, the image is left in layout */
+VkResult read_texture_data(Texture* texture, VkImageLayout layout, void* data, uint32_t width, uint32_t height);
+/*
+ * image written by compute shaders and sampled afterwards, cleared to (0, 0, 0, 1) and
+ * left in VK_IMAGE_LAYOUT_GENERAL. depth > 1 creates a volume.
+ */
+VkResult create_storage_texture(Texture* texture, VkFormat format, VkSamplerAddressMode sampler_address_mode,
+        uint32_t width, uint32_t height, uint32_t depth);
 
 VkPipelineShaderStageCreateInfo load_shader(VkDevice logical_device, const char* filnename, VkShaderStageFlagBits stage);
 
@@ -260,12 +457,31 @@ VkPipelineShaderStageCreateInfo load_shader(VkDevice logical_device, const char*
 
 VkPipelineShaderStageCreateInfo create_shader_module(const char* filename, VkShaderStageFlagBits stage);
 
+/*
+ * specialization must stay alive until the pipeline using the stage is created,
+ * the driver constant folds the values into the module
+ */
+VkPipelineShaderStageCreateInfo create_specialized_shader_module(const char* filename, VkShaderStageFlagBits stage,
+        const VkSpecializationInfo* specialization);
+
 VkResult create_descriptor_pool(DescriptorPoolInfo* info, VkDescriptorPool* pool);
 
 VkResult create_descriptor_layout(DescriptorLayoutInfo* info, VkDescriptorSetLayout* layout);
 
 VkResult create_descriptor_sets(VkDescriptorPool pool, VkDescriptorSetLayout* layouts, uint32_t num_layouts, VkDescriptorSet* sets);
 
+/*
+ * Layouts are cached by their bindings, equal binding arrays share one layout that
+ * lives until vk_renderer_cleanup. Sets come from growable pools owned by the renderer:
+ * allocate_descriptor_sets ones live until cleanup, allocate_frame_descriptor_sets ones
+ * until the frame slot is reused, descriptor_cache_begin_frame is called once the fence
+ * of frame was waited on.
+ */
+VkResult get_descriptor_layout(DescriptorLayoutInfo* info, VkDescriptorSetLayout* layout);
+VkResult allocate_descriptor_sets(VkDescriptorSetLayout* layouts, uint32_t num_layouts, VkDescriptorSet* sets);
+VkResult allocate_frame_descriptor_sets(VkDescriptorSetLayout* layouts, uint32_t num_layouts, VkDescriptorSet* sets);
+void descriptor_cache_begin_frame(uint32_t frame);
+
 void update_descriptor_set(DescriptorSetUpdateInfo* info);
 
 VkResult create_pipeline_layout(PipelineLayoutInfo* info, VkPipelineLayout* pipeline_layout);
@@ -273,9 +489,36 @@ VkResult create_pipeline_layout(PipelineLayoutInfo* info, VkPipelineLayout* pipe
 VkResult create_compute_pipeline(ComputePipelineInfo* info, VkPipeline* compute_pipeline);
 
 VkResult create_graphic_pipeline(GraphicPipelineInfo* info, VkPipeline* pipeline);
+/* one pipeline per render pass/subpass pair from the same state, render_pass and subpass of info are ignored */
+VkResult create_graphic_pipelines(GraphicPipelineInfo* info, uint32_t count, const VkRenderPass* render_passes,
+        const uint32_t* subpasses, VkPipeline* pipelines);
+
+typedef uint32_t PipelineHandle;
+
+/*
+ * Graphics pipelines cached by the xxh64 hash of their description: the code and
+ * specialization of the shaders, the render pass and subpass, the layout and the fixed
+ * function state. A request equal to an earlier one gets its handle back, the missing
+ * pipelines are compiled on a job thread and get_pipeline returns VK_NULL_HANDLE until
+ * pso_cache_update saw them finish, draws using it are skipped meanwhile. Without a job
+ * context they are compiled before request_graphic_pipelines returns.
+ * The cache owns the shader modules of info from the call on, and the pipelines until
+ * vk_renderer_cleanup. Requests and updates come from the thread recording the frame,
+ * get_pipeline from any thread recording it.
+ */
+/* waits for the compiles running on the previous context, NULL compiles in place */
+void pso_cache_set_jobs(sx_job_context* jobs);
+VkResult request_graphic_pipelines(GraphicPipelineInfo* info, uint32_t count, const VkRenderPass* render_passes,
+        const uint32_t* subpasses, PipelineHandle* handles);
+VkPipeline get_pipeline(PipelineHandle handle);
+/* once per frame before recording */
+void pso_cache_update();
 
 VkResult create_renderpass(RenderPassInfo* info, VkRenderPass* render_pass);
 
+/* subgroupAdd and friends are usable from every stage in stages */
+bool device_supports_subgroup_arithmetic(VkShaderStageFlags stages);
+
 VkResult create_fence(VkFence* fence, bool begin_signaled);
 
 VkResult create_semaphore(VkSemaphore* sem);
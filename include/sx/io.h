@@ -46,6 +46,8 @@
 //              
 //              sx_file_load_bin            allocates memory and loads the file data into it
 //              sx_file_load_text           Same as binary, but appends a null terminator to the end of the buffer
+//              sx_file_map                 maps the file read-only into memory, the returned block is a view
+//                                          of the mapping and must be released with sx_file_unmap
 //              
 //              sx_file_write_var           Helper macro: writes a variable to file (no need for sizeof)
 //              sx_file_write_text          Helper macro: writes a string to file (no need for strlen)
@@ -187,6 +189,8 @@ SX_API int64_t sx_file_size(const sx_file* file);
 
 SX_API sx_mem_block* sx_file_load_text(const sx_alloc* alloc, const char* filepath);
 SX_API sx_mem_block* sx_file_load_bin(const sx_alloc* alloc, const char* filepath);
+SX_API sx_mem_block* sx_file_map(const sx_alloc* alloc, const char* filepath);
+SX_API void sx_file_unmap(sx_mem_block* mem);
 
 #define sx_file_write_var(w, v) sx_file_write((w), &(v), sizeof(v))
 #define sx_file_write_text(w, s) sx_file_write((w), (s), sx_strlen(s))
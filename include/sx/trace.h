@@ -0,0 +1,46 @@
+//
+// trace.h - v1.0 - Scoped CPU trace recorder with chrome trace export
+//
+//      sx_trace_init           Sets up the recorder, call once before any thread records
+//                              sx_tm_init() must be called before
+//      sx_trace_shutdown       Frees the rings of all threads, no thread should be recording anymore
+//      sx_trace_thread_name    Names the calling thread in the exported trace
+//                              threads created by sx_thread_create are named automatically
+//      sx_trace_begin          Records the start of a scope on the calling thread
+//                              'name' is not copied, pass a string literal
+//      sx_trace_end            Records the end of the last scope begun on the calling thread
+//      sx_trace_dump           Writes the events still held by the rings to a chrome trace JSON file
+//                              (chrome://tracing or https://ui.perfetto.dev), can be called from
+//                              any thread while the others keep recording
+//
+//      Every thread records into its own ring of SX_TRACE_RING_SIZE events, allocated on its
+//      first event. Only the owning thread writes to a ring, so recording takes no lock, old events
+//      are overwritten once the ring is full.
+//
+// Usage:
+//      sx_trace_begin("update");
+//      update();
+//      sx_trace_end();
+//      ...
+//      sx_trace_dump("trace.json");
+//
+#pragma once
+
+#include "sx.h"
+
+typedef struct sx_alloc sx_alloc;
+
+#ifndef SX_TRACE_RING_SIZE
+#    define SX_TRACE_RING_SIZE 16384
+#endif
+
+#ifndef SX_TRACE_MAX_THREADS
+#    define SX_TRACE_MAX_THREADS 32
+#endif
+
+SX_API void sx_trace_init(const sx_alloc* alloc);
+SX_API void sx_trace_shutdown();
+SX_API void sx_trace_thread_name(const char* name);
+SX_API void sx_trace_begin(const char* name);
+SX_API void sx_trace_end();
+SX_API bool sx_trace_dump(const char* filepath);
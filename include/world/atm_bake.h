@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include "sx/allocator.h"
+#include "sx/jobs.h"
+#include "world/atm_model.h"
+
+/*
+ * CPU LUT bakers on top of atm_model. Work is split across sx_job workers,
+ * passing a NULL job context bakes on the calling thread.
+ * LUTs are linear RGBA float tables, alpha is always 1.
+ */
+
+AtmLut atm_lut_create(const sx_alloc* alloc, uint32_t width, uint32_t height);
+void atm_lut_destroy(const sx_alloc* alloc, AtmLut* lut);
+
+/* texel layout of compute_transmittance.comp */
+void atm_bake_transmittance(sx_job_context* ctx, const Atmosphere* atm, AtmLut* lut);
+
+/*
+ * texel layout of compute_multi_scattering.comp, 64 sphere directions per texel
+ * reduced in the same fixed pairwise order as the shader, so the result does not
+ * depend on the number of threads. transmittance is a table from atm_bake_transmittance.
+ */
+void atm_bake_multi_scattering(sx_job_context* ctx, const Atmosphere* atm, const AtmLut* transmittance, AtmLut* lut);
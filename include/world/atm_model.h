@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sx/math.h"
+#include "sx/simd.h"
+
+/*
+ * CPU version of the atmosphere model used by the sky shaders
+ * (compute_transmittance.comp, compute_multi_scattering.comp, render_sky.frag).
+ * Every function works on four rays at once, one per sx_simd_t lane.
+ * Distances are in kilometers, the planet center is the origin.
+ */
+
+#define ATM_TRANSMITTANCE_WIDTH 256
+#define ATM_TRANSMITTANCE_HEIGHT 64
+#define ATM_MULTI_SCAT_WIDTH 32
+#define ATM_MULTI_SCAT_HEIGHT 32
+
+typedef struct Atmosphere {
+    sx_vec4 rayleigh_scattering;
+    sx_vec4 mie_scattering;
+    sx_vec4 mie_absorption;
+    sx_vec4 sun_direction;
+    float bottom_radius;
+    float top_radius;
+} Atmosphere;
+
+typedef struct AtmVec3x4 {
+    sx_simd_t x;
+    sx_simd_t y;
+    sx_simd_t z;
+} AtmVec3x4;
+
+typedef struct AtmMediumSample {
+    AtmVec3x4 scattering;
+    AtmVec3x4 absorption;
+    AtmVec3x4 extinction;
+
+    AtmVec3x4 mie_scattering;
+    AtmVec3x4 mie_absorption;
+    AtmVec3x4 mie_extinction;
+
+    AtmVec3x4 rayleigh_scattering;
+    AtmVec3x4 rayleigh_absorption;
+    AtmVec3x4 rayleigh_extinction;
+} AtmMediumSample;
+
+typedef struct AtmMultiScatteringResult {
+    AtmVec3x4 L;
+    AtmVec3x4 ms_as1;
+} AtmMultiScatteringResult;
+
+typedef struct AtmScatteringResult {
+    AtmVec3x4 L;
+    AtmVec3x4 transmittance;
+} AtmScatteringResult;
+
+/* Linear RGBA float table, sampled bilinearly with clamp to edge like the GPU samplers */
+typedef struct AtmLut {
+    float* data;
+    uint32_t width;
+    uint32_t height;
+} AtmLut;
+
+AtmVec3x4 atm_vec3x4(const sx_vec3 v);
+AtmVec3x4 atm_vec3x4_load(const sx_vec3 v[4]);
+void atm_vec3x4_store(AtmVec3x4 v, sx_vec3 out[4]);
+
+/* distance to the closest hit in front of ro, -1 when the sphere is missed */
+sx_simd_t atm_intersect_ray_sphere(AtmVec3x4 ro, AtmVec3x4 rd, AtmVec3x4 so, sx_simd_t sr);
+sx_simd_t atm_get_ray_tmax(const Atmosphere* atm, AtmVec3x4 pos, AtmVec3x4 dir, float max_max);
+AtmMediumSample atm_sample_medium(const Atmosphere* atm, AtmVec3x4 pos);
+AtmVec3x4 atm_compute_optical_thickness(const Atmosphere* atm, AtmVec3x4 pos, AtmVec3x4 dir, float max_max);
+
+/* transmittance toward the sun, read from lut or integrated when lut is NULL */
+AtmVec3x4 atm_sun_transmittance(const Atmosphere* atm, const AtmLut* lut, sx_simd_t height, sx_simd_t sun_cos_angle);
+
+/* integrateRadiance of compute_multi_scattering.comp, L and msAs1 for one sphere direction */
+AtmMultiScatteringResult atm_integrate_radiance(const Atmosphere* atm, const AtmLut* transmittance,
+                                                AtmVec3x4 pos, AtmVec3x4 dir, AtmVec3x4 sun_dir);
+/* integrateRadiance of render_sky.frag, L and view transmittance for a camera ray */
+AtmScatteringResult atm_integrate_sky_radiance(const Atmosphere* atm, const AtmLut* transmittance,
+                                               const AtmLut* multi_scat, AtmVec3x4 pos, AtmVec3x4 dir);
+
+sx_simd_t atm_uvs_to_unit(sx_simd_t u, float resolution);
+sx_simd_t atm_unit_to_uvs(sx_simd_t u, float resolution);
+void atm_uv_to_transmittance(const Atmosphere* atm, sx_simd_t u, sx_simd_t v, uint32_t width, uint32_t height,
+                             sx_simd_t* height_out, sx_simd_t* view_cos_angle);
+void atm_transmittance_to_uv(const Atmosphere* atm, sx_simd_t height, sx_simd_t view_cos_angle,
+                             sx_simd_t* u, sx_simd_t* v);
+void atm_uv_to_multi_scattering(const Atmosphere* atm, sx_simd_t u, sx_simd_t v, uint32_t width, uint32_t height,
+                                sx_simd_t* height_out, sx_simd_t* sun_cos_angle);
+void atm_multi_scattering_to_uv(const Atmosphere* atm, sx_simd_t height, sx_simd_t sun_cos_angle,
+                                uint32_t width, uint32_t height_res, sx_simd_t* u, sx_simd_t* v);
+
+AtmVec3x4 atm_sample_lut(const AtmLut* lut, sx_simd_t u, sx_simd_t v);
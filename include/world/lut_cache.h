@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sx/allocator.h"
+#include "sx/io.h"
+#include "world/atm_model.h"
+
+#include "vulkan/vulkan_core.h"
+
+/*
+ * On-disk cache of baked sky LUTs. Each entry is one sx_iff file named after
+ * the xxh64 of the atmosphere, the LUT dimensions, the texel format and the
+ * sample count, so presets that were already baked once become a file read on
+ * the next start.
+ */
+
+#define LUT_CACHE_DIR "lut_cache"
+
+/* sample_count is the integration step count the LUT was baked with */
+uint64_t lut_cache_key(const Atmosphere* atm, uint32_t width, uint32_t height, VkFormat format, uint32_t sample_count);
+
+/*
+ * read-only view of the size texel bytes of the entry of key, NULL when missing
+ * or stale. The view points into a file mapping, release it with sx_file_unmap.
+ */
+sx_mem_block* lut_cache_map(const sx_alloc* alloc, const char* dir, uint64_t key, uint32_t size);
+bool lut_cache_store(const sx_alloc* alloc, const char* dir, uint64_t key, const void* data, uint32_t size);
@@ -43,12 +43,12 @@ typedef struct NkGui {
 
     Texture textures[MAX_NKTEXTURES];
 
-    VkDescriptorPool descriptor_pool;
     VkDescriptorSetLayout descriptor_layout;
     VkDescriptorSet descriptor_set;
 
     VkPipelineLayout pipeline_layout;
-    VkPipeline pipeline;
+    /* one per SceneMode of the renderer */
+    PipelineHandle pipelines[SCENE_MODE_COUNT];
 
     VkFence fence;
 
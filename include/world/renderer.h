@@ -1,14 +1,73 @@
 #pragma once
 
 #include "renderer/vk_renderer.h"
+#include "renderer/render_graph.h"
+#include "sx/jobs.h"
+
+#define MAX_FRAME_SEMAPHORES 4
+#define MAX_SUBPASS_CALLBACKS 20
+/* secondary command buffers a recording thread may fill in one frame, subpasses 0 and 2 */
+#define MAX_RECORD_CMDBUFFERS (2 * MAX_SUBPASS_CALLBACKS)
+/* froxels of the aerial perspective volume along each axis, see compute_aerial_perspective.comp */
+#define AERIAL_PERSPECTIVE_SIZE 32
 
 typedef void(*draw_callback)(VkCommandBuffer);
+typedef void(*compute_callback)();
+
+/*
+ * Without subpass 0 callbacks there is nothing to shade, the frame is a single forward
+ * pass over the backbuffer and the depth buffer that runs the subpass 2 callbacks.
+ */
+typedef enum SceneMode {
+    SCENE_MODE_DEFERRED,
+    SCENE_MODE_FORWARD,
+    SCENE_MODE_COUNT
+} SceneMode;
+
+/* secondary command buffers of one recording thread for one frame in flight */
+typedef struct RecordPool {
+    VkCommandPool pool;
+    VkCommandBuffer cmdbuffers[MAX_RECORD_CMDBUFFERS];
+    uint32_t allocated;
+    uint32_t used;
+} RecordPool;
+
+struct Renderer;
+
+/* swapchain replaced on resize, destroyed once the frames recorded before completed */
+typedef struct RetiredSwapchain {
+    Swapchain swapchain;
+    uint64_t frame;
+} RetiredSwapchain;
+
+/* records the callbacks of one subpass, one secondary command buffer each */
+typedef struct SubpassRecordJob {
+    struct Renderer* rd;
+    uint32_t subpass;
+    uint32_t resource_index;
+    VkViewport viewport;
+    VkRect2D scissor;
+    uint32_t scopes[MAX_SUBPASS_CALLBACKS];
+} SubpassRecordJob;
 
 typedef struct Renderer {
     const sx_alloc* alloc;
 
     Swapchain swapchain;
     VkFramebuffer* framebuffer;
+    /*
+     * renderer_resize and out of date swapchains only flag the swapchain, the next
+     * renderer_draw recreates it without waiting for the device
+     */
+    bool swapchain_dirty;
+    uint32_t pending_width;
+    uint32_t pending_height;
+    /* frame_number when the current swapchain was created */
+    uint64_t swapchain_frame;
+    RetiredSwapchain retired_swapchains[RENDERING_RESOURCES_MAX];
+    uint32_t retired_swapchains_count;
+    /* frames submitted so far */
+    uint64_t frame_number;
 
     VkCommandBuffer* present_cmdbuffer;
     VkCommandBuffer* graphic_cmdbuffer;
@@ -19,34 +78,79 @@ typedef struct Renderer {
     VkSemaphore *image_available_semaphore;
     VkSemaphore *rendering_finished_semaphore;
     VkFence *fences;
+    /* per-frame set recorded next, cycles through frames_in_flight() */
+    uint32_t resource_index;
+
+    /* Extra semaphores for the next graphics submit, reset after every frame */
+    VkSemaphore frame_wait_semaphores[MAX_FRAME_SEMAPHORES];
+    VkPipelineStageFlags frame_wait_stages[MAX_FRAME_SEMAPHORES];
+    uint32_t frame_wait_semaphores_count;
+    VkSemaphore frame_signal_semaphores[MAX_FRAME_SEMAPHORES];
+    uint32_t frame_signal_semaphores_count;
 
     VkRenderPass render_pass;
-    draw_callback subpass_callbacks[3][20];
+    /* subpass 2 of render_pass on its own, see SceneMode */
+    VkRenderPass forward_render_pass;
+    SceneMode scene_mode;
+    /*
+     * Subpasses 0 and 2 are recorded as jobs, one secondary command buffer per callback,
+     * and run with vkCmdExecuteCommands in registration order. Subpass 1 is the inline
+     * composition draw.
+     */
+    draw_callback subpass_callbacks[3][MAX_SUBPASS_CALLBACKS];
+    const char* subpass_callback_names[3][MAX_SUBPASS_CALLBACKS];
     uint32_t subpass_callbacks_count[3];
-
-    VkDescriptorPool global_descriptor_pool;
-    VkDescriptorPool composition_descriptor_pool;
+    VkCommandBuffer subpass_cmdbuffers[3][MAX_SUBPASS_CALLBACKS];
+    /* Run before the render graph is compiled, may submit compute work and toggle its passes */
+    compute_callback compute_callbacks[MAX_SUBPASS_CALLBACKS];
+    uint32_t compute_callbacks_count;
+
+    sx_job_context* jobs;
+    uint32_t num_record_threads;
+    /* num_record_threads pools per frame in flight */
+    RecordPool* record_pools;
+    /* subpasses 0 and 2 of the frame being recorded, waited on by the scene pass */
+    SubpassRecordJob record_jobs[2];
+    sx_job_t record_handles[2];
+
+    /*
+     * The render passes are the "scene" and "forward" passes of the graph, added on the
+     * first frame after the compute passes of the subsystems, one of them is enabled.
+     * The G-buffer is transient to the graph and lazily allocated.
+     */
+    RenderGraph* graph;
+    RgPass scene_passes[SCENE_MODE_COUNT];
+    /* images sampled by subpass callbacks, see renderer_scene_read */
+    RgImage scene_reads[RG_MAX_PASS_ACCESSES];
+    uint32_t scene_reads_count;
+    RgImage backbuffer;
+    RgImageState backbuffer_state;
+    RgImage aerial_perspective_image;
+    RgImageState aerial_perspective_state;
 
     VkDescriptorSetLayout global_descriptor_layout;
     VkDescriptorSetLayout composition_descriptorset_layout;
 
     VkDescriptorSet global_descriptorset;
+    /* allocated from the frame pools, it follows the G-buffer when the graph recreates it */
     VkDescriptorSet composition_descriptorset;
 
     VkPipelineLayout composition_pipeline_layout;
-    VkPipeline composition_pipeline;
+    PipelineHandle composition_pipeline;
 
-    ImageBuffer depth_image;
+    RgImage depth_image;
     /* G-Buffer */
-    ImageBuffer position_image;
-    ImageBuffer normal_image;
-    ImageBuffer albedo_image;
-    ImageBuffer metallic_roughness_image;
+    RgImage position_image;
+    RgImage normal_image;
+    RgImage albedo_image;
+    RgImage metallic_roughness_image;
 
     Texture lut_brdf;
     Texture irradiance_cube;
     Texture prefiltered_cube;
-    Buffer global_uniform_buffer;
+    /* in-scattered radiance and transmittance in front of the camera, filled by the sky */
+    Texture aerial_perspective;
+    UniformBlock global_uniforms;
 
     uint32_t width;
     uint32_t height;
@@ -67,12 +171,36 @@ typedef struct GlobaUBO {
 
 
 Renderer* create_renderer(const sx_alloc* alloc, uint32_t width, uint32_t height);
+void renderer_destroy(Renderer* rd);
 
 bool renderer_draw(Renderer* rd);
 
 void renderer_render(Renderer* rd);
 
+/* the swapchain and the attachments follow at the start of the next frame */
 void renderer_resize(Renderer* rd, uint32_t width, uint32_t height);
 
-void renderer_register_callback(Renderer* rd, draw_callback callback, uint32_t subpass_index);
+/*
+ * callback records on a job thread into a secondary command buffer with the viewport, the
+ * scissor and the global descriptor set already bound, name is its GPU profiler scope.
+ */
+void renderer_register_callback(Renderer* rd, draw_callback callback, uint32_t subpass_index,
+        const char* name);
+
+void renderer_register_compute_callback(Renderer* rd, compute_callback callback);
+
+/*
+ * Pipelines of a subpass 2 callback, one per SceneMode, the callback binds
+ * get_pipeline(pipelines[rd->scene_mode]) and skips its draws while that is
+ * VK_NULL_HANDLE. render_pass and subpass of info are ignored.
+ */
+VkResult renderer_create_scene_pipelines(Renderer* rd, GraphicPipelineInfo* info,
+        PipelineHandle pipelines[SCENE_MODE_COUNT]);
+
+/* declares a graph image the subpass callbacks sample, before the first frame */
+void renderer_scene_read(Renderer* rd, RgImage image);
+
+void renderer_wait_semaphore(Renderer* rd, VkSemaphore semaphore, VkPipelineStageFlags stage);
+
+void renderer_signal_semaphore(Renderer* rd, VkSemaphore semaphore);
 
@@ -5,38 +5,60 @@
 #include "sx/allocator.h"
 #include "sx/math.h"
 #include "world/renderer.h"
+#include "world/atm_model.h"
 
 #include "vulkan/vulkan_core.h"
 
-typedef struct Atmosphere {
-    sx_vec4 rayleigh_scattering;
-    sx_vec4 mie_scattering;
-    sx_vec4 mie_absorption;
-    sx_vec4 sun_direction;
-    float bottom_radius;
-    float top_radius;
-} Atmosphere;
+typedef enum SkyQualityTier {
+    SKY_QUALITY_LOW,
+    SKY_QUALITY_MEDIUM,
+    SKY_QUALITY_HIGH,
+    SKY_QUALITY_COUNT
+} SkyQualityTier;
+
+/*
+ * LUT sizes and sample counts of a quality tier. Passed as specialization
+ * constants to every sky shader, the constant_id of a field is its index.
+ */
+typedef struct SkyQuality {
+    uint32_t transmittance_width;
+    uint32_t transmittance_height;
+    uint32_t multi_scat_size;
+    uint32_t sky_view_width;
+    uint32_t sky_view_height;
+    uint32_t transmittance_samples;
+    uint32_t multi_scat_samples;
+    uint32_t raymarch_samples;
+    uint32_t aerial_perspective_steps;
+} SkyQuality;
+
+#define SKY_QUALITY_CONSTANT_COUNT (sizeof(SkyQuality) / sizeof(uint32_t))
 
 typedef struct Sky {
     const sx_alloc* alloc;
     Atmosphere atmosphere;
-    Buffer atmospher_ubo;
+    /* atmosphere the LUTs were built from, written to every uniform arena slice */
+    Atmosphere gpu_atmosphere;
+    UniformBlock atmosphere_uniforms;
     float rayleigh_scattering_scale;
     float mie_scattering_scale;
     float mie_absorption_scale;
 
+    SkyQuality quality;
+    VkSpecializationMapEntry specialization_entries[SKY_QUALITY_CONSTANT_COUNT];
+    VkSpecializationInfo specialization;
+
 
-    VkDescriptorPool descriptor_pool;
     VkDescriptorSetLayout descriptor_layout;
     VkDescriptorSet descriptor_set;
 
     VkPipelineLayout pipeline_layout;
-    VkPipeline pipeline;
+    /* one per SceneMode of the renderer */
+    PipelineHandle pipelines[SCENE_MODE_COUNT];
 
     Texture transmittance_tex;
 
     VkCommandBuffer transmittance_cmd_buffer;
-    VkDescriptorPool transmittance_descriptor_pool;
     VkDescriptorSetLayout transmittance_descriptor_layout;
     VkDescriptorSet transmittance_descriptor_set;
 
@@ -46,17 +68,52 @@ typedef struct Sky {
     Texture multi_scat_tex;
 
     VkCommandBuffer multi_scat_cmd_buffer;
-    VkDescriptorPool multi_scat_descriptor_pool;
     VkDescriptorSetLayout multi_scat_descriptor_layout;
     VkDescriptorSet multi_scat_descriptor_set;
 
     VkPipelineLayout multi_scat_pipeline_layout;
     VkPipeline multi_scat_pipeline;
 
-    VkFence fence;
+    /* sky radiance around the camera, recomputed every frame before the render pass */
+    Texture sky_view_tex;
+
+    VkDescriptorSetLayout sky_view_descriptor_layout;
+    VkDescriptorSet sky_view_descriptor_set;
+
+    VkPipelineLayout sky_view_pipeline_layout;
+    VkPipeline sky_view_pipeline;
+    /* false falls back to the per pixel raymarch in render_sky.frag */
+    bool use_sky_view_lut;
+
+    /* fills Renderer.aerial_perspective every frame */
+    VkDescriptorSetLayout aerial_perspective_descriptor_layout;
+    VkDescriptorSet aerial_perspective_descriptor_set;
+
+    VkPipelineLayout aerial_perspective_pipeline_layout;
+    VkPipeline aerial_perspective_pipeline;
+
+    /*
+     * LUT regeneration, re-recorded for every rebuild into the buffer of the frame's
+     * resource index. The graphics submit of that frame waits on lut_ready_semaphore,
+     * so the buffer is idle again once the frame's fence was waited on.
+     */
+    VkCommandBuffer lut_cmdbuffers[RENDERING_RESOURCES_MAX];
+    VkSemaphore lut_release_semaphore;
+    VkSemaphore lut_ready_semaphore;
+    uint64_t atmosphere_hash;
+    bool lut_release_pending;
+
+    /* render graph state of the LUTs, carried across frames and LUT rebuilds */
+    RgImageState transmittance_state;
+    RgImageState multi_scat_state;
+    RgImageState sky_view_state;
+    RgImage transmittance_image;
+    RgImage multi_scat_image;
+    RgImage sky_view_image;
+    RgPass sky_view_pass;
 
     Renderer* rd;
 } Sky;
 
-Sky* sky_create(const sx_alloc* alloc, Renderer* rd);
+Sky* sky_create(const sx_alloc* alloc, Renderer* rd, SkyQualityTier tier);
 void sky_update(Sky* sky);
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Renders a short headless run for every frames in flight setting and checks
+# that each one writes one PNG per frame. Run from the repository root so the
+# shaders are found:
+#   scripts/check-headless-dumps.sh path/to/Vulkan-preatmospheric-scattering [frames]
+
+if [ -z "$1" ]; then
+    echo "usage: $0 APP [FRAMES]"
+    exit 2
+fi
+app="$1"
+frames="${2:-8}"
+status=0
+
+for n in 1 2 3 4; do
+    out=$(mktemp -d)
+    if ! "$app" --headless --frames "$frames" --frames-in-flight "$n" \
+            --width 64 --height 64 --output "$out" > /dev/null; then
+        echo "frames in flight $n: run failed"
+        status=1
+    fi
+    count=$(find "$out" -name 'frame_*.png' | wc -l)
+    rm -rf "$out"
+    if [ "$count" -ne "$frames" ]; then
+        echo "frames in flight $n: $count of $frames frames written"
+        status=1
+    else
+        echo "frames in flight $n: ok"
+    fi
+done
+exit $status
@@ -14,6 +14,11 @@ workspace "Gabibits"
 
 include("toolchain.lua")
 
+newoption {
+    trigger = "gpu-profiler",
+    description = "Build the GPU timestamp profiler in every configuration, Debug always has it",
+}
+
 project "sx"
     kind "StaticLib"
     language "C"
@@ -112,14 +117,20 @@ project "Vulkan-preatmospheric-scattering"
         "m",
         --"vulkan",
     }
+
+    filter { "configurations:Debug" }
+    defines { "GPU_PROFILER" }
+    filter { "options:gpu-profiler" }
+    defines { "GPU_PROFILER" }
+
     filter "files:**.comp or **.vert or **.frag or **.glsl"
     -- A message to display while this build step is running (optional)
     buildmessage 'Compiling %{file.relpath}'
 
     -- One or more commands to run (required)
     buildcommands {
-      'glslc "%{file.relpath}" -I'..DIR..'/shaders/preatmospheric -o "%{cfg.buildtarget.directory}/shaders/%{file.name}.spv"',
-      'glslc "%{file.relpath}" -I'..DIR..'/shaders/preatmospheric -o'..DIR..'"/shaders/%{file.name}.spv"',
+      'glslc --target-env=vulkan1.2 "%{file.relpath}" -I'..DIR..'/shaders/preatmospheric -o "%{cfg.buildtarget.directory}/shaders/%{file.name}.spv"',
+      'glslc --target-env=vulkan1.2 "%{file.relpath}" -I'..DIR..'/shaders/preatmospheric -o'..DIR..'"/shaders/%{file.name}.spv"',
     }
 
     buildoutputs {
@@ -29,3 +29,36 @@ for i = 1, #matches do
     }
 end
 
+
+local WORLDTESTDIR = path.join(TESTDIR, "world")
+
+matches = os.matchfiles(WORLDTESTDIR .. "/*.c")
+
+for i = 1, #matches do
+    name = path.getbasename(matches[i])
+
+    project(name)
+    system "Linux"
+    architecture "x86_64"
+
+    kind "ConsoleAPP"
+    language "C"
+
+    includedirs {
+        path.join(DIR, "include"),
+        path.join(DIR, "3rdparty"),
+    }
+
+    links {
+        "sx",
+        "m",
+        "dl",
+        "pthread",
+    }
+
+    files {
+        matches[i],
+        path.join(DIR, "src/world/atm_model.c"),
+        path.join(DIR, "src/world/atm_bake.c"),
+    }
+end
@@ -4,6 +4,7 @@ layout (set = 1, input_attachment_index = 0, binding = 0) uniform subpassInput s
 layout (set = 1, input_attachment_index = 1, binding = 1) uniform subpassInput sampler_normal;
 layout (set = 1, input_attachment_index = 2, binding = 2) uniform subpassInput sampler_albedo;
 layout (set = 1, input_attachment_index = 3, binding = 3) uniform subpassInput sampler_metallicroughness;
+layout (set = 1, binding = 4) uniform sampler3D aerial_perspective;
 
 layout (location = 0) in vec2 v_uv;
 
@@ -22,6 +23,9 @@ layout(set=0, binding=0) uniform u_global_ubo {
     vec4 exposure_gama;
 } global_ubo;
 
+#define AERIAL_PERSPECTIVE_SIZE 32
+#define AERIAL_PERSPECTIVE_KM_PER_SLICE 4.0
+
 
 void main() 
 {
@@ -65,6 +69,15 @@ void main()
 
 		frag_color += diff;// + spec;	
 	}    	
-   
+
+	// Aerial perspective, slice z of the volume is centered at (z + 0.5) km per slice
+	float dist = length(frag_pos - global_ubo.camera_position.xyz) / 1000.0;
+	vec4 ap = texture(aerial_perspective, vec3(v_uv, dist / (AERIAL_PERSPECTIVE_SIZE * AERIAL_PERSPECTIVE_KM_PER_SLICE)));
+	// fade in over the first half slice, where the volume has no sample
+	ap = mix(vec4(0.0, 0.0, 0.0, 1.0), ap, clamp(dist / (0.5 * AERIAL_PERSPECTIVE_KM_PER_SLICE), 0.0, 1.0));
+	vec3 white_point = vec3(1.08241, 0.96756, 0.95003);
+	vec3 in_scattering = vec3(1.0) - exp(-ap.rgb / white_point * global_ubo.exposure_gama.x);
+	frag_color = frag_color * ap.a + in_scattering;
+
 	out_color = vec4(frag_color, 1.0);
 }
@@ -7,6 +7,11 @@ layout (location = 0) out vec4 out_color;
 
 layout(set = 1, binding = 1) uniform sampler2D transmittanceTex;
 layout(set = 1, binding = 2) uniform sampler2D multiScatTex;
+layout(set = 1, binding = 3) uniform sampler2D skyViewTex;
+
+layout(push_constant) uniform u_sky_push {
+    uint useSkyViewLut;
+} push;
 
 layout(set=0, binding=0) uniform u_global_ubo {
     mat4 projection;
@@ -34,8 +39,13 @@ struct ScatteringResult {
 };
 
 #define PI 3.14159265358f
-#define TRANSMITTANCE_WIDTH 256
-#define TRANSMITTANCE_HEIGHT 64
+/* specialized per sky quality tier, constant ids follow SkyQuality in sky.h */
+layout (constant_id = 0) const uint TRANSMITTANCE_WIDTH = 256;
+layout (constant_id = 1) const uint TRANSMITTANCE_HEIGHT = 64;
+layout (constant_id = 2) const uint MULTI_SCAT_SIZE = 32;
+layout (constant_id = 3) const uint SKY_VIEW_WIDTH = 192;
+layout (constant_id = 4) const uint SKY_VIEW_HEIGHT = 108;
+layout (constant_id = 7) const uint RAYMARCH_SAMPLE_COUNT = 40;
 
 float intersectRaySphere(vec3 ro, vec3 rd, vec3 so, float sr)
 {
@@ -211,14 +221,56 @@ bool move2topAtmosphere(inout vec3 pos, in vec3 dir, in float top)
 vec3 getMultiScattering(vec3 pos, float viewCosAngle)
 {
     vec2 uv = clamp(vec2(viewCosAngle * 0.5f + 0.5f, (length(pos) - atmosphere.bottom) / (atmosphere.top - atmosphere.bottom)), 0.0, 1.0);
-    vec2 res = vec2(32.0, 32.0);
+    vec2 res = vec2(MULTI_SCAT_SIZE);
     uv = vec2(unit2uvs(uv.x, res.x), unit2uvs(uv.y, res.y));
 
     vec3 radiance = texture(multiScatTex, uv).rgb;
     return radiance;
 }
 
-ScatteringResult integrateRadiance(vec4 pos, vec3 dir) {
+/* inverse of uv2skyView in compute_sky_view.comp */
+void skyView2uv(bool intersectGround, float viewZenithCosAngle, float lightViewCosAngle, float viewHeight, out vec2 uv)
+{
+    float vHorizon = sqrt(max(0.f, viewHeight * viewHeight - atmosphere.bottom * atmosphere.bottom));
+    float cosBeta = vHorizon / viewHeight;
+    float beta = acos(cosBeta);
+    float zenithHorizonAngle = PI - beta;
+
+    if (!intersectGround) {
+        float coord = acos(viewZenithCosAngle) / zenithHorizonAngle;
+        coord = 1.f - sqrt(max(0.f, 1.f - coord));
+        uv.y = coord * 0.5f;
+    } else {
+        float coord = (acos(viewZenithCosAngle) - zenithHorizonAngle) / beta;
+        coord = sqrt(max(0.f, coord));
+        uv.y = coord * 0.5f + 0.5f;
+    }
+
+    uv.x = sqrt(-lightViewCosAngle * 0.5f + 0.5f);
+
+    uv = vec2(uvs2unit(uv.x, SKY_VIEW_WIDTH), uvs2unit(uv.y, SKY_VIEW_HEIGHT));
+}
+
+vec3 sampleSkyView(vec3 pos, vec3 dir)
+{
+    float viewHeight = length(pos);
+    vec3 upVec = pos / viewHeight;
+    float viewZenithCosAngle = dot(dir, upVec);
+
+    /* azimuth of the sun around the up vector, seen from the view direction */
+    vec3 sunDir = normalize(atmosphere.sunDir.xyz);
+    vec3 sideVec = normalize(cross(upVec, dir));
+    vec3 forwardVec = normalize(cross(sideVec, upVec));
+    vec2 lightOnPlane = normalize(vec2(dot(sunDir, forwardVec), dot(sunDir, sideVec)));
+
+    bool intersectGround = intersectRaySphere(pos, dir, vec3(0.f), atmosphere.bottom) >= 0.f;
+    vec2 uv;
+    skyView2uv(intersectGround, viewZenithCosAngle, lightOnPlane.x, viewHeight, uv);
+
+    return texture(skyViewTex, uv).rgb;
+}
+
+ScatteringResult integrateRadiance(vec3 pos, vec3 dir) {
     ScatteringResult result = { vec3(0.f), vec3(0.f) };
     vec3 orig = vec3(0.f);
     if ((length(pos - orig) < atmosphere.bottom)) {
@@ -226,7 +278,7 @@ ScatteringResult integrateRadiance(vec4 pos, vec3 dir) {
     }
 
     float tMax = getRayTmax(pos, dir, 9000000.f);
-    float sampleCount = mix(1, 40, clamp(tMax * 0.01, 0.f, 1.f));
+    float sampleCount = mix(1.f, float(RAYMARCH_SAMPLE_COUNT), clamp(tMax * 0.01, 0.f, 1.f));
     float countFloor = floor(sampleCount);
     float maxFloor = tMax * countFloor / sampleCount;
     float dt = tMax / sampleCount;
@@ -306,7 +358,11 @@ void main()
     vec3 dir = normalize(camera_ray);
     vec3 L = vec3(0.f);
     ScatteringResult result;
-    if (move2topAtmosphere(pos, dir, atmosphere.top)) {
+    /* the sky-view LUT is only built for cameras inside the atmosphere */
+    if (push.useSkyViewLut != 0 && length(pos) < atmosphere.top) {
+        L += sampleSkyView(pos, dir);
+        L += sunRadiance(pos, dir, L, true);
+    } else if (move2topAtmosphere(pos, dir, atmosphere.top)) {
         result = integrateRadiance(pos, dir);
         L += result.L;
         L += sunRadiance(pos, dir, L, true);
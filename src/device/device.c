@@ -6,6 +6,9 @@
 #include "device/types.h"
 #include "device/input_manager.h"
 #include "sx/timer.h"
+#include "sx/trace.h"
+#include "sx/string.h"
+#include "stb/stb_image_write.h"
 #include <time.h>
 #include <limits.h>
 #include <math.h>
@@ -69,7 +72,6 @@ bool process_events(InputManager* input_manager, World* world, bool vsync) {
 }
 
 int device_run(void* win, void* data) {
-    sx_tm_init();
     uint64_t last_time = 0;
     DeviceWindow* window = (DeviceWindow*)win;
     game_device.viewport.xmin = 0.0;
@@ -104,10 +106,16 @@ int device_run(void* win, void* data) {
         dt = (float)sx_tm_sec(sx_tm_laptime(&last_time));
         fps_camera_update(&game_device.camera, dt, world->cam_translation_speed);
         world_update(world, dt);
+        if (keyboard_button_pressed(game_device.input_manager, KB_F12)) {
+            if (!sx_trace_dump(CPU_TRACE_PATH)) {
+                printf("Could not write cpu trace to %s\n", CPU_TRACE_PATH);
+            }
+        }
         input_manager_update(game_device.input_manager);
         /*printf("fps: %lf\n", 1.0/dt);*/
     }
     world_destroy(world);
+    vk_renderer_cleanup();
     sx_free(alloc, game_device.input_manager->keyboard);
     sx_free(alloc, game_device.input_manager->mouse);
     sx_free(alloc, game_device.input_manager->touch);
@@ -117,6 +125,111 @@ int device_run(void* win, void* data) {
     return 0;
 }
 
+static void write_headless_frame(const HeadlessRun* run, uint8_t* rgba, uint64_t frame) {
+    const uint8_t* bgra = headless_frame(frame);
+    if (!bgra) {
+        printf("Frame %u was not read back\n", (uint32_t)frame);
+        return;
+    }
+    uint32_t texels = run->width * run->height;
+    for (uint32_t i = 0; i < texels; i++) {
+        rgba[i * 4 + 0] = bgra[i * 4 + 2];
+        rgba[i * 4 + 1] = bgra[i * 4 + 1];
+        rgba[i * 4 + 2] = bgra[i * 4 + 0];
+        rgba[i * 4 + 3] = 255;
+    }
+    char path[512];
+    sx_snprintf(path, sizeof(path), "%s/frame_%04u.png", run->output_dir, (uint32_t)frame);
+    if (!stbi_write_png(path, run->width, run->height, 4, rgba, run->width * 4)) {
+        printf("Could not write %s\n", path);
+    }
+}
+
+static float last_gpu_frame_ms() {
+    const GpuProfileScope* scopes;
+    uint32_t num_scopes = gpu_profiler_scopes(&scopes);
+    for (uint32_t i = 0; i < num_scopes; i++) {
+        if (sx_strequal(scopes[i].name, "frame") && scopes[i].count > 0) {
+            return scopes[i].history[(scopes[i].head + GPU_PROFILER_HISTORY - 1) % GPU_PROFILER_HISTORY];
+        }
+    }
+    return 0.0f;
+}
+
+/*
+ * Renders run->frames frames offscreen while the camera turns a full circle
+ * and the sun rises from below the horizon. The GPU time printed for a frame
+ * is the one read back last, frames_in_flight() frames behind.
+ */
+int device_run_headless(const HeadlessRun* run) {
+    const sx_alloc* alloc = sx_alloc_malloc();
+    DeviceWindow window = {0};
+    window.width = run->width;
+    window.height = run->height;
+    window.headless = true;
+    window.frames_in_flight = run->frames_in_flight;
+    game_device.viewport.xmin = 0.0;
+    game_device.viewport.xmax = window.width;
+    game_device.viewport.ymin = 0.0;
+    game_device.viewport.ymax = window.height;
+
+    if (!vk_renderer_init(window)) {
+        printf("Could not initialize the renderer\n");
+        return -1;
+    }
+
+    World* world = create_world(alloc, window.width, window.height);
+    game_device.input_manager = create_input_manager(alloc);
+    fps_init(&game_device.camera, 60, game_device.viewport, 0.01, 10000.0);
+    world_init(world);
+
+    uint8_t* rgba = run->output_dir ? sx_malloc(alloc, (size_t)run->width * run->height * 4) : NULL;
+    /* frames before it are written */
+    uint32_t frames_written = 0;
+    float yaw_step = SX_PI2 / (float)sx_max(run->frames, 1u);
+    double total_ms = 0.0;
+    uint64_t last_time = sx_tm_now();
+
+    printf("frame, cpu_ms, gpu_ms\n");
+    for (uint32_t i = 0; i < run->frames; i++) {
+        float t = run->frames > 1 ? (float)i / (float)(run->frames - 1) : 0.0f;
+        float elevation = sx_lerp(-0.1f, 1.2f, t);
+        world->sky->atmosphere.sun_direction = sx_vec4f(0.0f, sx_sin(elevation), sx_cos(elevation), 0.0f);
+        fps_yaw(&game_device.camera, yaw_step);
+
+        world_update(world, 1.0f / 60.0f);
+        input_manager_update(game_device.input_manager);
+        double cpu_ms = sx_tm_ms(sx_tm_laptime(&last_time));
+        total_ms += cpu_ms;
+        printf("%u, %.3f, %.3f\n", i, cpu_ms, last_gpu_frame_ms());
+
+        /* the readbacks of all but the last frames_in_flight() - 1 frames are done */
+        while (rgba && frames_written + frames_in_flight() <= i + 1) {
+            write_headless_frame(run, rgba, frames_written);
+            frames_written++;
+        }
+    }
+    while (rgba && frames_written < run->frames) {
+        write_headless_frame(run, rgba, frames_written);
+        frames_written++;
+    }
+    headless_wait_idle();
+    if (run->frames > 0) {
+        printf("average: %.3f ms\n", total_ms / run->frames);
+    }
+
+    if (rgba) {
+        sx_free(alloc, rgba);
+    }
+    world_destroy(world);
+    vk_renderer_cleanup();
+    sx_free(alloc, game_device.input_manager->keyboard);
+    sx_free(alloc, game_device.input_manager->mouse);
+    sx_free(alloc, game_device.input_manager->touch);
+    sx_free(alloc, game_device.input_manager);
+    return 0;
+}
+
 Device* device() {
     return &game_device;
 }
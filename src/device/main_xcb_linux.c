@@ -10,6 +10,9 @@
 #include "sx/atomic.h"
 #include "sx/threads.h"
 #include "sx/string.h"
+#include "sx/timer.h"
+#include "sx/trace.h"
+#include "sx/cmdline.h"
 #include "device/types.h"
 #include "device/device.h"
 /*#include "world/renderer.h"*/
@@ -317,6 +320,9 @@ int run() {
 
     const sx_alloc* alloc = sx_alloc_malloc();
     event_queue = sx_queue_spsc_create(alloc, sizeof(OsEvent), 1024);
+    sx_tm_init();
+    sx_trace_init(alloc);
+    sx_trace_thread_name("XcbEventThread");
 
     linux_device.cursor_mode = CM_NORMAL;
     create_window(WIDTH, HEIGHT);
@@ -338,6 +344,7 @@ int run() {
         if (!event) {
             sx_os_sleep(8);
         } else {
+            sx_trace_begin("xcb event");
             switch (event->response_type & ~0x80) {
                 case XCB_ENTER_NOTIFY:
                 {
@@ -499,11 +506,13 @@ int run() {
                     break;
             }
         free(event);
+        sx_trace_end();
         }
 	}
 
     sx_thread_destroy(thrd, alloc);
     sx_queue_spsc_destroy(event_queue, alloc);
+    sx_trace_shutdown();
     return 0;
 }
 
@@ -512,14 +521,85 @@ bool next_event(OsEvent* ev) {
 }
 
 
+static int run_headless(const HeadlessRun* headless_run) {
+    const sx_alloc* alloc = sx_alloc_malloc();
+    sx_tm_init();
+    sx_trace_init(alloc);
+    sx_trace_thread_name("MainThread");
+    int result = device_run_headless(headless_run);
+    sx_trace_shutdown();
+    return result;
+}
+
 int main(int argc, char** argv) {
-    GB_UNUSED(argc);
-    GB_UNUSED(argv);
-    /*init_xcb_connection(&win);*/
-    /*create_window(WIDTH, HEIGHT);*/
-    run();
-    /*device_run(&win, NULL);*/
+    const sx_alloc* alloc = sx_alloc_malloc();
+    int headless = 0;
+    HeadlessRun headless_run = {
+        .width = WIDTH,
+        .height = HEIGHT,
+        .frames = 120,
+        .frames_in_flight = 0,
+        .output_dir = NULL
+    };
+    const sx_cmdline_opt opts[] = {
+        { "help", 'h', SX_CMDLINE_OPTYPE_NO_ARG, 0x0, 'h', "print this help text", 0x0 },
+        { "headless", 'H', SX_CMDLINE_OPTYPE_FLAG_SET, &headless, 1, "render offscreen without a window", 0x0 },
+        { "frames", 'n', SX_CMDLINE_OPTYPE_REQUIRED, 0x0, 'n', "number of headless frames", "N" },
+        { "width", 'x', SX_CMDLINE_OPTYPE_REQUIRED, 0x0, 'x', "headless frame width", "PIXELS" },
+        { "height", 'y', SX_CMDLINE_OPTYPE_REQUIRED, 0x0, 'y', "headless frame height", "PIXELS" },
+        { "frames-in-flight", 'f', SX_CMDLINE_OPTYPE_REQUIRED, 0x0, 'f', "frames recorded ahead of the GPU, 1 to 4", "N" },
+        { "output", 'o', SX_CMDLINE_OPTYPE_REQUIRED, 0x0, 'o', "write headless frames as PNG to DIR", "DIR" },
+        SX_CMDLINE_OPT_END
+    };
+    sx_cmdline_context* cmdline = sx_cmdline_create_context(alloc, argc, (const char**)argv, opts);
+
+    int opt;
+    const char* arg;
+    while ((opt = sx_cmdline_next(cmdline, NULL, &arg)) != -1) {
+        switch (opt) {
+        case 'n':
+            headless_run.frames = (uint32_t)sx_toint(arg);
+            break;
+        case 'x':
+            headless_run.width = (uint32_t)sx_toint(arg);
+            break;
+        case 'y':
+            headless_run.height = (uint32_t)sx_toint(arg);
+            break;
+        case 'f':
+            headless_run.frames_in_flight = (uint32_t)sx_toint(arg);
+            win.frames_in_flight = headless_run.frames_in_flight;
+            break;
+        case 'o':
+            headless_run.output_dir = arg;
+            break;
+        case '?':
+        case '!':
+        case 'h': {
+            char help[2048];
+            if (opt != 'h') {
+                printf("invalid argument: %s\n", arg);
+            }
+            puts(sx_cmdline_create_help_string(cmdline, help, sizeof(help)));
+            sx_cmdline_destroy_context(cmdline, alloc);
+            return opt == 'h' ? 0 : 1;
+        }
+        default:
+            break;
+        }
+    }
 
-    return 0;
+    int result = 0;
+    if (headless) {
+        result = run_headless(&headless_run);
+    } else {
+        /*init_xcb_connection(&win);*/
+        /*create_window(WIDTH, HEIGHT);*/
+        run();
+        /*device_run(&win, NULL);*/
+    }
+    sx_cmdline_destroy_context(cmdline, alloc);
+
+    return result;
 }
 #endif
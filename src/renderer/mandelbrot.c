@@ -11,14 +11,6 @@ void compute_mandelbrot(MandelbrotInfo *info) {
     create_buffer(&info->buffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 
                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, size);
 
-    // Descriptor pool
-    VkDescriptorPoolSize pool_size[1];
-    pool_size[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    pool_size[0].descriptorCount = 1;
-    DescriptorPoolInfo pool_info = { .pool_sizes = pool_size, .pool_size_count = 1, .max_sets = 1};
-    VkResult result = create_descriptor_pool(&pool_info, &info->descriptor_pool);
-    sx_assert_rel(result == VK_SUCCESS && "Could not create descriptor pool");
-
     // Descriptor Set layout
     VkDescriptorSetLayoutBinding bindings[1];
     bindings[0].binding = 0;
@@ -27,11 +19,11 @@ void compute_mandelbrot(MandelbrotInfo *info) {
     bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
     bindings[0].pImmutableSamplers = NULL;
     DescriptorLayoutInfo layout_info = { .bindings = bindings, .num_bindings = 1};
-    result = create_descriptor_layout(&layout_info, &info->descriptor_layout);
+    VkResult result = get_descriptor_layout(&layout_info, &info->descriptor_layout);
     VK_CHECK_RESULT(result);
 
     // Descriptor set
-    result = create_descriptor_sets(info->descriptor_pool, &info->descriptor_layout, 1, &info->descriptor_set);
+    result = allocate_descriptor_sets(&info->descriptor_layout, 1, &info->descriptor_set);
     sx_assert_rel(result == VK_SUCCESS && "Could not create descriptor set");
 
     // Update Descriptors
@@ -103,7 +95,7 @@ void compute_mandelbrot(MandelbrotInfo *info) {
     submit_info.signal_semaphores = NULL;
     submit_info.wait_semaphores_count = 0;
     submit_info.wait_semaphores = NULL;
-    submit_info.wait_dst_stage_mask = 0;
+    submit_info.wait_dst_stage_masks = NULL;
     submit_info.fence = fence;
     submit_info.queue = COMPUTE;
     result = submit_commands(&submit_info);
@@ -0,0 +1,598 @@
+#include "renderer/render_graph.h"
+#include "sx/string.h"
+
+#define RG_WRITE_ACCESS (VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | \
+                         VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT)
+
+typedef struct RgUsageInfo {
+    VkPipelineStageFlags stages;
+    VkAccessFlags access;
+    VkImageLayout layout;
+    VkImageUsageFlags image_usage;
+} RgUsageInfo;
+
+static const RgUsageInfo rg_usages[RG_USAGE_COUNT] = {
+    [RG_USAGE_SAMPLED_COMPUTE] = {
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT
+    },
+    [RG_USAGE_SAMPLED_FRAGMENT] = {
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT
+    },
+    [RG_USAGE_STORAGE_WRITE_COMPUTE] = {
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT
+    },
+    [RG_USAGE_COLOR_ATTACHMENT] = {
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+    },
+    [RG_USAGE_DEPTH_ATTACHMENT] = {
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT
+    },
+    [RG_USAGE_TRANSFER_SRC] = {
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+    },
+    [RG_USAGE_PRESENT] = {
+        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, 0
+    },
+};
+
+/*{{{RenderGraph* rg_create(const sx_alloc* alloc, uint32_t queue_family)*/
+RenderGraph* rg_create(const sx_alloc* alloc, uint32_t queue_family) {
+    RenderGraph* graph = sx_malloc(alloc, sizeof(*graph));
+    sx_assert_rel(graph && "Could not allocate render graph");
+    sx_memset(graph, 0, sizeof(*graph));
+    graph->alloc = alloc;
+    graph->queue_family = queue_family;
+    return graph;
+}
+/*}}}*/
+
+/*{{{static void rg_free_retired(RgRetired* retired)*/
+static void rg_free_retired(RgRetired* retired) {
+    for (uint32_t i = 0; i < retired->buffers_count; i++) {
+        clear_image(&retired->buffers[i]);
+    }
+    for (uint32_t i = 0; i < retired->allocations_count; i++) {
+        gpu_memory_free(&retired->allocations[i]);
+    }
+}
+/*}}}*/
+
+/*{{{static void rg_collect_retired(RenderGraph* graph, bool all)*/
+static void rg_collect_retired(RenderGraph* graph, bool all) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < graph->retired_count; i++) {
+        if (all || graph->frame >= graph->retired[i].frame + frames_in_flight()) {
+            rg_free_retired(&graph->retired[i]);
+        } else {
+            graph->retired[kept++] = graph->retired[i];
+        }
+    }
+    graph->retired_count = kept;
+}
+/*}}}*/
+
+/* hands the transient images and their memory to the frames still using them */
+/*{{{static void rg_retire_memory(RenderGraph* graph)*/
+static void rg_retire_memory(RenderGraph* graph) {
+    sx_assert_rel(graph->retired_count < RENDERING_RESOURCES_MAX && "Too much retired transient memory");
+    RgRetired* retired = &graph->retired[graph->retired_count++];
+    retired->buffers_count = 0;
+    retired->allocations_count = 0;
+    retired->frame = graph->frame;
+    for (uint32_t i = 0; i < graph->images_count; i++) {
+        RgImageNode* node = &graph->images[i];
+        if (!node->imported && node->buffer.image != VK_NULL_HANDLE) {
+            retired->buffers[retired->buffers_count++] = node->buffer;
+            node->buffer.image = VK_NULL_HANDLE;
+            node->buffer.image_view = VK_NULL_HANDLE;
+        }
+    }
+    for (uint32_t i = 0; i < graph->slots_count; i++) {
+        retired->allocations[retired->allocations_count++] = graph->slots[i].allocation;
+    }
+    graph->slots_count = 0;
+}
+/*}}}*/
+
+/*{{{void rg_destroy(RenderGraph* graph)*/
+void rg_destroy(RenderGraph* graph) {
+    rg_retire_memory(graph);
+    rg_collect_retired(graph, true);
+    sx_free(graph->alloc, graph);
+}
+/*}}}*/
+
+/*{{{static RgImage rg_add_image(RenderGraph* graph, const char* name)*/
+static RgImage rg_add_image(RenderGraph* graph, const char* name) {
+    sx_assert_rel(graph->images_count < RG_MAX_IMAGES && "Too many render graph images");
+    RgImage image = graph->images_count++;
+    RgImageNode* node = &graph->images[image];
+    sx_memset(node, 0, sizeof(*node));
+    node->name = name;
+    node->slot = RG_INVALID;
+    node->first_pass = RG_INVALID;
+    node->last_pass = RG_INVALID;
+    return image;
+}
+/*}}}*/
+
+/*{{{RgImage rg_import_image(RenderGraph* graph, const char* name, VkImage image, VkImageAspectFlags aspect,*/
+RgImage rg_import_image(RenderGraph* graph, const char* name, VkImage image, VkImageAspectFlags aspect,
+        RgImageState* state, uint32_t flags) {
+    RgImage handle = rg_add_image(graph, name);
+    RgImageNode* node = &graph->images[handle];
+    node->imported = true;
+    node->image = image;
+    node->aspect = aspect;
+    node->state = state;
+    node->flags = flags;
+    return handle;
+}
+/*}}}*/
+
+/*{{{void rg_set_imported_image(RenderGraph* graph, RgImage image, VkImage vk_image, RgImageState* state)*/
+void rg_set_imported_image(RenderGraph* graph, RgImage image, VkImage vk_image, RgImageState* state) {
+    sx_assert_rel(image < graph->images_count && graph->images[image].imported && "Not an imported image");
+    graph->images[image].image = vk_image;
+    graph->images[image].state = state;
+}
+/*}}}*/
+
+/*{{{RgImage rg_create_image(RenderGraph* graph, const char* name, const RgImageDesc* desc)*/
+RgImage rg_create_image(RenderGraph* graph, const char* name, const RgImageDesc* desc) {
+    RgImage handle = rg_add_image(graph, name);
+    RgImageNode* node = &graph->images[handle];
+    node->desc = *desc;
+    node->flags = desc->flags;
+    node->aspect = desc->aspect;
+    node->state = &node->transient_state;
+    graph->memory_dirty = true;
+    return handle;
+}
+/*}}}*/
+
+/*{{{void rg_set_image_desc(RenderGraph* graph, RgImage image, const RgImageDesc* desc)*/
+void rg_set_image_desc(RenderGraph* graph, RgImage image, const RgImageDesc* desc) {
+    sx_assert_rel(image < graph->images_count && !graph->images[image].imported && "Not a transient image");
+    graph->images[image].desc = *desc;
+    graph->images[image].flags = desc->flags;
+    graph->images[image].aspect = desc->aspect;
+    graph->memory_dirty = true;
+}
+/*}}}*/
+
+/*{{{const RgImageDesc* rg_image_desc(RenderGraph* graph, RgImage image)*/
+const RgImageDesc* rg_image_desc(RenderGraph* graph, RgImage image) {
+    sx_assert_rel(image < graph->images_count && !graph->images[image].imported && "Not a transient image");
+    return &graph->images[image].desc;
+}
+/*}}}*/
+
+/*{{{const ImageBuffer* rg_image_buffer(RenderGraph* graph, RgImage image)*/
+const ImageBuffer* rg_image_buffer(RenderGraph* graph, RgImage image) {
+    sx_assert_rel(image < graph->images_count && !graph->images[image].imported && "Not a transient image");
+    return &graph->images[image].buffer;
+}
+/*}}}*/
+
+/*{{{RgImage rg_find_image(RenderGraph* graph, const char* name)*/
+RgImage rg_find_image(RenderGraph* graph, const char* name) {
+    for (uint32_t i = 0; i < graph->images_count; i++) {
+        if (sx_strequal(graph->images[i].name, name)) {
+            return i;
+        }
+    }
+    return RG_INVALID;
+}
+/*}}}*/
+
+/*{{{void rg_export_image(RenderGraph* graph, RgImage image, RgUsage usage, uint32_t queue_family)*/
+void rg_export_image(RenderGraph* graph, RgImage image, RgUsage usage, uint32_t queue_family) {
+    sx_assert_rel(image < graph->images_count && "Invalid render graph image");
+    RgImageNode* node = &graph->images[image];
+    if (!node->exported || node->export_usage != usage) {
+        graph->dirty = true;
+    }
+    node->exported = true;
+    node->export_usage = usage;
+    node->export_queue_family = queue_family;
+}
+/*}}}*/
+
+/*{{{RgPass rg_add_pass(RenderGraph* graph, const char* name, rg_execute_callback callback, void* user, uint32_t flags)*/
+RgPass rg_add_pass(RenderGraph* graph, const char* name, rg_execute_callback callback, void* user, uint32_t flags) {
+    sx_assert_rel(graph->passes_count < RG_MAX_PASSES && "Too many render graph passes");
+    RgPass pass = graph->passes_count++;
+    RgPassNode* node = &graph->passes[pass];
+    sx_memset(node, 0, sizeof(*node));
+    node->name = name;
+    node->callback = callback;
+    node->user = user;
+    node->flags = flags;
+    node->enabled = true;
+    graph->dirty = true;
+    return pass;
+}
+/*}}}*/
+
+/*{{{static void rg_add_access(RenderGraph* graph, RgPass pass, RgImage image, RgUsage usage, bool write)*/
+static void rg_add_access(RenderGraph* graph, RgPass pass, RgImage image, RgUsage usage, bool write) {
+    sx_assert_rel(pass < graph->passes_count && image < graph->images_count && "Invalid render graph handle");
+    RgPassNode* node = &graph->passes[pass];
+    RgImageNode* image_node = &graph->images[image];
+    const RgUsageInfo* info = &rg_usages[usage];
+    VkImageLayout layout = image_node->flags & RG_IMAGE_GENERAL_LAYOUT ? VK_IMAGE_LAYOUT_GENERAL : info->layout;
+    image_node->usage |= info->image_usage;
+    graph->dirty = true;
+    if (!image_node->imported) {
+        graph->memory_dirty = true;
+    }
+
+    /* a pass reading and writing an image needs a single barrier covering both */
+    for (uint32_t i = 0; i < node->accesses_count; i++) {
+        RgAccess* access = &node->accesses[i];
+        if (access->image == image) {
+            sx_assert_rel(access->layout == layout && "An image is used in two layouts by one pass");
+            access->stages |= info->stages;
+            access->access |= info->access;
+            access->write |= write;
+            return;
+        }
+    }
+    sx_assert_rel(node->accesses_count < RG_MAX_PASS_ACCESSES && "Too many accesses in a render graph pass");
+    RgAccess* access = &node->accesses[node->accesses_count++];
+    access->image = image;
+    access->stages = info->stages;
+    access->access = info->access;
+    access->layout = layout;
+    access->write = write;
+}
+/*}}}*/
+
+/*{{{void rg_read(RenderGraph* graph, RgPass pass, RgImage image, RgUsage usage)*/
+void rg_read(RenderGraph* graph, RgPass pass, RgImage image, RgUsage usage) {
+    rg_add_access(graph, pass, image, usage, false);
+}
+/*}}}*/
+
+/*{{{void rg_write(RenderGraph* graph, RgPass pass, RgImage image, RgUsage usage)*/
+void rg_write(RenderGraph* graph, RgPass pass, RgImage image, RgUsage usage) {
+    rg_add_access(graph, pass, image, usage, true);
+}
+/*}}}*/
+
+/*{{{void rg_set_pass_enabled(RenderGraph* graph, RgPass pass, bool enabled)*/
+void rg_set_pass_enabled(RenderGraph* graph, RgPass pass, bool enabled) {
+    sx_assert_rel(pass < graph->passes_count && "Invalid render graph pass");
+    if (graph->passes[pass].enabled != enabled) {
+        graph->passes[pass].enabled = enabled;
+        graph->dirty = true;
+    }
+}
+/*}}}*/
+
+/*{{{static void rg_allocate_memory(RenderGraph* graph)*/
+static void rg_allocate_memory(RenderGraph* graph) {
+    VkResult result;
+    /* transient images by first use, so a slot is free once its last image was last used */
+    for (uint32_t p = 0; p < graph->passes_count; p++) {
+        for (uint32_t i = 0; i < graph->images_count; i++) {
+            RgImageNode* node = &graph->images[i];
+            if (node->imported || node->first_pass != p) {
+                continue;
+            }
+            VkImageUsageFlags usage = node->usage | node->desc.usage;
+            if (node->flags & RG_IMAGE_LAZILY_ALLOCATED) {
+                usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+            }
+            node->buffer.format = node->desc.format;
+            result = create_unbound_image(node->desc.width, node->desc.height, 1, usage, 1, &node->buffer);
+            sx_assert_rel(result == VK_SUCCESS && "Could not create transient image");
+            VkMemoryRequirements requirements;
+            get_image_memory_requirements(node->buffer.image, &requirements);
+
+            /* desktop devices usually have no lazily allocated memory, plain device memory then */
+            VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+            if ((node->flags & RG_IMAGE_LAZILY_ALLOCATED) &&
+                    get_memory_type(requirements, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != UINT32_MAX) {
+                properties = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+            }
+
+            RgMemorySlot* slot = NULL;
+            for (uint32_t s = 0; s < graph->slots_count; s++) {
+                if (graph->slots[s].last_pass < p && graph->slots[s].properties == properties &&
+                        (graph->slots[s].requirements.memoryTypeBits & requirements.memoryTypeBits)) {
+                    slot = &graph->slots[s];
+                    break;
+                }
+            }
+            if (slot) {
+                slot->requirements.size = sx_max(slot->requirements.size, requirements.size);
+                slot->requirements.alignment = sx_max(slot->requirements.alignment, requirements.alignment);
+                slot->requirements.memoryTypeBits &= requirements.memoryTypeBits;
+            } else {
+                slot = &graph->slots[graph->slots_count++];
+                slot->requirements = requirements;
+                slot->properties = properties;
+            }
+            slot->last_pass = node->last_pass;
+            node->slot = (uint32_t)(slot - graph->slots);
+        }
+    }
+
+    for (uint32_t s = 0; s < graph->slots_count; s++) {
+        RgMemorySlot* slot = &graph->slots[s];
+        result = gpu_memory_alloc(slot->requirements, slot->properties, false, &slot->allocation);
+        sx_assert_rel(result == VK_SUCCESS && "Could not allocate transient memory");
+        slot->stages = 0;
+        slot->write_access = 0;
+    }
+    for (uint32_t i = 0; i < graph->images_count; i++) {
+        RgImageNode* node = &graph->images[i];
+        if (node->imported || node->first_pass == RG_INVALID) {
+            continue;
+        }
+        result = bind_image_memory(&node->buffer, &graph->slots[node->slot].allocation,
+                                   VK_IMAGE_VIEW_TYPE_2D, node->desc.aspect);
+        sx_assert_rel(result == VK_SUCCESS && "Could not bind transient image");
+    }
+}
+/*}}}*/
+
+/*{{{bool rg_compile(RenderGraph* graph)*/
+bool rg_compile(RenderGraph* graph) {
+    rg_collect_retired(graph, false);
+    if (!graph->dirty && !graph->memory_dirty) {
+        return false;
+    }
+
+    /* culling, walked backwards so the consumers of a pass are known before it */
+    bool needed[RG_MAX_IMAGES];
+    for (uint32_t i = 0; i < graph->images_count; i++) {
+        needed[i] = graph->images[i].exported;
+    }
+    for (uint32_t p = graph->passes_count; p-- > 0;) {
+        RgPassNode* pass = &graph->passes[p];
+        pass->live = pass->enabled && (pass->flags & RG_PASS_SIDE_EFFECTS);
+        for (uint32_t i = 0; i < pass->accesses_count && pass->enabled; i++) {
+            if (pass->accesses[i].write && needed[pass->accesses[i].image]) {
+                pass->live = true;
+            }
+        }
+        if (!pass->live) {
+            continue;
+        }
+        for (uint32_t i = 0; i < pass->accesses_count; i++) {
+            if (!pass->accesses[i].write) {
+                needed[pass->accesses[i].image] = true;
+            }
+        }
+    }
+
+    /* lifetimes of the transient images, aliasing changes with them */
+    bool memory_dirty = graph->memory_dirty;
+    for (uint32_t i = 0; i < graph->images_count; i++) {
+        RgImageNode* node = &graph->images[i];
+        if (node->imported) {
+            continue;
+        }
+        uint32_t first_pass = RG_INVALID;
+        uint32_t last_pass = RG_INVALID;
+        for (uint32_t p = 0; p < graph->passes_count; p++) {
+            RgPassNode* pass = &graph->passes[p];
+            for (uint32_t a = 0; a < pass->accesses_count && pass->live; a++) {
+                if (pass->accesses[a].image == i) {
+                    first_pass = first_pass == RG_INVALID ? p : first_pass;
+                    last_pass = p;
+                }
+            }
+        }
+        memory_dirty |= node->first_pass != first_pass || node->last_pass != last_pass;
+        node->first_pass = first_pass;
+        node->last_pass = last_pass;
+    }
+    graph->dirty = false;
+    graph->memory_dirty = false;
+    if (!memory_dirty) {
+        return false;
+    }
+
+    /* frames in flight still render to the old images */
+    rg_retire_memory(graph);
+    rg_allocate_memory(graph);
+    return true;
+}
+/*}}}*/
+
+/*{{{static bool rg_access_barrier(RenderGraph* graph, RgImageNode* node, const RgAccess* access,*/
+static bool rg_access_barrier(RenderGraph* graph, RgImageNode* node, const RgAccess* access,
+        VkImageMemoryBarrier* barrier, VkPipelineStageFlags* src_stages) {
+    RgImageState* state = node->state;
+    bool transition = state->layout != access->layout;
+    bool acquire = state->queue_family != VK_QUEUE_FAMILY_IGNORED && state->queue_family != graph->queue_family;
+    bool needed = transition || acquire;
+    VkPipelineStageFlags stages = state->write_stages;
+    if (access->write) {
+        /* write after write and write after read */
+        needed |= state->write_stages || state->read_stages;
+        stages |= state->read_stages;
+    } else {
+        needed |= state->write_access && (access->stages & ~state->visible_stages);
+    }
+
+    if (needed) {
+        barrier->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier->pNext = NULL;
+        barrier->srcAccessMask = acquire ? 0 : state->write_access;
+        barrier->dstAccessMask = access->access;
+        barrier->oldLayout = state->layout;
+        barrier->newLayout = access->layout;
+        barrier->srcQueueFamilyIndex = acquire ? state->queue_family : VK_QUEUE_FAMILY_IGNORED;
+        barrier->dstQueueFamilyIndex = acquire ? graph->queue_family : VK_QUEUE_FAMILY_IGNORED;
+        barrier->image = node->imported ? node->image : node->buffer.image;
+        barrier->subresourceRange.aspectMask = node->aspect;
+        barrier->subresourceRange.baseMipLevel = 0;
+        barrier->subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        barrier->subresourceRange.baseArrayLayer = 0;
+        barrier->subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+        *src_stages |= acquire ? 0 : stages;
+    }
+
+    state->layout = access->layout;
+    state->queue_family = VK_QUEUE_FAMILY_IGNORED;
+    if (access->write) {
+        state->write_stages = access->stages;
+        state->write_access = access->access & RG_WRITE_ACCESS;
+        state->read_stages = 0;
+        state->visible_stages = 0;
+    } else if (transition) {
+        /* the transition is the last write, done once access->stages may start */
+        state->write_stages = access->stages;
+        state->write_access = 0;
+        state->read_stages = access->stages;
+        state->visible_stages = access->stages;
+    } else {
+        state->read_stages |= access->stages;
+        state->visible_stages |= needed ? access->stages : 0;
+    }
+    return needed;
+}
+/*}}}*/
+
+/*{{{void rg_execute(RenderGraph* graph, VkCommandBuffer cmdbuffer)*/
+void rg_execute(RenderGraph* graph, VkCommandBuffer cmdbuffer) {
+    sx_assert_rel(!graph->dirty && !graph->memory_dirty && "The render graph changed since rg_compile");
+
+    for (uint32_t p = 0; p < graph->passes_count; p++) {
+        RgPassNode* pass = &graph->passes[p];
+        if (!pass->live) {
+            continue;
+        }
+
+        VkImageMemoryBarrier barriers[RG_MAX_PASS_ACCESSES];
+        uint32_t barriers_count = 0;
+        VkPipelineStageFlags src_stages = 0;
+        VkPipelineStageFlags dst_stages = 0;
+        for (uint32_t i = 0; i < pass->accesses_count; i++) {
+            const RgAccess* access = &pass->accesses[i];
+            RgImageNode* node = &graph->images[access->image];
+            sx_assert_rel(node->state && "Render graph image without state");
+            if (!node->imported && node->first_pass == p) {
+                /* contents are discarded, only the previous user of the memory is waited on */
+                RgMemorySlot* slot = &graph->slots[node->slot];
+                node->state->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+                node->state->write_stages = slot->stages;
+                node->state->write_access = slot->write_access;
+                node->state->read_stages = 0;
+                node->state->visible_stages = 0;
+                node->state->queue_family = VK_QUEUE_FAMILY_IGNORED;
+            }
+            if (rg_access_barrier(graph, node, access, &barriers[barriers_count], &src_stages)) {
+                dst_stages |= access->stages;
+                barriers_count++;
+            }
+        }
+        if (barriers_count > 0) {
+            vkCmdPipelineBarrier(cmdbuffer, src_stages ? src_stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                 dst_stages, 0, 0, NULL, 0, NULL, barriers_count, barriers);
+        }
+
+        GPU_SCOPE_BEGIN(cmdbuffer, pass->name);
+        pass->callback(cmdbuffer, pass->user);
+        GPU_SCOPE_END(cmdbuffer);
+
+        for (uint32_t i = 0; i < pass->accesses_count; i++) {
+            RgImageNode* node = &graph->images[pass->accesses[i].image];
+            if (!node->imported && node->last_pass == p) {
+                RgMemorySlot* slot = &graph->slots[node->slot];
+                slot->stages = node->state->write_stages | node->state->read_stages;
+                slot->write_access = node->state->write_access;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < graph->images_count; i++) {
+        RgImageNode* node = &graph->images[i];
+        if (!node->exported || !node->state) {
+            continue;
+        }
+        RgImageState* state = node->state;
+        const RgUsageInfo* info = &rg_usages[node->export_usage];
+        VkImageLayout layout = node->flags & RG_IMAGE_GENERAL_LAYOUT ? VK_IMAGE_LAYOUT_GENERAL : info->layout;
+        bool release = node->export_queue_family != VK_QUEUE_FAMILY_IGNORED &&
+                       node->export_queue_family != graph->queue_family;
+        if (state->layout == layout && !release) {
+            continue;
+        }
+
+        VkImageMemoryBarrier barrier;
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.pNext = NULL;
+        barrier.srcAccessMask = state->write_access;
+        barrier.dstAccessMask = release ? 0 : info->access;
+        barrier.oldLayout = state->layout;
+        barrier.newLayout = layout;
+        barrier.srcQueueFamilyIndex = release ? graph->queue_family : VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = release ? node->export_queue_family : VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = node->imported ? node->image : node->buffer.image;
+        barrier.subresourceRange.aspectMask = node->aspect;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+        VkPipelineStageFlags src_stages = state->write_stages | state->read_stages;
+        VkPipelineStageFlags dst_stages = release ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : info->stages;
+        vkCmdPipelineBarrier(cmdbuffer, src_stages ? src_stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             dst_stages, 0, 0, NULL, 0, NULL, 1, &barrier);
+
+        state->layout = layout;
+        state->write_stages = dst_stages;
+        state->write_access = 0;
+        state->read_stages = 0;
+        state->visible_stages = 0;
+        state->queue_family = release ? node->export_queue_family : VK_QUEUE_FAMILY_IGNORED;
+    }
+    graph->frame++;
+}
+/*}}}*/
+
+/*{{{void rg_release_image(VkCommandBuffer cmdbuffer, VkImage image, VkImageAspectFlags aspect,*/
+void rg_release_image(VkCommandBuffer cmdbuffer, VkImage image, VkImageAspectFlags aspect,
+        VkPipelineStageFlags src_stages, VkAccessFlags src_access, RgImageState* state,
+        uint32_t src_queue_family, uint32_t dst_queue_family) {
+    if (src_queue_family != dst_queue_family) {
+        VkImageMemoryBarrier barrier;
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.pNext = NULL;
+        barrier.srcAccessMask = src_access;
+        barrier.dstAccessMask = 0;
+        barrier.oldLayout = state->layout;
+        barrier.newLayout = state->layout;
+        barrier.srcQueueFamilyIndex = src_queue_family;
+        barrier.dstQueueFamilyIndex = dst_queue_family;
+        barrier.image = image;
+        barrier.subresourceRange.aspectMask = aspect;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+        vkCmdPipelineBarrier(cmdbuffer, src_stages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                             0, 0, NULL, 0, NULL, 1, &barrier);
+    }
+    /* the semaphore the graph's queue waits on makes the writes visible */
+    state->write_stages = 0;
+    state->write_access = 0;
+    state->read_stages = 0;
+    state->visible_stages = 0;
+    state->queue_family = src_queue_family != dst_queue_family ? src_queue_family : VK_QUEUE_FAMILY_IGNORED;
+}
+/*}}}*/
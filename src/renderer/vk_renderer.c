@@ -29,6 +29,226 @@ SX_PRAGMA_DIAGNOSTIC_POP()
 
 int swapchain_image_count = 0;
 
+/*typedef struct GpuMemoryBlock {{{*/
+typedef struct GpuMemoryRange {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+} GpuMemoryRange;
+
+typedef struct GpuMemoryBlock {
+    VkDeviceMemory memory;
+    uint32_t memory_type;
+    bool linear;
+    void* mapped;
+    /*
+     * free ranges sorted by offset, neighbours are merged on free. The bookkeeping
+     * lives on the host, nothing is ever written into the managed range.
+     */
+    GpuMemoryRange* free_ranges;
+    uint32_t num_free_ranges;
+} GpuMemoryBlock;
+/*}}}*/
+
+/*typedef struct StagingRing {{{*/
+typedef struct StagingFrame {
+    /* recorded and submitted on the transfer queue */
+    VkCommandBuffer cmdbuffer;
+    VkFence fence;
+    VkSemaphore semaphore;
+    /* ring head once the frame was submitted, everything before is free when the fence signals */
+    uint64_t end;
+    bool recording;
+    bool in_flight;
+    /* signaled but no graphics submit waits on it yet */
+    bool semaphore_pending;
+} StagingFrame;
+
+typedef struct StagingRing {
+    Buffer buffer;
+    uint8_t* mapped;
+    /* monotonic byte counters, head % STAGING_RING_SIZE is the next free byte */
+    uint64_t head;
+    uint64_t tail;
+    StagingFrame frames[RENDERING_RESOURCES_MAX];
+    uint32_t frame;
+    /* graphics queue halves of the ownership transfers released by submitted uploads */
+    VkImageMemoryBarrier image_acquires[STAGING_MAX_ACQUIRES];
+    uint32_t image_acquires_count;
+    VkBufferMemoryBarrier buffer_acquires[STAGING_MAX_ACQUIRES];
+    uint32_t buffer_acquires_count;
+} StagingRing;
+/*}}}*/
+
+/*typedef struct UniformArena {{{*/
+typedef struct UniformArena {
+    Buffer buffer;
+    uint8_t* mapped;
+    uint32_t slice_size;
+    uint32_t alignment;
+    /* bytes of every slice handed out by uniform_arena_reserve */
+    uint32_t reserved;
+    uint32_t frame;
+} UniformArena;
+/*}}}*/
+
+/*typedef struct DescriptorCache {{{*/
+/* pools of DESCRIPTOR_POOL_MAX_SETS sets, a new one is added when all are full */
+typedef struct DescriptorAllocator {
+    VkDescriptorPool pools[DESCRIPTOR_ALLOCATOR_MAX_POOLS];
+    uint32_t pools_count;
+    /* the pools before it ran out of space */
+    uint32_t current;
+} DescriptorAllocator;
+
+typedef struct DescriptorLayoutEntry {
+    VkDescriptorSetLayoutBinding bindings[DESCRIPTOR_LAYOUT_MAX_BINDINGS];
+    uint32_t num_bindings;
+    VkDescriptorSetLayout layout;
+} DescriptorLayoutEntry;
+
+typedef struct DescriptorCache {
+    /* hash of the bindings to layouts index */
+    sx_hashtbl* layout_table;
+    DescriptorLayoutEntry layouts[DESCRIPTOR_LAYOUT_CACHE_SIZE];
+    uint32_t layouts_count;
+    DescriptorAllocator persistent;
+    /* reset when the fence of their frame was waited on */
+    DescriptorAllocator frames[RENDERING_RESOURCES_MAX];
+    uint32_t frame;
+} DescriptorCache;
+/*}}}*/
+
+/*typedef struct PsoCache {{{*/
+/* code hash of a module made by load_shader, dropped once a pipeline consumes the module */
+typedef struct ShaderModuleHash {
+    VkShaderModule module;
+    uint64_t hash;
+} ShaderModuleHash;
+
+/* zeroed before it is filled and copied as bytes, so the padding hashes and compares as well */
+typedef struct PipelineDesc {
+    uint64_t render_pass;
+    uint64_t layout;
+    /* code, entry point and specialization of each stage */
+    uint64_t shader_hashes[PSO_MAX_SHADER_STAGES];
+    uint32_t shader_stages[PSO_MAX_SHADER_STAGES];
+    uint32_t shader_stages_count;
+    uint32_t subpass;
+    VkVertexInputBindingDescription vertex_bindings[PSO_MAX_VERTEX_BINDINGS];
+    uint32_t vertex_bindings_count;
+    VkVertexInputAttributeDescription vertex_attributes[PSO_MAX_VERTEX_ATTRIBUTES];
+    uint32_t vertex_attributes_count;
+    uint32_t topology;
+    uint32_t restart_enabled;
+    uint32_t polygon_mode;
+    uint32_t cull_mode;
+    uint32_t front_face;
+    uint32_t samples;
+    uint32_t sample_shading;
+    float min_sample_shading;
+    uint32_t depth_test;
+    uint32_t depth_write;
+    uint32_t depth_compare_op;
+    uint32_t blend_attachments_count;
+    uint32_t blend_enables[MAX_NUM_ATTACHMENTS];
+} PipelineDesc;
+
+typedef struct PsoEntry {
+    PipelineDesc desc;
+    VkPipeline pipeline;
+    /* set by pso_cache_update, pipeline is not handed out before */
+    bool ready;
+} PsoEntry;
+
+/* deep copy of a request, the job compiles the pipelines of its missing entries from it */
+typedef struct PsoBuild {
+    sx_job_t job;
+    bool active;
+    GraphicPipelineInfo info;
+    VertexInputStateInfo vertex_input;
+    VkVertexInputBindingDescription vertex_bindings[PSO_MAX_VERTEX_BINDINGS];
+    VkVertexInputAttributeDescription vertex_attributes[PSO_MAX_VERTEX_ATTRIBUTES];
+    InputAssemblyStateInfo input_assembly;
+    RasterizationStateInfo rasterization;
+    MultisampleStateInfo multisample;
+    DepthStencilStateInfo depth_stencil;
+    ColorBlendStateInfo color_blend;
+    bool blend_enables[MAX_NUM_ATTACHMENTS];
+    VkPipelineLayout layout;
+    VkPipelineShaderStageCreateInfo stages[PSO_MAX_SHADER_STAGES];
+    VkSpecializationInfo specializations[PSO_MAX_SHADER_STAGES];
+    VkSpecializationMapEntry map_entries[PSO_MAX_SHADER_STAGES][PSO_MAX_SPECIALIZATION_ENTRIES];
+    uint8_t specialization_data[PSO_MAX_SHADER_STAGES][PSO_MAX_SPECIALIZATION_SIZE];
+    uint32_t count;
+    VkRenderPass render_passes[PSO_MAX_VARIANTS];
+    uint32_t subpasses[PSO_MAX_VARIANTS];
+    uint32_t entries[PSO_MAX_VARIANTS];
+    /* written by the job, moved to the entries by pso_cache_update */
+    VkPipeline pipelines[PSO_MAX_VARIANTS];
+    VkResult result;
+} PsoBuild;
+
+typedef struct PsoCache {
+    /* folded hash of the descriptions to entries index */
+    sx_hashtbl* table;
+    PsoEntry entries[PSO_CACHE_SIZE];
+    uint32_t entries_count;
+    ShaderModuleHash shader_hashes[PSO_MAX_SHADER_MODULES];
+    uint32_t shader_hashes_count;
+    PsoBuild builds[PSO_MAX_BUILDS];
+    sx_job_context* jobs;
+} PsoCache;
+/*}}}*/
+
+/*typedef struct GpuProfiler {{{*/
+typedef struct GpuProfilerFrame {
+    /* scope of every begin/end query pair written in the frame */
+    uint32_t scopes[GPU_PROFILER_MAX_QUERIES / 2];
+    uint32_t count;
+    uint32_t compute_scopes[GPU_PROFILER_MAX_COMPUTE_QUERIES / 2];
+    uint32_t compute_count;
+} GpuProfilerFrame;
+
+typedef struct GpuProfiler {
+    VkQueryPool query_pool;
+    /* VK_NULL_HANDLE when the compute queue has no timestamps */
+    VkQueryPool compute_query_pool;
+    bool enabled;
+    /* nanoseconds per tick */
+    float timestamp_period;
+    uint64_t timestamp_mask;
+    uint64_t compute_timestamp_mask;
+    GpuProfilerFrame frames[RENDERING_RESOURCES_MAX];
+    uint32_t frame;
+    uint32_t stack[GPU_PROFILER_MAX_DEPTH];
+    uint32_t depth;
+    GpuProfileScope scopes[GPU_PROFILER_MAX_SCOPES];
+    uint32_t num_scopes;
+} GpuProfiler;
+/*}}}*/
+
+/*typedef struct HeadlessTarget {{{*/
+typedef struct HeadlessReadback {
+    VkCommandBuffer cmdbuffer;
+    VkFence fence;
+    Buffer buffer;
+    uint8_t* mapped;
+    uint64_t frame;
+    bool pending;
+} HeadlessReadback;
+
+/* stands in for the swapchain when there is no surface */
+typedef struct HeadlessTarget {
+    ImageBuffer images[RENDERING_RESOURCES_MAX];
+    uint32_t width;
+    uint32_t height;
+    uint32_t next_image;
+    HeadlessReadback readbacks[RENDERING_RESOURCES_MAX];
+    /* frame n is read back into readbacks[n % frames_in_flight] */
+    uint64_t frames_presented;
+} HeadlessTarget;
+/*}}}*/
+
 /*typedef struct RendererContext {{{*/
 typedef struct RendererContext {
     VkDebugUtilsMessengerEXT vk_debugmessenger;
@@ -60,9 +280,39 @@ typedef struct RendererContext {
     uint32_t attchments_width;
     uint32_t attchments_height;
 
+    /* shared by every pipeline creation, persisted to PIPELINE_CACHE_PATH */
+    VkPipelineCache pipeline_cache;
+
+    /* sizes every per-frame array, at most RENDERING_RESOURCES_MAX */
+    uint32_t frames_in_flight;
+    StagingRing staging;
+    UniformArena uniforms;
+    DescriptorCache descriptors;
+    PsoCache pso;
+    GpuProfiler profiler;
+    bool headless;
+    HeadlessTarget headless_target;
+
+    GpuMemoryBlock memory_blocks[GPU_MEMORY_MAX_BLOCKS];
+    uint32_t num_memory_blocks;
+    VkDeviceSize buffer_image_granularity;
+
 } RendererContext;
 /*}}}*/
 
+/* prefix of the pipeline cache file, vkGetPipelineCacheData follows */
+typedef struct PipelineCacheFileHeader {
+    uint32_t magic;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint8_t uuid[VK_UUID_SIZE];
+    uint64_t data_size;
+    uint64_t data_hash;
+} PipelineCacheFileHeader;
+
+#define PIPELINE_CACHE_MAGIC sx_makefourcc('P', 'S', 'O', 'C')
+
 static RendererContext vk_context;
 /*{{{char* vk_error_code(uint32_t cod) {*/
 char* vk_error_code(uint32_t cod) {
@@ -152,6 +402,18 @@ char* vk_error_code(uint32_t cod) {
 }
 /*}}}*/
 
+/*{{{uint32_t frames_in_flight()*/
+uint32_t frames_in_flight() {
+    return vk_context.frames_in_flight;
+}
+/*}}}*/
+
+/*{{{bool is_headless()*/
+bool is_headless() {
+    return vk_context.headless;
+}
+/*}}}*/
+
 
 
 /* {{{debug_callback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, */
@@ -166,24 +428,126 @@ debug_callback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
 }
 /* }}}*/
 
-uint32_t get_memory_type(VkMemoryRequirements image_memory_requirements, VkMemoryPropertyFlags properties);
-
 VkCommandPool find_pool(QueueType type);
 
+static void staging_ring_init();
+static void staging_ring_destroy();
+static void uniform_arena_init();
+static void descriptor_cache_init();
+static void descriptor_cache_destroy();
+static void pso_cache_init();
+static void pso_cache_destroy();
+static void pso_cache_wait();
+static void shader_module_add_hash(VkShaderModule module, uint64_t hash);
+static uint64_t shader_module_take_hash(VkShaderModule module);
+static void gpu_profiler_init();
+static void headless_target_init();
+static Swapchain create_headless_swapchain(uint32_t width, uint32_t height);
+
+
+
+
+/*{{{static VkResult load_pipeline_cache(const char* path, VkPipelineCache* pipeline_cache)*/
+static VkResult load_pipeline_cache(const char* path, VkPipelineCache* pipeline_cache) {
+    VkPhysicalDeviceProperties device_props;
+    vkGetPhysicalDeviceProperties(vk_context.device.physical_device, &device_props);
+
+    VkPipelineCacheCreateInfo cache_create_info;
+    cache_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cache_create_info.pNext = NULL;
+    cache_create_info.flags = 0;
+    cache_create_info.initialDataSize = 0;
+    cache_create_info.pInitialData = NULL;
+
+    /* anything written by another device or driver starts from an empty cache */
+    sx_mem_block* mem = sx_os_path_isfile(path) ? sx_file_map(sx_alloc_malloc(), path) : NULL;
+    if (mem && mem->size >= (int64_t)sizeof(PipelineCacheFileHeader)) {
+        const PipelineCacheFileHeader* header = mem->data;
+        const uint8_t* data = (const uint8_t*)mem->data + sizeof(PipelineCacheFileHeader);
+        if (header->magic == PIPELINE_CACHE_MAGIC &&
+            header->vendor_id == device_props.vendorID &&
+            header->device_id == device_props.deviceID &&
+            header->driver_version == device_props.driverVersion &&
+            sx_memcmp(header->uuid, device_props.pipelineCacheUUID, VK_UUID_SIZE) == 0 &&
+            header->data_size == (uint64_t)mem->size - sizeof(PipelineCacheFileHeader) &&
+            header->data_hash == sx_hash_xxh64(data, (size_t)header->data_size, 0)) {
+            cache_create_info.initialDataSize = (size_t)header->data_size;
+            cache_create_info.pInitialData = data;
+        }
+    }
+
+    VkResult result = vkCreatePipelineCache(vk_context.device.logical_device, &cache_create_info, NULL, pipeline_cache);
+    if (mem) {
+        sx_file_unmap(mem);
+    }
+    return result;
+}
+/*}}}*/
+
+/*{{{static bool save_pipeline_cache(const char* path, VkPipelineCache pipeline_cache)*/
+static bool save_pipeline_cache(const char* path, VkPipelineCache pipeline_cache) {
+    const sx_alloc* alloc = sx_alloc_malloc();
+    size_t data_size = 0;
+    VkResult result = vkGetPipelineCacheData(vk_context.device.logical_device, pipeline_cache, &data_size, NULL);
+    if (result != VK_SUCCESS || data_size == 0) {
+        return false;
+    }
 
+    uint8_t* data = sx_malloc(alloc, data_size);
+    sx_assert_rel(data && "Could not allocate pipeline cache data");
+    result = vkGetPipelineCacheData(vk_context.device.logical_device, pipeline_cache, &data_size, data);
+
+    VkPhysicalDeviceProperties device_props;
+    vkGetPhysicalDeviceProperties(vk_context.device.physical_device, &device_props);
+    PipelineCacheFileHeader header;
+    sx_memset(&header, 0, sizeof(header));
+    header.magic = PIPELINE_CACHE_MAGIC;
+    header.vendor_id = device_props.vendorID;
+    header.device_id = device_props.deviceID;
+    header.driver_version = device_props.driverVersion;
+    sx_memcpy(header.uuid, device_props.pipelineCacheUUID, VK_UUID_SIZE);
+    header.data_size = data_size;
+    header.data_hash = sx_hash_xxh64(data, data_size, 0);
+
+    /* written next to the cache and renamed, a crash mid write leaves the old file intact */
+    char tmp_path[256];
+    sx_snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    bool written = false;
+    sx_file file;
+    if (result == VK_SUCCESS && sx_file_open(&file, tmp_path, SX_FILE_WRITE)) {
+        written = sx_file_write(&file, &header, sizeof(header)) == sizeof(header) &&
+                  sx_file_write(&file, data, (int64_t)data_size) == (int64_t)data_size;
+        sx_file_close(&file);
+        if (!written) {
+            sx_os_del(tmp_path, SX_FILE_TYPE_REGULAR);
+        }
+    }
+    sx_free(alloc, data);
 
+    return written && sx_os_rename(tmp_path, path);
+}
+/*}}}*/
 
 /*bool vk_renderer_init(DeviceWindow win) {{{*/
 bool vk_renderer_init(DeviceWindow win) {
     vk_context.width = win.width;
     vk_context.height = win.height;
+    vk_context.headless = win.headless;
+    vk_context.frames_in_flight = win.frames_in_flight ? win.frames_in_flight : RENDERING_RESOURCES_DEFAULT;
+    vk_context.frames_in_flight = sx_clamp(vk_context.frames_in_flight, 1u, (uint32_t)RENDERING_RESOURCES_MAX);
     volkInitialize();
 
     const sx_alloc* alloc = sx_alloc_malloc();
 
     uint32_t num_layers = 0;
-    uint32_t num_extensions = 2;
+    uint32_t num_extensions = 0;
     const char *layers[10];
+    const char *extensions[3];
+
+    if (!win.headless) {
+        extensions[num_extensions++] = VK_KHR_SURFACE_EXTENSION_NAME;
+        extensions[num_extensions++] = KHR_SURFACE_EXTENSION_NAME;
+    }
 
 #ifdef VALIDATION_LAYERS
     /*const char *validation_layers[] = {*/
@@ -191,16 +555,8 @@ bool vk_renderer_init(DeviceWindow win) {
     /*};*/
     layers[num_layers] = "VK_LAYER_KHRONOS_validation";
     num_layers++;
-    num_extensions++;
-#endif
-
-    const char *extensions[] = {
-        VK_KHR_SURFACE_EXTENSION_NAME,
-        KHR_SURFACE_EXTENSION_NAME,
-#ifdef VALIDATION_LAYERS
-        VK_EXT_DEBUG_UTILS_EXTENSION_NAME
+    extensions[num_extensions++] = VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
 #endif
-    };
 
 
     VkResult result;
@@ -303,7 +659,7 @@ bool vk_renderer_init(DeviceWindow win) {
     /* }}} */
 
     /* Initiate swap chain {{{*/
-    {
+    if (!win.headless) {
         VkXcbSurfaceCreateInfoKHR surface_create_info;
         surface_create_info.sType = VK_STRUCTURE_TYPE_XCB_SURFACE_CREATE_INFO_KHR;
         surface_create_info.pNext = NULL;
@@ -353,7 +709,7 @@ bool vk_renderer_init(DeviceWindow win) {
         const char *device_extensions[] = {
             VK_KHR_SWAPCHAIN_EXTENSION_NAME
         };
-        uint32_t num_device_extensions = 1;
+        uint32_t num_device_extensions = win.headless ? 0 : 1;
 
         for (uint32_t i = 0; i < num_device_extensions; i++) {
             bool has_extension = false;
@@ -376,8 +732,13 @@ bool vk_renderer_init(DeviceWindow win) {
                 queue_family_properties);
         for (uint32_t i = 0; i < queue_family_count; i++) {
             VkBool32 queue_present_support = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(vk_context.device.physical_device, i,
-                    vk_context.device.presentation_surface, &queue_present_support);
+            if (win.headless) {
+                /* offscreen frames are read back on the graphics queue */
+                queue_present_support = (queue_family_properties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+            } else {
+                vkGetPhysicalDeviceSurfaceSupportKHR(vk_context.device.physical_device, i,
+                        vk_context.device.presentation_surface, &queue_present_support);
+            }
             if(queue_present_support) {
                 vk_context.present_queue_index = i;
             }
@@ -388,13 +749,13 @@ bool vk_renderer_init(DeviceWindow win) {
             }
 
         }
+        /* a family with only transfer is the copy engine, uploads on it overlap rendering */
+        vk_context.transfer_queue_index = vk_context.graphic_queue_index;
         for (uint32_t i = 0; i < queue_family_count; i++) {
-            if (queue_family_count > 0 &&
-                    queue_family_properties[i].queueFlags & VK_QUEUE_TRANSFER_BIT) {
+            VkQueueFlags flags = queue_family_properties[i].queueFlags;
+            if (queue_family_properties[i].queueCount > 0 && (flags & VK_QUEUE_TRANSFER_BIT) &&
+                    !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
                 vk_context.transfer_queue_index = i;
-            }
-            if (queue_family_count > 0 &&
-                    !(queue_family_properties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
                 break;
             }
         }
@@ -441,6 +802,7 @@ bool vk_renderer_init(DeviceWindow win) {
             queue_create_info[idx].queueFamilyIndex = vk_context.present_queue_index;
             queue_create_info[idx].queueCount = 1;
             queue_create_info[idx].pQueuePriorities = &queue_priority;
+            idx++;
         }
 
         if ((vk_context.graphic_queue_index != vk_context.compute_queue_index) &&
@@ -486,7 +848,7 @@ bool vk_renderer_init(DeviceWindow win) {
         device_create_info.flags = 0;
         device_create_info.queueCreateInfoCount = number_of_queues;
         device_create_info.pQueueCreateInfos = &queue_create_info[0];
-        device_create_info.enabledExtensionCount = 1;
+        device_create_info.enabledExtensionCount = num_device_extensions;
         device_create_info.ppEnabledExtensionNames = device_extensions;
         device_create_info.enabledLayerCount = 0;
         device_create_info.ppEnabledLayerNames = NULL;
@@ -534,9 +896,26 @@ bool vk_renderer_init(DeviceWindow win) {
                 &vk_context.compute_queue_cmdpool);
         sx_assert_rel(result == VK_SUCCESS && "Could not create command pool!");
 
+        cmd_pool_create_info.queueFamilyIndex = vk_context.transfer_queue_index;
+        result = vkCreateCommandPool(vk_context.device.logical_device, &cmd_pool_create_info, NULL,
+                &vk_context.transfer_queue_cmdpool);
+        sx_assert_rel(result == VK_SUCCESS && "Could not create command pool!");
+
     }
     /*}}}*/
 
+    result = load_pipeline_cache(PIPELINE_CACHE_PATH, &vk_context.pipeline_cache);
+    sx_assert_rel(result == VK_SUCCESS && "Could not create pipeline cache!");
+
+    staging_ring_init();
+    uniform_arena_init();
+    descriptor_cache_init();
+    pso_cache_init();
+    gpu_profiler_init();
+    if (vk_context.headless) {
+        headless_target_init();
+    }
+
 
 
     return true;
@@ -544,11 +923,56 @@ bool vk_renderer_init(DeviceWindow win) {
 /*}}}*/
 
 
+/*{{{void vk_renderer_cleanup()*/
+void vk_renderer_cleanup() {
+    vkDeviceWaitIdle(vk_context.device.logical_device);
+    /* compiles still running on job threads write to the pipeline cache */
+    pso_cache_destroy();
+    if (!save_pipeline_cache(PIPELINE_CACHE_PATH, vk_context.pipeline_cache)) {
+        printf("Could not write pipeline cache to %s\n", PIPELINE_CACHE_PATH);
+    }
+    vkDestroyPipelineCache(vk_context.device.logical_device, vk_context.pipeline_cache, NULL);
+    vk_context.pipeline_cache = VK_NULL_HANDLE;
+
+    staging_ring_destroy();
+    clear_buffer(&vk_context.uniforms.buffer);
+    descriptor_cache_destroy();
+    if (vk_context.headless) {
+        HeadlessTarget* target = &vk_context.headless_target;
+        for (uint32_t i = 0; i < vk_context.frames_in_flight; i++) {
+            destroy_fence(target->readbacks[i].fence);
+            destroy_command_buffer(GRAPHICS, &target->readbacks[i].cmdbuffer);
+            clear_buffer(&target->readbacks[i].buffer);
+        }
+        for (uint32_t i = 0; i < vk_context.frames_in_flight; i++) {
+            clear_image(&target->images[i]);
+        }
+    }
+    if (vk_context.profiler.query_pool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(vk_context.device.logical_device, vk_context.profiler.query_pool, NULL);
+        vk_context.profiler.query_pool = VK_NULL_HANDLE;
+    }
+    if (vk_context.profiler.compute_query_pool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(vk_context.device.logical_device, vk_context.profiler.compute_query_pool, NULL);
+        vk_context.profiler.compute_query_pool = VK_NULL_HANDLE;
+    }
+    for (uint32_t i = 0; i < vk_context.num_memory_blocks; i++) {
+        GpuMemoryBlock* block = &vk_context.memory_blocks[i];
+        vkFreeMemory(vk_context.device.logical_device, block->memory, NULL);
+        sx_free(sx_alloc_malloc(), block->free_ranges);
+    }
+    vk_context.num_memory_blocks = 0;
+}
+/*}}}*/
+
 /* create_swapchain( uint32_t width, uint32_t height) {{{*/
 Swapchain create_swapchain( uint32_t width, uint32_t height) {
+    if (vk_context.headless) {
+        return create_headless_swapchain(width, height);
+    }
     Swapchain swapchain;
     swapchain.swapchain = VK_NULL_HANDLE;
-    for (uint32_t i = 0; i < 4; i++) {
+    for (uint32_t i = 0; i < MAX_SWAPCHAIN_IMAGES; i++) {
         swapchain.images[i] = VK_NULL_HANDLE;
         swapchain.image_views[i] = VK_NULL_HANDLE;
     }
@@ -578,7 +1002,8 @@ Swapchain create_swapchain( uint32_t width, uint32_t height) {
     sx_assert_rel(result == VK_SUCCESS);
 
 
-    uint32_t image_count = surface_capabilities.minImageCount + 1;
+    /* one image on screen plus one per frame the CPU may have queued */
+    uint32_t image_count = sx_max(surface_capabilities.minImageCount + 1, vk_context.frames_in_flight + 1);
     if( (surface_capabilities.maxImageCount > 0) && (image_count >
                 surface_capabilities.maxImageCount) ) {
         image_count = surface_capabilities.maxImageCount;
@@ -658,18 +1083,15 @@ Swapchain create_swapchain( uint32_t width, uint32_t height) {
     swap_chain_create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     swap_chain_create_info.presentMode = present_mode;
     swap_chain_create_info.clipped = VK_TRUE;
+    /* the old swapchain is retired, the caller destroys it with destroy_swapchain */
     swap_chain_create_info.oldSwapchain = vk_context.swapchain.swapchain;
-    VkSwapchainKHR old_swapchain = vk_context.swapchain.swapchain;
-
-    /*if(old_swapchain != VK_NULL_HANDLE) {*/
-        /*vkDestroySwapchainKHR(vk_context.device.logical_device, old_swapchain, NULL);*/
-    /*}*/
     result = vkCreateSwapchainKHR(vk_context.device.logical_device, &swap_chain_create_info, NULL,
             &swapchain.swapchain);
     sx_assert_rel(result == VK_SUCCESS);
 
 
     vkGetSwapchainImagesKHR(vk_context.device.logical_device, swapchain.swapchain, &image_count, NULL);
+    image_count = sx_min(image_count, (uint32_t)MAX_SWAPCHAIN_IMAGES);
     vkGetSwapchainImagesKHR(vk_context.device.logical_device, swapchain.swapchain, &image_count,
             swapchain.images);
     swapchain_image_count = image_count;
@@ -703,12 +1125,30 @@ Swapchain create_swapchain( uint32_t width, uint32_t height) {
         sx_assert_rel(result == VK_SUCCESS);
     }
     swapchain.format = surface_format;
+    swapchain.extent = swap_chain_extent;
+    swapchain.present_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
     vk_context.swapchain = swapchain;
-    /*RENDERING_RESOURCES_SIZE = image_count;*/
     return swapchain;
 }
 /*}}}*/
 
+/*{{{void destroy_swapchain(Swapchain* swapchain)*/
+void destroy_swapchain(Swapchain* swapchain) {
+    /* the images of the headless swapchain belong to the offscreen target */
+    if (swapchain->swapchain == VK_NULL_HANDLE) {
+        return;
+    }
+    for (uint32_t i = 0; i < MAX_SWAPCHAIN_IMAGES; i++) {
+        if (swapchain->image_views[i] != VK_NULL_HANDLE) {
+            vkDestroyImageView(vk_context.device.logical_device, swapchain->image_views[i], NULL);
+            swapchain->image_views[i] = VK_NULL_HANDLE;
+        }
+    }
+    vkDestroySwapchainKHR(vk_context.device.logical_device, swapchain->swapchain, NULL);
+    swapchain->swapchain = VK_NULL_HANDLE;
+}
+/*}}}*/
+
 /* get_memory_type(VkMemoryRequirements image_memory_requirements, VkMemoryPropertyFlags properties) {{{*/
 uint32_t get_memory_type(VkMemoryRequirements image_memory_requirements, VkMemoryPropertyFlags properties) {
     VkPhysicalDeviceMemoryProperties memory_properties;
@@ -725,193 +1165,1306 @@ uint32_t get_memory_type(VkMemoryRequirements image_memory_requirements, VkMemor
 }
 /*}}}*/
 
-/* {{{ VkResult create_image(uint32_t width, uint32_t height, VkImageUsageFlags usage,*/
-VkResult create_image(uint32_t width, uint32_t height, VkImageUsageFlags usage, 
-        VkImageAspectFlags aspect, uint32_t mip_levels, ImageBuffer* image_buffer) {
-
-    if (image_buffer->image != VK_NULL_HANDLE) {
-        clear_image(image_buffer);
-    }
-
-    image_buffer->image = VK_NULL_HANDLE;
-    image_buffer->image_view = VK_NULL_HANDLE;
-    image_buffer->memory = VK_NULL_HANDLE;
-
-    VkResult result;
-    VkExtent3D extent;
-    extent.width = width;
-    extent.height = height;
-    extent.depth = 1;
-    VkImageCreateInfo image_create_info;
-    image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    image_create_info.pNext = NULL;
-    image_create_info.flags = 0;
-    image_create_info.imageType = VK_IMAGE_TYPE_2D;
-    image_create_info.format = image_buffer->format;
-    image_create_info.extent = extent;
-    image_create_info.mipLevels = mip_levels;
-    image_create_info.arrayLayers = 1;
-    image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
-    image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
-    image_create_info.usage = usage;
-    image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    image_create_info.queueFamilyIndexCount = 0;
-    image_create_info.pQueueFamilyIndices = NULL;
-    image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    result = vkCreateImage(vk_context.device.logical_device, &image_create_info, NULL,
-            &image_buffer->image);
-    if(result != VK_SUCCESS) {
-        printf("Could not create depht image!\n");
+/*{{{static VkResult allocate_device_memory(VkDeviceSize size, uint32_t memory_type, VkDeviceMemory* memory, void** mapped)*/
+static VkResult allocate_device_memory(VkDeviceSize size, uint32_t memory_type, VkDeviceMemory* memory, void** mapped) {
+    VkMemoryAllocateInfo memory_allocate_info;
+    memory_allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memory_allocate_info.pNext = NULL;
+    memory_allocate_info.allocationSize = size;
+    memory_allocate_info.memoryTypeIndex = memory_type;
+    VkResult result = vkAllocateMemory(vk_context.device.logical_device, &memory_allocate_info, NULL, memory);
+    if (result != VK_SUCCESS) {
+        printf("Could not allocate memory!\n");
         return result;
     }
 
-    VkMemoryRequirements image_memory_requirements;
-    vkGetImageMemoryRequirements(vk_context.device.logical_device, image_buffer->image,
-            &image_memory_requirements);
+    /* host visible memory stays mapped for its whole lifetime */
     VkPhysicalDeviceMemoryProperties memory_properties;
     vkGetPhysicalDeviceMemoryProperties(vk_context.device.physical_device, &memory_properties);
+    *mapped = NULL;
+    if (memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        result = vkMapMemory(vk_context.device.logical_device, *memory, 0, VK_WHOLE_SIZE, 0, mapped);
+    }
+    return result;
+}
+/*}}}*/
 
-    for(uint32_t k = 0; k < memory_properties.memoryTypeCount; k++) {
-        if((image_memory_requirements.memoryTypeBits & (1<<k)) &&
-                (memory_properties.memoryTypes[k].propertyFlags &
-                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
-
-            VkMemoryAllocateInfo memory_allocate_info;
-            memory_allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            memory_allocate_info.pNext = NULL;
-            memory_allocate_info.allocationSize = image_memory_requirements.size;
-            memory_allocate_info.memoryTypeIndex = k;
-
-            result = vkAllocateMemory(vk_context.device.logical_device, &memory_allocate_info, NULL,
-                    &image_buffer->memory);
-            if(result != VK_SUCCESS) {
-                printf("Could not allocate memory!\n");
-                return result;
-            }
+/*{{{static GpuMemoryBlock* create_memory_block(uint32_t memory_type, bool linear)*/
+static GpuMemoryBlock* create_memory_block(uint32_t memory_type, bool linear) {
+    if (vk_context.num_memory_blocks == GPU_MEMORY_MAX_BLOCKS) {
+        return NULL;
+    }
+    GpuMemoryBlock* block = &vk_context.memory_blocks[vk_context.num_memory_blocks];
+    if (allocate_device_memory(GPU_MEMORY_BLOCK_SIZE, memory_type, &block->memory, &block->mapped) != VK_SUCCESS) {
+        return NULL;
+    }
+    block->memory_type = memory_type;
+    block->linear = linear;
+    block->free_ranges = sx_malloc(sx_alloc_malloc(), GPU_MEMORY_MAX_FREE_RANGES * sizeof(*block->free_ranges));
+    sx_assert_rel(block->free_ranges && "Could not allocate gpu memory block bookkeeping");
+    block->free_ranges[0].offset = 0;
+    block->free_ranges[0].size = GPU_MEMORY_BLOCK_SIZE;
+    block->num_free_ranges = 1;
+
+    vk_context.num_memory_blocks++;
+    return block;
+}
+/*}}}*/
+
+/*
+ * Best fit over the free ranges. The alignment padding in front of the allocation
+ * stays free, so an allocation covers exactly [offset, offset + size).
+ */
+/*{{{static bool memory_block_alloc(GpuMemoryBlock* block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset)*/
+static bool memory_block_alloc(GpuMemoryBlock* block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset) {
+    uint32_t best = UINT32_MAX;
+    VkDeviceSize best_offset = 0;
+    for (uint32_t i = 0; i < block->num_free_ranges; i++) {
+        GpuMemoryRange* range = &block->free_ranges[i];
+        VkDeviceSize aligned = (range->offset + alignment - 1) / alignment * alignment;
+        if (aligned + size > range->offset + range->size) {
+            continue;
+        }
+        if (best == UINT32_MAX || range->size < block->free_ranges[best].size) {
+            best = i;
+            best_offset = aligned;
         }
     }
-    result = vkBindImageMemory(vk_context.device.logical_device, image_buffer->image,
-            image_buffer->memory, 0);
-    if(result != VK_SUCCESS) {
-        printf("Could not bind memory image!\n");
-        return result;
+    if (best == UINT32_MAX) {
+        return false;
     }
-    VkImageSubresourceRange image_subresource_range;
-    image_subresource_range.aspectMask = aspect;
-    image_subresource_range.baseMipLevel = 0;
-    image_subresource_range.levelCount = 1;
-    image_subresource_range.baseArrayLayer = 0;
-    image_subresource_range.layerCount = 1;
 
-    VkImageViewCreateInfo image_view_create_info;
-    image_view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    image_view_create_info.pNext = NULL;
-    image_view_create_info.flags = 0;
-    image_view_create_info.image = image_buffer->image;
-    image_view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    image_view_create_info.format = image_buffer->format;
-    image_view_create_info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-    image_view_create_info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-    image_view_create_info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-    image_view_create_info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-    image_view_create_info.subresourceRange = image_subresource_range;
+    GpuMemoryRange range = block->free_ranges[best];
+    GpuMemoryRange pieces[2];
+    uint32_t num_pieces = 0;
+    if (best_offset > range.offset) {
+        pieces[num_pieces].offset = range.offset;
+        pieces[num_pieces].size = best_offset - range.offset;
+        num_pieces++;
+    }
+    if (best_offset + size < range.offset + range.size) {
+        pieces[num_pieces].offset = best_offset + size;
+        pieces[num_pieces].size = range.offset + range.size - (best_offset + size);
+        num_pieces++;
+    }
+    if (block->num_free_ranges - 1 + num_pieces > GPU_MEMORY_MAX_FREE_RANGES) {
+        return false;
+    }
 
-    result = vkCreateImageView(vk_context.device.logical_device, &image_view_create_info, NULL,
-            &image_buffer->image_view);
-    if(result != VK_SUCCESS) {
-        printf("Could not depth image view!\n");
-        return result;
+    /* the pieces take the place of the range, in order */
+    uint32_t tail = block->num_free_ranges - best - 1;
+    sx_memmove(&block->free_ranges[best + num_pieces], &block->free_ranges[best + 1],
+               tail * sizeof(*block->free_ranges));
+    for (uint32_t i = 0; i < num_pieces; i++) {
+        block->free_ranges[best + i] = pieces[i];
     }
-    return result;
+    block->num_free_ranges = block->num_free_ranges - 1 + num_pieces;
+    *offset = best_offset;
+    return true;
 }
 /*}}}*/
 
-/* clear_image(DeviceVk* device, ImageBuffer* image) {{{*/
-void clear_image(ImageBuffer* image) {
-    vkDestroyImageView(vk_context.device.logical_device, image->image_view, NULL);
-    vkFreeMemory(vk_context.device.logical_device, image->memory, NULL);
-    vkDestroyImage(vk_context.device.logical_device, image->image, NULL);
+/*{{{static void memory_block_free(GpuMemoryBlock* block, VkDeviceSize offset, VkDeviceSize size)*/
+static void memory_block_free(GpuMemoryBlock* block, VkDeviceSize offset, VkDeviceSize size) {
+    /* first free range after the allocation */
+    uint32_t next = 0;
+    uint32_t count = block->num_free_ranges;
+    while (count > 0) {
+        uint32_t half = count / 2;
+        if (block->free_ranges[next + half].offset < offset) {
+            next += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+
+    bool merge_prev = next > 0 &&
+        block->free_ranges[next - 1].offset + block->free_ranges[next - 1].size == offset;
+    bool merge_next = next < block->num_free_ranges && offset + size == block->free_ranges[next].offset;
+    if (merge_prev && merge_next) {
+        block->free_ranges[next - 1].size += size + block->free_ranges[next].size;
+        sx_memmove(&block->free_ranges[next], &block->free_ranges[next + 1],
+                   (block->num_free_ranges - next - 1) * sizeof(*block->free_ranges));
+        block->num_free_ranges--;
+    } else if (merge_prev) {
+        block->free_ranges[next - 1].size += size;
+    } else if (merge_next) {
+        block->free_ranges[next].offset = offset;
+        block->free_ranges[next].size += size;
+    } else {
+        sx_assert_rel(block->num_free_ranges < GPU_MEMORY_MAX_FREE_RANGES && "Too many free gpu memory ranges");
+        sx_memmove(&block->free_ranges[next + 1], &block->free_ranges[next],
+                   (block->num_free_ranges - next) * sizeof(*block->free_ranges));
+        block->free_ranges[next].offset = offset;
+        block->free_ranges[next].size = size;
+        block->num_free_ranges++;
+    }
 }
 /*}}}*/
 
-/*{{{void clear_buffer(DeviceVk* device, Buffer* buffer) { */
-void clear_buffer(Buffer* buffer) {
-    vkFreeMemory(vk_context.device.logical_device, buffer->memory, NULL);
-    vkDestroyBuffer(vk_context.device.logical_device, buffer->buffer, NULL);
+/*{{{VkResult gpu_memory_alloc(VkMemoryRequirements requirements, VkMemoryPropertyFlags properties,*/
+VkResult gpu_memory_alloc(VkMemoryRequirements requirements, VkMemoryPropertyFlags properties,
+        bool linear, GpuAllocation* allocation) {
+    uint32_t memory_type = get_memory_type(requirements, properties);
+    sx_assert_rel(memory_type != UINT32_MAX && "No memory type matches the requirements");
+
+    allocation->memory = VK_NULL_HANDLE;
+    allocation->offset = 0;
+    allocation->size = requirements.size;
+    allocation->mapped = NULL;
+    allocation->block = -1;
+
+    if (vk_context.buffer_image_granularity == 0) {
+        VkPhysicalDeviceProperties device_props;
+        vkGetPhysicalDeviceProperties(vk_context.device.physical_device, &device_props);
+        vk_context.buffer_image_granularity = device_props.limits.bufferImageGranularity;
+    }
+    /* buffers and images can share blocks when the device doesn't care about the neighbour */
+    if (vk_context.buffer_image_granularity <= 1) {
+        linear = false;
+    }
+
+    if (requirements.size <= GPU_MEMORY_BLOCK_SIZE / 2 && requirements.alignment <= GPU_MEMORY_MAX_ALIGNMENT) {
+        for (uint32_t i = 0; i <= vk_context.num_memory_blocks; i++) {
+            GpuMemoryBlock* block = NULL;
+            if (i < vk_context.num_memory_blocks) {
+                block = &vk_context.memory_blocks[i];
+                if (block->memory_type != memory_type || block->linear != linear) {
+                    continue;
+                }
+            } else {
+                block = create_memory_block(memory_type, linear);
+                if (block == NULL) {
+                    break;
+                }
+            }
+            VkDeviceSize offset;
+            if (memory_block_alloc(block, requirements.size, sx_max(requirements.alignment, (VkDeviceSize)1), &offset)) {
+                allocation->memory = block->memory;
+                allocation->offset = offset;
+                allocation->mapped = block->mapped ? (uint8_t*)block->mapped + allocation->offset : NULL;
+                allocation->block = (int32_t)i;
+                return VK_SUCCESS;
+            }
+        }
+    }
+
+    return allocate_device_memory(requirements.size, memory_type, &allocation->memory, &allocation->mapped);
 }
 /*}}}*/
 
-/*{{{void clear_texture(DeviceVk* device, Texture* texture) {*/
-void clear_texture(Texture* texture) {
-    if (texture->image_buffer.image != VK_NULL_HANDLE) {
-        vkDestroySampler(vk_context.device.logical_device, texture->sampler, NULL);
-        clear_image(&texture->image_buffer);
+/*{{{void gpu_memory_free(GpuAllocation* allocation)*/
+void gpu_memory_free(GpuAllocation* allocation) {
+    if (allocation->memory == VK_NULL_HANDLE) {
+        return;
+    }
+    if (allocation->block < 0) {
+        vkFreeMemory(vk_context.device.logical_device, allocation->memory, NULL);
+    } else {
+        GpuMemoryBlock* block = &vk_context.memory_blocks[allocation->block];
+        memory_block_free(block, allocation->offset, allocation->size);
     }
+    allocation->memory = VK_NULL_HANDLE;
+    allocation->mapped = NULL;
 }
 /*}}}*/
 
-/* {{{ VkResult create_texture_from_data(Texture* texture, VkSamplerAddressMode sampler_address_mode, const sx_alloc* alloc, */
-VkResult create_texture_from_data(Texture* texture, VkSamplerAddressMode sampler_address_mode, const sx_alloc* alloc, 
-        const void* data, uint32_t width, uint32_t height) {
-    /*clear_texture(texture);*/
-    VkResult result;
-    Buffer staging;
-    uint32_t size = width * height * 4;
-    result = create_buffer(&staging, VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-                            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, size);
-    sx_assert_rel(result == VK_SUCCESS && "Could not create staging buffer!");
-
-    void *staging_buffer_memory_pointer;
-    result = vkMapMemory(vk_context.device.logical_device, staging.memory, 0,
-            size, 0, &staging_buffer_memory_pointer);
-    sx_assert_rel(result == VK_SUCCESS && "Could not map memory and upload data to staging buffer!");
-    sx_memcpy(staging_buffer_memory_pointer, data, size);
-    vkUnmapMemory(vk_context.device.logical_device, staging.memory);
-    uint32_t offset = 0;
-    VkExtent3D extent;
-    extent.width = width;
-    extent.height = height;
-    extent.depth = 1;
-    VkImageCreateInfo image_create_info;
-    image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    image_create_info.pNext = NULL;
-    image_create_info.flags = 0;
-    image_create_info.imageType = VK_IMAGE_TYPE_2D;
-    image_create_info.format = VK_FORMAT_R8G8B8A8_UNORM;
-    image_create_info.extent = extent;
-    image_create_info.mipLevels = 1;
-    image_create_info.arrayLayers = 1;
-    image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
-    image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
-    image_create_info.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
-    image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    image_create_info.queueFamilyIndexCount = 0;
-    image_create_info.pQueueFamilyIndices = NULL;
-    image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+/*{{{static void staging_ring_init()*/
+static void staging_ring_init() {
+    StagingRing* ring = &vk_context.staging;
+    VkResult result = create_buffer(&ring->buffer, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                    STAGING_RING_SIZE);
+    sx_assert_rel(result == VK_SUCCESS && "Could not create staging ring!");
+    ring->mapped = map_buffer_memory(&ring->buffer, 0);
+    sx_assert_rel(ring->mapped && "Staging ring is not host visible!");
+    ring->head = 0;
+    ring->tail = 0;
+    ring->frame = 0;
+    ring->image_acquires_count = 0;
+    ring->buffer_acquires_count = 0;
+    for (uint32_t i = 0; i < vk_context.frames_in_flight; i++) {
+        StagingFrame* frame = &ring->frames[i];
+        result = create_command_buffer(TRANSFER, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1, &frame->cmdbuffer);
+        sx_assert_rel(result == VK_SUCCESS && "Could not create staging command buffer!");
+        result = create_fence(&frame->fence, false);
+        sx_assert_rel(result == VK_SUCCESS && "Could not create staging fence!");
+        result = create_semaphore(&frame->semaphore);
+        sx_assert_rel(result == VK_SUCCESS && "Could not create staging semaphore!");
+        frame->end = 0;
+        frame->recording = false;
+        frame->in_flight = false;
+        frame->semaphore_pending = false;
+    }
+}
+/*}}}*/
 
-    result = vkCreateImage(vk_context.device.logical_device, &image_create_info, NULL,
-            &texture->image_buffer.image);
-    sx_assert_rel(result == VK_SUCCESS && "Could not create texture image!");
+/*{{{static void staging_ring_destroy()*/
+static void staging_ring_destroy() {
+    StagingRing* ring = &vk_context.staging;
+    for (uint32_t i = 0; i < vk_context.frames_in_flight; i++) {
+        destroy_fence(ring->frames[i].fence);
+        vkDestroySemaphore(vk_context.device.logical_device, ring->frames[i].semaphore, NULL);
+        destroy_command_buffer(TRANSFER, &ring->frames[i].cmdbuffer);
+    }
+    clear_buffer(&ring->buffer);
+}
+/*}}}*/
 
-    VkMemoryRequirements image_memory_requirements;
-    vkGetImageMemoryRequirements(vk_context.device.logical_device, texture->image_buffer.image, &image_memory_requirements);
+/*{{{static void staging_retire(StagingFrame* frame)*/
+static void staging_retire(StagingFrame* frame) {
+    StagingRing* ring = &vk_context.staging;
+    VkResult result = vkWaitForFences(vk_context.device.logical_device, 1, &frame->fence, VK_TRUE, UINT64_MAX);
+    VK_CHECK_RESULT(result);
+    vkResetFences(vk_context.device.logical_device, 1, &frame->fence);
+    /* the counters are monotonic, the tail only ever moves forward */
+    ring->tail = sx_max(ring->tail, frame->end);
+    frame->in_flight = false;
+}
+/*}}}*/
 
-    VkMemoryAllocateInfo memory_allocate_info;
-    memory_allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    memory_allocate_info.pNext = NULL;
-    memory_allocate_info.allocationSize = image_memory_requirements.size;
-    memory_allocate_info.memoryTypeIndex = get_memory_type(image_memory_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    result = vkAllocateMemory(vk_context.device.logical_device, &memory_allocate_info, NULL,
-            &texture->image_buffer.memory);
+/*
+ * Frames are submitted in slot order, so the oldest one in flight is the slot
+ * recorded next, followed by the ones after it.
+ */
+/*{{{static bool staging_retire_oldest()*/
+static bool staging_retire_oldest() {
+    StagingRing* ring = &vk_context.staging;
+    for (uint32_t i = 0; i < vk_context.frames_in_flight; i++) {
+        StagingFrame* frame = &ring->frames[(ring->frame + i) % vk_context.frames_in_flight];
+        if (frame->in_flight) {
+            staging_retire(frame);
+            return true;
+        }
+    }
+    return false;
+}
+/*}}}*/
 
-    sx_assert_rel(result == VK_SUCCESS && "Could not allocate memory for texture!");
+/*{{{static VkResult staging_submit()*/
+static VkResult staging_submit() {
+    StagingRing* ring = &vk_context.staging;
+    StagingFrame* frame = &ring->frames[ring->frame];
+    if (!frame->recording) {
+        return VK_SUCCESS;
+    }
 
-    result = vkBindImageMemory(vk_context.device.logical_device, texture->image_buffer.image, texture->image_buffer.memory, 0);
-    sx_assert_rel(result == VK_SUCCESS && "Could not bind memory image!");
+    VkResult result = vkEndCommandBuffer(frame->cmdbuffer);
+    sx_assert_rel(result == VK_SUCCESS && "Could not record staging command buffer!");
 
-    VkImageSubresourceRange image_subresource_range;
-    image_subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    image_subresource_range.baseMipLevel = 0;
+    VkSubmitInfo submit_info;
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = NULL;
+    submit_info.waitSemaphoreCount = 0;
+    submit_info.pWaitSemaphores = NULL;
+    submit_info.pWaitDstStageMask = NULL;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &frame->cmdbuffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &frame->semaphore;
+    result = vkQueueSubmit(vk_context.vk_transfer_queue, 1, &submit_info, frame->fence);
+    sx_assert_rel(result == VK_SUCCESS && "Could not submit staging command buffer!");
+
+    frame->end = ring->head;
+    frame->recording = false;
+    frame->in_flight = true;
+    frame->semaphore_pending = true;
+    ring->frame = (ring->frame + 1) % vk_context.frames_in_flight;
+    return result;
+}
+/*}}}*/
+
+/*{{{void* staging_alloc(VkDeviceSize size, VkBuffer* buffer, VkDeviceSize* offset)*/
+void* staging_alloc(VkDeviceSize size, VkBuffer* buffer, VkDeviceSize* offset) {
+    StagingRing* ring = &vk_context.staging;
+    /* bufferOffset of image copies must be a multiple of 4 and of the texel size */
+    size = (size + 15) & ~(VkDeviceSize)15;
+    sx_assert_rel(size <= STAGING_RING_SIZE && "Upload does not fit in the staging ring");
+
+    uint64_t start = ring->head;
+    uint64_t position = start % STAGING_RING_SIZE;
+    if (position + size > STAGING_RING_SIZE) {
+        /* uploads never wrap, the end of the ring stays unused this lap */
+        start += STAGING_RING_SIZE - position;
+    }
+    /* only blocks when the uploads of the frames in flight fill the whole ring */
+    while (start + size - ring->tail > STAGING_RING_SIZE) {
+        if (ring->tail == ring->head) {
+            ring->tail = start;
+            break;
+        }
+        if (!staging_retire_oldest()) {
+            sx_assert_rel(ring->frames[ring->frame].recording && "Staging ring exhausted by a single frame");
+            staging_submit();
+        }
+    }
+
+    ring->head = start + size;
+    *buffer = ring->buffer.buffer;
+    *offset = start % STAGING_RING_SIZE;
+    return ring->mapped + *offset;
+}
+/*}}}*/
+
+/*{{{VkCommandBuffer staging_command_buffer()*/
+VkCommandBuffer staging_command_buffer() {
+    StagingRing* ring = &vk_context.staging;
+    StagingFrame* frame = &ring->frames[ring->frame];
+    if (!frame->recording) {
+        /*
+         * A binary semaphore can't be signaled again before its wait. Only more than
+         * frames_in_flight() submits between two frames get here, e.g. load time uploads
+         * or a frame that overflowed the ring, and they fall back to a blocking wait.
+         */
+        if (frame->semaphore_pending) {
+            staging_wait_idle();
+        }
+        if (frame->in_flight) {
+            staging_retire(frame);
+        }
+        VkCommandBufferBeginInfo command_buffer_begin_info;
+        command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        command_buffer_begin_info.pNext = NULL;
+        command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        command_buffer_begin_info.pInheritanceInfo = NULL;
+        VkResult result = vkBeginCommandBuffer(frame->cmdbuffer, &command_buffer_begin_info);
+        VK_CHECK_RESULT(result);
+        frame->recording = true;
+    }
+    return frame->cmdbuffer;
+}
+/*}}}*/
+
+/*{{{void staging_release_image(VkImage image, VkImageSubresourceRange range, VkImageLayout layout)*/
+void staging_release_image(VkImage image, VkImageSubresourceRange range, VkImageLayout layout) {
+    StagingRing* ring = &vk_context.staging;
+    bool ownership_transfer = vk_context.transfer_queue_index != vk_context.graphic_queue_index;
+
+    VkImageMemoryBarrier image_memory_barrier = {};
+    image_memory_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    image_memory_barrier.pNext = NULL;
+    image_memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    image_memory_barrier.dstAccessMask = 0;
+    image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    image_memory_barrier.newLayout = layout;
+    image_memory_barrier.srcQueueFamilyIndex = ownership_transfer ? vk_context.transfer_queue_index : VK_QUEUE_FAMILY_IGNORED;
+    image_memory_barrier.dstQueueFamilyIndex = ownership_transfer ? vk_context.graphic_queue_index : VK_QUEUE_FAMILY_IGNORED;
+    image_memory_barrier.image = image;
+    image_memory_barrier.subresourceRange = range;
+    /* the staging semaphore makes the writes visible to the graphics queue */
+    vkCmdPipelineBarrier(staging_command_buffer(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &image_memory_barrier);
+
+    if (ownership_transfer) {
+        /* blocking fallback for more than STAGING_MAX_ACQUIRES uploads in one frame */
+        if (ring->image_acquires_count == STAGING_MAX_ACQUIRES) {
+            staging_wait_idle();
+        }
+        image_memory_barrier.srcAccessMask = 0;
+        image_memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        ring->image_acquires[ring->image_acquires_count++] = image_memory_barrier;
+    }
+}
+/*}}}*/
+
+/*{{{void staging_release_buffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size)*/
+void staging_release_buffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size) {
+    StagingRing* ring = &vk_context.staging;
+    bool ownership_transfer = vk_context.transfer_queue_index != vk_context.graphic_queue_index;
+    if (!ownership_transfer) {
+        return;
+    }
+
+    VkBufferMemoryBarrier buffer_memory_barrier = {};
+    buffer_memory_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    buffer_memory_barrier.pNext = NULL;
+    buffer_memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    buffer_memory_barrier.dstAccessMask = 0;
+    buffer_memory_barrier.srcQueueFamilyIndex = vk_context.transfer_queue_index;
+    buffer_memory_barrier.dstQueueFamilyIndex = vk_context.graphic_queue_index;
+    buffer_memory_barrier.buffer = buffer;
+    buffer_memory_barrier.offset = offset;
+    buffer_memory_barrier.size = size;
+    vkCmdPipelineBarrier(staging_command_buffer(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 1, &buffer_memory_barrier, 0, NULL);
+
+    /* blocking fallback for more than STAGING_MAX_ACQUIRES uploads in one frame */
+    if (ring->buffer_acquires_count == STAGING_MAX_ACQUIRES) {
+        staging_wait_idle();
+    }
+    buffer_memory_barrier.srcAccessMask = 0;
+    buffer_memory_barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+                                          VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    ring->buffer_acquires[ring->buffer_acquires_count++] = buffer_memory_barrier;
+}
+/*}}}*/
+
+/*{{{uint32_t staging_flush(VkCommandBuffer cmdbuffer, VkSemaphore* wait_semaphores)*/
+uint32_t staging_flush(VkCommandBuffer cmdbuffer, VkSemaphore* wait_semaphores) {
+    StagingRing* ring = &vk_context.staging;
+    staging_submit();
+
+    uint32_t count = 0;
+    for (uint32_t i = 1; i <= vk_context.frames_in_flight; i++) {
+        StagingFrame* frame = &ring->frames[(ring->frame + i) % vk_context.frames_in_flight];
+        if (frame->semaphore_pending) {
+            wait_semaphores[count++] = frame->semaphore;
+            frame->semaphore_pending = false;
+        }
+    }
+
+    if (ring->image_acquires_count > 0 || ring->buffer_acquires_count > 0) {
+        vkCmdPipelineBarrier(cmdbuffer, STAGING_WAIT_STAGES, STAGING_WAIT_STAGES, 0, 0, NULL,
+                ring->buffer_acquires_count, ring->buffer_acquires,
+                ring->image_acquires_count, ring->image_acquires);
+        ring->image_acquires_count = 0;
+        ring->buffer_acquires_count = 0;
+    }
+    return count;
+}
+/*}}}*/
+
+/*{{{void staging_wait_idle()*/
+void staging_wait_idle() {
+    VkCommandBuffer cmdbuffer;
+    VkResult result = create_command_buffer(GRAPHICS, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1, &cmdbuffer);
+    sx_assert_rel(result == VK_SUCCESS && "Could not create command buffer!");
+
+    VkCommandBufferBeginInfo command_buffer_begin_info;
+    command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    command_buffer_begin_info.pNext = NULL;
+    command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    command_buffer_begin_info.pInheritanceInfo = NULL;
+    vkBeginCommandBuffer(cmdbuffer, &command_buffer_begin_info);
+
+    VkSemaphore wait_semaphores[RENDERING_RESOURCES_MAX];
+    VkPipelineStageFlags wait_dst_stage_masks[RENDERING_RESOURCES_MAX];
+    uint32_t wait_semaphores_count = staging_flush(cmdbuffer, wait_semaphores);
+    for (uint32_t i = 0; i < wait_semaphores_count; i++) {
+        wait_dst_stage_masks[i] = STAGING_WAIT_STAGES;
+    }
+    vkEndCommandBuffer(cmdbuffer);
+
+    VkFence fence;
+    result = create_fence(&fence, false);
+    sx_assert_rel(result == VK_SUCCESS && "Could not create fence!");
+
+    VkSubmitInfo submit_info;
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = NULL;
+    submit_info.waitSemaphoreCount = wait_semaphores_count;
+    submit_info.pWaitSemaphores = wait_semaphores;
+    submit_info.pWaitDstStageMask = wait_dst_stage_masks;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &cmdbuffer;
+    submit_info.signalSemaphoreCount = 0;
+    submit_info.pSignalSemaphores = NULL;
+    result = vkQueueSubmit(vk_context.vk_graphic_queue, 1, &submit_info, fence);
+    sx_assert_rel(result == VK_SUCCESS && "Could not submit command buffer!");
+    result = vkWaitForFences(vk_context.device.logical_device, 1, &fence, VK_TRUE, UINT64_MAX);
+    sx_assert_rel(result == VK_SUCCESS && "Could not wait for staging uploads!");
+    destroy_fence(fence);
+    destroy_command_buffer(GRAPHICS, &cmdbuffer);
+
+    while (staging_retire_oldest()) {
+    }
+}
+/*}}}*/
+
+/*{{{static void uniform_arena_init()*/
+static void uniform_arena_init() {
+    UniformArena* arena = &vk_context.uniforms;
+    VkPhysicalDeviceProperties device_props;
+    vkGetPhysicalDeviceProperties(vk_context.device.physical_device, &device_props);
+    arena->alignment = (uint32_t)device_props.limits.minUniformBufferOffsetAlignment;
+    arena->slice_size = UNIFORM_ARENA_SLICE_SIZE;
+    arena->reserved = 0;
+    arena->frame = 0;
+
+    VkResult result = create_buffer(&arena->buffer, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                    (VkDeviceSize)arena->slice_size * vk_context.frames_in_flight);
+    sx_assert_rel(result == VK_SUCCESS && "Could not create uniform arena!");
+    arena->mapped = map_buffer_memory(&arena->buffer, 0);
+    sx_assert_rel(arena->mapped && "Uniform arena is not host visible!");
+}
+/*}}}*/
+
+/*{{{UniformBlock uniform_arena_reserve(uint32_t size)*/
+UniformBlock uniform_arena_reserve(uint32_t size) {
+    UniformArena* arena = &vk_context.uniforms;
+    UniformBlock block;
+    block.offset = (arena->reserved + arena->alignment - 1) & ~(arena->alignment - 1);
+    block.size = size;
+    sx_assert_rel(block.offset + size <= arena->slice_size && "Uniform arena slice is full");
+    arena->reserved = block.offset + size;
+    return block;
+}
+/*}}}*/
+
+/*{{{VkDescriptorBufferInfo uniform_block_descriptor(UniformBlock block)*/
+VkDescriptorBufferInfo uniform_block_descriptor(UniformBlock block) {
+    VkDescriptorBufferInfo buffer_info;
+    buffer_info.buffer = vk_context.uniforms.buffer.buffer;
+    buffer_info.offset = block.offset;
+    buffer_info.range = block.size;
+    return buffer_info;
+}
+/*}}}*/
+
+/*{{{void uniform_block_write(UniformBlock block, const void* data)*/
+void uniform_block_write(UniformBlock block, const void* data) {
+    UniformArena* arena = &vk_context.uniforms;
+    sx_memcpy(arena->mapped + uniform_arena_dynamic_offset() + block.offset, data, block.size);
+}
+/*}}}*/
+
+/*{{{void uniform_arena_begin_frame(uint32_t frame)*/
+void uniform_arena_begin_frame(uint32_t frame) {
+    vk_context.uniforms.frame = frame % vk_context.frames_in_flight;
+}
+/*}}}*/
+
+/*{{{uint32_t uniform_arena_dynamic_offset()*/
+uint32_t uniform_arena_dynamic_offset() {
+    return vk_context.uniforms.frame * vk_context.uniforms.slice_size;
+}
+/*}}}*/
+
+/*{{{static void gpu_profiler_init()*/
+static void gpu_profiler_init() {
+    GpuProfiler* profiler = &vk_context.profiler;
+    sx_memset(profiler, 0, sizeof(*profiler));
+#ifdef GPU_PROFILER
+    uint32_t queue_family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(vk_context.device.physical_device, &queue_family_count, NULL);
+    VkQueueFamilyProperties* queue_family_properties = sx_malloc(sx_alloc_malloc(),
+            queue_family_count * sizeof(*queue_family_properties));
+    vkGetPhysicalDeviceQueueFamilyProperties(vk_context.device.physical_device, &queue_family_count,
+            queue_family_properties);
+    uint32_t valid_bits = queue_family_properties[vk_context.graphic_queue_index].timestampValidBits;
+    uint32_t compute_valid_bits = queue_family_properties[vk_context.compute_queue_index].timestampValidBits;
+    sx_free(sx_alloc_malloc(), queue_family_properties);
+    if (valid_bits == 0) {
+        printf("Graphics queue has no timestamp support, GPU profiler disabled\n");
+        return;
+    }
+
+    VkPhysicalDeviceProperties device_props;
+    vkGetPhysicalDeviceProperties(vk_context.device.physical_device, &device_props);
+    profiler->timestamp_period = device_props.limits.timestampPeriod;
+    profiler->timestamp_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+
+    VkQueryPoolCreateInfo query_pool_info;
+    query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_pool_info.pNext = NULL;
+    query_pool_info.flags = 0;
+    query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    query_pool_info.queryCount = GPU_PROFILER_MAX_QUERIES * vk_context.frames_in_flight;
+    query_pool_info.pipelineStatistics = 0;
+    VkResult result = vkCreateQueryPool(vk_context.device.logical_device, &query_pool_info, NULL,
+                                        &profiler->query_pool);
+    sx_assert_rel(result == VK_SUCCESS && "Could not create timestamp query pool!");
+    profiler->enabled = true;
+
+    if (compute_valid_bits == 0) {
+        printf("Compute queue has no timestamp support, its scopes are not profiled\n");
+        return;
+    }
+    profiler->compute_timestamp_mask = compute_valid_bits >= 64 ? UINT64_MAX : (1ull << compute_valid_bits) - 1;
+    query_pool_info.queryCount = GPU_PROFILER_MAX_COMPUTE_QUERIES * vk_context.frames_in_flight;
+    result = vkCreateQueryPool(vk_context.device.logical_device, &query_pool_info, NULL,
+                               &profiler->compute_query_pool);
+    sx_assert_rel(result == VK_SUCCESS && "Could not create compute timestamp query pool!");
+#endif
+}
+/*}}}*/
+
+/*{{{static uint32_t gpu_profiler_scope_index(const char* name)*/
+static uint32_t gpu_profiler_scope_index(const char* name) {
+    GpuProfiler* profiler = &vk_context.profiler;
+    for (uint32_t i = 0; i < profiler->num_scopes; i++) {
+        if (profiler->scopes[i].name == name || sx_strequal(profiler->scopes[i].name, name)) {
+            return i;
+        }
+    }
+    if (profiler->num_scopes == GPU_PROFILER_MAX_SCOPES) {
+        return UINT32_MAX;
+    }
+    GpuProfileScope* scope = &profiler->scopes[profiler->num_scopes];
+    scope->name = name;
+    scope->head = 0;
+    scope->count = 0;
+    return profiler->num_scopes++;
+}
+/*}}}*/
+
+/* {{{ static bool gpu_profiler_read_queries(VkQueryPool pool, uint32_t first_query, uint32_t count, */
+/* adds the elapsed milliseconds of count query pairs to their scopes, false when not available */
+static bool gpu_profiler_read_queries(VkQueryPool pool, uint32_t first_query, uint32_t count,
+                                      const uint32_t* scopes, uint64_t mask, float* elapsed, bool* touched) {
+    GpuProfiler* profiler = &vk_context.profiler;
+    uint64_t timestamps[GPU_PROFILER_MAX_QUERIES];
+    VkResult result = vkGetQueryPoolResults(vk_context.device.logical_device, pool, first_query, count * 2,
+                                            sizeof(timestamps), timestamps, sizeof(uint64_t),
+                                            VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t ticks = (timestamps[i * 2 + 1] - timestamps[i * 2]) & mask;
+        elapsed[scopes[i]] += (float)ticks * profiler->timestamp_period * 1e-6f;
+        touched[scopes[i]] = true;
+    }
+    return true;
+}
+/*}}}*/
+
+/*
+ * Called once the fence of frame was waited on: the timestamps it wrote
+ * frames_in_flight() frames ago are read back without stalling and
+ * its queries are reset for this frame.
+ */
+/*{{{void gpu_profiler_begin_frame(VkCommandBuffer cmdbuffer, uint32_t frame)*/
+void gpu_profiler_begin_frame(VkCommandBuffer cmdbuffer, uint32_t frame) {
+    GpuProfiler* profiler = &vk_context.profiler;
+    if (!profiler->enabled) {
+        return;
+    }
+    profiler->frame = frame % vk_context.frames_in_flight;
+    profiler->depth = 0;
+    GpuProfilerFrame* profile_frame = &profiler->frames[profiler->frame];
+    uint32_t first_query = profiler->frame * GPU_PROFILER_MAX_QUERIES;
+
+    /* a scope recorded several times in a frame reports its sum */
+    float elapsed[GPU_PROFILER_MAX_SCOPES] = {0};
+    bool touched[GPU_PROFILER_MAX_SCOPES] = {0};
+    bool available = true;
+    if (profile_frame->count > 0) {
+        available = gpu_profiler_read_queries(profiler->query_pool, first_query, profile_frame->count,
+                                              profile_frame->scopes, profiler->timestamp_mask, elapsed, touched);
+    }
+    if (available && profile_frame->compute_count > 0) {
+        available = gpu_profiler_read_queries(profiler->compute_query_pool,
+                                              profiler->frame * GPU_PROFILER_MAX_COMPUTE_QUERIES,
+                                              profile_frame->compute_count, profile_frame->compute_scopes,
+                                              profiler->compute_timestamp_mask, elapsed, touched);
+    }
+    for (uint32_t i = 0; available && i < profiler->num_scopes; i++) {
+        if (!touched[i]) {
+            continue;
+        }
+        GpuProfileScope* scope = &profiler->scopes[i];
+        scope->history[scope->head] = elapsed[i];
+        scope->head = (scope->head + 1) % GPU_PROFILER_HISTORY;
+        scope->count = sx_min(scope->count + 1, (uint32_t)GPU_PROFILER_HISTORY);
+    }
+
+    profile_frame->count = 0;
+    profile_frame->compute_count = 0;
+    vkCmdResetQueryPool(cmdbuffer, profiler->query_pool, first_query, GPU_PROFILER_MAX_QUERIES);
+}
+/*}}}*/
+
+/*{{{void gpu_profiler_begin(VkCommandBuffer cmdbuffer, const char* name)*/
+void gpu_profiler_begin(VkCommandBuffer cmdbuffer, const char* name) {
+    GpuProfiler* profiler = &vk_context.profiler;
+    if (!profiler->enabled) {
+        return;
+    }
+    sx_assert(profiler->depth < GPU_PROFILER_MAX_DEPTH && "GPU profiler scopes nested too deep");
+    GpuProfilerFrame* profile_frame = &profiler->frames[profiler->frame];
+    uint32_t scope = gpu_profiler_scope_index(name);
+    if (scope == UINT32_MAX || profile_frame->count == GPU_PROFILER_MAX_QUERIES / 2) {
+        profiler->stack[profiler->depth++] = UINT32_MAX;
+        return;
+    }
+
+    uint32_t pair = profile_frame->count++;
+    profile_frame->scopes[pair] = scope;
+    profiler->stack[profiler->depth++] = pair;
+    vkCmdWriteTimestamp(cmdbuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, profiler->query_pool,
+                        profiler->frame * GPU_PROFILER_MAX_QUERIES + pair * 2);
+}
+/*}}}*/
+
+/*{{{void gpu_profiler_end(VkCommandBuffer cmdbuffer)*/
+void gpu_profiler_end(VkCommandBuffer cmdbuffer) {
+    GpuProfiler* profiler = &vk_context.profiler;
+    if (!profiler->enabled) {
+        return;
+    }
+    sx_assert(profiler->depth > 0 && "GPU profiler scope ended without begin");
+    uint32_t pair = profiler->stack[--profiler->depth];
+    if (pair == UINT32_MAX) {
+        return;
+    }
+    vkCmdWriteTimestamp(cmdbuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, profiler->query_pool,
+                        profiler->frame * GPU_PROFILER_MAX_QUERIES + pair * 2 + 1);
+}
+/*}}}*/
+
+/*{{{uint32_t gpu_profiler_reserve(const char* name)*/
+uint32_t gpu_profiler_reserve(const char* name) {
+    GpuProfiler* profiler = &vk_context.profiler;
+    if (!profiler->enabled) {
+        return UINT32_MAX;
+    }
+    GpuProfilerFrame* profile_frame = &profiler->frames[profiler->frame];
+    uint32_t scope = gpu_profiler_scope_index(name);
+    if (scope == UINT32_MAX || profile_frame->count == GPU_PROFILER_MAX_QUERIES / 2) {
+        return UINT32_MAX;
+    }
+    uint32_t pair = profile_frame->count++;
+    profile_frame->scopes[pair] = scope;
+    return pair;
+}
+/*}}}*/
+
+/*{{{void gpu_profiler_begin_reserved(VkCommandBuffer cmdbuffer, uint32_t pair)*/
+void gpu_profiler_begin_reserved(VkCommandBuffer cmdbuffer, uint32_t pair) {
+    GpuProfiler* profiler = &vk_context.profiler;
+    if (pair == UINT32_MAX) {
+        return;
+    }
+    vkCmdWriteTimestamp(cmdbuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, profiler->query_pool,
+                        profiler->frame * GPU_PROFILER_MAX_QUERIES + pair * 2);
+}
+/*}}}*/
+
+/*{{{void gpu_profiler_end_reserved(VkCommandBuffer cmdbuffer, uint32_t pair)*/
+void gpu_profiler_end_reserved(VkCommandBuffer cmdbuffer, uint32_t pair) {
+    GpuProfiler* profiler = &vk_context.profiler;
+    if (pair == UINT32_MAX) {
+        return;
+    }
+    vkCmdWriteTimestamp(cmdbuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, profiler->query_pool,
+                        profiler->frame * GPU_PROFILER_MAX_QUERIES + pair * 2 + 1);
+}
+/*}}}*/
+
+/*{{{void gpu_profiler_begin_compute(VkCommandBuffer cmdbuffer)*/
+void gpu_profiler_begin_compute(VkCommandBuffer cmdbuffer) {
+    GpuProfiler* profiler = &vk_context.profiler;
+    if (profiler->compute_query_pool == VK_NULL_HANDLE) {
+        return;
+    }
+    vkCmdResetQueryPool(cmdbuffer, profiler->compute_query_pool,
+                        profiler->frame * GPU_PROFILER_MAX_COMPUTE_QUERIES, GPU_PROFILER_MAX_COMPUTE_QUERIES);
+}
+/*}}}*/
+
+/*{{{uint32_t gpu_profiler_compute_begin(VkCommandBuffer cmdbuffer, const char* name)*/
+uint32_t gpu_profiler_compute_begin(VkCommandBuffer cmdbuffer, const char* name) {
+    GpuProfiler* profiler = &vk_context.profiler;
+    if (profiler->compute_query_pool == VK_NULL_HANDLE) {
+        return UINT32_MAX;
+    }
+    GpuProfilerFrame* profile_frame = &profiler->frames[profiler->frame];
+    uint32_t scope = gpu_profiler_scope_index(name);
+    if (scope == UINT32_MAX || profile_frame->compute_count == GPU_PROFILER_MAX_COMPUTE_QUERIES / 2) {
+        return UINT32_MAX;
+    }
+    uint32_t pair = profile_frame->compute_count++;
+    profile_frame->compute_scopes[pair] = scope;
+    vkCmdWriteTimestamp(cmdbuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, profiler->compute_query_pool,
+                        profiler->frame * GPU_PROFILER_MAX_COMPUTE_QUERIES + pair * 2);
+    return pair;
+}
+/*}}}*/
+
+/*{{{void gpu_profiler_compute_end(VkCommandBuffer cmdbuffer, uint32_t pair)*/
+void gpu_profiler_compute_end(VkCommandBuffer cmdbuffer, uint32_t pair) {
+    GpuProfiler* profiler = &vk_context.profiler;
+    if (pair == UINT32_MAX) {
+        return;
+    }
+    vkCmdWriteTimestamp(cmdbuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, profiler->compute_query_pool,
+                        profiler->frame * GPU_PROFILER_MAX_COMPUTE_QUERIES + pair * 2 + 1);
+}
+/*}}}*/
+
+/*{{{uint32_t gpu_profiler_scopes(const GpuProfileScope** scopes)*/
+uint32_t gpu_profiler_scopes(const GpuProfileScope** scopes) {
+    *scopes = vk_context.profiler.scopes;
+    return vk_context.profiler.num_scopes;
+}
+/*}}}*/
+
+/*{{{float gpu_profile_scope_average(const GpuProfileScope* scope)*/
+float gpu_profile_scope_average(const GpuProfileScope* scope) {
+    if (scope->count == 0) {
+        return 0.0f;
+    }
+    float sum = 0.0f;
+    for (uint32_t i = 0; i < scope->count; i++) {
+        sum += scope->history[i];
+    }
+    return sum / scope->count;
+}
+/*}}}*/
+
+/*{{{static void headless_target_init()*/
+static void headless_target_init() {
+    HeadlessTarget* target = &vk_context.headless_target;
+    for (uint32_t i = 0; i < vk_context.frames_in_flight; i++) {
+        VkResult result = create_command_buffer(GRAPHICS, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1,
+                                                &target->readbacks[i].cmdbuffer);
+        sx_assert_rel(result == VK_SUCCESS && "Could not create readback command buffer!");
+        result = create_fence(&target->readbacks[i].fence, false);
+        sx_assert_rel(result == VK_SUCCESS && "Could not create readback fence!");
+    }
+}
+/*}}}*/
+
+/*{{{static void headless_wait_readback(uint32_t index)*/
+static void headless_wait_readback(uint32_t index) {
+    HeadlessTarget* target = &vk_context.headless_target;
+    HeadlessReadback* readback = &target->readbacks[index];
+    if (!readback->pending) {
+        return;
+    }
+    VkResult result = wait_fences(1, &readback->fence, true, UINT64_MAX);
+    sx_assert_rel(result == VK_SUCCESS && "Could not wait readback fence!");
+    reset_fences(1, &readback->fence);
+    readback->pending = false;
+}
+/*}}}*/
+
+/*{{{static Swapchain create_headless_swapchain(uint32_t width, uint32_t height)*/
+static Swapchain create_headless_swapchain(uint32_t width, uint32_t height) {
+    HeadlessTarget* target = &vk_context.headless_target;
+    for (uint32_t i = 0; i < vk_context.frames_in_flight; i++) {
+        headless_wait_readback(i);
+    }
+    target->width = width;
+    target->height = height;
+
+    Swapchain swapchain;
+    swapchain.swapchain = VK_NULL_HANDLE;
+    /* same format the surface path picks */
+    swapchain.format.format = VK_FORMAT_B8G8R8A8_UNORM;
+    swapchain.format.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+    swapchain.present_layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    swapchain.extent.width = width;
+    swapchain.extent.height = height;
+    for (uint32_t i = 0; i < MAX_SWAPCHAIN_IMAGES; i++) {
+        swapchain.images[i] = VK_NULL_HANDLE;
+        swapchain.image_views[i] = VK_NULL_HANDLE;
+    }
+
+    for (uint32_t i = 0; i < vk_context.frames_in_flight; i++) {
+        if (target->images[i].image != VK_NULL_HANDLE) {
+            clear_image(&target->images[i]);
+        }
+        target->images[i].format = swapchain.format.format;
+        VkResult result = create_image(width, height,
+                                       VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                                       VK_IMAGE_ASPECT_COLOR_BIT, 1, &target->images[i]);
+        sx_assert_rel(result == VK_SUCCESS && "Could not create offscreen image!");
+        swapchain.images[i] = target->images[i].image;
+        swapchain.image_views[i] = target->images[i].image_view;
+    }
+
+    for (uint32_t i = 0; i < vk_context.frames_in_flight; i++) {
+        HeadlessReadback* readback = &target->readbacks[i];
+        if (readback->buffer.buffer != VK_NULL_HANDLE) {
+            clear_buffer(&readback->buffer);
+        }
+        VkResult result = create_buffer(&readback->buffer, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                        (VkDeviceSize)width * height * 4);
+        sx_assert_rel(result == VK_SUCCESS && "Could not create readback buffer!");
+        readback->mapped = map_buffer_memory(&readback->buffer, 0);
+    }
+
+    swapchain_image_count = vk_context.frames_in_flight;
+    vk_context.swapchain = swapchain;
+    return swapchain;
+}
+/*}}}*/
+
+/*{{{static VkResult headless_acquire_image(VkSemaphore semaphore, uint32_t* image_index)*/
+static VkResult headless_acquire_image(VkSemaphore semaphore, uint32_t* image_index) {
+    HeadlessTarget* target = &vk_context.headless_target;
+    *image_index = target->next_image;
+    target->next_image = (target->next_image + 1) % vk_context.frames_in_flight;
+
+    /* the frame submit waits on it, nothing else would signal it */
+    CommandSubmitInfo submit_info = {0};
+    submit_info.queue = GRAPHICS;
+    submit_info.signal_semaphores_count = 1;
+    submit_info.signal_semaphores = &semaphore;
+    submit_info.fence = VK_NULL_HANDLE;
+    return submit_commands(&submit_info);
+}
+/*}}}*/
+
+/*
+ * Copies the frame to the readback of this frame and waits for the oldest one
+ * still in flight, so copies overlap the rendering of the following frames and
+ * every frame older than frames_in_flight() - 1 presents is read back.
+ */
+/*{{{static VkResult headless_present_image(PresentInfo* info)*/
+static VkResult headless_present_image(PresentInfo* info) {
+    HeadlessTarget* target = &vk_context.headless_target;
+    uint32_t index = (uint32_t)(target->frames_presented % vk_context.frames_in_flight);
+    HeadlessReadback* readback = &target->readbacks[index];
+    headless_wait_readback(index);
+
+    VkCommandBufferBeginInfo begin_info = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                                            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT };
+    VkResult result = vkBeginCommandBuffer(readback->cmdbuffer, &begin_info);
+    sx_assert_rel(result == VK_SUCCESS && "Could not begin command buffer");
+
+    VkBufferImageCopy region = {0};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent.width = target->width;
+    region.imageExtent.height = target->height;
+    region.imageExtent.depth = 1;
+    vkCmdCopyImageToBuffer(readback->cmdbuffer, target->images[*info->image_index].image,
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback->buffer.buffer, 1, &region);
+
+    VkMemoryBarrier memory_barrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                                       .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                                       .dstAccessMask = VK_ACCESS_HOST_READ_BIT };
+    vkCmdPipelineBarrier(readback->cmdbuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &memory_barrier, 0, NULL, 0, NULL);
+    result = vkEndCommandBuffer(readback->cmdbuffer);
+    sx_assert_rel(result == VK_SUCCESS && "Could not finish command buffer record");
+
+    VkPipelineStageFlags wait_stages[4];
+    sx_assert(info->wait_semaphores_count <= 4);
+    for (uint32_t i = 0; i < info->wait_semaphores_count; i++) {
+        wait_stages[i] = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }
+    CommandSubmitInfo submit_info = {0};
+    submit_info.queue = GRAPHICS;
+    submit_info.command_buffers_count = 1;
+    submit_info.command_buffers = &readback->cmdbuffer;
+    submit_info.wait_semaphores_count = info->wait_semaphores_count;
+    submit_info.wait_semaphores = info->wait_semaphores;
+    submit_info.wait_dst_stage_masks = wait_stages;
+    submit_info.fence = readback->fence;
+    result = submit_commands(&submit_info);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+    readback->pending = true;
+    readback->frame = target->frames_presented++;
+
+    headless_wait_readback((index + 1) % vk_context.frames_in_flight);
+    return VK_SUCCESS;
+}
+/*}}}*/
+
+/*{{{const uint8_t* headless_frame(uint64_t frame)*/
+const uint8_t* headless_frame(uint64_t frame) {
+    HeadlessTarget* target = &vk_context.headless_target;
+    if (!vk_context.headless || frame >= target->frames_presented) {
+        return NULL;
+    }
+    uint32_t index = (uint32_t)(frame % vk_context.frames_in_flight);
+    HeadlessReadback* readback = &target->readbacks[index];
+    if (readback->frame != frame) {
+        return NULL;
+    }
+    headless_wait_readback(index);
+    return readback->mapped;
+}
+/*}}}*/
+
+/*{{{void headless_wait_idle()*/
+void headless_wait_idle() {
+    if (!vk_context.headless) {
+        return;
+    }
+    for (uint32_t i = 0; i < vk_context.frames_in_flight; i++) {
+        headless_wait_readback(i);
+    }
+}
+/*}}}*/
+
+/* {{{ VkResult create_image(uint32_t width, uint32_t height, VkImageUsageFlags usage,*/
+VkResult create_image(uint32_t width, uint32_t height, VkImageUsageFlags usage, 
+        VkImageAspectFlags aspect, uint32_t mip_levels, ImageBuffer* image_buffer) {
+    return create_image_3d(width, height, 1, usage, aspect, mip_levels, image_buffer);
+}
+/*}}}*/
+
+/* {{{ VkResult create_image_3d(uint32_t width, uint32_t height, uint32_t depth, VkImageUsageFlags usage,*/
+VkResult create_image_3d(uint32_t width, uint32_t height, uint32_t depth, VkImageUsageFlags usage,
+        VkImageAspectFlags aspect, uint32_t mip_levels, ImageBuffer* image_buffer) {
+
+    if (image_buffer->image != VK_NULL_HANDLE) {
+        clear_image(image_buffer);
+    }
+
+    VkResult result = create_unbound_image(width, height, depth, usage, mip_levels, image_buffer);
+    if(result != VK_SUCCESS) {
+        return result;
+    }
+
+    VkMemoryRequirements image_memory_requirements;
+    vkGetImageMemoryRequirements(vk_context.device.logical_device, image_buffer->image,
+            &image_memory_requirements);
+    result = gpu_memory_alloc(image_memory_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false,
+            &image_buffer->allocation);
+    if(result != VK_SUCCESS) {
+        printf("Could not allocate memory!\n");
+        return result;
+    }
+    VkImageViewType view_type = depth > 1 ? VK_IMAGE_VIEW_TYPE_3D : VK_IMAGE_VIEW_TYPE_2D;
+    return bind_image_memory(image_buffer, &image_buffer->allocation, view_type, aspect);
+}
+/*}}}*/
+
+/* {{{ VkResult create_unbound_image(uint32_t width, uint32_t height, uint32_t depth, VkImageUsageFlags usage,*/
+VkResult create_unbound_image(uint32_t width, uint32_t height, uint32_t depth, VkImageUsageFlags usage,
+        uint32_t mip_levels, ImageBuffer* image_buffer) {
+    image_buffer->image = VK_NULL_HANDLE;
+    image_buffer->image_view = VK_NULL_HANDLE;
+    image_buffer->allocation.memory = VK_NULL_HANDLE;
+
+    VkResult result;
+    VkExtent3D extent;
+    extent.width = width;
+    extent.height = height;
+    extent.depth = depth;
+    VkImageCreateInfo image_create_info;
+    image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_create_info.pNext = NULL;
+    image_create_info.flags = 0;
+    image_create_info.imageType = depth > 1 ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D;
+    image_create_info.format = image_buffer->format;
+    image_create_info.extent = extent;
+    image_create_info.mipLevels = mip_levels;
+    image_create_info.arrayLayers = 1;
+    image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_create_info.usage = usage;
+    image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_create_info.queueFamilyIndexCount = 0;
+    image_create_info.pQueueFamilyIndices = NULL;
+    image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    result = vkCreateImage(vk_context.device.logical_device, &image_create_info, NULL,
+            &image_buffer->image);
+    if(result != VK_SUCCESS) {
+        printf("Could not create depht image!\n");
+    }
+    return result;
+}
+/*}}}*/
+
+/*{{{void get_image_memory_requirements(VkImage image, VkMemoryRequirements* requirements)*/
+void get_image_memory_requirements(VkImage image, VkMemoryRequirements* requirements) {
+    vkGetImageMemoryRequirements(vk_context.device.logical_device, image, requirements);
+}
+/*}}}*/
+
+/* {{{ VkResult bind_image_memory(ImageBuffer* image_buffer, const GpuAllocation* allocation,*/
+VkResult bind_image_memory(ImageBuffer* image_buffer, const GpuAllocation* allocation,
+        VkImageViewType view_type, VkImageAspectFlags aspect) {
+    VkResult result = vkBindImageMemory(vk_context.device.logical_device, image_buffer->image,
+            allocation->memory, allocation->offset);
+    if(result != VK_SUCCESS) {
+        printf("Could not bind memory image!\n");
+        return result;
+    }
+    VkImageSubresourceRange image_subresource_range;
+    image_subresource_range.aspectMask = aspect;
+    image_subresource_range.baseMipLevel = 0;
+    image_subresource_range.levelCount = 1;
+    image_subresource_range.baseArrayLayer = 0;
+    image_subresource_range.layerCount = 1;
+
+    VkImageViewCreateInfo image_view_create_info;
+    image_view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    image_view_create_info.pNext = NULL;
+    image_view_create_info.flags = 0;
+    image_view_create_info.image = image_buffer->image;
+    image_view_create_info.viewType = view_type;
+    image_view_create_info.format = image_buffer->format;
+    image_view_create_info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+    image_view_create_info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+    image_view_create_info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+    image_view_create_info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+    image_view_create_info.subresourceRange = image_subresource_range;
+
+    result = vkCreateImageView(vk_context.device.logical_device, &image_view_create_info, NULL,
+            &image_buffer->image_view);
+    if(result != VK_SUCCESS) {
+        printf("Could not depth image view!\n");
+        return result;
+    }
+    return result;
+}
+/*}}}*/
+
+/* clear_image(DeviceVk* device, ImageBuffer* image) {{{*/
+void clear_image(ImageBuffer* image) {
+    vkDestroyImageView(vk_context.device.logical_device, image->image_view, NULL);
+    vkDestroyImage(vk_context.device.logical_device, image->image, NULL);
+    gpu_memory_free(&image->allocation);
+}
+/*}}}*/
+
+/*{{{void clear_buffer(DeviceVk* device, Buffer* buffer) { */
+void clear_buffer(Buffer* buffer) {
+    vkDestroyBuffer(vk_context.device.logical_device, buffer->buffer, NULL);
+    gpu_memory_free(&buffer->allocation);
+}
+/*}}}*/
+
+/*{{{void clear_texture(DeviceVk* device, Texture* texture) {*/
+void clear_texture(Texture* texture) {
+    if (texture->image_buffer.image != VK_NULL_HANDLE) {
+        vkDestroySampler(vk_context.device.logical_device, texture->sampler, NULL);
+        clear_image(&texture->image_buffer);
+    }
+}
+/*}}}*/
+
+/* {{{ VkResult create_texture_from_data(Texture* texture, VkSamplerAddressMode sampler_address_mode, const sx_alloc* alloc, */
+VkResult create_texture_from_data(Texture* texture, VkSamplerAddressMode sampler_address_mode, const sx_alloc* alloc, 
+        const void* data, uint32_t width, uint32_t height) {
+    /*clear_texture(texture);*/
+    VkResult result;
+    uint32_t size = width * height * 4;
+    VkBuffer staging_buffer;
+    VkDeviceSize offset;
+    void *staging_buffer_memory_pointer = staging_alloc(size, &staging_buffer, &offset);
+    sx_memcpy(staging_buffer_memory_pointer, data, size);
+    VkExtent3D extent;
+    extent.width = width;
+    extent.height = height;
+    extent.depth = 1;
+    VkImageCreateInfo image_create_info;
+    image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_create_info.pNext = NULL;
+    image_create_info.flags = 0;
+    image_create_info.imageType = VK_IMAGE_TYPE_2D;
+    image_create_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+    image_create_info.extent = extent;
+    image_create_info.mipLevels = 1;
+    image_create_info.arrayLayers = 1;
+    image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_create_info.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_create_info.queueFamilyIndexCount = 0;
+    image_create_info.pQueueFamilyIndices = NULL;
+    image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    result = vkCreateImage(vk_context.device.logical_device, &image_create_info, NULL,
+            &texture->image_buffer.image);
+    sx_assert_rel(result == VK_SUCCESS && "Could not create texture image!");
+
+    VkMemoryRequirements image_memory_requirements;
+    vkGetImageMemoryRequirements(vk_context.device.logical_device, texture->image_buffer.image, &image_memory_requirements);
+
+    result = gpu_memory_alloc(image_memory_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false,
+            &texture->image_buffer.allocation);
+    sx_assert_rel(result == VK_SUCCESS && "Could not allocate memory for texture!");
+
+    result = vkBindImageMemory(vk_context.device.logical_device, texture->image_buffer.image,
+            texture->image_buffer.allocation.memory, texture->image_buffer.allocation.offset);
+    sx_assert_rel(result == VK_SUCCESS && "Could not bind memory image!");
+
+    VkImageSubresourceRange image_subresource_range;
+    image_subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    image_subresource_range.baseMipLevel = 0;
+    image_subresource_range.levelCount = 1;
+    image_subresource_range.baseArrayLayer = 0;
+    image_subresource_range.layerCount = 1;
+    /* recorded into the staging ring, submitted with the next frame */
+    VkCommandBuffer cmdbuffer = staging_command_buffer();
+
+    VkBufferImageCopy buffer_image_copy_info = {};
+    buffer_image_copy_info.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    buffer_image_copy_info.imageSubresource.mipLevel = 0;
+    buffer_image_copy_info.imageSubresource.baseArrayLayer = 0;
+    buffer_image_copy_info.imageSubresource.layerCount = 1;
+    buffer_image_copy_info.imageExtent.width = width;
+    buffer_image_copy_info.imageExtent.height = height;
+    buffer_image_copy_info.imageExtent.depth = 1;
+    buffer_image_copy_info.bufferOffset = offset;
+
+    {
+        VkImageMemoryBarrier image_memory_barrier = {};
+        image_memory_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        image_memory_barrier.pNext = NULL;
+        image_memory_barrier.srcAccessMask = 0;
+        image_memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        image_memory_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        image_memory_barrier.image = texture->image_buffer.image;
+        image_memory_barrier.subresourceRange = image_subresource_range;
+        vkCmdPipelineBarrier(cmdbuffer,
+                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0,
+                NULL, 1, &image_memory_barrier);
+    }
+
+    vkCmdCopyBufferToImage(cmdbuffer, staging_buffer,
+            texture->image_buffer.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+            &buffer_image_copy_info);
+    staging_release_image(texture->image_buffer.image, image_subresource_range,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+    // Create sampler
+    VkSamplerCreateInfo samplerCreateInfo = {};
+    samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+    samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+    samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerCreateInfo.addressModeU = sampler_address_mode;
+    samplerCreateInfo.addressModeV = samplerCreateInfo.addressModeU;
+    samplerCreateInfo.addressModeW = samplerCreateInfo.addressModeU;
+    samplerCreateInfo.mipLodBias = 0.0;
+    samplerCreateInfo.maxAnisotropy = 1.0;
+    samplerCreateInfo.anisotropyEnable = VK_FALSE;
+    samplerCreateInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    samplerCreateInfo.minLod = 0.0;
+    samplerCreateInfo.maxLod = 0.0;
+    samplerCreateInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+    result = vkCreateSampler(vk_context.device.logical_device, &samplerCreateInfo, NULL, &texture->sampler);
+    sx_assert_rel(result == VK_SUCCESS && "Could not create texture sampler!");
+
+    // Create image view
+    VkImageViewCreateInfo viewCreateInfo = {};
+    viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    viewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+    viewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+    viewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+    viewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+    viewCreateInfo.subresourceRange = image_subresource_range;
+    viewCreateInfo.subresourceRange.layerCount = 1;
+    viewCreateInfo.image = texture->image_buffer.image;
+    result = vkCreateImageView(vk_context.device.logical_device, &viewCreateInfo, NULL, &texture->image_buffer.image_view);
+    sx_assert_rel(result == VK_SUCCESS && "Could not create texture image view!");
+
+    return result;
+}
+/*}}}*/
+
+/* {{{ VkResult read_texture_data(Texture* texture, VkImageLayout layout, void* data, uint32_t width, uint32_t height) */
+VkResult read_texture_data(Texture* texture, VkImageLayout layout, void* data, uint32_t width, uint32_t height) {
+    VkResult result;
+    /* pending uploads finish and are owned by the graphics queue */
+    staging_wait_idle();
+    Buffer staging;
+    uint32_t size = width * height * 4;
+    result = create_buffer(&staging, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, size);
+    sx_assert_rel(result == VK_SUCCESS && "Could not create readback buffer!");
+
+    VkImageSubresourceRange image_subresource_range;
+    image_subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    image_subresource_range.baseMipLevel = 0;
     image_subresource_range.levelCount = 1;
     image_subresource_range.baseArrayLayer = 0;
     image_subresource_range.layerCount = 1;
@@ -932,7 +2485,7 @@ VkResult create_texture_from_data(Texture* texture, VkSamplerAddressMode sampler
     buffer_image_copy_info.imageExtent.width = width;
     buffer_image_copy_info.imageExtent.height = height;
     buffer_image_copy_info.imageExtent.depth = 1;
-    buffer_image_copy_info.bufferOffset = offset;
+    buffer_image_copy_info.bufferOffset = 0;
 
     vkBeginCommandBuffer(cmdbuffer, &command_buffer_begin_info);
 
@@ -940,34 +2493,50 @@ VkResult create_texture_from_data(Texture* texture, VkSamplerAddressMode sampler
         VkImageMemoryBarrier image_memory_barrier = {};
         image_memory_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
         image_memory_barrier.pNext = NULL;
-        image_memory_barrier.srcAccessMask = 0;
-        image_memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        image_memory_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        image_memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        image_memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        image_memory_barrier.oldLayout = layout;
+        image_memory_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        image_memory_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_memory_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
         image_memory_barrier.image = texture->image_buffer.image;
         image_memory_barrier.subresourceRange = image_subresource_range;
         vkCmdPipelineBarrier(cmdbuffer,
-                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0,
+                VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0,
                 NULL, 1, &image_memory_barrier);
     }
 
-    vkCmdCopyBufferToImage(cmdbuffer, staging.buffer,
-            texture->image_buffer.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
-            &buffer_image_copy_info);
+    vkCmdCopyImageToBuffer(cmdbuffer, texture->image_buffer.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            staging.buffer, 1, &buffer_image_copy_info);
     {
         VkImageMemoryBarrier image_memory_barrier = {};
         image_memory_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
         image_memory_barrier.pNext = NULL;
-        image_memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        image_memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        image_memory_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        image_memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        image_memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        image_memory_barrier.newLayout = layout;
+        image_memory_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_memory_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
         image_memory_barrier.image = texture->image_buffer.image;
         image_memory_barrier.subresourceRange = image_subresource_range;
-        vkCmdPipelineBarrier( cmdbuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1,
+        vkCmdPipelineBarrier(cmdbuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0, NULL, 1,
                 &image_memory_barrier);
     }
+    {
+        VkBufferMemoryBarrier buffer_memory_barrier = {};
+        buffer_memory_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        buffer_memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        buffer_memory_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        buffer_memory_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        buffer_memory_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        buffer_memory_barrier.buffer = staging.buffer;
+        buffer_memory_barrier.offset = 0;
+        buffer_memory_barrier.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(cmdbuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1, &buffer_memory_barrier, 0, NULL);
+    }
 
     vkEndCommandBuffer(cmdbuffer);
 
@@ -982,21 +2551,106 @@ VkResult create_texture_from_data(Texture* texture, VkSamplerAddressMode sampler
     submit_info.signalSemaphoreCount = 0;
     submit_info.pSignalSemaphores = NULL;
 
-    VkFenceCreateInfo fence_create_info;
-    fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fence_create_info.flags = 0;
-    fence_create_info.pNext = NULL;
     VkFence fence;
-    vkCreateFence(vk_context.device.logical_device, &fence_create_info, NULL, &fence);
+    result = create_fence(&fence, false);
+    sx_assert_rel(result == VK_SUCCESS && "Could not create fence!");
 
     result = vkQueueSubmit(vk_context.vk_graphic_queue, 1, &submit_info, fence);
     sx_assert_rel(result == VK_SUCCESS && "Could not submit command buffer!");
     result = vkWaitForFences(vk_context.device.logical_device, 1, &fence, VK_TRUE, 1000000000);
     sx_assert_rel(result == VK_SUCCESS && "Could not submit command buffer!");
-    vkDestroyFence(vk_context.device.logical_device, fence, NULL);
+    destroy_fence(fence);
+    destroy_command_buffer(GRAPHICS, &cmdbuffer);
+
+    void* mapped = map_buffer_memory(&staging, 0);
+    sx_assert_rel(mapped && "Could not map readback buffer!");
+    sx_memcpy(data, mapped, size);
+    unmap_buffer_memory(&staging);
+
+    clear_buffer(&staging);
+
+    return result;
+}
+/*}}}*/
+
+/* {{{ VkResult create_storage_texture(Texture* texture, VkFormat format, VkSamplerAddressMode sampler_address_mode, */
+VkResult create_storage_texture(Texture* texture, VkFormat format, VkSamplerAddressMode sampler_address_mode,
+        uint32_t width, uint32_t height, uint32_t depth) {
+    VkResult result;
+    texture->image_buffer.format = format;
+    result = create_image_3d(width, height, depth,
+                             VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                             VK_IMAGE_ASPECT_COLOR_BIT, 1, &texture->image_buffer);
+    sx_assert_rel(result == VK_SUCCESS && "Could not create storage image!");
+
+    VkImageSubresourceRange image_subresource_range;
+    image_subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    image_subresource_range.baseMipLevel = 0;
+    image_subresource_range.levelCount = 1;
+    image_subresource_range.baseArrayLayer = 0;
+    image_subresource_range.layerCount = 1;
+    VkCommandBuffer cmdbuffer;
+    result = create_command_buffer(GRAPHICS, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1, &cmdbuffer);
+
+    VkCommandBufferBeginInfo command_buffer_begin_info;
+    command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    command_buffer_begin_info.pNext = NULL;
+    command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    command_buffer_begin_info.pInheritanceInfo = NULL;
+
+    vkBeginCommandBuffer(cmdbuffer, &command_buffer_begin_info);
+    {
+        VkImageMemoryBarrier image_memory_barrier = {};
+        image_memory_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        image_memory_barrier.pNext = NULL;
+        image_memory_barrier.srcAccessMask = 0;
+        image_memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        image_memory_barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        image_memory_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_memory_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_memory_barrier.image = texture->image_buffer.image;
+        image_memory_barrier.subresourceRange = image_subresource_range;
+        vkCmdPipelineBarrier(cmdbuffer,
+                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0,
+                NULL, 1, &image_memory_barrier);
+
+        /* readers sampling it before the first compute write see no radiance and full transmittance */
+        VkClearColorValue clear_color = { .float32 = { 0.f, 0.f, 0.f, 1.f } };
+        vkCmdClearColorImage(cmdbuffer, texture->image_buffer.image, VK_IMAGE_LAYOUT_GENERAL, &clear_color, 1,
+                             &image_subresource_range);
+
+        image_memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        image_memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        vkCmdPipelineBarrier(cmdbuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                0, 0, NULL, 0, NULL, 1, &image_memory_barrier);
+    }
+    vkEndCommandBuffer(cmdbuffer);
+
+    VkSubmitInfo submit_info;
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = NULL;
+    submit_info.waitSemaphoreCount = 0;
+    submit_info.pWaitSemaphores = NULL;
+    submit_info.pWaitDstStageMask = NULL;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &cmdbuffer;
+    submit_info.signalSemaphoreCount = 0;
+    submit_info.pSignalSemaphores = NULL;
+
+    VkFence fence;
+    result = create_fence(&fence, false);
+    sx_assert_rel(result == VK_SUCCESS && "Could not create fence!");
+
+    result = vkQueueSubmit(vk_context.vk_graphic_queue, 1, &submit_info, fence);
+    sx_assert_rel(result == VK_SUCCESS && "Could not submit command buffer!");
+    result = vkWaitForFences(vk_context.device.logical_device, 1, &fence, VK_TRUE, 1000000000);
+    sx_assert_rel(result == VK_SUCCESS && "Could not submit command buffer!");
+    destroy_fence(fence);
     destroy_command_buffer(GRAPHICS, &cmdbuffer);
 
-    // Create sampler
     VkSamplerCreateInfo samplerCreateInfo = {};
     samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
     samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
@@ -1010,29 +2664,10 @@ VkResult create_texture_from_data(Texture* texture, VkSamplerAddressMode sampler
     samplerCreateInfo.anisotropyEnable = VK_FALSE;
     samplerCreateInfo.compareOp = VK_COMPARE_OP_ALWAYS;
     samplerCreateInfo.minLod = 0.0;
-    samplerCreateInfo.maxLod = 0.0;
-    samplerCreateInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
-    result = vkCreateSampler(vk_context.device.logical_device, &samplerCreateInfo, NULL, &texture->sampler);
-    sx_assert_rel(result == VK_SUCCESS && "Could not create texture sampler!");
-
-    // Create image view
-    VkImageViewCreateInfo viewCreateInfo = {};
-    viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    viewCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
-    viewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-    viewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-    viewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-    viewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-    viewCreateInfo.subresourceRange = image_subresource_range;
-    viewCreateInfo.subresourceRange.layerCount = 1;
-    viewCreateInfo.image = texture->image_buffer.image;
-    result = vkCreateImageView(vk_context.device.logical_device, &viewCreateInfo, NULL, &texture->image_buffer.image_view);
-    sx_assert_rel(result == VK_SUCCESS && "Could not create texture image view!");
-
-    // Clean up staging resources
-    vkFreeMemory(vk_context.device.logical_device, staging.memory, NULL);
-    vkDestroyBuffer(vk_context.device.logical_device, staging.buffer, NULL);
+    samplerCreateInfo.maxLod = 0.0;
+    samplerCreateInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+    result = vkCreateSampler(vk_context.device.logical_device, &samplerCreateInfo, NULL, &texture->sampler);
+    sx_assert_rel(result == VK_SUCCESS && "Could not create texture sampler!");
 
     return result;
 }
@@ -1043,25 +2678,21 @@ VkResult create_texture(Texture* texture, VkSamplerAddressMode sampler_address_m
     texture->sampler = VK_NULL_HANDLE;
     texture->image_buffer.image = VK_NULL_HANDLE;
     texture->image_buffer.image_view = VK_NULL_HANDLE;
-    texture->image_buffer.memory = VK_NULL_HANDLE;
+    texture->image_buffer.allocation.memory = VK_NULL_HANDLE;
 
     VkResult result = VK_SUCCESS;
-    sx_mem_block* mem = sx_file_load_bin(alloc, filepath);
+    /* sub images are copied from the file mapping straight into the staging memory */
+    sx_mem_block* mem = sx_file_map(alloc, filepath);
+    sx_assert_rel(mem && "Could not open texture file");
     ddsktx_texture_info tc = {0};
     ddsktx_error err;
     bool parse = ddsktx_parse(&tc, mem->data, mem->size, &err);
     /*printf("%s\n", filepath);*/
     sx_assert(parse == true && "Could not parse ktx file");
     if(parse) {
-        Buffer staging;
-        result = create_buffer(&staging, VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-                                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, tc.size_bytes);
-        sx_assert_rel(result == VK_SUCCESS && "Could not create staging buffer!");
-
-		void *staging_buffer_memory_pointer;
-		VkResult result = vkMapMemory(vk_context.device.logical_device, staging.memory, 0,
-				tc.size_bytes, 0, &staging_buffer_memory_pointer);
-        sx_assert_rel(result == VK_SUCCESS && "Could not map memory and upload data to staging buffer!");
+        VkBuffer staging_buffer;
+        VkDeviceSize staging_offset;
+		void *staging_buffer_memory_pointer = staging_alloc(tc.size_bytes, &staging_buffer, &staging_offset);
         uint32_t offset = 0;
         int num_faces = 1;
         if (tc.flags & DDSKTX_TEXTURE_FLAG_CUBEMAP) {
@@ -1086,7 +2717,7 @@ VkResult create_texture(Texture* texture, VkSamplerAddressMode sampler_address_m
                     buffer_image_copy_info.imageExtent.width = sub_data.width;
                     buffer_image_copy_info.imageExtent.height = sub_data.height;
                     buffer_image_copy_info.imageExtent.depth = 1;
-                    buffer_image_copy_info.bufferOffset = offset;
+                    buffer_image_copy_info.bufferOffset = staging_offset + offset;
                     buffer_copy_regions[idx] = buffer_image_copy_info;
 
                     offset += sub_data.size_bytes;
@@ -1095,7 +2726,6 @@ VkResult create_texture(Texture* texture, VkSamplerAddressMode sampler_address_m
                 }
             }
         }
-		vkUnmapMemory(vk_context.device.logical_device, staging.memory);
         VkExtent3D extent;
 		extent.width = tc.width;
 		extent.height = tc.height;
@@ -1127,17 +2757,12 @@ VkResult create_texture(Texture* texture, VkSamplerAddressMode sampler_address_m
 		VkMemoryRequirements image_memory_requirements;
 		vkGetImageMemoryRequirements(vk_context.device.logical_device, texture->image_buffer.image, &image_memory_requirements);
 
-        VkMemoryAllocateInfo memory_allocate_info;
-        memory_allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        memory_allocate_info.pNext = NULL;
-        memory_allocate_info.allocationSize = image_memory_requirements.size;
-        memory_allocate_info.memoryTypeIndex = get_memory_type(image_memory_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-        result = vkAllocateMemory(vk_context.device.logical_device, &memory_allocate_info, NULL,
-                &texture->image_buffer.memory);
-
+        result = gpu_memory_alloc(image_memory_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false,
+                &texture->image_buffer.allocation);
         sx_assert_rel(result == VK_SUCCESS && "Could not allocate memory for texture!");
 
-		result = vkBindImageMemory(vk_context.device.logical_device, texture->image_buffer.image, texture->image_buffer.memory, 0);
+		result = vkBindImageMemory(vk_context.device.logical_device, texture->image_buffer.image,
+                texture->image_buffer.allocation.memory, texture->image_buffer.allocation.offset);
         sx_assert_rel(result == VK_SUCCESS && "Could not bind memory image!");
 
 		VkImageSubresourceRange image_subresource_range;
@@ -1148,16 +2773,7 @@ VkResult create_texture(Texture* texture, VkSamplerAddressMode sampler_address_m
 		image_subresource_range.layerCount = layer_face;
         /*printf("num_layers: %d\n\n", layer_face);*/
         /*printf("num_mips: %d\n\n", tc.num_mips);*/
-        VkCommandBuffer cmdbuffer;
-        result = create_command_buffer(GRAPHICS, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1, &cmdbuffer);
-
-		VkCommandBufferBeginInfo command_buffer_begin_info;
-		command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		command_buffer_begin_info.pNext = NULL;
-		command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-		command_buffer_begin_info.pInheritanceInfo = NULL;
-
-		vkBeginCommandBuffer(cmdbuffer, &command_buffer_begin_info);
+        VkCommandBuffer cmdbuffer = staging_command_buffer();
 
         {
             VkImageMemoryBarrier image_memory_barrier = {};
@@ -1174,52 +2790,13 @@ VkResult create_texture(Texture* texture, VkSamplerAddressMode sampler_address_m
                     NULL, 1, &image_memory_barrier);
         }
 
-		vkCmdCopyBufferToImage(cmdbuffer, staging.buffer,
+		vkCmdCopyBufferToImage(cmdbuffer, staging_buffer,
 				texture->image_buffer.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, num_regions,
 				buffer_copy_regions);
-        {
-            VkImageMemoryBarrier image_memory_barrier = {};
-            image_memory_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            image_memory_barrier.pNext = NULL;
-            image_memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            image_memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-            image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            image_memory_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            image_memory_barrier.image = texture->image_buffer.image;
-            image_memory_barrier.subresourceRange = image_subresource_range;
-            vkCmdPipelineBarrier( cmdbuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1,
-                    &image_memory_barrier);
-        }
+        staging_release_image(texture->image_buffer.image, image_subresource_range,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
         sx_free(alloc, buffer_copy_regions);
 
-		vkEndCommandBuffer(cmdbuffer);
-
-		VkSubmitInfo submit_info;
-		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submit_info.pNext = NULL;
-		submit_info.waitSemaphoreCount = 0;
-		submit_info.pWaitSemaphores = NULL;
-		submit_info.pWaitDstStageMask = NULL;
-		submit_info.commandBufferCount = 1;
-		submit_info.pCommandBuffers = &cmdbuffer;
-		submit_info.signalSemaphoreCount = 0;
-		submit_info.pSignalSemaphores = NULL;
-
-        VkFenceCreateInfo fence_create_info;
-        fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fence_create_info.flags = 0;
-        fence_create_info.pNext = NULL;
-        VkFence fence;
-        vkCreateFence(vk_context.device.logical_device, &fence_create_info, NULL, &fence);
-
-        result = vkQueueSubmit(vk_context.vk_graphic_queue, 1, &submit_info, fence);
-        sx_assert_rel(result == VK_SUCCESS && "Could not submit command buffer!");
-        result = vkWaitForFences(vk_context.device.logical_device, 1, &fence, VK_TRUE, 1000000000);
-        sx_assert_rel(result == VK_SUCCESS && "Could not submit command buffer!");
-        vkDestroyFence(vk_context.device.logical_device, fence, NULL);
-        destroy_command_buffer(GRAPHICS, &cmdbuffer);
-
         // Create sampler
         VkSamplerCreateInfo samplerCreateInfo = {};
         samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -1259,13 +2836,9 @@ VkResult create_texture(Texture* texture, VkSamplerAddressMode sampler_address_m
         result = vkCreateImageView(vk_context.device.logical_device, &viewCreateInfo, NULL, &texture->image_buffer.image_view);
         sx_assert_rel(result == VK_SUCCESS && "Could not create texture image view!");
 
-        // Clean up staging resources
-        vkFreeMemory(vk_context.device.logical_device, staging.memory, NULL);
-        vkDestroyBuffer(vk_context.device.logical_device, staging.buffer, NULL);
-
 
     }
-    sx_mem_destroy_block(mem);
+    sx_file_unmap(mem);
 
     return result;
 }
@@ -1312,7 +2885,7 @@ VkResult create_depth_image(uint32_t width, uint32_t height, ImageBuffer* depth_
 VkResult create_buffer(Buffer* buffer, VkBufferUsageFlags usage, 
                        VkMemoryPropertyFlags memory_properties_flags, VkDeviceSize size) {
         buffer->buffer = VK_NULL_HANDLE;
-        buffer->memory = VK_NULL_HANDLE;
+        buffer->allocation.memory = VK_NULL_HANDLE;
 		buffer->size = size;
 		VkBufferCreateInfo buffer_create_info;
 		buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1331,16 +2904,11 @@ VkResult create_buffer(Buffer* buffer, VkBufferUsageFlags usage,
 		VkMemoryRequirements buffer_memory_requirements;
 		vkGetBufferMemoryRequirements(vk_context.device.logical_device, buffer->buffer,
 				&buffer_memory_requirements);
-        VkMemoryAllocateInfo memory_allocate_info;
-        memory_allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        memory_allocate_info.pNext = NULL;
-        memory_allocate_info.allocationSize = buffer_memory_requirements.size;
-        memory_allocate_info.memoryTypeIndex = get_memory_type(buffer_memory_requirements, memory_properties_flags);
-        result = vkAllocateMemory(vk_context.device.logical_device, &memory_allocate_info, NULL,
-                &buffer->memory);
+        result = gpu_memory_alloc(buffer_memory_requirements, memory_properties_flags, true, &buffer->allocation);
+        sx_assert_rel(result == VK_SUCCESS && "Could not allocate memory for buffer");
 
 		result = vkBindBufferMemory(vk_context.device.logical_device, buffer->buffer,
-				buffer->memory, 0);
+				buffer->allocation.memory, buffer->allocation.offset);
         sx_assert_rel(result == VK_SUCCESS && "Could not bind memory for buffer");
         return result;
 }
@@ -1348,80 +2916,32 @@ VkResult create_buffer(Buffer* buffer, VkBufferUsageFlags usage,
 
 /*VkResult copy_buffer(DeviceVk* device, Buffer* dst_buffer, void* data, VkDeviceSize size) {{{*/
 VkResult copy_buffer(Buffer* dst_buffer, void* data, VkDeviceSize size) {
-    void *buffer_memory_pointer;
-    VkResult result;
-    result = vkMapMemory(vk_context.device.logical_device, dst_buffer->memory, 0, size, 0, &buffer_memory_pointer);
-    sx_assert_rel(result == VK_SUCCESS && "Could not map memory and upload data to buffer!");
+    void *buffer_memory_pointer = map_buffer_memory(dst_buffer, 0);
+    sx_assert_rel(buffer_memory_pointer && "Could not map memory and upload data to buffer!");
     sx_memcpy(buffer_memory_pointer, data, size);
     
-    vkUnmapMemory(vk_context.device.logical_device, dst_buffer->memory);
+    unmap_buffer_memory(dst_buffer);
 
-    return result;
+    return VK_SUCCESS;
 }
 /*}}}*/
 
 /* VkResult copy_buffer_staged(Buffer* dst_buffer, void* data, VkDeviceSize size) {{{*/
 VkResult copy_buffer_staged(Buffer* dst_buffer, void* data, VkDeviceSize size) {
-    Buffer staging;
-    VkResult result = create_buffer(&staging, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, size);
-    sx_assert_rel(result == VK_SUCCESS && "Could not create staging buffer!");
-
-    void *staging_buffer_memory_pointer;
-    result = vkMapMemory(vk_context.device.logical_device, staging.memory, 0,
-            staging.size, 0, &staging_buffer_memory_pointer);
-    sx_assert_rel(result == VK_SUCCESS && "Could not map memory and upload data to buffer!");
+    VkBuffer staging_buffer;
+    VkDeviceSize staging_offset;
+    void *staging_buffer_memory_pointer = staging_alloc(size, &staging_buffer, &staging_offset);
     sx_memcpy(staging_buffer_memory_pointer, data, size);
-    
-    vkUnmapMemory(vk_context.device.logical_device, staging.memory);
-    VkCommandBuffer cmdbuffer;
-    result = create_command_buffer(GRAPHICS, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1, &cmdbuffer);
-
-    VkCommandBufferBeginInfo command_buffer_begin_info;
-    command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    command_buffer_begin_info.pNext = NULL;
-    command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    command_buffer_begin_info.pInheritanceInfo = NULL;
 
-    vkBeginCommandBuffer(cmdbuffer, &command_buffer_begin_info);
     VkBufferCopy buffer_copy_info;
-    buffer_copy_info.srcOffset = 0;
+    buffer_copy_info.srcOffset = staging_offset;
     buffer_copy_info.dstOffset = 0;
     buffer_copy_info.size = size;
-    vkCmdCopyBuffer(cmdbuffer, staging.buffer,
+    vkCmdCopyBuffer(staging_command_buffer(), staging_buffer,
             dst_buffer->buffer, 1, &buffer_copy_info);
+    staging_release_buffer(dst_buffer->buffer, 0, size);
 
-    vkEndCommandBuffer(cmdbuffer);
-
-    VkSubmitInfo submit_info;
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.pNext = NULL;
-    submit_info.waitSemaphoreCount = 0;
-    submit_info.pWaitSemaphores = NULL;
-    submit_info.pWaitDstStageMask = NULL;
-    submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &cmdbuffer;
-    submit_info.signalSemaphoreCount = 0;
-    submit_info.pSignalSemaphores = NULL;
-
-    VkFenceCreateInfo fence_create_info;
-    fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fence_create_info.flags = 0;
-    fence_create_info.pNext = NULL;
-    VkFence fence;
-    vkCreateFence(vk_context.device.logical_device, &fence_create_info, NULL, &fence);
-
-    result = vkQueueSubmit(vk_context.vk_graphic_queue, 1, &submit_info, fence);
-    sx_assert_rel(result == VK_SUCCESS && "Could not submit command buffer!");
-    result = vkWaitForFences(vk_context.device.logical_device, 1, &fence, VK_TRUE, 1000000000);
-    sx_assert_rel(result == VK_SUCCESS && "Could not submit command buffer!");
-    vkDestroyFence(vk_context.device.logical_device, fence, NULL);
-    destroy_command_buffer(GRAPHICS, &cmdbuffer);
-
-    // Clean up staging resources
-    vkFreeMemory(vk_context.device.logical_device, staging.memory, NULL);
-    vkDestroyBuffer(vk_context.device.logical_device, staging.buffer, NULL);
-    return result;
+    return VK_SUCCESS;
 }
 /*}}}*/
 
@@ -1434,7 +2954,8 @@ VkPipelineShaderStageCreateInfo load_shader(VkDevice logical_device, const char*
     shaderstage_create_info.stage = stage;
     shaderstage_create_info.pName = "main";
     shaderstage_create_info.pSpecializationInfo = NULL;
-    sx_mem_block* mem = sx_file_load_bin(sx_alloc_malloc(), filnename);
+    sx_mem_block* mem = sx_file_map(sx_alloc_malloc(), filnename);
+    sx_assert_rel(mem && "Could not open shader file");
     /*FILE* shader = fopen(filnename, "rb");*/
     /*fseek(shader, 0, SEEK_END);*/
     /*uint64_t size = ftell(shader);*/
@@ -1451,8 +2972,10 @@ VkPipelineShaderStageCreateInfo load_shader(VkDevice logical_device, const char*
             &shaderstage_create_info.module);
     if(result != VK_SUCCESS) {
         printf("Could not create vert shader module!\n");
+    } else {
+        shader_module_add_hash(shaderstage_create_info.module, sx_hash_xxh64(mem->data, mem->size, 0));
     }
-    sx_mem_destroy_block(mem);
+    sx_file_unmap(mem);
     /*free(data);*/
     return shaderstage_create_info;
 }
@@ -1488,6 +3011,42 @@ VkQueue find_queue(QueueType type) {
 }
 /*}}}*/
 
+/*{{{VkResult create_command_pool(QueueType type, VkCommandPoolCreateFlags flags, VkCommandPool* pool)*/
+VkResult create_command_pool(QueueType type, VkCommandPoolCreateFlags flags, VkCommandPool* pool) {
+    VkCommandPoolCreateInfo cmd_pool_create_info;
+    cmd_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    cmd_pool_create_info.pNext = NULL;
+    cmd_pool_create_info.flags = flags;
+    cmd_pool_create_info.queueFamilyIndex = get_queue_index(type);
+    return vkCreateCommandPool(vk_context.device.logical_device, &cmd_pool_create_info, NULL, pool);
+}
+/*}}}*/
+
+/*{{{void destroy_command_pool(VkCommandPool pool)*/
+void destroy_command_pool(VkCommandPool pool) {
+    vkDestroyCommandPool(vk_context.device.logical_device, pool, NULL);
+}
+/*}}}*/
+
+/*{{{VkResult reset_command_pool(VkCommandPool pool)*/
+VkResult reset_command_pool(VkCommandPool pool) {
+    return vkResetCommandPool(vk_context.device.logical_device, pool, 0);
+}
+/*}}}*/
+
+/*{{{VkResult allocate_command_buffers(VkCommandPool pool, VkCommandBufferLevel level, uint32_t count, VkCommandBuffer* cmdbuffer)*/
+VkResult allocate_command_buffers(VkCommandPool pool, VkCommandBufferLevel level, uint32_t count,
+        VkCommandBuffer* cmdbuffer) {
+    VkCommandBufferAllocateInfo cmd_buffer_allocate_info;
+    cmd_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    cmd_buffer_allocate_info.pNext = NULL;
+    cmd_buffer_allocate_info.commandPool = pool;
+    cmd_buffer_allocate_info.level = level;
+    cmd_buffer_allocate_info.commandBufferCount = count;
+    return vkAllocateCommandBuffers(vk_context.device.logical_device, &cmd_buffer_allocate_info, cmdbuffer);
+}
+/*}}}*/
+
 /*{{{ VkResult create_command_buffer(VkCommandPool pool, VkCommandBufferLevel level, uint32_t count, VkCommandBuffer* cmdbuffer)*/
 VkResult create_command_buffer(QueueType type, VkCommandBufferLevel level, uint32_t count, VkCommandBuffer* cmdbuffer) {
     VkCommandPool pool = find_pool(type);
@@ -1546,6 +3105,197 @@ VkResult create_descriptor_sets(VkDescriptorPool pool, VkDescriptorSetLayout* la
 }
 /* }}} */
 
+/*{{{static void descriptor_cache_init()*/
+static void descriptor_cache_init() {
+    DescriptorCache* cache = &vk_context.descriptors;
+    cache->layout_table = sx_hashtbl_create(sx_alloc_malloc(), DESCRIPTOR_LAYOUT_CACHE_SIZE);
+    sx_assert_rel(cache->layout_table && "Could not create descriptor layout table");
+    cache->layouts_count = 0;
+    cache->persistent.pools_count = 0;
+    cache->persistent.current = 0;
+    for (uint32_t i = 0; i < RENDERING_RESOURCES_MAX; i++) {
+        cache->frames[i].pools_count = 0;
+        cache->frames[i].current = 0;
+    }
+    cache->frame = 0;
+}
+/*}}}*/
+
+/*{{{static void descriptor_allocator_destroy(DescriptorAllocator* allocator)*/
+static void descriptor_allocator_destroy(DescriptorAllocator* allocator) {
+    for (uint32_t i = 0; i < allocator->pools_count; i++) {
+        vkDestroyDescriptorPool(vk_context.device.logical_device, allocator->pools[i], NULL);
+    }
+    allocator->pools_count = 0;
+    allocator->current = 0;
+}
+/*}}}*/
+
+/*{{{static void descriptor_cache_destroy()*/
+static void descriptor_cache_destroy() {
+    DescriptorCache* cache = &vk_context.descriptors;
+    descriptor_allocator_destroy(&cache->persistent);
+    for (uint32_t i = 0; i < RENDERING_RESOURCES_MAX; i++) {
+        descriptor_allocator_destroy(&cache->frames[i]);
+    }
+    for (uint32_t i = 0; i < cache->layouts_count; i++) {
+        vkDestroyDescriptorSetLayout(vk_context.device.logical_device, cache->layouts[i].layout, NULL);
+    }
+    cache->layouts_count = 0;
+    sx_hashtbl_destroy(cache->layout_table, sx_alloc_malloc());
+    cache->layout_table = NULL;
+}
+/*}}}*/
+
+/*
+ * Packs the fields of the bindings so the padding in front of pImmutableSamplers never
+ * reaches the hash.
+ */
+/*{{{static uint32_t descriptor_layout_hash(const DescriptorLayoutInfo* info, uint32_t seed)*/
+static uint32_t descriptor_layout_hash(const DescriptorLayoutInfo* info, uint32_t seed) {
+    uint32_t fields[DESCRIPTOR_LAYOUT_MAX_BINDINGS * 4];
+    for (uint32_t i = 0; i < info->num_bindings; i++) {
+        fields[i * 4 + 0] = info->bindings[i].binding;
+        fields[i * 4 + 1] = (uint32_t)info->bindings[i].descriptorType;
+        fields[i * 4 + 2] = info->bindings[i].descriptorCount;
+        fields[i * 4 + 3] = info->bindings[i].stageFlags;
+    }
+    uint32_t hash = sx_hash_xxh32(fields, info->num_bindings * 4 * sizeof(uint32_t), seed);
+    /* 0 marks an empty slot of sx_hashtbl */
+    return hash ? hash : 1;
+}
+/*}}}*/
+
+/*{{{static bool descriptor_layout_equal(const DescriptorLayoutEntry* entry, const DescriptorLayoutInfo* info)*/
+static bool descriptor_layout_equal(const DescriptorLayoutEntry* entry, const DescriptorLayoutInfo* info) {
+    if (entry->num_bindings != info->num_bindings) {
+        return false;
+    }
+    for (uint32_t i = 0; i < info->num_bindings; i++) {
+        const VkDescriptorSetLayoutBinding* a = &entry->bindings[i];
+        const VkDescriptorSetLayoutBinding* b = &info->bindings[i];
+        if (a->binding != b->binding || a->descriptorType != b->descriptorType ||
+                a->descriptorCount != b->descriptorCount || a->stageFlags != b->stageFlags) {
+            return false;
+        }
+    }
+    return true;
+}
+/*}}}*/
+
+/*{{{VkResult get_descriptor_layout(DescriptorLayoutInfo* info, VkDescriptorSetLayout* layout)*/
+VkResult get_descriptor_layout(DescriptorLayoutInfo* info, VkDescriptorSetLayout* layout) {
+    DescriptorCache* cache = &vk_context.descriptors;
+    sx_assert_rel(info->num_bindings <= DESCRIPTOR_LAYOUT_MAX_BINDINGS && "Too many descriptor bindings");
+    for (uint32_t i = 0; i < info->num_bindings; i++) {
+        sx_assert_rel(info->bindings[i].pImmutableSamplers == NULL && "Immutable samplers are not cached");
+    }
+
+    /* a collision moves on to the next seed */
+    uint32_t key;
+    for (uint32_t seed = 0;; seed++) {
+        key = descriptor_layout_hash(info, seed);
+        int index = sx_hashtbl_find(cache->layout_table, key);
+        if (index == -1) {
+            break;
+        }
+        DescriptorLayoutEntry* entry = &cache->layouts[sx_hashtbl_get(cache->layout_table, index)];
+        if (descriptor_layout_equal(entry, info)) {
+            *layout = entry->layout;
+            return VK_SUCCESS;
+        }
+    }
+
+    sx_assert_rel(cache->layouts_count < DESCRIPTOR_LAYOUT_CACHE_SIZE && "Too many descriptor layouts");
+    DescriptorLayoutEntry* entry = &cache->layouts[cache->layouts_count];
+    VkResult result = create_descriptor_layout(info, &entry->layout);
+    if (result != VK_SUCCESS) {
+        return result;
+    }
+    sx_memcpy(entry->bindings, info->bindings, info->num_bindings * sizeof(*info->bindings));
+    entry->num_bindings = info->num_bindings;
+    sx_hashtbl_add_and_grow(cache->layout_table, key, (int)cache->layouts_count, sx_alloc_malloc());
+    cache->layouts_count++;
+    *layout = entry->layout;
+    return VK_SUCCESS;
+}
+/*}}}*/
+
+/*{{{static VkResult descriptor_allocator_add_pool(DescriptorAllocator* allocator)*/
+static VkResult descriptor_allocator_add_pool(DescriptorAllocator* allocator) {
+    sx_assert_rel(allocator->pools_count < DESCRIPTOR_ALLOCATOR_MAX_POOLS && "Too many descriptor pools");
+    /* descriptors per set of each type, sized after what the subsystems use */
+    VkDescriptorPoolSize pool_sizes[6] = {
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 2 },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4 },
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2 },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+        { VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 4 }
+    };
+    for (uint32_t i = 0; i < 6; i++) {
+        pool_sizes[i].descriptorCount *= DESCRIPTOR_POOL_MAX_SETS;
+    }
+
+    DescriptorPoolInfo pool_info;
+    pool_info.pool_sizes = pool_sizes;
+    pool_info.pool_size_count = 6;
+    pool_info.max_sets = DESCRIPTOR_POOL_MAX_SETS;
+    VkResult result = create_descriptor_pool(&pool_info, &allocator->pools[allocator->pools_count]);
+    if (result == VK_SUCCESS) {
+        allocator->pools_count++;
+    }
+    return result;
+}
+/*}}}*/
+
+/*{{{static VkResult descriptor_allocator_allocate(DescriptorAllocator* allocator, VkDescriptorSetLayout* layouts,*/
+static VkResult descriptor_allocator_allocate(DescriptorAllocator* allocator, VkDescriptorSetLayout* layouts,
+        uint32_t num_layouts, VkDescriptorSet* sets) {
+    VkResult result;
+    for (;;) {
+        bool fresh = allocator->current == allocator->pools_count;
+        if (fresh) {
+            result = descriptor_allocator_add_pool(allocator);
+            if (result != VK_SUCCESS) {
+                return result;
+            }
+        }
+        result = create_descriptor_sets(allocator->pools[allocator->current], layouts, num_layouts, sets);
+        /* a fresh pool that cannot hold the sets never will */
+        if (fresh || (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL)) {
+            return result;
+        }
+        allocator->current++;
+    }
+}
+/*}}}*/
+
+/*{{{VkResult allocate_descriptor_sets(VkDescriptorSetLayout* layouts, uint32_t num_layouts, VkDescriptorSet* sets)*/
+VkResult allocate_descriptor_sets(VkDescriptorSetLayout* layouts, uint32_t num_layouts, VkDescriptorSet* sets) {
+    return descriptor_allocator_allocate(&vk_context.descriptors.persistent, layouts, num_layouts, sets);
+}
+/*}}}*/
+
+/*{{{VkResult allocate_frame_descriptor_sets(VkDescriptorSetLayout* layouts, uint32_t num_layouts, VkDescriptorSet* sets)*/
+VkResult allocate_frame_descriptor_sets(VkDescriptorSetLayout* layouts, uint32_t num_layouts, VkDescriptorSet* sets) {
+    DescriptorCache* cache = &vk_context.descriptors;
+    return descriptor_allocator_allocate(&cache->frames[cache->frame], layouts, num_layouts, sets);
+}
+/*}}}*/
+
+/*{{{void descriptor_cache_begin_frame(uint32_t frame)*/
+void descriptor_cache_begin_frame(uint32_t frame) {
+    DescriptorCache* cache = &vk_context.descriptors;
+    cache->frame = frame % vk_context.frames_in_flight;
+    DescriptorAllocator* allocator = &cache->frames[cache->frame];
+    for (uint32_t i = 0; i < allocator->pools_count; i++) {
+        vkResetDescriptorPool(vk_context.device.logical_device, allocator->pools[i], 0);
+    }
+    allocator->current = 0;
+}
+/*}}}*/
+
 /*{{{void update_descriptor_set(DescriptorSetUpdateInfo* info)*/
 void update_descriptor_set(DescriptorSetUpdateInfo* info) {
     uint32_t num_writes = info->num_buffer_bindings + info->num_image_bindings + info->num_texel_bindings;
@@ -1610,6 +3360,15 @@ VkPipelineShaderStageCreateInfo create_shader_module(const char* filename, VkSha
 }
 /* }}}*/
 
+/* {{{VkPipelineShaderStageCreateInfo create_specialized_shader_module(const char* filename, VkShaderStageFlagBits stage,*/
+VkPipelineShaderStageCreateInfo create_specialized_shader_module(const char* filename, VkShaderStageFlagBits stage,
+        const VkSpecializationInfo* specialization) {
+    VkPipelineShaderStageCreateInfo shader_stage = load_shader(vk_context.device.logical_device, filename, stage);
+    shader_stage.pSpecializationInfo = specialization;
+    return shader_stage;
+}
+/* }}}*/
+
 /* {{{ VkResult create_pipeline_layout(PipelineLayoutInfo* info, VkPipeline* pipeline_layout);*/
 VkResult create_pipeline_layout(PipelineLayoutInfo* info, VkPipelineLayout* pipeline_layout) {
     VkPipelineLayoutCreateInfo layout_create_info;
@@ -1631,6 +3390,7 @@ VkResult create_compute_pipeline(ComputePipelineInfo* info, VkPipeline* compute_
     VkComputePipelineCreateInfo* create_info = sx_malloc(alloc, info->num_pipelines * sizeof(*create_info));
     
     for (uint32_t i = 0; i < info->num_pipelines; i++) {
+        shader_module_take_hash(info->shader[i].module);
         create_info[i].sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
         create_info[i].pNext = NULL;
         create_info[i].flags = 0;
@@ -1639,7 +3399,7 @@ VkResult create_compute_pipeline(ComputePipelineInfo* info, VkPipeline* compute_
         create_info[i].basePipelineHandle = VK_NULL_HANDLE;
         create_info[i].basePipelineIndex = -1;
     }
-    VkResult result =  vkCreateComputePipelines(vk_context.device.logical_device, VK_NULL_HANDLE, info->num_pipelines,
+    VkResult result =  vkCreateComputePipelines(vk_context.device.logical_device, vk_context.pipeline_cache, info->num_pipelines,
                                     create_info, NULL, compute_pipeline);
 
     sx_free(alloc, create_info);
@@ -1647,6 +3407,22 @@ VkResult create_compute_pipeline(ComputePipelineInfo* info, VkPipeline* compute_
 }
 /*}}}*/
 
+/*{{{bool device_supports_subgroup_arithmetic(VkShaderStageFlags stages)*/
+bool device_supports_subgroup_arithmetic(VkShaderStageFlags stages) {
+    VkPhysicalDeviceSubgroupProperties subgroup_properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES,
+    };
+    VkPhysicalDeviceProperties2 device_properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &subgroup_properties,
+    };
+    vkGetPhysicalDeviceProperties2(vk_context.device.physical_device, &device_properties);
+
+    return (subgroup_properties.supportedOperations & VK_SUBGROUP_FEATURE_ARITHMETIC_BIT) &&
+           (subgroup_properties.supportedStages & stages) == stages;
+}
+/*}}}*/
+
 /*{{{VkResult create_fence(VkFence* fence) */
 VkResult create_fence(VkFence* fence, bool begin_signaled) {
     VkFenceCreateInfo fence_create_info;
@@ -1675,7 +3451,7 @@ VkResult submit_commands(CommandSubmitInfo* info) {
     submit_info.pNext = NULL;
     submit_info.waitSemaphoreCount = info->wait_semaphores_count;
     submit_info.pWaitSemaphores = info->wait_semaphores;
-    submit_info.pWaitDstStageMask = &info->wait_dst_stage_mask;
+    submit_info.pWaitDstStageMask = info->wait_dst_stage_masks;
     submit_info.signalSemaphoreCount = info->signal_semaphores_count;
     submit_info.pSignalSemaphores = info->signal_semaphores;
     submit_info.commandBufferCount = info->command_buffers_count;
@@ -1692,15 +3468,18 @@ void destroy_fence(VkFence fence) {
 
 /*{{{void* map_buffer_memory(Buffer* buffer, VkDeviceSize offset)*/
 void* map_buffer_memory(Buffer* buffer, VkDeviceSize offset) {
-    void* mem = NULL;
-    vkMapMemory(vk_context.device.logical_device, buffer->memory, offset, buffer->size, 0, &mem);
-    return mem;
+    /* blocks are shared and mapped once when allocated, vkMapMemory can't be nested */
+    if (buffer->allocation.mapped == NULL) {
+        return NULL;
+    }
+    return (uint8_t*)buffer->allocation.mapped + offset;
 }
 /*}}}*/
 
 /*{{{void unmap_buffer_memory(Buffer* buffer)*/
 void unmap_buffer_memory(Buffer* buffer) {
-    vkUnmapMemory(vk_context.device.logical_device, buffer->memory);
+    /* host visible memory is only unmapped when freed */
+    (void)buffer;
 }
 /*}}}*/
 
@@ -1730,9 +3509,13 @@ void destroy_command_buffer(QueueType type, VkCommandBuffer* cmdbuffer) {
 }
 /*}}}*/
 
-/*{{{ VkResult create_graphic_pipeline(GraphicPipelineInfo* info, VkPipeline* pipeline)*/
-VkResult create_graphic_pipeline(GraphicPipelineInfo* info, VkPipeline* pipeline) {
-    VkResult result;
+/*
+ * Leaves the shader modules of info alone, also runs on the job threads of the pso cache.
+ */
+/*{{{static VkResult build_graphic_pipelines(GraphicPipelineInfo* info, uint32_t count, const VkRenderPass* render_passes,*/
+static VkResult build_graphic_pipelines(GraphicPipelineInfo* info, uint32_t count, const VkRenderPass* render_passes,
+        const uint32_t* subpasses, VkPipeline* pipelines) {
+    VkResult result = VK_SUCCESS;
 
     VkPipelineVertexInputStateCreateInfo vertex_input_state_create_info = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
@@ -1811,9 +3594,8 @@ VkResult create_graphic_pipeline(GraphicPipelineInfo* info, VkPipeline* pipeline
         .maxDepthBounds = 1.0
     };
 
-    VkPipelineColorBlendAttachmentState* color_blend_attachment_state;
-    color_blend_attachment_state = sx_malloc(sx_alloc_malloc(), 
-        info->color_blend->attachment_count * sizeof(*color_blend_attachment_state));
+    sx_assert_rel(info->color_blend->attachment_count <= MAX_NUM_ATTACHMENTS && "Too many color attachments");
+    VkPipelineColorBlendAttachmentState color_blend_attachment_state[MAX_NUM_ATTACHMENTS];
 
     for (uint32_t i = 0; i < info->color_blend->attachment_count; i++) {
         color_blend_attachment_state[i].blendEnable = 
@@ -1859,17 +3641,388 @@ VkResult create_graphic_pipeline(GraphicPipelineInfo* info, VkPipeline* pipeline
         .basePipelineIndex = -1
     };
 
-    result = vkCreateGraphicsPipelines(vk_context.device.logical_device, 
-            VK_NULL_HANDLE, 1, &pipeline_create_info, NULL, pipeline);
-    VK_CHECK_RESULT(result);
-    for (int32_t i = 0; i < info->shader_stages_count; i++) {
-        vkDestroyShaderModule(vk_context.device.logical_device, 
-                info->shader_stages[i].module, NULL);
+    for (uint32_t v = 0; v < count; v++) {
+        pipeline_create_info.renderPass = render_passes[v];
+        pipeline_create_info.subpass = subpasses[v];
+        result = vkCreateGraphicsPipelines(vk_context.device.logical_device, 
+                vk_context.pipeline_cache, 1, &pipeline_create_info, NULL, &pipelines[v]);
+        if (result != VK_SUCCESS) {
+            /* all or nothing, the variants created so far are dropped */
+            for (uint32_t i = 0; i < v; i++) {
+                vkDestroyPipeline(vk_context.device.logical_device, pipelines[i], NULL);
+                pipelines[i] = VK_NULL_HANDLE;
+            }
+            pipelines[v] = VK_NULL_HANDLE;
+            return result;
+        }
+    }
+    return result;
+}
+/*}}}*/
+
+/*{{{static void destroy_shader_stages(const VkPipelineShaderStageCreateInfo* stages, uint32_t count)*/
+static void destroy_shader_stages(const VkPipelineShaderStageCreateInfo* stages, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        vkDestroyShaderModule(vk_context.device.logical_device, stages[i].module, NULL);
     }
+}
+/*}}}*/
+
+/*{{{ VkResult create_graphic_pipeline(GraphicPipelineInfo* info, VkPipeline* pipeline)*/
+VkResult create_graphic_pipeline(GraphicPipelineInfo* info, VkPipeline* pipeline) {
+    return create_graphic_pipelines(info, 1, &info->render_pass, &info->subpass, pipeline);
+}
+/*}}}*/
+
+/*{{{VkResult create_graphic_pipelines(GraphicPipelineInfo* info, uint32_t count, const VkRenderPass* render_passes,*/
+VkResult create_graphic_pipelines(GraphicPipelineInfo* info, uint32_t count, const VkRenderPass* render_passes,
+        const uint32_t* subpasses, VkPipeline* pipelines) {
+    for (uint32_t i = 0; i < info->shader_stages_count; i++) {
+        shader_module_take_hash(info->shader_stages[i].module);
+    }
+    VkResult result = build_graphic_pipelines(info, count, render_passes, subpasses, pipelines);
+    VK_CHECK_RESULT(result);
+    destroy_shader_stages(info->shader_stages, info->shader_stages_count);
     return result;
 }
 /*}}}*/
 
+/*{{{static void pso_cache_init()*/
+static void pso_cache_init() {
+    PsoCache* cache = &vk_context.pso;
+    cache->table = sx_hashtbl_create(sx_alloc_malloc(), PSO_CACHE_SIZE);
+    sx_assert_rel(cache->table && "Could not create pipeline table");
+    cache->entries_count = 0;
+    cache->shader_hashes_count = 0;
+    for (uint32_t i = 0; i < PSO_MAX_BUILDS; i++) {
+        cache->builds[i].active = false;
+    }
+    cache->jobs = NULL;
+}
+/*}}}*/
+
+/*{{{static void shader_module_add_hash(VkShaderModule module, uint64_t hash)*/
+static void shader_module_add_hash(VkShaderModule module, uint64_t hash) {
+    PsoCache* cache = &vk_context.pso;
+    sx_assert_rel(cache->shader_hashes_count < PSO_MAX_SHADER_MODULES && "Too many shader modules");
+    cache->shader_hashes[cache->shader_hashes_count].module = module;
+    /* 0 is kept for modules load_shader did not make */
+    cache->shader_hashes[cache->shader_hashes_count].hash = hash ? hash : 1;
+    cache->shader_hashes_count++;
+}
+/*}}}*/
+
+/*
+ * The handle of a destroyed module can come back for another one, so the hash is
+ * dropped once a pipeline consumed the module.
+ */
+/*{{{static uint64_t shader_module_take_hash(VkShaderModule module)*/
+static uint64_t shader_module_take_hash(VkShaderModule module) {
+    PsoCache* cache = &vk_context.pso;
+    for (uint32_t i = 0; i < cache->shader_hashes_count; i++) {
+        if (cache->shader_hashes[i].module == module) {
+            uint64_t hash = cache->shader_hashes[i].hash;
+            cache->shader_hashes_count--;
+            cache->shader_hashes[i] = cache->shader_hashes[cache->shader_hashes_count];
+            return hash;
+        }
+    }
+    return 0;
+}
+/*}}}*/
+
+/*{{{static uint64_t shader_stage_hash(const VkPipelineShaderStageCreateInfo* stage)*/
+static uint64_t shader_stage_hash(const VkPipelineShaderStageCreateInfo* stage) {
+    uint64_t hash = shader_module_take_hash(stage->module);
+    sx_assert_rel(hash != 0 && "Cached pipelines need shader modules from load_shader");
+    hash = sx_hash_xxh64(stage->pName, sx_strlen(stage->pName), hash);
+    const VkSpecializationInfo* specialization = stage->pSpecializationInfo;
+    if (specialization) {
+        for (uint32_t i = 0; i < specialization->mapEntryCount; i++) {
+            uint32_t fields[3] = {
+                specialization->pMapEntries[i].constantID,
+                specialization->pMapEntries[i].offset,
+                (uint32_t)specialization->pMapEntries[i].size
+            };
+            hash = sx_hash_xxh64(fields, sizeof(fields), hash);
+        }
+        hash = sx_hash_xxh64(specialization->pData, specialization->dataSize, hash);
+    }
+    return hash;
+}
+/*}}}*/
+
+/*{{{static void pipeline_desc_init(PipelineDesc* desc, const GraphicPipelineInfo* info, const uint64_t* shader_hashes,*/
+static void pipeline_desc_init(PipelineDesc* desc, const GraphicPipelineInfo* info, const uint64_t* shader_hashes,
+        VkRenderPass render_pass, uint32_t subpass) {
+    sx_memset(desc, 0, sizeof(*desc));
+    sx_memcpy(&desc->render_pass, &render_pass, sizeof(render_pass));
+    sx_memcpy(&desc->layout, info->layout, sizeof(*info->layout));
+    for (uint32_t i = 0; i < info->shader_stages_count; i++) {
+        desc->shader_hashes[i] = shader_hashes[i];
+        desc->shader_stages[i] = info->shader_stages[i].stage;
+    }
+    desc->shader_stages_count = info->shader_stages_count;
+    desc->subpass = subpass;
+
+    const VertexInputStateInfo* vertex_input = info->vertex_input;
+    sx_assert_rel(vertex_input->binding_count <= PSO_MAX_VERTEX_BINDINGS && "Too many vertex bindings");
+    sx_assert_rel(vertex_input->attribute_count <= PSO_MAX_VERTEX_ATTRIBUTES && "Too many vertex attributes");
+    for (uint32_t i = 0; i < vertex_input->binding_count; i++) {
+        desc->vertex_bindings[i] = vertex_input->binding_descriptions[i];
+    }
+    desc->vertex_bindings_count = vertex_input->binding_count;
+    for (uint32_t i = 0; i < vertex_input->attribute_count; i++) {
+        desc->vertex_attributes[i] = vertex_input->attribute_descriptions[i];
+    }
+    desc->vertex_attributes_count = vertex_input->attribute_count;
+
+    desc->topology = info->input_assembly->topology;
+    desc->restart_enabled = info->input_assembly->restart_enabled;
+    desc->polygon_mode = info->rasterization->polygon_mode;
+    desc->cull_mode = info->rasterization->cull_mode;
+    desc->front_face = info->rasterization->front_face;
+    desc->samples = info->multisample->samples;
+    desc->sample_shading = info->multisample->shadingenable;
+    desc->min_sample_shading = info->multisample->min_shading;
+    desc->depth_test = info->depth_stencil->depth_test_enable;
+    desc->depth_write = info->depth_stencil->depth_write_enable;
+    desc->depth_compare_op = info->depth_stencil->depht_compare_op;
+
+    sx_assert_rel(info->color_blend->attachment_count <= MAX_NUM_ATTACHMENTS && "Too many color attachments");
+    for (uint32_t i = 0; i < info->color_blend->attachment_count; i++) {
+        desc->blend_enables[i] = info->color_blend->blend_enables[i] ? 1 : 0;
+    }
+    desc->blend_attachments_count = info->color_blend->attachment_count;
+}
+/*}}}*/
+
+/*
+ * The 64 bit hash is folded into the key of the table, a collision moves on to the
+ * next seed. Returns UINT32_MAX when desc is not cached, key is then free for it.
+ */
+/*{{{static uint32_t pso_cache_find(const PipelineDesc* desc, uint32_t* key)*/
+static uint32_t pso_cache_find(const PipelineDesc* desc, uint32_t* key) {
+    PsoCache* cache = &vk_context.pso;
+    uint64_t hash = sx_hash_xxh64(desc, sizeof(*desc), 0);
+    for (uint32_t seed = 0;; seed++) {
+        *key = sx_hash_u64_to_u32(hash + seed);
+        /* 0 marks an empty slot of sx_hashtbl */
+        *key = *key ? *key : 1;
+        int index = sx_hashtbl_find(cache->table, *key);
+        if (index == -1) {
+            return UINT32_MAX;
+        }
+        uint32_t entry = (uint32_t)sx_hashtbl_get(cache->table, index);
+        if (sx_memcmp(&cache->entries[entry].desc, desc, sizeof(*desc)) == 0) {
+            return entry;
+        }
+    }
+}
+/*}}}*/
+
+/*{{{static PsoBuild* pso_build_begin(const GraphicPipelineInfo* info)*/
+static PsoBuild* pso_build_begin(const GraphicPipelineInfo* info) {
+    PsoCache* cache = &vk_context.pso;
+    PsoBuild* build = NULL;
+    for (uint32_t i = 0; i < PSO_MAX_BUILDS; i++) {
+        if (!cache->builds[i].active) {
+            build = &cache->builds[i];
+            break;
+        }
+    }
+    if (!build) {
+        pso_cache_wait();
+        build = &cache->builds[0];
+    }
+    build->active = true;
+    build->job = NULL;
+    build->count = 0;
+    build->result = VK_SUCCESS;
+
+    /* the caller's state is gone by the time the job runs */
+    build->info = *info;
+    build->vertex_input = *info->vertex_input;
+    for (uint32_t i = 0; i < info->vertex_input->binding_count; i++) {
+        build->vertex_bindings[i] = info->vertex_input->binding_descriptions[i];
+    }
+    for (uint32_t i = 0; i < info->vertex_input->attribute_count; i++) {
+        build->vertex_attributes[i] = info->vertex_input->attribute_descriptions[i];
+    }
+    build->vertex_input.binding_descriptions = build->vertex_bindings;
+    build->vertex_input.attribute_descriptions = build->vertex_attributes;
+    build->input_assembly = *info->input_assembly;
+    build->rasterization = *info->rasterization;
+    build->multisample = *info->multisample;
+    build->depth_stencil = *info->depth_stencil;
+    build->color_blend = *info->color_blend;
+    for (uint32_t i = 0; i < info->color_blend->attachment_count; i++) {
+        build->blend_enables[i] = info->color_blend->blend_enables[i];
+    }
+    build->color_blend.blend_enables = build->blend_enables;
+    build->layout = *info->layout;
+
+    for (uint32_t i = 0; i < info->shader_stages_count; i++) {
+        build->stages[i] = info->shader_stages[i];
+        const VkSpecializationInfo* specialization = info->shader_stages[i].pSpecializationInfo;
+        if (specialization) {
+            sx_assert_rel(specialization->mapEntryCount <= PSO_MAX_SPECIALIZATION_ENTRIES &&
+                    "Too many specialization constants");
+            sx_assert_rel(specialization->dataSize <= PSO_MAX_SPECIALIZATION_SIZE &&
+                    "Specialization data too large");
+            for (uint32_t j = 0; j < specialization->mapEntryCount; j++) {
+                build->map_entries[i][j] = specialization->pMapEntries[j];
+            }
+            sx_memcpy(build->specialization_data[i], specialization->pData, specialization->dataSize);
+            build->specializations[i] = *specialization;
+            build->specializations[i].pMapEntries = build->map_entries[i];
+            build->specializations[i].pData = build->specialization_data[i];
+            build->stages[i].pSpecializationInfo = &build->specializations[i];
+        }
+    }
+
+    build->info.vertex_input = &build->vertex_input;
+    build->info.input_assembly = &build->input_assembly;
+    build->info.rasterization = &build->rasterization;
+    build->info.multisample = &build->multisample;
+    build->info.depth_stencil = &build->depth_stencil;
+    build->info.color_blend = &build->color_blend;
+    build->info.layout = &build->layout;
+    build->info.shader_stages = build->stages;
+    return build;
+}
+/*}}}*/
+
+/*{{{static void pso_build_job(int range_start, int range_end, int thread_index, void* user)*/
+static void pso_build_job(int range_start, int range_end, int thread_index, void* user) {
+    sx_unused(range_start);
+    sx_unused(range_end);
+    sx_unused(thread_index);
+    PsoBuild* build = user;
+    build->result = build_graphic_pipelines(&build->info, build->count, build->render_passes,
+            build->subpasses, build->pipelines);
+    destroy_shader_stages(build->stages, build->info.shader_stages_count);
+}
+/*}}}*/
+
+/*{{{static VkResult pso_build_finish(PsoBuild* build)*/
+static VkResult pso_build_finish(PsoBuild* build) {
+    PsoCache* cache = &vk_context.pso;
+    VK_CHECK_RESULT(build->result);
+    for (uint32_t i = 0; i < build->count; i++) {
+        PsoEntry* entry = &cache->entries[build->entries[i]];
+        entry->pipeline = build->pipelines[i];
+        entry->ready = true;
+    }
+    build->active = false;
+    return build->result;
+}
+/*}}}*/
+
+/*{{{static void pso_cache_wait()*/
+static void pso_cache_wait() {
+    PsoCache* cache = &vk_context.pso;
+    for (uint32_t i = 0; i < PSO_MAX_BUILDS; i++) {
+        PsoBuild* build = &cache->builds[i];
+        if (build->active) {
+            sx_job_wait_and_del(cache->jobs, build->job);
+            pso_build_finish(build);
+        }
+    }
+}
+/*}}}*/
+
+/*{{{static void pso_cache_destroy()*/
+static void pso_cache_destroy() {
+    PsoCache* cache = &vk_context.pso;
+    pso_cache_wait();
+    for (uint32_t i = 0; i < cache->entries_count; i++) {
+        vkDestroyPipeline(vk_context.device.logical_device, cache->entries[i].pipeline, NULL);
+    }
+    cache->entries_count = 0;
+    sx_hashtbl_destroy(cache->table, sx_alloc_malloc());
+    cache->table = NULL;
+}
+/*}}}*/
+
+/*{{{void pso_cache_set_jobs(sx_job_context* jobs)*/
+void pso_cache_set_jobs(sx_job_context* jobs) {
+    /* the compiles still running belong to the old context */
+    pso_cache_wait();
+    vk_context.pso.jobs = jobs;
+}
+/*}}}*/
+
+/*{{{VkResult request_graphic_pipelines(GraphicPipelineInfo* info, uint32_t count, const VkRenderPass* render_passes,*/
+VkResult request_graphic_pipelines(GraphicPipelineInfo* info, uint32_t count, const VkRenderPass* render_passes,
+        const uint32_t* subpasses, PipelineHandle* handles) {
+    PsoCache* cache = &vk_context.pso;
+    sx_assert_rel(count <= PSO_MAX_VARIANTS && "Too many pipeline variants");
+    sx_assert_rel(info->shader_stages_count <= PSO_MAX_SHADER_STAGES && "Too many shader stages");
+    uint64_t shader_hashes[PSO_MAX_SHADER_STAGES];
+    for (uint32_t i = 0; i < info->shader_stages_count; i++) {
+        shader_hashes[i] = shader_stage_hash(&info->shader_stages[i]);
+    }
+
+    PsoBuild* build = NULL;
+    for (uint32_t v = 0; v < count; v++) {
+        PipelineDesc desc;
+        pipeline_desc_init(&desc, info, shader_hashes, render_passes[v], subpasses[v]);
+        uint32_t key;
+        uint32_t index = pso_cache_find(&desc, &key);
+        if (index == UINT32_MAX) {
+            sx_assert_rel(cache->entries_count < PSO_CACHE_SIZE && "Too many pipelines");
+            index = cache->entries_count;
+            PsoEntry* entry = &cache->entries[index];
+            sx_memcpy(&entry->desc, &desc, sizeof(desc));
+            entry->pipeline = VK_NULL_HANDLE;
+            entry->ready = false;
+            sx_hashtbl_add_and_grow(cache->table, key, (int)index, sx_alloc_malloc());
+            cache->entries_count++;
+
+            if (!build) {
+                build = pso_build_begin(info);
+            }
+            build->render_passes[build->count] = render_passes[v];
+            build->subpasses[build->count] = subpasses[v];
+            build->entries[build->count] = index;
+            build->count++;
+        }
+        handles[v] = index;
+    }
+
+    if (!build) {
+        destroy_shader_stages(info->shader_stages, info->shader_stages_count);
+        return VK_SUCCESS;
+    }
+    if (cache->jobs) {
+        build->job = sx_job_dispatch(cache->jobs, 1, pso_build_job, build, SX_JOB_PRIORITY_LOW, 0);
+        return VK_SUCCESS;
+    }
+    pso_build_job(0, 1, 0, build);
+    return pso_build_finish(build);
+}
+/*}}}*/
+
+/*{{{VkPipeline get_pipeline(PipelineHandle handle)*/
+VkPipeline get_pipeline(PipelineHandle handle) {
+    const PsoEntry* entry = &vk_context.pso.entries[handle];
+    return entry->ready ? entry->pipeline : VK_NULL_HANDLE;
+}
+/*}}}*/
+
+/*{{{void pso_cache_update()*/
+void pso_cache_update() {
+    PsoCache* cache = &vk_context.pso;
+    for (uint32_t i = 0; i < PSO_MAX_BUILDS; i++) {
+        PsoBuild* build = &cache->builds[i];
+        if (build->active && sx_job_test_and_del(cache->jobs, build->job)) {
+            pso_build_finish(build);
+        }
+    }
+}
+/*}}}*/
+
 /*{{{VkResult create_semaphore(VkSemaphore* sem)*/
 VkResult create_semaphore(VkSemaphore* sem) {
     VkSemaphoreCreateInfo sem_create_info;
@@ -1919,6 +4072,9 @@ void reset_fences(uint32_t num_fences, VkFence* fence) {
 /*{{{VkResult acquire_next_image(VkSwapchainKHR swapchain, uint64_t timeout, VkSemaphore semaphore, uint32_t* image_index)*/
 VkResult acquire_next_image(VkSwapchainKHR swapchain, uint64_t timeout, VkSemaphore semaphore, uint32_t* image_index) {
     VkResult result;
+    if (vk_context.headless) {
+        return headless_acquire_image(semaphore, image_index);
+    }
     result = vkAcquireNextImageKHR(vk_context.device.logical_device, swapchain, timeout, semaphore, VK_NULL_HANDLE, image_index);
     return result;
 }
@@ -1926,6 +4082,9 @@ VkResult acquire_next_image(VkSwapchainKHR swapchain, uint64_t timeout, VkSemaph
 
 /*{{{VkResult present_image(PresentInfo* info)*/
 VkResult present_image(PresentInfo* info) {
+    if (vk_context.headless) {
+        return headless_present_image(info);
+    }
 	VkPresentInfoKHR present_info;
 	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 	present_info.pNext = NULL;
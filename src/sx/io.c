@@ -20,6 +20,7 @@
 #    include <sys/types.h>
 #    include <fcntl.h>
 #    include <unistd.h>
+#    include <sys/mman.h>
 #    undef _LARGEFILE64_SOURCE
 #    ifndef __O_LARGEFILE
 #        define __O_LARGEFILE 0
@@ -390,6 +391,47 @@ int64_t sx_file_size(const sx_file* file)
     return f->size;
 }
 
+sx_mem_block* sx_file_map(const sx_alloc* alloc, const char* filepath)
+{
+    sx_file file;
+    if (!sx_file_open(&file, filepath, SX_FILE_READ)) {
+        return NULL;
+    }
+
+    sx__file_win32* f = (sx__file_win32*)&file;
+    sx_mem_block* mem = NULL;
+    if (f->size > 0) {
+        HANDLE mapping = CreateFileMappingA(f->handle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) {
+            // the view keeps the mapping object alive
+            void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+            if (data) {
+                mem = sx_mem_ref_block(alloc, f->size, data);
+                if (!mem) {
+                    UnmapViewOfFile(data);
+                }
+            }
+        }
+    }
+
+    sx_file_close(&file);
+    return mem;
+}
+
+void sx_file_unmap(sx_mem_block* mem)
+{
+    sx_assert(mem);
+    sx_assert(mem->refcount >= 1);
+
+    if (sx_atomic_decr(&mem->refcount) == 0) {
+        UnmapViewOfFile((uint8_t*)mem->data - mem->start_offset);
+        if (mem->alloc) {
+            sx_free(mem->alloc, mem);
+        }
+    }
+}
+
 #elif SX_PLATFORM_POSIX // if SX_PLATFORM_WINDOWS
 
 typedef struct sx__file_posix {
@@ -521,6 +563,43 @@ int64_t sx_file_size(const sx_file* file)
     return f->size;
 }
 
+sx_mem_block* sx_file_map(const sx_alloc* alloc, const char* filepath)
+{
+    sx_file file;
+    if (!sx_file_open(&file, filepath, SX_FILE_READ)) {
+        return NULL;
+    }
+
+    sx__file_posix* f = (sx__file_posix*)&file;
+    sx_mem_block* mem = NULL;
+    if (f->size > 0) {
+        // the mapping stays valid after the descriptor is closed
+        void* data = mmap(NULL, (size_t)f->size, PROT_READ, MAP_PRIVATE, f->id, 0);
+        if (data != MAP_FAILED) {
+            mem = sx_mem_ref_block(alloc, f->size, data);
+            if (!mem) {
+                munmap(data, (size_t)f->size);
+            }
+        }
+    }
+
+    sx_file_close(&file);
+    return mem;
+}
+
+void sx_file_unmap(sx_mem_block* mem)
+{
+    sx_assert(mem);
+    sx_assert(mem->refcount >= 1);
+
+    if (sx_atomic_decr(&mem->refcount) == 0) {
+        munmap((uint8_t*)mem->data - mem->start_offset, (size_t)(mem->size + mem->start_offset));
+        if (mem->alloc) {
+            sx_free(mem->alloc, mem);
+        }
+    }
+}
+
 #endif  // elif SX_PLATFORM_POSIX
 
 
@@ -568,7 +647,8 @@ static inline int64_t sx__iff_read(sx_iff_file* iff, void* data, int64_t size)
 {
     switch (iff->type) {
     case SX_IFFTYPE_MEM_READER:
-        return sx_mem_read(iff->mread, data, size);
+        // chunk scans read past the last chunk, that is the end of data and not a truncation
+        return sx_mem_read(iff->mread, data, sx_min(size, iff->mread->top - iff->mread->pos));
     case SX_IFFTYPE_DISK_READER:
     case SX_IFFTYPE_DISK_WRITER:
         return sx_file_read(iff->disk, data, size);
@@ -8,6 +8,7 @@
 #include "sx/pool.h"
 #include "sx/string.h"    // sx_snprintf
 #include "sx/threads.h"
+#include "sx/trace.h"
 
 #include <alloca.h>
 
@@ -105,7 +106,9 @@ static void fiber_fn(sx_fiber_transfer transfer)
     tdata->cur_job = job;
 
     // Run the actual job code
+    sx_trace_begin("job");
     job->callback(job->range_start, job->range_end, tdata->thread_index, job->user);
+    sx_trace_end();
     job->done = 1;
 
     // Back to job caller
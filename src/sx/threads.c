@@ -10,6 +10,7 @@
 #include "sx/allocator.h"
 #include "sx/os.h"
 #include "sx/string.h"
+#include "sx/trace.h"
 
 #if SX_PLATFORM_APPLE
 #    include <dispatch/dispatch.h>
@@ -86,10 +87,8 @@ typedef struct sx__thread_s {
     DWORD thread_id;
 #elif SX_PLATFORM_POSIX
     pthread_t handle;
-#    if SX_PLATFORM_APPLE
-    char name[32];
-#    endif
 #endif
+    char name[32];    // also names the thread in sx_trace
 
     void* user_data1;
     void* user_data2;
@@ -185,6 +184,8 @@ static void* thread_fn(void* arg)
     if (thrd->name[0])
         sx_thread_setname(thrd, thrd->name);
 #    endif
+    if (thrd->name[0])
+        sx_trace_thread_name(thrd->name);
 
     sx_semaphore_post(&thrd->sem, 1);
     cast.i = thrd->callback(thrd->user_data1, thrd->user_data2);
@@ -212,11 +213,9 @@ sx_thread* sx_thread_create(const sx_alloc* alloc, sx_thread_cb* callback, void*
     r = pthread_attr_setstacksize(&attr, thrd->stack_sz);
     sx_assertf(r == 0, "pthread_attr_setstacksize failed");
 
-#    if SX_PLATFORM_APPLE
     thrd->name[0] = 0;
     if (name)
         sx_strcpy(thrd->name, sizeof(thrd->name), name);
-#    endif
 
     r = pthread_create(&thrd->handle, &attr, thread_fn, thrd);
     sx_assertf(r == 0, "pthread_create failed");
@@ -610,6 +609,8 @@ static DWORD WINAPI thread_fn(LPVOID arg)
 {
     sx_thread* thrd = (sx_thread*)arg;
     thrd->thread_id = GetCurrentThreadId();
+    if (thrd->name[0])
+        sx_trace_thread_name(thrd->name);
     sx_semaphore_post(&thrd->sem, 1);
     return (DWORD)thrd->callback(thrd->user_data1, thrd->user_data2);
 }
@@ -627,6 +628,9 @@ sx_thread* sx_thread_create(const sx_alloc* alloc, sx_thread_cb* callback, void*
     thrd->user_data2 = user_data2;
     thrd->stack_sz = sx_max(stack_sz, (int)sx_os_minstacksz());
     thrd->running = true;
+    thrd->name[0] = 0;
+    if (name)
+        sx_strcpy(thrd->name, sizeof(thrd->name), name);
 
     thrd->handle =
         CreateThread(NULL, thrd->stack_sz, (LPTHREAD_START_ROUTINE)thread_fn, thrd, 0, NULL);
@@ -0,0 +1,199 @@
+#include "sx/trace.h"
+#include "sx/allocator.h"
+#include "sx/atomic.h"
+#include "sx/io.h"
+#include "sx/string.h"
+#include "sx/threads.h"
+#include "sx/timer.h"
+
+typedef struct sx__trace_event {
+    const char* name;    // NULL for the end of a scope
+    uint64_t ticks;
+} sx__trace_event;
+
+typedef struct sx__trace_ring {
+    sx__trace_event events[SX_TRACE_RING_SIZE];
+    sx_atomic_int64 head;    // total number of events written
+    uint32_t tid;
+    char name[32];
+} sx__trace_ring;
+
+typedef struct sx__trace_context {
+    const sx_alloc* alloc;
+    sx__trace_ring* rings[SX_TRACE_MAX_THREADS];
+    sx_atomic_int num_rings;
+} sx__trace_context;
+
+static sx__trace_context g_trace;
+static thread_local sx__trace_ring* g_trace_ring;
+
+static sx__trace_ring* sx__trace_thread_ring()
+{
+    if (g_trace_ring || !g_trace.alloc) {
+        return g_trace_ring;
+    }
+
+    // threads past the limit never record, don't touch the counter on every event
+    if (g_trace.num_rings >= SX_TRACE_MAX_THREADS) {
+        return NULL;
+    }
+    int index = sx_atomic_fetch_add(&g_trace.num_rings, 1);
+    if (index >= SX_TRACE_MAX_THREADS) {
+        return NULL;
+    }
+
+    sx__trace_ring* ring = (sx__trace_ring*)sx_malloc(g_trace.alloc, sizeof(sx__trace_ring));
+    if (!ring) {
+        sx_out_of_memory();
+        return NULL;
+    }
+    ring->head = 0;
+    ring->tid = sx_thread_tid();
+    sx_snprintf(ring->name, sizeof(ring->name), "thread %u", ring->tid);
+
+    sx_memory_write_barrier();
+    g_trace.rings[index] = ring;
+    g_trace_ring = ring;
+    return ring;
+}
+
+static inline void sx__trace_push(const char* name)
+{
+    sx__trace_ring* ring = sx__trace_thread_ring();
+    if (!ring) {
+        return;
+    }
+
+    int64_t head = ring->head;
+    sx__trace_event* ev = &ring->events[head % SX_TRACE_RING_SIZE];
+    ev->name = name;
+    ev->ticks = sx_tm_now();
+    // the event has to be visible before the dumping thread sees the new head
+    sx_memory_write_barrier();
+    ring->head = head + 1;
+}
+
+void sx_trace_init(const sx_alloc* alloc)
+{
+    sx_assert(alloc);
+    sx_assert(!g_trace.alloc && "sx_trace_init called twice");
+    sx_memset(&g_trace, 0x0, sizeof(g_trace));
+    g_trace.alloc = alloc;
+}
+
+void sx_trace_shutdown()
+{
+    if (!g_trace.alloc) {
+        return;
+    }
+
+    int num_rings = sx_min(g_trace.num_rings, SX_TRACE_MAX_THREADS);
+    for (int i = 0; i < num_rings; i++) {
+        if (g_trace.rings[i]) {
+            sx_free(g_trace.alloc, g_trace.rings[i]);
+        }
+    }
+    sx_memset(&g_trace, 0x0, sizeof(g_trace));
+    g_trace_ring = NULL;
+}
+
+void sx_trace_thread_name(const char* name)
+{
+    sx__trace_ring* ring = sx__trace_thread_ring();
+    if (ring) {
+        sx_strcpy(ring->name, sizeof(ring->name), name);
+    }
+}
+
+void sx_trace_begin(const char* name)
+{
+    sx_assert(name);
+    sx__trace_push(name);
+}
+
+void sx_trace_end()
+{
+    sx__trace_push(NULL);
+}
+
+static void sx__trace_write_string(sx_file* file, const char* str)
+{
+    char escaped[256];
+    int len = 0;
+    for (const char* c = str; *c && len < (int)sizeof(escaped) - 2; c++) {
+        if (*c == '"' || *c == '\\') {
+            escaped[len++] = '\\';
+        }
+        escaped[len++] = *c;
+    }
+    sx_file_write(file, escaped, len);
+}
+
+bool sx_trace_dump(const char* filepath)
+{
+    if (!g_trace.alloc) {
+        return false;
+    }
+
+    sx_file file;
+    if (!sx_file_open(&file, filepath, SX_FILE_WRITE)) {
+        return false;
+    }
+
+    sx__trace_event* events =
+        (sx__trace_event*)sx_malloc(g_trace.alloc, sizeof(sx__trace_event) * SX_TRACE_RING_SIZE);
+    if (!events) {
+        sx_file_close(&file);
+        sx_out_of_memory();
+        return false;
+    }
+
+    char line[128];
+    bool first = true;
+    sx_file_write_text(&file, "{\"traceEvents\":[\n");
+
+    int num_rings = sx_min(g_trace.num_rings, SX_TRACE_MAX_THREADS);
+    for (int r = 0; r < num_rings; r++) {
+        sx__trace_ring* ring = g_trace.rings[r];
+        if (!ring) {
+            continue;
+        }
+
+        sx_snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                    "\"args\":{\"name\":\"", first ? "" : ",\n", ring->tid);
+        sx_file_write_text(&file, line);
+        sx__trace_write_string(&file, ring->name);
+        sx_file_write_text(&file, "\"}}");
+        first = false;
+
+        // the owner keeps writing, so only keep the events that could not have been
+        // overwritten while they were copied
+        int64_t end = ring->head;
+        sx_memory_read_barrier();
+        int64_t copied = sx_max(end - SX_TRACE_RING_SIZE, (int64_t)0);
+        for (int64_t i = copied; i < end; i++) {
+            events[i - copied] = ring->events[i % SX_TRACE_RING_SIZE];
+        }
+        sx_memory_read_barrier();
+        // the slot of event head - SX_TRACE_RING_SIZE may be half written by now
+        int64_t start = sx_max(ring->head - SX_TRACE_RING_SIZE + 1, copied);
+
+        for (int64_t i = start; i < end; i++) {
+            const sx__trace_event* ev = &events[i - copied];
+            sx_snprintf(line, sizeof(line), ",\n{\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%.3f",
+                        ev->name ? 'B' : 'E', ring->tid, sx_tm_us(ev->ticks));
+            sx_file_write_text(&file, line);
+            if (ev->name) {
+                sx_file_write_text(&file, ",\"name\":\"");
+                sx__trace_write_string(&file, ev->name);
+                sx_file_write_text(&file, "\"");
+            }
+            sx_file_write_text(&file, "}");
+        }
+    }
+
+    sx_file_write_text(&file, "\n]}\n");
+    sx_file_close(&file);
+    sx_free(g_trace.alloc, events);
+    return true;
+}
@@ -0,0 +1,167 @@
+#include "world/atm_bake.h"
+#include "sx/string.h"
+
+#define MULTI_SCAT_SAMPLE_COUNT_SQRT 8
+#define MULTI_SCAT_SAMPLE_COUNT (MULTI_SCAT_SAMPLE_COUNT_SQRT * MULTI_SCAT_SAMPLE_COUNT_SQRT)
+
+typedef struct AtmBakeJob {
+    const Atmosphere* atm;
+    const AtmLut* transmittance;
+    AtmLut* lut;
+    /* sphere directions of the multi scattering integration, 4 per simd vector */
+    AtmVec3x4 directions[MULTI_SCAT_SAMPLE_COUNT / 4];
+} AtmBakeJob;
+
+/*{{{AtmLut atm_lut_create(const sx_alloc* alloc, uint32_t width, uint32_t height)*/
+AtmLut atm_lut_create(const sx_alloc* alloc, uint32_t width, uint32_t height) {
+    AtmLut lut;
+    lut.width = width;
+    lut.height = height;
+    lut.data = sx_malloc(alloc, (size_t)width * height * 4 * sizeof(float));
+    sx_assert_rel(lut.data && "Could not allocate lut");
+    return lut;
+}
+/*}}}*/
+
+/*{{{void atm_lut_destroy(const sx_alloc* alloc, AtmLut* lut)*/
+void atm_lut_destroy(const sx_alloc* alloc, AtmLut* lut) {
+    sx_free(alloc, lut->data);
+    lut->data = NULL;
+}
+/*}}}*/
+
+/*{{{static void store_texels(AtmLut* lut, uint32_t x, uint32_t y, AtmVec3x4 rgb)*/
+static void store_texels(AtmLut* lut, uint32_t x, uint32_t y, AtmVec3x4 rgb) {
+    sx_vec3 texels[4];
+    atm_vec3x4_store(rgb, texels);
+    for (uint32_t i = 0; i < 4 && x + i < lut->width; i++) {
+        float* texel = lut->data + ((size_t)y * lut->width + x + i) * 4;
+        texel[0] = texels[i].x;
+        texel[1] = texels[i].y;
+        texel[2] = texels[i].z;
+        texel[3] = 1.f;
+    }
+}
+/*}}}*/
+
+/*{{{static void transmittance_rows(int range_start, int range_end, int thread_index, void* user)*/
+static void transmittance_rows(int range_start, int range_end, int thread_index, void* user) {
+    sx_unused(thread_index);
+    AtmBakeJob* job = user;
+    AtmLut* lut = job->lut;
+    const float width = (float)lut->width;
+    const float height = (float)lut->height;
+
+    for (int y = range_start; y < range_end; y++) {
+        sx_simd_t v = sx_simd_splat1(((float)y + 0.5f) / height);
+        for (uint32_t x = 0; x < lut->width; x += 4) {
+            sx_simd_t u = sx_simd_load4(((float)x + 0.5f) / width, ((float)x + 1.5f) / width,
+                                        ((float)x + 2.5f) / width, ((float)x + 3.5f) / width);
+            sx_simd_t h, mu;
+            atm_uv_to_transmittance(job->atm, u, v, lut->width, lut->height, &h, &mu);
+
+            /* without a lut this integrates exp(-opticalThickness) along (0, mu, sqrt(1 - mu^2)) */
+            AtmVec3x4 transmittance = atm_sun_transmittance(job->atm, NULL, h, mu);
+            store_texels(lut, x, (uint32_t)y, transmittance);
+        }
+    }
+}
+/*}}}*/
+
+/*{{{void atm_bake_transmittance(sx_job_context* ctx, const Atmosphere* atm, AtmLut* lut)*/
+void atm_bake_transmittance(sx_job_context* ctx, const Atmosphere* atm, AtmLut* lut) {
+    AtmBakeJob job = { .atm = atm, .transmittance = NULL, .lut = lut };
+    if (!ctx) {
+        transmittance_rows(0, (int)lut->height, 0, &job);
+        return;
+    }
+
+    sx_job_t handle = sx_job_dispatch(ctx, (int)lut->height, transmittance_rows, &job, SX_JOB_PRIORITY_HIGH, 0);
+    sx_job_wait_and_del(ctx, handle);
+}
+/*}}}*/
+
+/*{{{static void multi_scattering_texels(int range_start, int range_end, int thread_index, void* user)*/
+static void multi_scattering_texels(int range_start, int range_end, int thread_index, void* user) {
+    sx_unused(thread_index);
+    AtmBakeJob* job = user;
+    AtmLut* lut = job->lut;
+    const sx_simd_t zero = sx_simd_zero();
+    const float solid_angle = 4.f * SX_PI;
+    const float iso_angle = 1.f / solid_angle;
+    const sx_simd_t sample_weight = sx_simd_splat1(solid_angle / (float)MULTI_SCAT_SAMPLE_COUNT);
+
+    for (int texel = range_start; texel < range_end; texel++) {
+        uint32_t x = (uint32_t)texel % lut->width;
+        uint32_t y = (uint32_t)texel / lut->width;
+        sx_simd_t u = sx_simd_splat1(((float)x + 0.5f) / (float)lut->width);
+        sx_simd_t v = sx_simd_splat1(((float)y + 0.5f) / (float)lut->height);
+        sx_simd_t h, cos_sun;
+        atm_uv_to_multi_scattering(job->atm, u, v, lut->width, lut->height, &h, &cos_sun);
+        sx_simd_t sin_sun = sx_simd_sqrt(sx_simd_max(zero, sx_simd_sub(sx_simd_splat1(1.f), sx_simd_mul(cos_sun, cos_sun))));
+
+        AtmVec3x4 pos = { zero, h, zero };
+        AtmVec3x4 sun_dir = { zero, cos_sun, sin_sun };
+
+        sx_vec3 ms_as1[MULTI_SCAT_SAMPLE_COUNT];
+        sx_vec3 L[MULTI_SCAT_SAMPLE_COUNT];
+        for (int i = 0; i < MULTI_SCAT_SAMPLE_COUNT / 4; i++) {
+            AtmMultiScatteringResult result = atm_integrate_radiance(job->atm, job->transmittance, pos,
+                                                                     job->directions[i], sun_dir);
+            result.ms_as1.x = sx_simd_mul(result.ms_as1.x, sample_weight);
+            result.ms_as1.y = sx_simd_mul(result.ms_as1.y, sample_weight);
+            result.ms_as1.z = sx_simd_mul(result.ms_as1.z, sample_weight);
+            result.L.x = sx_simd_mul(result.L.x, sample_weight);
+            result.L.y = sx_simd_mul(result.L.y, sample_weight);
+            result.L.z = sx_simd_mul(result.L.z, sample_weight);
+            atm_vec3x4_store(result.ms_as1, &ms_as1[i * 4]);
+            atm_vec3x4_store(result.L, &L[i * 4]);
+        }
+
+        /* same tree as the shared memory reduction: [i] += [i + 32], [i] += [i + 16], ... */
+        for (int stride = MULTI_SCAT_SAMPLE_COUNT / 2; stride > 0; stride /= 2) {
+            for (int i = 0; i < stride; i++) {
+                ms_as1[i] = sx_vec3_add(ms_as1[i], ms_as1[i + stride]);
+                L[i] = sx_vec3_add(L[i], L[i + stride]);
+            }
+        }
+
+        float* texel_out = lut->data + ((size_t)y * lut->width + x) * 4;
+        for (int c = 0; c < 3; c++) {
+            float ms = ms_as1[0].f[c] * iso_angle;
+            float in_scat_radiance = L[0].f[c] * iso_angle;
+            float r = sx_clamp(ms, 0.f, 0.999f);
+            texel_out[c] = in_scat_radiance * (1.f / (1.f - r));
+        }
+        texel_out[3] = 1.f;
+    }
+}
+/*}}}*/
+
+/*{{{void atm_bake_multi_scattering(sx_job_context* ctx, const Atmosphere* atm, const AtmLut* transmittance, AtmLut* lut)*/
+void atm_bake_multi_scattering(sx_job_context* ctx, const Atmosphere* atm, const AtmLut* transmittance, AtmLut* lut) {
+    AtmBakeJob job = { .atm = atm, .transmittance = transmittance, .lut = lut };
+
+    for (int i = 0; i < MULTI_SCAT_SAMPLE_COUNT / 4; i++) {
+        sx_vec3 dirs[4];
+        for (int k = 0; k < 4; k++) {
+            int z = i * 4 + k;
+            float a = (0.5f + (float)(z / MULTI_SCAT_SAMPLE_COUNT_SQRT)) / (float)MULTI_SCAT_SAMPLE_COUNT_SQRT;
+            float b = (0.5f + (float)(z % MULTI_SCAT_SAMPLE_COUNT_SQRT)) / (float)MULTI_SCAT_SAMPLE_COUNT_SQRT;
+            float theta = 2.f * SX_PI * a;
+            float phi = SX_PI * b;
+            dirs[k] = sx_vec3f(sx_sin(theta) * sx_sin(phi), sx_cos(phi), sx_cos(theta) * sx_sin(phi));
+        }
+        job.directions[i] = atm_vec3x4_load(dirs);
+    }
+
+    int texel_count = (int)(lut->width * lut->height);
+    if (!ctx) {
+        multi_scattering_texels(0, texel_count, 0, &job);
+        return;
+    }
+
+    sx_job_t handle = sx_job_dispatch(ctx, texel_count, multi_scattering_texels, &job, SX_JOB_PRIORITY_HIGH, 0);
+    sx_job_wait_and_del(ctx, handle);
+}
+/*}}}*/
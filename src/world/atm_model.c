@@ -0,0 +1,498 @@
+#include "world/atm_model.h"
+
+/*{{{ simd helpers */
+static inline sx_simd_t simd_select(sx_simd_t mask, sx_simd_t a, sx_simd_t b) {
+    return sx_simd_or(sx_simd_and(mask, a), sx_simd_andc(b, mask));
+}
+
+static inline sx_simd_t simd_floor(sx_simd_t a) {
+    sx_simd_t r = sx_simd_round(a);
+    return sx_simd_sub(r, sx_simd_and(sx_simd_cmpgt(r, a), sx_simd_splat1(1.f)));
+}
+
+/* Cephes style expf, ~1 ulp in the range the model uses */
+static inline sx_simd_t simd_exp(sx_simd_t x) {
+    x = simd_clamp(x, sx_simd_splat1(-87.3f), sx_simd_splat1(88.3f));
+    sx_simd_t n = sx_simd_round(sx_simd_mul(x, sx_simd_splat1(1.44269504088896341f)));
+    x = sx_simd_sub(x, sx_simd_mul(n, sx_simd_splat1(0.693359375f)));
+    x = sx_simd_sub(x, sx_simd_mul(n, sx_simd_splat1(-2.12194440e-4f)));
+
+    sx_simd_t y = sx_simd_splat1(1.9875691500e-4f);
+    y = sx_simd_madd(y, x, sx_simd_splat1(1.3981999507e-3f));
+    y = sx_simd_madd(y, x, sx_simd_splat1(8.3334519073e-3f));
+    y = sx_simd_madd(y, x, sx_simd_splat1(4.1665795894e-2f));
+    y = sx_simd_madd(y, x, sx_simd_splat1(1.6666665459e-1f));
+    y = sx_simd_madd(y, x, sx_simd_splat1(5.0000001201e-1f));
+    y = sx_simd_madd(y, sx_simd_mul(x, x), sx_simd_add(x, sx_simd_splat1(1.f)));
+
+    /* 2^n built directly in the exponent bits: (n + 127) << 23 */
+    sx_simd_t pow2n = sx_simd_ftoi(sx_simd_mul(sx_simd_add(n, sx_simd_splat1(127.f)), sx_simd_splat1(8388608.f)));
+    return sx_simd_mul(y, pow2n);
+}
+
+static inline AtmVec3x4 v3_splat(float x, float y, float z) {
+    return (AtmVec3x4){ sx_simd_splat1(x), sx_simd_splat1(y), sx_simd_splat1(z) };
+}
+
+static inline AtmVec3x4 v3_rgb(sx_vec4 v) {
+    return v3_splat(v.x, v.y, v.z);
+}
+
+static inline AtmVec3x4 v3_add(AtmVec3x4 a, AtmVec3x4 b) {
+    return (AtmVec3x4){ sx_simd_add(a.x, b.x), sx_simd_add(a.y, b.y), sx_simd_add(a.z, b.z) };
+}
+
+static inline AtmVec3x4 v3_sub(AtmVec3x4 a, AtmVec3x4 b) {
+    return (AtmVec3x4){ sx_simd_sub(a.x, b.x), sx_simd_sub(a.y, b.y), sx_simd_sub(a.z, b.z) };
+}
+
+static inline AtmVec3x4 v3_mul(AtmVec3x4 a, AtmVec3x4 b) {
+    return (AtmVec3x4){ sx_simd_mul(a.x, b.x), sx_simd_mul(a.y, b.y), sx_simd_mul(a.z, b.z) };
+}
+
+static inline AtmVec3x4 v3_div(AtmVec3x4 a, AtmVec3x4 b) {
+    return (AtmVec3x4){ sx_simd_div(a.x, b.x), sx_simd_div(a.y, b.y), sx_simd_div(a.z, b.z) };
+}
+
+static inline AtmVec3x4 v3_scale(AtmVec3x4 a, sx_simd_t s) {
+    return (AtmVec3x4){ sx_simd_mul(a.x, s), sx_simd_mul(a.y, s), sx_simd_mul(a.z, s) };
+}
+
+static inline AtmVec3x4 v3_madd(AtmVec3x4 a, sx_simd_t s, AtmVec3x4 b) {
+    return (AtmVec3x4){ sx_simd_madd(a.x, s, b.x), sx_simd_madd(a.y, s, b.y), sx_simd_madd(a.z, s, b.z) };
+}
+
+static inline AtmVec3x4 v3_select(sx_simd_t mask, AtmVec3x4 a, AtmVec3x4 b) {
+    return (AtmVec3x4){ simd_select(mask, a.x, b.x), simd_select(mask, a.y, b.y), simd_select(mask, a.z, b.z) };
+}
+
+static inline AtmVec3x4 v3_exp(AtmVec3x4 a) {
+    return (AtmVec3x4){ simd_exp(a.x), simd_exp(a.y), simd_exp(a.z) };
+}
+
+static inline sx_simd_t v3_dot(AtmVec3x4 a, AtmVec3x4 b) {
+    return sx_simd_madd(a.x, b.x, sx_simd_madd(a.y, b.y, sx_simd_mul(a.z, b.z)));
+}
+
+static inline sx_simd_t v3_length(AtmVec3x4 a) {
+    return sx_simd_sqrt(v3_dot(a, a));
+}
+/*}}}*/
+
+/*{{{AtmVec3x4 atm_vec3x4(const sx_vec3 v)*/
+AtmVec3x4 atm_vec3x4(const sx_vec3 v) {
+    return v3_splat(v.x, v.y, v.z);
+}
+/*}}}*/
+
+/*{{{AtmVec3x4 atm_vec3x4_load(const sx_vec3 v[4])*/
+AtmVec3x4 atm_vec3x4_load(const sx_vec3 v[4]) {
+    AtmVec3x4 r;
+    r.x = sx_simd_load4(v[0].x, v[1].x, v[2].x, v[3].x);
+    r.y = sx_simd_load4(v[0].y, v[1].y, v[2].y, v[3].y);
+    r.z = sx_simd_load4(v[0].z, v[1].z, v[2].z, v[3].z);
+    return r;
+}
+/*}}}*/
+
+/*{{{void atm_vec3x4_store(AtmVec3x4 v, sx_vec3 out[4])*/
+void atm_vec3x4_store(AtmVec3x4 v, sx_vec3 out[4]) {
+    for (int i = 0; i < 4; i++) {
+        out[i].x = ((float*)&v.x)[i];
+        out[i].y = ((float*)&v.y)[i];
+        out[i].z = ((float*)&v.z)[i];
+    }
+}
+/*}}}*/
+
+/*{{{sx_simd_t atm_intersect_ray_sphere(AtmVec3x4 ro, AtmVec3x4 rd, AtmVec3x4 so, sx_simd_t sr)*/
+sx_simd_t atm_intersect_ray_sphere(AtmVec3x4 ro, AtmVec3x4 rd, AtmVec3x4 so, sx_simd_t sr) {
+    const sx_simd_t zero = sx_simd_zero();
+    const sx_simd_t miss = sx_simd_splat1(-1.f);
+
+    AtmVec3x4 f = v3_sub(ro, so);
+    sx_simd_t b2 = v3_dot(f, rd);
+    sx_simd_t r2 = sx_simd_mul(sr, sr);
+    AtmVec3x4 fd = v3_sub(f, v3_scale(rd, b2));
+    sx_simd_t discriminant = sx_simd_sub(r2, v3_dot(fd, fd));
+
+    sx_simd_t c = sx_simd_sub(v3_dot(f, f), r2);
+    sx_simd_t sqrtv = sx_simd_sqrt(sx_simd_max(discriminant, zero));
+    sx_simd_t q = simd_select(sx_simd_cmpge(b2, zero), sx_simd_sub(simd_neg(sqrtv), b2), sx_simd_sub(sqrtv, b2));
+
+    sx_simd_t t0 = sx_simd_div(c, q);
+    sx_simd_t t1 = q;
+    sx_simd_t t0_neg = sx_simd_cmplt(t0, zero);
+    sx_simd_t t1_neg = sx_simd_cmplt(t1, zero);
+
+    sx_simd_t t = simd_select(t1_neg, sx_simd_max(zero, t0), sx_simd_max(zero, sx_simd_min(t0, t1)));
+    t = simd_select(t0_neg, sx_simd_max(zero, t1), t);
+    t = simd_select(sx_simd_and(t0_neg, t1_neg), miss, t);
+    return simd_select(sx_simd_cmplt(discriminant, zero), miss, t);
+}
+/*}}}*/
+
+/*{{{sx_simd_t atm_get_ray_tmax(const Atmosphere* atm, AtmVec3x4 pos, AtmVec3x4 dir, float max_max)*/
+sx_simd_t atm_get_ray_tmax(const Atmosphere* atm, AtmVec3x4 pos, AtmVec3x4 dir, float max_max) {
+    const sx_simd_t zero = sx_simd_zero();
+    AtmVec3x4 org = v3_splat(0.f, 0.f, 0.f);
+    sx_simd_t t_bottom = atm_intersect_ray_sphere(pos, dir, org, sx_simd_splat1(atm->bottom_radius));
+    sx_simd_t t_top = atm_intersect_ray_sphere(pos, dir, org, sx_simd_splat1(atm->top_radius));
+
+    sx_simd_t above = simd_select(sx_simd_cmplt(t_top, zero), zero, t_top);
+    sx_simd_t below = simd_select(sx_simd_cmpgt(t_top, zero), sx_simd_min(t_top, t_bottom), zero);
+    sx_simd_t t_max = simd_select(sx_simd_cmplt(t_bottom, zero), above, below);
+
+    return sx_simd_min(t_max, sx_simd_splat1(max_max));
+}
+/*}}}*/
+
+/*{{{AtmMediumSample atm_sample_medium(const Atmosphere* atm, AtmVec3x4 pos)*/
+AtmMediumSample atm_sample_medium(const Atmosphere* atm, AtmVec3x4 pos) {
+    sx_simd_t height = sx_simd_sub(v3_length(pos), sx_simd_splat1(atm->bottom_radius));
+
+    sx_simd_t m_density = simd_exp(sx_simd_div(simd_neg(height), sx_simd_splat1(1.2f)));
+    sx_simd_t r_density = simd_exp(sx_simd_div(simd_neg(height), sx_simd_splat1(8.f)));
+
+    AtmMediumSample s;
+    s.mie_scattering = v3_scale(v3_rgb(atm->mie_scattering), m_density);
+    s.mie_absorption = v3_scale(v3_rgb(atm->mie_absorption), m_density);
+    s.mie_extinction = v3_scale(v3_add(v3_rgb(atm->mie_scattering), v3_rgb(atm->mie_absorption)), m_density);
+
+    s.rayleigh_scattering = v3_scale(v3_rgb(atm->rayleigh_scattering), r_density);
+    s.rayleigh_absorption = v3_splat(0.f, 0.f, 0.f);
+    s.rayleigh_extinction = v3_add(s.rayleigh_scattering, s.rayleigh_absorption);
+
+    s.scattering = v3_add(s.mie_scattering, s.rayleigh_scattering);
+    s.absorption = v3_add(s.mie_absorption, s.rayleigh_absorption);
+    s.extinction = v3_add(s.mie_extinction, s.rayleigh_extinction);
+
+    return s;
+}
+/*}}}*/
+
+/*{{{AtmVec3x4 atm_compute_optical_thickness(const Atmosphere* atm, AtmVec3x4 pos, AtmVec3x4 dir, float max_max)*/
+AtmVec3x4 atm_compute_optical_thickness(const Atmosphere* atm, AtmVec3x4 pos, AtmVec3x4 dir, float max_max) {
+    const float sample_count = 50.f;
+    const float segment_frac = 0.3f;
+    sx_simd_t t_max = atm_get_ray_tmax(atm, pos, dir, max_max);
+    sx_simd_t bottom = sx_simd_splat1(atm->bottom_radius);
+
+    sx_simd_t t = sx_simd_zero();
+    sx_simd_t m_density = sx_simd_zero();
+    sx_simd_t r_density = sx_simd_zero();
+    for (float s = 0.f; s < sample_count; s += 1.f) {
+        sx_simd_t t_new = sx_simd_div(sx_simd_mul(t_max, sx_simd_splat1(s + segment_frac)), sx_simd_splat1(sample_count));
+        sx_simd_t dt = sx_simd_sub(t_new, t);
+        t = t_new;
+
+        AtmVec3x4 p = v3_madd(dir, t, pos);
+        sx_simd_t height = sx_simd_sub(v3_length(p), bottom);
+        m_density = sx_simd_madd(simd_exp(sx_simd_div(simd_neg(height), sx_simd_splat1(1.2f))), dt, m_density);
+        r_density = sx_simd_madd(simd_exp(sx_simd_div(simd_neg(height), sx_simd_splat1(8.f))), dt, r_density);
+    }
+
+    AtmVec3x4 mie_extinction = v3_add(v3_rgb(atm->mie_scattering), v3_rgb(atm->mie_absorption));
+    return v3_add(v3_scale(v3_rgb(atm->rayleigh_scattering), r_density), v3_scale(mie_extinction, m_density));
+}
+/*}}}*/
+
+/*{{{sx_simd_t atm_uvs_to_unit(sx_simd_t u, float resolution)*/
+sx_simd_t atm_uvs_to_unit(sx_simd_t u, float resolution) {
+    return sx_simd_mul(sx_simd_add(u, sx_simd_splat1(0.5f / resolution)),
+                       sx_simd_splat1(resolution / (resolution + 1.f)));
+}
+/*}}}*/
+
+/*{{{sx_simd_t atm_unit_to_uvs(sx_simd_t u, float resolution)*/
+sx_simd_t atm_unit_to_uvs(sx_simd_t u, float resolution) {
+    return sx_simd_mul(sx_simd_sub(u, sx_simd_splat1(0.5f / resolution)),
+                       sx_simd_splat1(resolution / (resolution - 1.f)));
+}
+/*}}}*/
+
+/*{{{void atm_uv_to_transmittance(...)*/
+void atm_uv_to_transmittance(const Atmosphere* atm, sx_simd_t u, sx_simd_t v, uint32_t width, uint32_t height,
+                             sx_simd_t* height_out, sx_simd_t* view_cos_angle) {
+    const float top = atm->top_radius;
+    const float bottom = atm->bottom_radius;
+    sx_simd_t x_mu = atm_uvs_to_unit(u, (float)width);
+    sx_simd_t x_r = atm_uvs_to_unit(v, (float)height);
+
+    sx_simd_t H = sx_simd_splat1(sx_sqrt(top * top - bottom * bottom));
+    sx_simd_t rho = sx_simd_mul(H, x_r);
+    sx_simd_t h = sx_simd_sqrt(sx_simd_madd(rho, rho, sx_simd_splat1(bottom * bottom)));
+
+    sx_simd_t d_min = sx_simd_sub(sx_simd_splat1(top), h);
+    sx_simd_t d_max = sx_simd_add(rho, H);
+    sx_simd_t d = sx_simd_madd(x_mu, sx_simd_sub(d_max, d_min), d_min);
+
+    sx_simd_t num = sx_simd_sub(sx_simd_sub(sx_simd_mul(H, H), sx_simd_mul(rho, rho)), sx_simd_mul(d, d));
+    sx_simd_t mu = sx_simd_div(num, sx_simd_mul(sx_simd_splat1(2.f), sx_simd_mul(h, d)));
+    mu = simd_select(sx_simd_cmpeq(d, sx_simd_zero()), sx_simd_splat1(1.f), mu);
+
+    *height_out = h;
+    *view_cos_angle = simd_clamp(mu, sx_simd_splat1(-1.f), sx_simd_splat1(1.f));
+}
+/*}}}*/
+
+/*{{{void atm_transmittance_to_uv(...)*/
+void atm_transmittance_to_uv(const Atmosphere* atm, sx_simd_t height, sx_simd_t view_cos_angle,
+                             sx_simd_t* u, sx_simd_t* v) {
+    const sx_simd_t zero = sx_simd_zero();
+    const float top = atm->top_radius;
+    const float bottom = atm->bottom_radius;
+
+    sx_simd_t H = sx_simd_splat1(sx_sqrt(sx_max(0.f, top * top - bottom * bottom)));
+    sx_simd_t rho = sx_simd_sqrt(sx_simd_max(zero, sx_simd_sub(sx_simd_mul(height, height), sx_simd_splat1(bottom * bottom))));
+
+    sx_simd_t cos2 = sx_simd_sub(sx_simd_mul(view_cos_angle, view_cos_angle), sx_simd_splat1(1.f));
+    sx_simd_t discriminant = sx_simd_madd(sx_simd_mul(height, height), cos2, sx_simd_splat1(top * top));
+    sx_simd_t d = sx_simd_max(zero, sx_simd_add(simd_neg(sx_simd_mul(height, view_cos_angle)),
+                                                sx_simd_sqrt(sx_simd_max(discriminant, zero))));
+
+    sx_simd_t d_min = sx_simd_sub(sx_simd_splat1(top), height);
+    sx_simd_t d_max = sx_simd_add(rho, H);
+    *u = sx_simd_div(sx_simd_sub(d, d_min), sx_simd_sub(d_max, d_min));
+    *v = sx_simd_div(rho, H);
+}
+/*}}}*/
+
+/*{{{void atm_uv_to_multi_scattering(...)*/
+void atm_uv_to_multi_scattering(const Atmosphere* atm, sx_simd_t u, sx_simd_t v, uint32_t width, uint32_t height,
+                                sx_simd_t* height_out, sx_simd_t* sun_cos_angle) {
+    u = atm_uvs_to_unit(u, (float)width);
+    v = atm_uvs_to_unit(v, (float)height);
+
+    *sun_cos_angle = sx_simd_sub(sx_simd_mul(u, sx_simd_splat1(2.f)), sx_simd_splat1(1.f));
+    sx_simd_t h = simd_clamp(sx_simd_add(v, sx_simd_splat1(0.01f)), sx_simd_zero(), sx_simd_splat1(1.f));
+    *height_out = sx_simd_madd(h, sx_simd_splat1(atm->top_radius - atm->bottom_radius - 0.01f),
+                               sx_simd_splat1(atm->bottom_radius));
+}
+/*}}}*/
+
+/*{{{void atm_multi_scattering_to_uv(...)*/
+void atm_multi_scattering_to_uv(const Atmosphere* atm, sx_simd_t height, sx_simd_t sun_cos_angle,
+                                uint32_t width, uint32_t height_res, sx_simd_t* u, sx_simd_t* v) {
+    const sx_simd_t zero = sx_simd_zero();
+    const sx_simd_t one = sx_simd_splat1(1.f);
+    sx_simd_t x = simd_clamp(sx_simd_madd(sun_cos_angle, sx_simd_splat1(0.5f), sx_simd_splat1(0.5f)), zero, one);
+    sx_simd_t y = sx_simd_div(sx_simd_sub(height, sx_simd_splat1(atm->bottom_radius)),
+                              sx_simd_splat1(atm->top_radius - atm->bottom_radius));
+    y = simd_clamp(y, zero, one);
+
+    *u = atm_unit_to_uvs(x, (float)width);
+    *v = atm_unit_to_uvs(y, (float)height_res);
+}
+/*}}}*/
+
+/*{{{AtmVec3x4 atm_sample_lut(const AtmLut* lut, sx_simd_t u, sx_simd_t v)*/
+AtmVec3x4 atm_sample_lut(const AtmLut* lut, sx_simd_t u, sx_simd_t v) {
+    sx_align_decl(16, float us[4]);
+    sx_align_decl(16, float vs[4]);
+    sx_align_decl(16, float rgb[3][4]);
+    sx_simd_store(us, u);
+    sx_simd_store(vs, v);
+
+    const int w = (int)lut->width;
+    const int h = (int)lut->height;
+    for (int i = 0; i < 4; i++) {
+        float x = us[i] * (float)w - 0.5f;
+        float y = vs[i] * (float)h - 0.5f;
+        float x0f = sx_floor(x);
+        float y0f = sx_floor(y);
+        float fx = x - x0f;
+        float fy = y - y0f;
+        int x0 = sx_clamp((int)x0f, 0, w - 1);
+        int y0 = sx_clamp((int)y0f, 0, h - 1);
+        int x1 = sx_clamp((int)x0f + 1, 0, w - 1);
+        int y1 = sx_clamp((int)y0f + 1, 0, h - 1);
+
+        const float* p00 = lut->data + (y0 * w + x0) * 4;
+        const float* p10 = lut->data + (y0 * w + x1) * 4;
+        const float* p01 = lut->data + (y1 * w + x0) * 4;
+        const float* p11 = lut->data + (y1 * w + x1) * 4;
+        for (int c = 0; c < 3; c++) {
+            float a = p00[c] + (p10[c] - p00[c]) * fx;
+            float b = p01[c] + (p11[c] - p01[c]) * fx;
+            rgb[c][i] = a + (b - a) * fy;
+        }
+    }
+
+    return (AtmVec3x4){ sx_simd_load(rgb[0]), sx_simd_load(rgb[1]), sx_simd_load(rgb[2]) };
+}
+/*}}}*/
+
+/*{{{AtmVec3x4 atm_sun_transmittance(...)*/
+AtmVec3x4 atm_sun_transmittance(const Atmosphere* atm, const AtmLut* lut, sx_simd_t height, sx_simd_t sun_cos_angle) {
+    if (lut) {
+        sx_simd_t u, v;
+        atm_transmittance_to_uv(atm, height, sun_cos_angle, &u, &v);
+        return atm_sample_lut(lut, u, v);
+    }
+
+    sx_simd_t sin_angle = sx_simd_sqrt(sx_simd_max(sx_simd_zero(),
+                sx_simd_sub(sx_simd_splat1(1.f), sx_simd_mul(sun_cos_angle, sun_cos_angle))));
+    AtmVec3x4 pos = { sx_simd_zero(), height, sx_simd_zero() };
+    AtmVec3x4 dir = { sx_simd_zero(), sun_cos_angle, sin_angle };
+    AtmVec3x4 ot = atm_compute_optical_thickness(atm, pos, dir, 900000000.f);
+    return v3_exp(v3_scale(ot, sx_simd_splat1(-1.f)));
+}
+/*}}}*/
+
+/*{{{AtmMultiScatteringResult atm_integrate_radiance(...)*/
+AtmMultiScatteringResult atm_integrate_radiance(const Atmosphere* atm, const AtmLut* transmittance,
+                                                AtmVec3x4 pos, AtmVec3x4 dir, AtmVec3x4 sun_dir) {
+    const float sample_count = 20.f;
+    const float segment_frac = 0.3f;
+    const sx_simd_t zero = sx_simd_zero();
+    const sx_simd_t pu = sx_simd_splat1(1.f / (4.f * SX_PI));
+    const sx_simd_t bottom = sx_simd_splat1(atm->bottom_radius);
+    AtmVec3x4 orig = v3_splat(0.f, 0.f, 0.f);
+
+    sx_simd_t t_max = atm_get_ray_tmax(atm, pos, dir, 9000000.f);
+
+    AtmVec3x4 L = v3_splat(0.f, 0.f, 0.f);
+    AtmVec3x4 ms_as1 = v3_splat(0.f, 0.f, 0.f);
+    AtmVec3x4 view_transmittance = v3_splat(1.f, 1.f, 1.f);
+    sx_simd_t t = zero;
+    for (float s = 0.f; s < sample_count; s += 1.f) {
+        sx_simd_t t_new = sx_simd_div(sx_simd_mul(t_max, sx_simd_splat1(s + segment_frac)), sx_simd_splat1(sample_count));
+        sx_simd_t dt = sx_simd_sub(t_new, t);
+        t = t_new;
+
+        AtmVec3x4 p = v3_madd(dir, t, pos);
+        AtmMediumSample medium = atm_sample_medium(atm, p);
+        AtmVec3x4 sample_transmittance = v3_exp(v3_scale(medium.extinction, simd_neg(dt)));
+
+        sx_simd_t height = v3_length(p);
+        AtmVec3x4 up = v3_scale(p, simd_rcp(height));
+        sx_simd_t sun_cos_angle = v3_dot(up, sun_dir);
+        AtmVec3x4 sun_transmittance = atm_sun_transmittance(atm, transmittance, height, sun_cos_angle);
+
+        AtmVec3x4 f = v3_scale(medium.scattering, pu);
+        sx_simd_t ts = atm_intersect_ray_sphere(p, sun_dir, v3_madd(up, sx_simd_splat1(0.01f), orig), bottom);
+        sx_simd_t eshadow = simd_select(sx_simd_cmpge(ts, zero), zero, sx_simd_splat1(1.f));
+        AtmVec3x4 S = v3_scale(v3_mul(sun_transmittance, f), eshadow);
+
+        AtmVec3x4 MS = medium.scattering;
+        AtmVec3x4 MS_int = v3_div(v3_sub(MS, v3_mul(MS, sample_transmittance)), medium.extinction);
+        ms_as1 = v3_add(ms_as1, v3_mul(view_transmittance, MS_int));
+
+        AtmVec3x4 S_int = v3_div(v3_sub(S, v3_mul(S, sample_transmittance)), medium.extinction);
+        L = v3_add(L, v3_mul(view_transmittance, S_int));
+        view_transmittance = v3_mul(view_transmittance, sample_transmittance);
+    }
+
+    /* ground bounce with albedo 0.01 */
+    sx_simd_t t_bottom = atm_intersect_ray_sphere(pos, dir, orig, bottom);
+    sx_simd_t hit_ground = sx_simd_and(sx_simd_cmpeq(t_max, t_bottom), sx_simd_cmpgt(t_bottom, zero));
+    if (sx_simd_test_any_xyzw(hit_ground)) {
+        AtmVec3x4 p = v3_madd(dir, t_bottom, pos);
+        sx_simd_t height = v3_length(p);
+        AtmVec3x4 up = v3_scale(p, simd_rcp(height));
+        sx_simd_t sun_cos_angle = v3_dot(up, sun_dir);
+        AtmVec3x4 sun_transmittance = atm_sun_transmittance(atm, transmittance, height, sun_cos_angle);
+
+        sx_simd_t nl = simd_clamp(sx_simd_div(sun_cos_angle, v3_length(sun_dir)), zero, sx_simd_splat1(1.f));
+        AtmVec3x4 ground = v3_scale(v3_mul(sun_transmittance, view_transmittance), sx_simd_mul(nl, sx_simd_splat1(0.01f / SX_PI)));
+        L = v3_select(hit_ground, v3_add(L, ground), L);
+    }
+
+    AtmMultiScatteringResult result = { L, ms_as1 };
+    return result;
+}
+/*}}}*/
+
+/*{{{AtmScatteringResult atm_integrate_sky_radiance(...)*/
+AtmScatteringResult atm_integrate_sky_radiance(const Atmosphere* atm, const AtmLut* transmittance,
+                                               const AtmLut* multi_scat, AtmVec3x4 pos, AtmVec3x4 dir) {
+    const float segment_frac = 0.3f;
+    const float sun_intensity = 10.f;
+    const sx_simd_t zero = sx_simd_zero();
+    const sx_simd_t one = sx_simd_splat1(1.f);
+    const sx_simd_t bottom = sx_simd_splat1(atm->bottom_radius);
+    AtmVec3x4 orig = v3_splat(0.f, 0.f, 0.f);
+
+    sx_vec3 sun = sx_vec3_norm(sx_vec3f(atm->sun_direction.x, atm->sun_direction.y, atm->sun_direction.z));
+    AtmVec3x4 sun_dir = atm_vec3x4(sun);
+
+    sx_simd_t inside = sx_simd_cmpge(v3_length(pos), bottom);
+    sx_simd_t t_max = atm_get_ray_tmax(atm, pos, dir, 9000000.f);
+    sx_simd_t sample_count = simd_lerp(one, sx_simd_splat1(40.f),
+                                       simd_clamp(sx_simd_mul(t_max, sx_simd_splat1(0.01f)), zero, one));
+    sx_simd_t count_floor = simd_floor(sample_count);
+    sx_simd_t max_floor = sx_simd_div(sx_simd_mul(t_max, count_floor), sample_count);
+
+    const float g = 0.8f;
+    sx_simd_t mu = v3_dot(dir, sun_dir);
+    sx_simd_t mu2_1 = sx_simd_madd(mu, mu, one);
+    sx_simd_t rayleigh_phase = sx_simd_mul(mu2_1, sx_simd_splat1(3.f / (16.f * SX_PI)));
+    sx_simd_t k = sx_simd_sub(sx_simd_splat1(1.f + g * g), sx_simd_mul(sx_simd_splat1(2.f * g), mu));
+    sx_simd_t mie_phase = sx_simd_div(sx_simd_mul(mu2_1, sx_simd_splat1(3.f * (1.f - g * g))),
+                                      sx_simd_mul(sx_simd_splat1(8.f * SX_PI * (2.f + g * g)), sx_simd_mul(k, sx_simd_sqrt(k))));
+
+    AtmVec3x4 L = v3_splat(0.f, 0.f, 0.f);
+    AtmVec3x4 view_transmittance = v3_splat(1.f, 1.f, 1.f);
+    for (float s = 0.f; s < 40.f; s += 1.f) {
+        sx_simd_t active = sx_simd_cmplt(sx_simd_splat1(s), sample_count);
+        if (!sx_simd_test_any_xyzw(active))
+            break;
+
+        sx_simd_t t0 = sx_simd_div(sx_simd_splat1(s), count_floor);
+        sx_simd_t t1 = sx_simd_div(sx_simd_splat1(s + 1.f), count_floor);
+        t0 = sx_simd_mul(max_floor, sx_simd_mul(t0, t0));
+        t1 = sx_simd_mul(t1, t1);
+        t1 = simd_select(sx_simd_cmpgt(t1, one), t_max, sx_simd_mul(max_floor, t1));
+        sx_simd_t t = sx_simd_madd(sx_simd_sub(t1, t0), sx_simd_splat1(segment_frac), t0);
+        /* lanes past their own sample count contribute nothing */
+        sx_simd_t dt = simd_select(active, sx_simd_sub(t1, t0), zero);
+
+        AtmVec3x4 p = v3_madd(dir, t, pos);
+        AtmMediumSample medium = atm_sample_medium(atm, p);
+        AtmVec3x4 sample_transmittance = v3_exp(v3_scale(medium.extinction, simd_neg(dt)));
+
+        sx_simd_t height = v3_length(p);
+        AtmVec3x4 up = v3_scale(p, simd_rcp(height));
+        sx_simd_t sun_cos_angle = v3_dot(up, sun_dir);
+        AtmVec3x4 sun_transmittance = atm_sun_transmittance(atm, transmittance, height, sun_cos_angle);
+
+        AtmVec3x4 multi_scat_radiance = v3_splat(0.f, 0.f, 0.f);
+        if (multi_scat) {
+            sx_simd_t u, v;
+            atm_multi_scattering_to_uv(atm, height, sun_cos_angle, multi_scat->width, multi_scat->height, &u, &v);
+            multi_scat_radiance = atm_sample_lut(multi_scat, u, v);
+        }
+
+        AtmVec3x4 f = v3_add(v3_scale(medium.mie_scattering, mie_phase), v3_scale(medium.rayleigh_scattering, rayleigh_phase));
+        sx_simd_t ts = atm_intersect_ray_sphere(p, sun_dir, v3_madd(up, sx_simd_splat1(0.01f), orig), bottom);
+        sx_simd_t eshadow = simd_select(sx_simd_cmpge(ts, zero), zero, one);
+        AtmVec3x4 S = v3_add(v3_scale(v3_mul(sun_transmittance, f), eshadow), v3_mul(multi_scat_radiance, medium.scattering));
+        S = v3_scale(S, sx_simd_splat1(sun_intensity));
+
+        AtmVec3x4 S_int = v3_div(v3_sub(S, v3_mul(S, sample_transmittance)), medium.extinction);
+        L = v3_add(L, v3_mul(view_transmittance, S_int));
+        view_transmittance = v3_mul(view_transmittance, sample_transmittance);
+    }
+
+    sx_simd_t t_bottom = atm_intersect_ray_sphere(pos, dir, orig, bottom);
+    sx_simd_t hit_ground = sx_simd_and(sx_simd_cmpeq(t_max, t_bottom), sx_simd_cmpgt(t_bottom, zero));
+    if (sx_simd_test_any_xyzw(hit_ground)) {
+        AtmVec3x4 p = v3_madd(dir, t_bottom, pos);
+        sx_simd_t height = v3_length(p);
+        AtmVec3x4 up = v3_scale(p, simd_rcp(height));
+        sx_simd_t sun_cos_angle = v3_dot(up, sun_dir);
+        AtmVec3x4 sun_transmittance = atm_sun_transmittance(atm, transmittance, height, sun_cos_angle);
+
+        sx_simd_t nl = simd_clamp(sun_cos_angle, zero, one);
+        AtmVec3x4 ground = v3_scale(v3_mul(sun_transmittance, view_transmittance),
+                                    sx_simd_mul(nl, sx_simd_splat1(sun_intensity * 0.01f / SX_PI)));
+        L = v3_select(hit_ground, v3_add(L, ground), L);
+    }
+
+    AtmScatteringResult result;
+    result.L = v3_select(inside, L, v3_splat(0.f, 0.f, 0.f));
+    result.transmittance = v3_select(inside, view_transmittance, v3_splat(0.f, 0.f, 0.f));
+    return result;
+}
+/*}}}*/
@@ -0,0 +1,130 @@
+#include "world/lut_cache.h"
+#include "sx/hash.h"
+#include "sx/io.h"
+#include "sx/os.h"
+#include "sx/string.h"
+
+#define LUT_CACHE_VERSION 2
+
+typedef struct LutCacheKey {
+    Atmosphere atmosphere;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t sample_count;
+    uint32_t version;
+} LutCacheKey;
+
+typedef struct LutCacheHeader {
+    uint64_t key;
+    uint32_t size;
+    uint32_t version;
+} LutCacheHeader;
+
+/*{{{static void entry_path(char* path, int size, const char* dir, uint64_t key, const char* ext)*/
+static void entry_path(char* path, int size, const char* dir, uint64_t key, const char* ext) {
+    char filename[32];
+    sx_snprintf(filename, sizeof(filename), "%016llx.%s", (unsigned long long)key, ext);
+    sx_os_path_join(path, size, dir, filename);
+}
+/*}}}*/
+
+/*{{{uint64_t lut_cache_key(const Atmosphere* atm, uint32_t width, uint32_t height, VkFormat format, uint32_t sample_count)*/
+uint64_t lut_cache_key(const Atmosphere* atm, uint32_t width, uint32_t height, VkFormat format, uint32_t sample_count) {
+    LutCacheKey key;
+    sx_memset(&key, 0, sizeof(key));
+    key.atmosphere = *atm;
+    key.width = width;
+    key.height = height;
+    key.format = (uint32_t)format;
+    key.sample_count = sample_count;
+    key.version = LUT_CACHE_VERSION;
+    return sx_hash_xxh64(&key, sizeof(key), 0);
+}
+/*}}}*/
+
+/*{{{sx_mem_block* lut_cache_map(const sx_alloc* alloc, const char* dir, uint64_t key, uint32_t size)*/
+sx_mem_block* lut_cache_map(const sx_alloc* alloc, const char* dir, uint64_t key, uint32_t size) {
+    char path[256];
+    entry_path(path, sizeof(path), dir, key, "lut");
+    if (!sx_os_path_isfile(path)) {
+        return NULL;
+    }
+
+    sx_mem_block* mem = sx_file_map(alloc, path);
+    /* a truncated entry does not even hold the iff signature */
+    if (!mem || mem->size < (int64_t)sizeof(sx_iff_chunk)) {
+        if (mem) {
+            sx_file_unmap(mem);
+        }
+        return NULL;
+    }
+
+    int64_t texels_pos = -1;
+    sx_mem_reader reader;
+    sx_mem_init_reader(&reader, mem->data, mem->size);
+    sx_iff_file iff;
+    if (sx_iff_init_from_mem_reader(&iff, &reader, 0, alloc)) {
+        int header_id = sx_iff_get_chunk(&iff, sx_makefourcc('L', 'U', 'T', 'H'), 0);
+        if (header_id != -1 && iff.chunks[header_id].size == sizeof(LutCacheHeader)) {
+            LutCacheHeader header;
+            sx_iff_read_chunk(&iff, header_id, &header, sizeof(header));
+            int data_id = sx_iff_get_chunk(&iff, sx_makefourcc('L', 'U', 'T', 'D'), header_id);
+            if (header.key == key && header.size == size && header.version == LUT_CACHE_VERSION &&
+                data_id != -1 && iff.chunks[data_id].size == size &&
+                iff.chunks[data_id].pos + size <= mem->size) {
+                /* texels are hashed in place, never copied out of the mapping */
+                const uint8_t* texels = (const uint8_t*)mem->data + iff.chunks[data_id].pos;
+                if (sx_hash_xxh64(texels, size, 0) == iff.chunks[data_id].hash) {
+                    texels_pos = iff.chunks[data_id].pos;
+                }
+            }
+        }
+        sx_iff_release(&iff);
+    }
+
+    if (texels_pos == -1) {
+        sx_file_unmap(mem);
+        return NULL;
+    }
+    sx_mem_addoffset(mem, texels_pos);
+    return mem;
+}
+/*}}}*/
+
+/*{{{bool lut_cache_store(const sx_alloc* alloc, const char* dir, uint64_t key, const void* data, uint32_t size)*/
+bool lut_cache_store(const sx_alloc* alloc, const char* dir, uint64_t key, const void* data, uint32_t size) {
+    if (!sx_os_path_isdir(dir) && !sx_os_mkdir(dir)) {
+        return false;
+    }
+
+    /* written next to the entry and renamed, readers never see a partial file */
+    char tmp_path[256];
+    char path[256];
+    entry_path(tmp_path, sizeof(tmp_path), dir, key, "tmp");
+    entry_path(path, sizeof(path), dir, key, "lut");
+
+    sx_file file;
+    if (!sx_file_open(&file, tmp_path, SX_FILE_WRITE)) {
+        return false;
+    }
+
+    bool written = false;
+    sx_iff_file iff;
+    if (sx_iff_init_from_file_writer(&iff, &file, 0, alloc)) {
+        LutCacheHeader header = { .key = key, .size = size, .version = LUT_CACHE_VERSION };
+        int header_id = sx_iff_put_chunk(&iff, 0, sx_makefourcc('L', 'U', 'T', 'H'), &header, sizeof(header), 0, key);
+        int data_id = sx_iff_put_chunk(&iff, header_id, sx_makefourcc('L', 'U', 'T', 'D'), data, size, 0,
+                                       sx_hash_xxh64(data, size, 0));
+        written = header_id != -1 && data_id != -1;
+        sx_iff_release(&iff);
+    }
+    sx_file_close(&file);
+
+    if (!written) {
+        sx_os_del(tmp_path, SX_FILE_TYPE_REGULAR);
+        return false;
+    }
+    return sx_os_rename(tmp_path, path);
+}
+/*}}}*/
@@ -43,17 +43,6 @@ NkGui* nkgui_create(const sx_alloc* alloc, Renderer* rd) {
         result = create_texture(&gui->textures[i], VK_SAMPLER_ADDRESS_MODE_MIRROR_CLAMP_TO_EDGE, gui->alloc, "misc/empty.ktx");
         VK_CHECK_RESULT(result)
     }
-    //Descriptor pool
-    VkDescriptorPoolSize pool_size[1];
-    pool_size[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    pool_size[0].descriptorCount = MAX_NKTEXTURES;
-    DescriptorPoolInfo pool_info;
-    pool_info.pool_size_count = 1;
-    pool_info.pool_sizes = pool_size;
-    pool_info.max_sets = 1;
-    result = create_descriptor_pool(&pool_info, &gui->descriptor_pool);
-    VK_CHECK_RESULT(result);
-
     VkDescriptorSetLayoutBinding layout_bindings[1];
     layout_bindings[0].binding = 0;
     layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
@@ -63,10 +52,10 @@ NkGui* nkgui_create(const sx_alloc* alloc, Renderer* rd) {
     DescriptorLayoutInfo layout_info;
     layout_info.bindings =  layout_bindings;
     layout_info.num_bindings = 1;
-    result = create_descriptor_layout(&layout_info, &gui->descriptor_layout);
+    result = get_descriptor_layout(&layout_info, &gui->descriptor_layout);
     VK_CHECK_RESULT(result);
 
-    result = create_descriptor_sets(gui->descriptor_pool, &gui->descriptor_layout, 1, &gui->descriptor_set);
+    result = allocate_descriptor_sets(&gui->descriptor_layout, 1, &gui->descriptor_set);
     VK_CHECK_RESULT(result);
 
 
@@ -167,20 +156,18 @@ NkGui* nkgui_create(const sx_alloc* alloc, Renderer* rd) {
         graphic_pipeline_info.multisample = &multisample_state_info;
         graphic_pipeline_info.depth_stencil = &depth_stencil_state_info;
         graphic_pipeline_info.color_blend = &color_blend_state_info;
-        graphic_pipeline_info.render_pass = rd->render_pass;
-        graphic_pipeline_info.subpass = 2;
         graphic_pipeline_info.layout = &gui->pipeline_layout;
         graphic_pipeline_info.shader_stages = shader_stages;
         graphic_pipeline_info.shader_stages_count = 2;
 
-        result = create_graphic_pipeline(&graphic_pipeline_info, &gui->pipeline);
+        result = renderer_create_scene_pipelines(rd, &graphic_pipeline_info, gui->pipelines);
         VK_CHECK_RESULT(result);
 
         /*}}}*/
 
     }
     /*}}}*/
-    renderer_register_callback(gui->rd, nkgui_draw, 2);
+    renderer_register_callback(gui->rd, nkgui_draw, 2, "gui");
 
     return gui;
 }
@@ -271,7 +258,11 @@ void nkgui_update(NkGui* gui) {
 
 /*{{{void nkgui_draw(VkCommandBuffer cmdbuffer) */
 void nkgui_draw(VkCommandBuffer cmdbuffer) {
-    vkCmdBindPipeline(cmdbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, nk_gui->pipeline);
+    VkPipeline pipeline = get_pipeline(nk_gui->pipelines[nk_gui->rd->scene_mode]);
+    if (pipeline == VK_NULL_HANDLE) {
+        return;
+    }
+    vkCmdBindPipeline(cmdbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
     vkCmdBindDescriptorSets(cmdbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, nk_gui->pipeline_layout, 1, 1, &nk_gui->descriptor_set, 0, NULL);
     
     nk_gui->push_constants_block.scale.x = 2.0 / nk_gui->rd->width;
@@ -307,6 +298,5 @@ void nkgui_draw(VkCommandBuffer cmdbuffer) {
         vkCmdDrawIndexed(cmdbuffer, cmd->elem_count, 1, index_offset, 0, 0);
         index_offset += cmd->elem_count;
     }
-
 }
 /*}}}*/
@@ -3,8 +3,9 @@
 #include "vulkan/vulkan_core.h"
 #include "world/camera.h"
 #include "device/device.h"
+#include "sx/trace.h"
 
-void update_composition_descriptors(Renderer* rd);
+void update_composition_descriptors(Renderer* rd, VkDescriptorSet descriptor_set);
 VkResult renderer_frame(Renderer* rd, uint32_t resource_index, uint32_t image_index);
 VkResult create_attachments(Renderer* rd);
 
@@ -13,52 +14,86 @@ Renderer* create_renderer(const sx_alloc* alloc, uint32_t width, uint32_t height
     VkResult result;
 
     Renderer* rd = sx_malloc(alloc, sizeof(*rd));
+    rd->alloc = alloc;
     rd->width = width;
     rd->height = height;
     rd->exposure = 0.8f;
     rd->subpass_callbacks_count[0] = 0;
     rd->subpass_callbacks_count[1] = 0;
     rd->subpass_callbacks_count[2] = 0;
+    rd->compute_callbacks_count = 0;
+    rd->frame_wait_semaphores_count = 0;
+    rd->frame_signal_semaphores_count = 0;
 
-    rd->position_image.image = VK_NULL_HANDLE;
-    rd->position_image.image_view = VK_NULL_HANDLE;
-    rd->position_image.memory = VK_NULL_HANDLE;
-    rd->albedo_image.image = VK_NULL_HANDLE;
-    rd->albedo_image.image_view = VK_NULL_HANDLE;
-    rd->albedo_image.memory = VK_NULL_HANDLE;
-    rd->metallic_roughness_image.image = VK_NULL_HANDLE;
-    rd->metallic_roughness_image.image_view = VK_NULL_HANDLE;
-    rd->metallic_roughness_image.memory = VK_NULL_HANDLE;
-    rd->normal_image.image = VK_NULL_HANDLE;
-    rd->normal_image.image_view = VK_NULL_HANDLE;
-    rd->normal_image.memory = VK_NULL_HANDLE;
-    rd->depth_image.image = VK_NULL_HANDLE;
-    rd->depth_image.image_view = VK_NULL_HANDLE;
-    rd->depth_image.image_view = VK_NULL_HANDLE;
+    rd->graph = rg_create(alloc, get_queue_index(GRAPHICS));
+    rd->scene_passes[SCENE_MODE_DEFERRED] = RG_INVALID;
+    rd->scene_passes[SCENE_MODE_FORWARD] = RG_INVALID;
+    rd->scene_mode = SCENE_MODE_DEFERRED;
+    rd->scene_reads_count = 0;
+    rd->position_image = RG_INVALID;
 
     rd->swapchain = create_swapchain(width, height);
+    rd->swapchain_dirty = false;
+    rd->pending_width = width;
+    rd->pending_height = height;
+    rd->swapchain_frame = 0;
+    rd->retired_swapchains_count = 0;
+    rd->frame_number = 0;
+    /* the image and its state are set every frame, see renderer_frame */
+    rd->backbuffer = rg_import_image(rd->graph, "backbuffer", VK_NULL_HANDLE, VK_IMAGE_ASPECT_COLOR_BIT, NULL, 0);
+    rg_export_image(rd->graph, rd->backbuffer,
+                    rd->swapchain.present_layout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR ? RG_USAGE_PRESENT : RG_USAGE_TRANSFER_SRC,
+                    get_queue_index(PRESENT));
     result = create_attachments(rd);
     VK_CHECK_RESULT(result);
 
-    rd->graphic_cmdbuffer = sx_malloc(sx_alloc_malloc(), RENDERING_RESOURCES_SIZE *
+    rd->resource_index = 0;
+    rd->graphic_cmdbuffer = sx_malloc(sx_alloc_malloc(), frames_in_flight() *
             sizeof(*(rd->graphic_cmdbuffer)));
-    result = create_command_buffer(GRAPHICS, VK_COMMAND_BUFFER_LEVEL_PRIMARY, RENDERING_RESOURCES_SIZE, 
+    result = create_command_buffer(GRAPHICS, VK_COMMAND_BUFFER_LEVEL_PRIMARY, frames_in_flight(), 
             rd->graphic_cmdbuffer);
     VK_CHECK_RESULT(result);
     result = create_command_buffer(COMPUTE, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1, &rd->compute_cmdbuffer);
     VK_CHECK_RESULT(result);
 
+    /* Subpass recording threads {{{*/
+    {
+        sx_job_context_desc job_desc = {0};
+        rd->jobs = sx_job_create_context(alloc, &job_desc);
+        sx_assert_rel(rd->jobs && "Could not create job context!");
+        /* thread index 0 is the thread recording the frame, it works while it waits */
+        rd->num_record_threads = (uint32_t)sx_job_num_worker_threads(rd->jobs) + 1;
+        /* headless frames are compared against each other, they never miss a pipeline */
+        pso_cache_set_jobs(is_headless() ? NULL : rd->jobs);
+        uint32_t num_record_pools = rd->num_record_threads * frames_in_flight();
+        rd->record_pools = sx_malloc(alloc, num_record_pools * sizeof(*rd->record_pools));
+        for (uint32_t i = 0; i < num_record_pools; i++) {
+            rd->record_pools[i].allocated = 0;
+            rd->record_pools[i].used = 0;
+            result = create_command_pool(GRAPHICS, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT, &rd->record_pools[i].pool);
+            VK_CHECK_RESULT(result);
+        }
+    }
+    /*}}}*/
+
 
     /* Global Buffer Creation {{{*/ 
     {
-        result = create_buffer(&rd->global_uniform_buffer,
-                                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, sizeof(GlobalUBO));
-        sx_assert_rel(result == VK_SUCCESS && "Could not create global uniform buffer!");
+        rd->global_uniforms = uniform_arena_reserve(sizeof(GlobalUBO));
 
         create_texture(&rd->lut_brdf, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, alloc, "misc/empty.ktx");
         create_texture(&rd->irradiance_cube, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, alloc, "misc/empty.ktx");
         create_texture(&rd->prefiltered_cube, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, alloc, "misc/empty.ktx");
+
+        result = create_storage_texture(&rd->aerial_perspective, VK_FORMAT_R16G16B16A16_SFLOAT,
+                                        VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, AERIAL_PERSPECTIVE_SIZE,
+                                        AERIAL_PERSPECTIVE_SIZE, AERIAL_PERSPECTIVE_SIZE);
+        sx_assert_rel(result == VK_SUCCESS && "Could not create aerial perspective volume!");
+        rd->aerial_perspective_state = (RgImageState){ .layout = VK_IMAGE_LAYOUT_GENERAL,
+                                                       .queue_family = VK_QUEUE_FAMILY_IGNORED };
+        rd->aerial_perspective_image = rg_import_image(rd->graph, "aerial perspective",
+                                                       rd->aerial_perspective.image_buffer.image, VK_IMAGE_ASPECT_COLOR_BIT,
+                                                       &rd->aerial_perspective_state, RG_IMAGE_GENERAL_LAYOUT);
     }
     /*}}}*/
 
@@ -74,61 +109,61 @@ Renderer* create_renderer(const sx_alloc* alloc, uint32_t width, uint32_t height
 		attachment_descriptions[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 		attachment_descriptions[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		attachment_descriptions[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		attachment_descriptions[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		attachment_descriptions[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		attachment_descriptions[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		attachment_descriptions[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
         /* Deferred attachments */
         /* position */
 		attachment_descriptions[1].flags = 0;
-        attachment_descriptions[1].format = rd->position_image.format;
+        attachment_descriptions[1].format = rg_image_desc(rd->graph, rd->position_image)->format;
 		attachment_descriptions[1].samples = VK_SAMPLE_COUNT_1_BIT;
 		attachment_descriptions[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 		attachment_descriptions[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		attachment_descriptions[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		attachment_descriptions[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		attachment_descriptions[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachment_descriptions[1].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 		attachment_descriptions[1].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
         /* normal */
 		attachment_descriptions[2].flags = 0;
-        attachment_descriptions[2].format = rd->normal_image.format;
+        attachment_descriptions[2].format = rg_image_desc(rd->graph, rd->normal_image)->format;
 		attachment_descriptions[2].samples = VK_SAMPLE_COUNT_1_BIT;
 		attachment_descriptions[2].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 		attachment_descriptions[2].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		attachment_descriptions[2].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		attachment_descriptions[2].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		attachment_descriptions[2].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachment_descriptions[2].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 		attachment_descriptions[2].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
         /* albedo */
 		attachment_descriptions[3].flags = 0;
-        attachment_descriptions[3].format = rd->albedo_image.format;
+        attachment_descriptions[3].format = rg_image_desc(rd->graph, rd->albedo_image)->format;
 		attachment_descriptions[3].samples = VK_SAMPLE_COUNT_1_BIT;
 		attachment_descriptions[3].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 		attachment_descriptions[3].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		attachment_descriptions[3].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		attachment_descriptions[3].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		attachment_descriptions[3].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachment_descriptions[3].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 		attachment_descriptions[3].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
         /* metallic roughness */
 		attachment_descriptions[4].flags = 0;
-        attachment_descriptions[4].format = rd->metallic_roughness_image.format;
+        attachment_descriptions[4].format = rg_image_desc(rd->graph, rd->metallic_roughness_image)->format;
 		attachment_descriptions[4].samples = VK_SAMPLE_COUNT_1_BIT;
 		attachment_descriptions[4].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 		attachment_descriptions[4].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		attachment_descriptions[4].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		attachment_descriptions[4].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		attachment_descriptions[4].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachment_descriptions[4].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 		attachment_descriptions[4].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
         /* Depth attachment */
 		attachment_descriptions[5].flags = 0;
-		attachment_descriptions[5].format = rd->depth_image.format;
+		attachment_descriptions[5].format = rg_image_desc(rd->graph, rd->depth_image)->format;
 		attachment_descriptions[5].samples = VK_SAMPLE_COUNT_1_BIT;
 		attachment_descriptions[5].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		attachment_descriptions[5].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		attachment_descriptions[5].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		attachment_descriptions[5].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 		attachment_descriptions[5].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		attachment_descriptions[5].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		attachment_descriptions[5].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;;
+		attachment_descriptions[5].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		attachment_descriptions[5].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
 
         /* Three subpasses */
@@ -206,42 +241,24 @@ Renderer* create_renderer(const sx_alloc* alloc, uint32_t width, uint32_t height
         subpass_descriptions[2].preserveAttachmentCount = 0;
         subpass_descriptions[2].pPreserveAttachments = NULL;
 
-        /* Subpass dependencies for layout transitions */
-        VkSubpassDependency dependencies[4];
-        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-        dependencies[0].dstSubpass = 0;
-        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-        dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT 
-                                        | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        /* Subpass dependencies, the render graph synchronizes the attachments with the rest of the frame */
+        VkSubpassDependency dependencies[2];
+        dependencies[0].srcSubpass = 0;
+        dependencies[0].dstSubpass = 1;
+        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        dependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
         dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
-        dependencies[1].srcSubpass = 0;
-        dependencies[1].dstSubpass = 1;
+        dependencies[1].srcSubpass = 1;
+        dependencies[1].dstSubpass = 2;
         dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
         dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
         dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
         dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
         dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
-        dependencies[2].srcSubpass = 1;
-        dependencies[2].dstSubpass = 2;
-        dependencies[2].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependencies[2].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-        dependencies[2].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-        dependencies[2].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        dependencies[2].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-        dependencies[3].srcSubpass = 0;
-        dependencies[3].dstSubpass = VK_SUBPASS_EXTERNAL;
-        dependencies[3].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependencies[3].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-        dependencies[3].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT 
-                                        | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-        dependencies[3].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-        dependencies[3].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
         VkRenderPassCreateInfo render_pass_create_info;
         render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
         render_pass_create_info.pNext = NULL;
@@ -250,7 +267,7 @@ Renderer* create_renderer(const sx_alloc* alloc, uint32_t width, uint32_t height
         render_pass_create_info.pAttachments = attachment_descriptions;
         render_pass_create_info.subpassCount = 3;
         render_pass_create_info.pSubpasses = subpass_descriptions;
-        render_pass_create_info.dependencyCount = 4;
+        render_pass_create_info.dependencyCount = 2;
         render_pass_create_info.pDependencies = dependencies;
 
         RenderPassInfo render_pass_info;
@@ -259,57 +276,49 @@ Renderer* create_renderer(const sx_alloc* alloc, uint32_t width, uint32_t height
         render_pass_info.subpass_description = subpass_descriptions;
         render_pass_info.subpass_count = 3;
         render_pass_info.supass_dependencies = dependencies;
-        render_pass_info.supass_dependencies_count = 4;
+        render_pass_info.supass_dependencies_count = 2;
 
         result = create_renderpass(&render_pass_info, &rd->render_pass);
         sx_assert_rel(result == VK_SUCCESS && "Could not create render pass");
+
+        /* Forward render pass: the third subpass alone, over the color and depth attachments */
+        VkAttachmentDescription forward_attachments[2];
+        forward_attachments[0] = attachment_descriptions[0];
+        forward_attachments[1] = attachment_descriptions[5];
+
+        color_reference[0].attachment = 0;
+        color_reference[0].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        depth_reference[0].attachment = 1;
+        depth_reference[0].layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription forward_subpass = subpass_descriptions[2];
+        forward_subpass.inputAttachmentCount = 0;
+        forward_subpass.pInputAttachments = NULL;
+
+        render_pass_info.attachment_descriptions = forward_attachments;
+        render_pass_info.attachment_count = 2;
+        render_pass_info.subpass_description = &forward_subpass;
+        render_pass_info.subpass_count = 1;
+        render_pass_info.supass_dependencies = NULL;
+        render_pass_info.supass_dependencies_count = 0;
+
+        result = create_renderpass(&render_pass_info, &rd->forward_render_pass);
+        sx_assert_rel(result == VK_SUCCESS && "Could not create forward render pass");
     }
     /* }}} */
 
     /* Descriptor Sets Creation {{{*/
     {
-        /* Descriptor Pools creation {{{*/
-        /* Global Pool */
-        {
-            VkDescriptorPoolSize pool_sizes[2];
-            pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            pool_sizes[0].descriptorCount = 1;
-            pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            pool_sizes[1].descriptorCount = 3;
-
-            DescriptorPoolInfo pool_info;
-            pool_info.pool_sizes = pool_sizes;
-            pool_info.pool_size_count = 2;
-            pool_info.max_sets = 1;
-
-            result = create_descriptor_pool(&pool_info, &rd->global_descriptor_pool);
-            VK_CHECK_RESULT(result);
-        }
-        /* Composition pool */
-        {
-            VkDescriptorPoolSize pool_sizes[1];
-            pool_sizes[0].type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-            pool_sizes[0].descriptorCount = 4;
-
-            DescriptorPoolInfo pool_info;
-            pool_info.pool_sizes = pool_sizes;
-            pool_info.pool_size_count = 2;
-            pool_info.max_sets = 1;
-
-            result = create_descriptor_pool(&pool_info, &rd->composition_descriptor_pool);
-            VK_CHECK_RESULT(result);
-        }
-        /*}}}*/
-
         /*{{{ Descriptor Set Layout Creation */
         /* Global Layout */
         {
             VkDescriptorSetLayoutBinding layout_bindings[4];
             layout_bindings[0].binding = 0;
-            layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
             layout_bindings[0].descriptorCount = 1;
             layout_bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT 
-                                            | VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+                                            | VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT | VK_SHADER_STAGE_FRAGMENT_BIT
+                                            | VK_SHADER_STAGE_COMPUTE_BIT;
             layout_bindings[0].pImmutableSamplers = NULL;
             layout_bindings[1].binding = 1;
             layout_bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
@@ -330,12 +339,12 @@ Renderer* create_renderer(const sx_alloc* alloc, uint32_t width, uint32_t height
             DescriptorLayoutInfo layout_info;
             layout_info.bindings = layout_bindings;
             layout_info.num_bindings = 4;
-            result = create_descriptor_layout(&layout_info, &rd->global_descriptor_layout);
+            result = get_descriptor_layout(&layout_info, &rd->global_descriptor_layout);
             VK_CHECK_RESULT(result);
         }
         /* Composition Layout */
         {
-            VkDescriptorSetLayoutBinding layout_bindings[4];
+            VkDescriptorSetLayoutBinding layout_bindings[5];
             layout_bindings[0].binding = 0;
             layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
             layout_bindings[0].descriptorCount = 1;
@@ -356,22 +365,22 @@ Renderer* create_renderer(const sx_alloc* alloc, uint32_t width, uint32_t height
             layout_bindings[3].descriptorCount = 1;
             layout_bindings[3].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
             layout_bindings[3].pImmutableSamplers = NULL;
+            layout_bindings[4].binding = 4;
+            layout_bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            layout_bindings[4].descriptorCount = 1;
+            layout_bindings[4].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+            layout_bindings[4].pImmutableSamplers = NULL;
 
             DescriptorLayoutInfo layout_info;
             layout_info.bindings = layout_bindings;
-            layout_info.num_bindings = 4;
-            result = create_descriptor_layout(&layout_info, &rd->composition_descriptorset_layout);
+            layout_info.num_bindings = 5;
+            result = get_descriptor_layout(&layout_info, &rd->composition_descriptorset_layout);
             VK_CHECK_RESULT(result);
         }
         /*}}}*/
 
         /*{{{ Descriptor set creation */
-        result = create_descriptor_sets(rd->global_descriptor_pool, &rd->global_descriptor_layout, 
-                1, &rd->global_descriptorset);
-        VK_CHECK_RESULT(result);
-
-        result = create_descriptor_sets(rd->composition_descriptor_pool, &rd->composition_descriptorset_layout, 
-                1, &rd->composition_descriptorset);
+        result = allocate_descriptor_sets(&rd->global_descriptor_layout, 1, &rd->global_descriptorset);
         VK_CHECK_RESULT(result);
         /*}}}*/
     }
@@ -380,13 +389,10 @@ Renderer* create_renderer(const sx_alloc* alloc, uint32_t width, uint32_t height
     /* Update Descriptor Sets {{{*/
     /*Global Descriptor update*/
     {
-        VkDescriptorBufferInfo buffer_info;
-        buffer_info.buffer = rd->global_uniform_buffer.buffer;
-        buffer_info.offset = 0;
-        buffer_info.range = rd->global_uniform_buffer.size;
+        VkDescriptorBufferInfo buffer_info = uniform_block_descriptor(rd->global_uniforms);
         uint32_t buffer_binding = 0;
         uint32_t buffer_descriptor_count = 1;
-        VkDescriptorType buffer_descriptor_types = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        VkDescriptorType buffer_descriptor_types = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 
         VkDescriptorImageInfo image_info[3];
         image_info[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
@@ -421,7 +427,7 @@ Renderer* create_renderer(const sx_alloc* alloc, uint32_t width, uint32_t height
         update_descriptor_set(&update_info);
 
     }
-    update_composition_descriptors(rd);
+    /* the composition set is allocated and written every frame, see renderer_frame */
     /*}}}*/
 
     /* Pipelines creation {{{*/
@@ -538,7 +544,8 @@ Renderer* create_renderer(const sx_alloc* alloc, uint32_t width, uint32_t height
             graphic_pipeline_info.shader_stages = shader_stages;
             graphic_pipeline_info.shader_stages_count = 2;
 
-            result = create_graphic_pipeline(&graphic_pipeline_info, &rd->composition_pipeline);
+            result = request_graphic_pipelines(&graphic_pipeline_info, 1, &graphic_pipeline_info.render_pass,
+                    &graphic_pipeline_info.subpass, &rd->composition_pipeline);
             VK_CHECK_RESULT(result);
 
         }
@@ -549,12 +556,12 @@ Renderer* create_renderer(const sx_alloc* alloc, uint32_t width, uint32_t height
 
 	/* Semaphore creation {{{*/
 	{
-		rd->image_available_semaphore = sx_malloc(alloc, RENDERING_RESOURCES_SIZE *
+		rd->image_available_semaphore = sx_malloc(alloc, frames_in_flight() *
 				sizeof(*(rd->image_available_semaphore)));
-		rd->rendering_finished_semaphore = sx_malloc(alloc, RENDERING_RESOURCES_SIZE *
+		rd->rendering_finished_semaphore = sx_malloc(alloc, frames_in_flight() *
 				sizeof(*(rd->rendering_finished_semaphore)));
 
-		for(uint32_t i = 0; i < RENDERING_RESOURCES_SIZE; i++) {
+		for(uint32_t i = 0; i < frames_in_flight(); i++) {
 			result = create_semaphore(&rd->image_available_semaphore[i]);
             VK_CHECK_RESULT(result);
 			result = create_semaphore(&rd->rendering_finished_semaphore[i]);
@@ -565,10 +572,10 @@ Renderer* create_renderer(const sx_alloc* alloc, uint32_t width, uint32_t height
 
 	/* fences creation {{{*/
 	{
-		rd->fences = sx_malloc(alloc, RENDERING_RESOURCES_SIZE *
+		rd->fences = sx_malloc(alloc, frames_in_flight() *
 				sizeof(*(rd->fences)));
 
-		for(uint32_t i = 0; i < RENDERING_RESOURCES_SIZE; i++) {
+		for(uint32_t i = 0; i < frames_in_flight(); i++) {
 
 			result = create_fence(&rd->fences[i], true);
             VK_CHECK_RESULT(result);
@@ -576,15 +583,32 @@ Renderer* create_renderer(const sx_alloc* alloc, uint32_t width, uint32_t height
 	}
     /*}}}*/
 
-	rd->framebuffer = sx_malloc(alloc, RENDERING_RESOURCES_SIZE *
+	rd->framebuffer = sx_malloc(alloc, frames_in_flight() *
 			sizeof(*(rd->framebuffer)));
-	for (uint32_t i = 0; i < RENDERING_RESOURCES_SIZE; i++) {
+	for (uint32_t i = 0; i < frames_in_flight(); i++) {
 		rd->framebuffer[i] = VK_NULL_HANDLE;
 	}
     return rd;
 }
 /*}}}*/
 
+/*{{{void renderer_destroy(Renderer* rd)*/
+void renderer_destroy(Renderer* rd) {
+    device_wait_idle();
+    rg_destroy(rd->graph);
+    for (uint32_t i = 0; i < rd->retired_swapchains_count; i++) {
+        destroy_swapchain(&rd->retired_swapchains[i].swapchain);
+    }
+    rd->retired_swapchains_count = 0;
+    for (uint32_t i = 0; i < rd->num_record_threads * frames_in_flight(); i++) {
+        destroy_command_pool(rd->record_pools[i].pool);
+    }
+    sx_free(rd->alloc, rd->record_pools);
+    pso_cache_set_jobs(NULL);
+    sx_job_destroy_context(rd->jobs, rd->alloc);
+}
+/*}}}*/
+
 bool update_uniform_buffer(Renderer* rd) {
         GlobalUBO ubo;
         ubo.projection = perspective_mat((Camera*)&device()->camera);
@@ -602,77 +626,129 @@ bool update_uniform_buffer(Renderer* rd) {
         /*ubo.view.col4 = SX_VEC4_ZERO;*/
         /*memcpy(&ubo.view, &vk_context.camera->view, 16 * sizeof(float));*/
         /*mat4_transpose(res_matrix, m);*/
-        copy_buffer(&rd->global_uniform_buffer,  &ubo, sizeof(ubo));
+        uniform_block_write(rd->global_uniforms, &ubo);
 
         return true;
 }
 
-/*update_composition_descriptors(Renderer* rd){{{*/
-void update_composition_descriptors(Renderer* rd) {
-    VkDescriptorImageInfo image_info[4];
+/*update_composition_descriptors(Renderer* rd, VkDescriptorSet descriptor_set){{{*/
+void update_composition_descriptors(Renderer* rd, VkDescriptorSet descriptor_set) {
+    VkDescriptorImageInfo image_info[5];
     image_info[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    image_info[0].imageView = rd->position_image.image_view;
+    image_info[0].imageView = rg_image_buffer(rd->graph, rd->position_image)->image_view;
     image_info[0].sampler = VK_NULL_HANDLE;
     image_info[1].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    image_info[1].imageView = rd->normal_image.image_view;
+    image_info[1].imageView = rg_image_buffer(rd->graph, rd->normal_image)->image_view;
     image_info[1].sampler = VK_NULL_HANDLE;
     image_info[2].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    image_info[2].imageView = rd->albedo_image.image_view;
+    image_info[2].imageView = rg_image_buffer(rd->graph, rd->albedo_image)->image_view;
     image_info[2].sampler = VK_NULL_HANDLE;
     image_info[3].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    image_info[3].imageView = rd->metallic_roughness_image.image_view;
+    image_info[3].imageView = rg_image_buffer(rd->graph, rd->metallic_roughness_image)->image_view;
     image_info[3].sampler = VK_NULL_HANDLE;
-    uint32_t image_bindings[4] = {0, 1, 2, 3};
-    uint32_t image_descriptor_count[4] = {1, 1, 1, 1};
-    VkDescriptorType descriptor_types[4] = {VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+    image_info[4].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    image_info[4].imageView = rd->aerial_perspective.image_buffer.image_view;
+    image_info[4].sampler = rd->aerial_perspective.sampler;
+    uint32_t image_bindings[5] = {0, 1, 2, 3, 4};
+    uint32_t image_descriptor_count[5] = {1, 1, 1, 1, 1};
+    VkDescriptorType descriptor_types[5] = {VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+                                            VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
                                             VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
                                             VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
-                                            VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT};
+                                            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER};
     DescriptorSetUpdateInfo update_info = {0};
-    update_info.descriptor_set = rd->composition_descriptorset;
+    update_info.descriptor_set = descriptor_set;
 
     update_info.images_infos = image_info;
     update_info.image_bindings = image_bindings;
     update_info.image_descriptor_types = descriptor_types;
     update_info.image_descriptor_count = image_descriptor_count;
-    update_info.num_image_bindings = 4;
+    update_info.num_image_bindings = 5;
 
     update_descriptor_set(&update_info);
 }
 /*}}}*/
 
-/*{{{VkResult renderer_frame(Renderer* rd, uint32_t resource_index, uint32_t image_index)*/
-VkResult renderer_frame(Renderer* rd, uint32_t resource_index, uint32_t image_index) {
-    VkResult result;
-    if (rd->framebuffer[resource_index] != VK_NULL_HANDLE) {
-        destroy_framebuffer(rd->framebuffer[resource_index]);
+/*{{{static void record_subpass_callbacks(int range_start, int range_end, int thread_index, void* user)*/
+static void record_subpass_callbacks(int range_start, int range_end, int thread_index, void* user) {
+    SubpassRecordJob* job = user;
+    Renderer* rd = job->rd;
+    RecordPool* pool = &rd->record_pools[job->resource_index * rd->num_record_threads + thread_index];
+
+    VkCommandBufferInheritanceInfo inheritance_info = {0};
+    inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    if (rd->scene_mode == SCENE_MODE_FORWARD) {
+        inheritance_info.renderPass = rd->forward_render_pass;
+        inheritance_info.subpass = 0;
+    } else {
+        inheritance_info.renderPass = rd->render_pass;
+        inheritance_info.subpass = job->subpass;
     }
+    inheritance_info.framebuffer = rd->framebuffer[job->resource_index];
+
+    VkCommandBufferBeginInfo begin_info = {0};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                       VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    begin_info.pInheritanceInfo = &inheritance_info;
+
+    uint32_t uniform_offset = uniform_arena_dynamic_offset();
+    for (int i = range_start; i < range_end; i++) {
+        sx_assert_rel(pool->used < MAX_RECORD_CMDBUFFERS && "Too many secondary command buffers!");
+        if (pool->used == pool->allocated) {
+            VkResult result = allocate_command_buffers(pool->pool, VK_COMMAND_BUFFER_LEVEL_SECONDARY, 1,
+                                                       &pool->cmdbuffers[pool->allocated]);
+            sx_assert_rel(result == VK_SUCCESS && "Could not create secondary command buffer!");
+            pool->allocated++;
+        }
+        VkCommandBuffer cmdbuffer = pool->cmdbuffers[pool->used++];
+
+        vkBeginCommandBuffer(cmdbuffer, &begin_info);
+        /* nothing is inherited from the primary command buffer */
+        vkCmdSetViewport(cmdbuffer, 0, 1, &job->viewport);
+        vkCmdSetScissor(cmdbuffer, 0, 1, &job->scissor);
+        vkCmdBindDescriptorSets(cmdbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, rd->composition_pipeline_layout,
+                0, 1, &rd->global_descriptorset, 1, &uniform_offset);
+        gpu_profiler_begin_reserved(cmdbuffer, job->scopes[i]);
+        rd->subpass_callbacks[job->subpass][i](cmdbuffer);
+        gpu_profiler_end_reserved(cmdbuffer, job->scopes[i]);
+        VkResult result = vkEndCommandBuffer(cmdbuffer);
+        sx_assert_rel(result == VK_SUCCESS && "Could not record secondary command buffer!");
+
+        rd->subpass_cmdbuffers[job->subpass][i] = cmdbuffer;
+    }
+}
+/*}}}*/
 
-    VkImageView attachments[6];
-    attachments[0] = rd->swapchain.image_views[image_index];
-    attachments[1] = rd->position_image.image_view;
-    attachments[2] = rd->normal_image.image_view;
-    attachments[3] = rd->albedo_image.image_view;
-    attachments[4] = rd->metallic_roughness_image.image_view;
-    attachments[5] = rd->depth_image.image_view;
-
-    FramebufferInfo framebuffer_info;
-    framebuffer_info.render_pass = rd->render_pass;
-    framebuffer_info.attachments = attachments;
-    framebuffer_info.attachment_count = 6;
-    framebuffer_info.width = rd->width;
-    framebuffer_info.height = rd->height;
-    framebuffer_info.layers = 1;
-
-    result = create_framebuffer(&framebuffer_info, &rd->framebuffer[resource_index]);
-    VK_CHECK_RESULT(result);
+/*{{{static sx_job_t dispatch_subpass_recording(Renderer* rd, SubpassRecordJob* job)*/
+static sx_job_t dispatch_subpass_recording(Renderer* rd, SubpassRecordJob* job) {
+    uint32_t count = rd->subpass_callbacks_count[job->subpass];
+    if (count == 0) {
+        return NULL;
+    }
+    /* the profiler is not thread safe, the queries are handed out here */
+    for (uint32_t i = 0; i < count; i++) {
+        job->scopes[i] = gpu_profiler_reserve(rd->subpass_callback_names[job->subpass][i]);
+    }
+    return sx_job_dispatch(rd->jobs, (int)count, record_subpass_callbacks, job, SX_JOB_PRIORITY_HIGH, 0);
+}
+/*}}}*/
 
-	VkCommandBufferBeginInfo command_buffer_begin_info;
-	command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	command_buffer_begin_info.pNext = NULL;
-	command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-	command_buffer_begin_info.pInheritanceInfo = NULL;
+/*{{{static void execute_subpass_commands(Renderer* rd, VkCommandBuffer cmdbuffer, uint32_t subpass, sx_job_t job)*/
+static void execute_subpass_commands(Renderer* rd, VkCommandBuffer cmdbuffer, uint32_t subpass, sx_job_t job) {
+    if (!job) {
+        return;
+    }
+    sx_trace_begin("wait subpass recording");
+    sx_job_wait_and_del(rd->jobs, job);
+    sx_trace_end();
+    vkCmdExecuteCommands(cmdbuffer, rd->subpass_callbacks_count[subpass], rd->subpass_cmdbuffers[subpass]);
+}
+/*}}}*/
 
+/*{{{static void record_scene(VkCommandBuffer cmdbuffer, void* user)*/
+static void record_scene(VkCommandBuffer cmdbuffer, void* user) {
+    Renderer* rd = user;
     VkClearValue clear_value[6];
     VkClearColorValue color = { {0.0f, 0.0f, 0.0f, 0.0f} };
     VkClearDepthStencilValue depth = {1.0, 0.0};
@@ -683,49 +759,178 @@ VkResult renderer_frame(Renderer* rd, uint32_t resource_index, uint32_t image_in
     clear_value[4].color = color;
     clear_value[5].depthStencil = depth;
 
-    VkRect2D render_area;
-    render_area.offset.x = 0;
-    render_area.offset.y = 0;
-    render_area.extent.width = rd->width;
-    render_area.extent.height = rd->height;
-
     VkRenderPassBeginInfo render_pass_begin_info;
     render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     render_pass_begin_info.pNext = NULL;
     render_pass_begin_info.renderPass = rd->render_pass;
-    render_pass_begin_info.renderArea = render_area;
+    render_pass_begin_info.renderArea = rd->record_jobs[0].scissor;
     render_pass_begin_info.clearValueCount = 6;
     render_pass_begin_info.pClearValues = clear_value;
+    render_pass_begin_info.framebuffer = rd->framebuffer[rd->resource_index];
+
+    vkCmdBeginRenderPass(cmdbuffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+    // First Sub pass
+    {
+        execute_subpass_commands(rd, cmdbuffer, 0, rd->record_handles[0]);
+    }
+    // Second subpass
+    {
+        vkCmdNextSubpass(cmdbuffer, VK_SUBPASS_CONTENTS_INLINE);
+        GPU_SCOPE_BEGIN(cmdbuffer, "composition");
+        vkCmdSetViewport(cmdbuffer, 0, 1, &rd->record_jobs[0].viewport);
+        vkCmdSetScissor(cmdbuffer, 0, 1, &rd->record_jobs[0].scissor);
+        uint32_t uniform_offset = uniform_arena_dynamic_offset();
+        vkCmdBindDescriptorSets(cmdbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, rd->composition_pipeline_layout,
+                0, 1, &rd->global_descriptorset, 1, &uniform_offset);
+        vkCmdBindDescriptorSets(cmdbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, rd->composition_pipeline_layout,
+                1, 1, &rd->composition_descriptorset, 0, NULL);
+        VkPipeline composition_pipeline = get_pipeline(rd->composition_pipeline);
+        if (composition_pipeline != VK_NULL_HANDLE) {
+            vkCmdBindPipeline(cmdbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, composition_pipeline);
+            vkCmdDraw(cmdbuffer, 4, 1, 0, 0);
+        }
+        GPU_SCOPE_END(cmdbuffer);
+    }
+    //Third subpass
+    {
+        vkCmdNextSubpass(cmdbuffer, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        execute_subpass_commands(rd, cmdbuffer, 2, rd->record_handles[1]);
+    }
+
+    vkCmdEndRenderPass(cmdbuffer);
+}
+/*}}}*/
+
+/*{{{static void record_forward(VkCommandBuffer cmdbuffer, void* user)*/
+static void record_forward(VkCommandBuffer cmdbuffer, void* user) {
+    Renderer* rd = user;
+    VkClearValue clear_value[2];
+    VkClearColorValue color = { {0.0f, 0.0f, 0.0f, 0.0f} };
+    VkClearDepthStencilValue depth = {1.0, 0.0};
+    clear_value[0].color = color;
+    clear_value[1].depthStencil = depth;
+
+    VkRenderPassBeginInfo render_pass_begin_info;
+    render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    render_pass_begin_info.pNext = NULL;
+    render_pass_begin_info.renderPass = rd->forward_render_pass;
+    render_pass_begin_info.renderArea = rd->record_jobs[1].scissor;
+    render_pass_begin_info.clearValueCount = 2;
+    render_pass_begin_info.pClearValues = clear_value;
+    render_pass_begin_info.framebuffer = rd->framebuffer[rd->resource_index];
+
+    vkCmdBeginRenderPass(cmdbuffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    execute_subpass_commands(rd, cmdbuffer, 2, rd->record_handles[1]);
+    vkCmdEndRenderPass(cmdbuffer);
+}
+/*}}}*/
+
+/*{{{static void add_scene_passes(Renderer* rd)*/
+static void add_scene_passes(Renderer* rd) {
+    RgPass pass = rg_add_pass(rd->graph, "scene", record_scene, rd, 0);
+    rg_write(rd->graph, pass, rd->backbuffer, RG_USAGE_COLOR_ATTACHMENT);
+    rg_write(rd->graph, pass, rd->position_image, RG_USAGE_COLOR_ATTACHMENT);
+    rg_write(rd->graph, pass, rd->normal_image, RG_USAGE_COLOR_ATTACHMENT);
+    rg_write(rd->graph, pass, rd->albedo_image, RG_USAGE_COLOR_ATTACHMENT);
+    rg_write(rd->graph, pass, rd->metallic_roughness_image, RG_USAGE_COLOR_ATTACHMENT);
+    rg_write(rd->graph, pass, rd->depth_image, RG_USAGE_DEPTH_ATTACHMENT);
+    rg_read(rd->graph, pass, rd->aerial_perspective_image, RG_USAGE_SAMPLED_FRAGMENT);
+    for (uint32_t i = 0; i < rd->scene_reads_count; i++) {
+        rg_read(rd->graph, pass, rd->scene_reads[i], RG_USAGE_SAMPLED_FRAGMENT);
+    }
+    rd->scene_passes[SCENE_MODE_DEFERRED] = pass;
+
+    /* the G-buffer and the aerial perspective are culled with the scene pass */
+    pass = rg_add_pass(rd->graph, "forward", record_forward, rd, 0);
+    rg_write(rd->graph, pass, rd->backbuffer, RG_USAGE_COLOR_ATTACHMENT);
+    rg_write(rd->graph, pass, rd->depth_image, RG_USAGE_DEPTH_ATTACHMENT);
+    for (uint32_t i = 0; i < rd->scene_reads_count; i++) {
+        rg_read(rd->graph, pass, rd->scene_reads[i], RG_USAGE_SAMPLED_FRAGMENT);
+    }
+    rd->scene_passes[SCENE_MODE_FORWARD] = pass;
+}
+/*}}}*/
+
+/*{{{VkResult renderer_frame(Renderer* rd, uint32_t resource_index, uint32_t image_index)*/
+VkResult renderer_frame(Renderer* rd, uint32_t resource_index, uint32_t image_index) {
+    VkResult result;
+
+    /* the fence of resource_index was waited on, its secondary command buffers are free */
+    for (uint32_t i = 0; i < rd->num_record_threads; i++) {
+        RecordPool* pool = &rd->record_pools[resource_index * rd->num_record_threads + i];
+        result = reset_command_pool(pool->pool);
+        VK_CHECK_RESULT(result);
+        pool->used = 0;
+    }
+
+	VkCommandBufferBeginInfo command_buffer_begin_info;
+	command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	command_buffer_begin_info.pNext = NULL;
+	command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	command_buffer_begin_info.pInheritanceInfo = NULL;
 
-    render_pass_begin_info.framebuffer = rd->framebuffer[resource_index];
     vkBeginCommandBuffer(rd->graphic_cmdbuffer[resource_index],
             &command_buffer_begin_info);
-    VkImageSubresourceRange image_subresource_range;
-    image_subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    image_subresource_range.baseMipLevel = 0;
-    image_subresource_range.levelCount = 1;
-    image_subresource_range.baseArrayLayer = 0;
-    image_subresource_range.layerCount = 1;
-
-
-    if (get_queue(GRAPHICS) != get_queue(PRESENT)) {
-        VkImageMemoryBarrier barrier_from_present_to_draw;
-        barrier_from_present_to_draw.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        barrier_from_present_to_draw.pNext = NULL;
-        barrier_from_present_to_draw.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-        barrier_from_present_to_draw.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-        barrier_from_present_to_draw.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        barrier_from_present_to_draw.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-        barrier_from_present_to_draw.srcQueueFamilyIndex = get_queue_index(PRESENT);
-        barrier_from_present_to_draw.dstQueueFamilyIndex = get_queue_index(GRAPHICS);
-        barrier_from_present_to_draw.image = rd->swapchain.images[image_index];
-        barrier_from_present_to_draw.subresourceRange = image_subresource_range;
-        vkCmdPipelineBarrier(rd->graphic_cmdbuffer[resource_index],
-                VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-                VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, NULL, 0, NULL, 1,
-                &barrier_from_present_to_draw);
+    gpu_profiler_begin_frame(rd->graphic_cmdbuffer[resource_index], resource_index);
+    GPU_SCOPE_BEGIN(rd->graphic_cmdbuffer[resource_index], "frame");
+
+    /* uploads recorded since the last frame run on the transfer queue meanwhile */
+    VkSemaphore upload_semaphores[RENDERING_RESOURCES_MAX];
+    uint32_t upload_semaphores_count = staging_flush(rd->graphic_cmdbuffer[resource_index], upload_semaphores);
+    for (uint32_t i = 0; i < upload_semaphores_count; i++) {
+        renderer_wait_semaphore(rd, upload_semaphores[i], STAGING_WAIT_STAGES);
     }
 
+    for (uint32_t i = 0; i < rd->compute_callbacks_count; i++) {
+        rd->compute_callbacks[i]();
+    }
+
+    /* the subsystems added their passes by now */
+    if (rd->scene_passes[SCENE_MODE_DEFERRED] == RG_INVALID) {
+        add_scene_passes(rd);
+    }
+    /* nothing fills the G-buffer, composing it would only shade the clear color */
+    rd->scene_mode = rd->subpass_callbacks_count[0] == 0 ? SCENE_MODE_FORWARD : SCENE_MODE_DEFERRED;
+    for (uint32_t i = 0; i < SCENE_MODE_COUNT; i++) {
+        rg_set_pass_enabled(rd->graph, rd->scene_passes[i], i == rd->scene_mode);
+    }
+    rg_compile(rd->graph);
+    /* the sets of earlier frames may still be in use, a fresh one always sees the current G-buffer */
+    if (rd->scene_mode == SCENE_MODE_DEFERRED) {
+        result = allocate_frame_descriptor_sets(&rd->composition_descriptorset_layout, 1,
+                                                &rd->composition_descriptorset);
+        VK_CHECK_RESULT(result);
+        update_composition_descriptors(rd, rd->composition_descriptorset);
+    }
+
+    if (rd->framebuffer[resource_index] != VK_NULL_HANDLE) {
+        destroy_framebuffer(rd->framebuffer[resource_index]);
+    }
+
+    FramebufferInfo framebuffer_info;
+    VkImageView attachments[6];
+    attachments[0] = rd->swapchain.image_views[image_index];
+    if (rd->scene_mode == SCENE_MODE_FORWARD) {
+        attachments[1] = rg_image_buffer(rd->graph, rd->depth_image)->image_view;
+        framebuffer_info.render_pass = rd->forward_render_pass;
+        framebuffer_info.attachment_count = 2;
+    } else {
+        attachments[1] = rg_image_buffer(rd->graph, rd->position_image)->image_view;
+        attachments[2] = rg_image_buffer(rd->graph, rd->normal_image)->image_view;
+        attachments[3] = rg_image_buffer(rd->graph, rd->albedo_image)->image_view;
+        attachments[4] = rg_image_buffer(rd->graph, rd->metallic_roughness_image)->image_view;
+        attachments[5] = rg_image_buffer(rd->graph, rd->depth_image)->image_view;
+        framebuffer_info.render_pass = rd->render_pass;
+        framebuffer_info.attachment_count = 6;
+    }
+    framebuffer_info.attachments = attachments;
+    framebuffer_info.width = rd->width;
+    framebuffer_info.height = rd->height;
+    framebuffer_info.layers = 1;
+
+    result = create_framebuffer(&framebuffer_info, &rd->framebuffer[resource_index]);
+    VK_CHECK_RESULT(result);
 
     VkViewport viewport;
     viewport.x = 0;
@@ -741,111 +946,158 @@ VkResult renderer_frame(Renderer* rd, uint32_t resource_index, uint32_t image_in
     scissor.extent.width = rd->width;
     scissor.extent.height = rd->height;
 
-    vkCmdBeginRenderPass(rd->graphic_cmdbuffer[resource_index], &render_pass_begin_info,
-            VK_SUBPASS_CONTENTS_INLINE);
-
-    vkCmdSetViewport(rd->graphic_cmdbuffer[resource_index], 0, 1, &viewport);
-    vkCmdSetScissor(rd->graphic_cmdbuffer[resource_index], 0, 1, &scissor);
-    VkDeviceSize offset = 0;
-
-    VkDescriptorSet descriptor_sets[2];
-    descriptor_sets[0] = rd->global_descriptorset;
-
-    vkCmdBindDescriptorSets(rd->graphic_cmdbuffer[resource_index], 
-            VK_PIPELINE_BIND_POINT_GRAPHICS, rd->composition_pipeline_layout,
-            0, 1, &rd->global_descriptorset, 0, NULL);
-    // First Sub pass
-    {
+    /* subpasses 0 and 2 record on the job threads while this one records the rest */
+    for (uint32_t i = 0; i < 2; i++) {
+        rd->record_jobs[i].rd = rd;
+        rd->record_jobs[i].subpass = i * 2;
+        rd->record_jobs[i].resource_index = resource_index;
+        rd->record_jobs[i].viewport = viewport;
+        rd->record_jobs[i].scissor = scissor;
+        rd->record_handles[i] = dispatch_subpass_recording(rd, &rd->record_jobs[i]);
+    }
 
-        for (uint32_t i = 0; i < rd->subpass_callbacks_count[0]; i++) {
-            rd->subpass_callbacks[0][i](rd->graphic_cmdbuffer[resource_index]);
-        }
+    /* acquired for this frame, the submit waits for it before the color attachment output */
+    rd->backbuffer_state = (RgImageState){ .layout = VK_IMAGE_LAYOUT_UNDEFINED,
+                                           .write_stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                                           .queue_family = VK_QUEUE_FAMILY_IGNORED };
+    rg_set_imported_image(rd->graph, rd->backbuffer, rd->swapchain.images[image_index], &rd->backbuffer_state);
+    rg_execute(rd->graph, rd->graphic_cmdbuffer[resource_index]);
 
+    GPU_SCOPE_END(rd->graphic_cmdbuffer[resource_index]);
+     result = vkEndCommandBuffer(rd->graphic_cmdbuffer[resource_index]);
+     sx_assert_rel(result == VK_SUCCESS && "Could not record command buffers!");
+    return result;
+}
+/*}}}*/
 
-    }
-    // Second subpass
-    {
-        vkCmdNextSubpass(rd->graphic_cmdbuffer[resource_index], VK_SUBPASS_CONTENTS_INLINE);
-        vkCmdBindDescriptorSets(rd->graphic_cmdbuffer[resource_index], 
-                VK_PIPELINE_BIND_POINT_GRAPHICS, rd->composition_pipeline_layout,
-                1, 1, &rd->composition_descriptorset, 0, NULL);
-        vkCmdBindPipeline(rd->graphic_cmdbuffer[resource_index], 
-                VK_PIPELINE_BIND_POINT_GRAPHICS, rd->composition_pipeline);
-        vkCmdDraw(rd->graphic_cmdbuffer[resource_index], 4, 1, 0, 0);
-    }
-    //Third subpass
-    {
-        vkCmdNextSubpass(rd->graphic_cmdbuffer[resource_index], VK_SUBPASS_CONTENTS_INLINE);
-        for (uint32_t i = 0; i < rd->subpass_callbacks_count[2]; i++) {
-            rd->subpass_callbacks[2][i](rd->graphic_cmdbuffer[resource_index]);
+/*{{{static void collect_retired_swapchains(Renderer* rd)*/
+static void collect_retired_swapchains(Renderer* rd) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < rd->retired_swapchains_count; i++) {
+        RetiredSwapchain* retired = &rd->retired_swapchains[i];
+        /* the fences of every frame recorded before the swapchain was retired were waited on */
+        if (rd->frame_number >= retired->frame + frames_in_flight()) {
+            destroy_swapchain(&retired->swapchain);
+        } else {
+            rd->retired_swapchains[kept++] = *retired;
         }
     }
+    rd->retired_swapchains_count = kept;
+}
+/*}}}*/
 
-    vkCmdEndRenderPass(rd->graphic_cmdbuffer[resource_index]);
-
-    if (get_queue(GRAPHICS) != get_queue(PRESENT)) {
-        VkImageMemoryBarrier barrier_from_draw_to_present;
-        barrier_from_draw_to_present.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        barrier_from_draw_to_present.pNext = NULL;
-        barrier_from_draw_to_present.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-        barrier_from_draw_to_present.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-        barrier_from_draw_to_present.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-        barrier_from_draw_to_present.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-        barrier_from_draw_to_present.srcQueueFamilyIndex = get_queue_index(GRAPHICS);
-        barrier_from_draw_to_present.dstQueueFamilyIndex = get_queue_index(PRESENT);
-        barrier_from_draw_to_present.image = rd->swapchain.images[image_index];
-        barrier_from_draw_to_present.subresourceRange = image_subresource_range;
-        vkCmdPipelineBarrier(rd->graphic_cmdbuffer[resource_index],
-                VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-                VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1,
-                &barrier_from_draw_to_present);
+/*{{{static bool recreate_swapchain(Renderer* rd)*/
+static bool recreate_swapchain(Renderer* rd) {
+    /* minimized, there is nothing to present to until the next resize */
+    if (rd->pending_width == 0 || rd->pending_height == 0) {
+        return false;
     }
+    Swapchain old_swapchain = rd->swapchain;
+    rd->swapchain = create_swapchain(rd->pending_width, rd->pending_height);
+    if (rd->swapchain_frame == rd->frame_number) {
+        /* no frame was recorded with it, e.g. it went out of date at once */
+        destroy_swapchain(&old_swapchain);
+    } else {
+        sx_assert_rel(rd->retired_swapchains_count < RENDERING_RESOURCES_MAX && "Too many retired swapchains");
+        rd->retired_swapchains[rd->retired_swapchains_count++] = (RetiredSwapchain){ old_swapchain, rd->frame_number };
+    }
+    rd->swapchain_frame = rd->frame_number;
+    rd->swapchain_dirty = false;
 
-     result = vkEndCommandBuffer(rd->graphic_cmdbuffer[resource_index]);
-     sx_assert_rel(result == VK_SUCCESS && "Could not record command buffers!");
-    return result;
+    rd->width = rd->swapchain.extent.width;
+    rd->height = rd->swapchain.extent.height;
+    /* the graph recreates the G-buffer on the next rg_compile, the old one is retired as well */
+    create_attachments(rd);
+    return true;
 }
 /*}}}*/
 
 /*{{{bool renderer_draw(Renderer* rd)*/
 bool renderer_draw(Renderer* rd) {
-    static uint32_t resource_index = 0;
-	uint32_t next_resource_index = (resource_index + 1) % RENDERING_RESOURCES_SIZE;
+    uint32_t resource_index = rd->resource_index;
+	uint32_t next_resource_index = (resource_index + 1) % frames_in_flight();
 	uint32_t image_index;
+    sx_trace_begin("wait fences");
     VkResult result = wait_fences(1, &rd->fences[resource_index], VK_FALSE, 1000000000);
+    sx_trace_end();
     VK_CHECK_RESULT(result);
-    reset_fences(1, &rd->fences[resource_index]);
 
+    collect_retired_swapchains(rd);
+    if (rd->swapchain_dirty) {
+        sx_trace_begin("recreate swapchain");
+        bool recreated = recreate_swapchain(rd);
+        sx_trace_end();
+        if (!recreated) {
+            return true;
+        }
+    }
+
+    sx_trace_begin("acquire");
     result = acquire_next_image(rd->swapchain.swapchain, UINT64_MAX, rd->image_available_semaphore[resource_index], &image_index);
+    sx_trace_end();
 	switch(result) {
 		case VK_SUCCESS:
 			break;
 		case VK_SUBOPTIMAL_KHR:
-		case VK_ERROR_OUT_OF_DATE_KHR:
-            printf("acquire subotimo\n");
+            /* the image was acquired and the semaphore will be signaled, this frame still goes out */
+            rd->swapchain_dirty = true;
 			break;
-            /*renderer_resize(rd, rd->width, rd->height);*/
+		case VK_ERROR_OUT_OF_DATE_KHR:
+            /* nothing was acquired, the fence stays signaled for the retry on the next frame */
+            rd->swapchain_dirty = true;
+			return true;
 		default:
 			printf("Problem occurred during swap chain image acquisition!\n");
 			return false;
 	}
 
-    renderer_frame(rd, resource_index, image_index);
+    /* only reset once a submit is certain to signal it again */
+    reset_fences(1, &rd->fences[resource_index]);
+    /* the slice of this resource index is no longer read by the GPU */
+    uniform_arena_begin_frame(resource_index);
+    descriptor_cache_begin_frame(resource_index);
+    /* pipelines compiled since the last frame are handed out from here on */
+    pso_cache_update();
+    sx_trace_begin("update_uniform_buffer");
+    update_uniform_buffer(rd);
+    sx_trace_end();
 
-	VkPipelineStageFlags wait_dst_stage_mask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    sx_trace_begin("record");
+    renderer_frame(rd, resource_index, image_index);
+    sx_trace_end();
+
+    VkSemaphore wait_semaphores[MAX_FRAME_SEMAPHORES + 1];
+	VkPipelineStageFlags wait_dst_stage_masks[MAX_FRAME_SEMAPHORES + 1];
+    VkSemaphore signal_semaphores[MAX_FRAME_SEMAPHORES + 1];
+    wait_semaphores[0] = rd->image_available_semaphore[resource_index];
+    wait_dst_stage_masks[0] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    signal_semaphores[0] = rd->rendering_finished_semaphore[resource_index];
+    for (uint32_t i = 0; i < rd->frame_wait_semaphores_count; i++) {
+        wait_semaphores[i + 1] = rd->frame_wait_semaphores[i];
+        wait_dst_stage_masks[i + 1] = rd->frame_wait_stages[i];
+    }
+    for (uint32_t i = 0; i < rd->frame_signal_semaphores_count; i++) {
+        signal_semaphores[i + 1] = rd->frame_signal_semaphores[i];
+    }
 
     CommandSubmitInfo submit_info;
+    submit_info.queue = GRAPHICS;
     submit_info.command_buffers = &rd->graphic_cmdbuffer[resource_index];
     submit_info.command_buffers_count = 1;
-    submit_info.wait_semaphores_count = 1;
-    submit_info.wait_semaphores = &rd->image_available_semaphore[resource_index];
-    submit_info.wait_dst_stage_mask = wait_dst_stage_mask;
-    submit_info.signal_semaphores_count = 1;
-    submit_info.signal_semaphores = &rd->rendering_finished_semaphore[resource_index];
+    submit_info.wait_semaphores_count = 1 + rd->frame_wait_semaphores_count;
+    submit_info.wait_semaphores = wait_semaphores;
+    submit_info.wait_dst_stage_masks = wait_dst_stage_masks;
+    submit_info.signal_semaphores_count = 1 + rd->frame_signal_semaphores_count;
+    submit_info.signal_semaphores = signal_semaphores;
     submit_info.fence = rd->fences[resource_index];
 
+    sx_trace_begin("submit");
     result = submit_commands(&submit_info);
+    sx_trace_end();
     VK_CHECK_RESULT(result);
+    rd->frame_wait_semaphores_count = 0;
+    rd->frame_signal_semaphores_count = 0;
+    rd->frame_number++;
 
     PresentInfo present_info;
     present_info.wait_semaphores_count = 1;
@@ -854,20 +1106,21 @@ bool renderer_draw(Renderer* rd) {
     present_info.swapchains = &rd->swapchain.swapchain;
     present_info.image_index = &image_index;
 
+    sx_trace_begin("present");
     result = present_image(&present_info);
+    sx_trace_end();
 	switch(result) {
 		case VK_SUCCESS:
 			break;
 		case VK_SUBOPTIMAL_KHR:
 		case VK_ERROR_OUT_OF_DATE_KHR:
-            printf("present subotimo\n");
+            rd->swapchain_dirty = true;
             break;
-            /*renderer_resize(rd, rd->width, rd->height);*/
 		default:
 			printf("Problem occurred during image presentation!\n");
 			return false;
 	}
-	resource_index = next_resource_index;
+	rd->resource_index = next_resource_index;
 
     /*vkDeviceWaitIdle(rd->device.logical_device);*/
 	return true;
@@ -877,46 +1130,54 @@ bool renderer_draw(Renderer* rd) {
 
 /*{{{void renderer_render(Renderer* rd)*/
 void renderer_render(Renderer* rd) {
-    update_uniform_buffer(rd);
     renderer_draw(rd);
 }
 /*}}}*/
 
 /*{{{void renderer_resize(Renderer* rd, uint32_t width, uint32_t height)*/
 void renderer_resize(Renderer* rd, uint32_t width, uint32_t height) {
-    rd->width = width;
-    rd->height = height;
-    device_wait_idle();
-    rd->swapchain = create_swapchain(rd->width, rd->width);
-    /*setup_framebuffer(&vk_context, true);*/
-    create_attachments(rd);
-    update_composition_descriptors(rd);
-    device_wait_idle();
+    /* a burst of resize events ends up in a single recreation */
+    rd->pending_width = width;
+    rd->pending_height = height;
+    rd->swapchain_dirty = true;
+}
+/*}}}*/
+
+/*{{{static void set_attachment(Renderer* rd, RgImage* image, const char* name, const RgImageDesc* desc)*/
+static void set_attachment(Renderer* rd, RgImage* image, const char* name, const RgImageDesc* desc) {
+    if (*image == RG_INVALID) {
+        *image = rg_create_image(rd->graph, name, desc);
+    } else {
+        rg_set_image_desc(rd->graph, *image, desc);
+    }
 }
 /*}}}*/
 
 /*{{{VkResult create_attachments(Renderer* rd)*/
 VkResult create_attachments(Renderer* rd) {
-    uint32_t width = rd->width;
-    uint32_t height = rd->height;
-    VkResult result;
+    /* declared on the first call, resized afterwards */
+    if (rd->position_image == RG_INVALID) {
+        rd->normal_image = RG_INVALID;
+        rd->albedo_image = RG_INVALID;
+        rd->metallic_roughness_image = RG_INVALID;
+        rd->depth_image = RG_INVALID;
+    }
 
     /* GBuffer creation {{{*/
     {
-        VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
-        VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
-        rd->position_image.format = VK_FORMAT_R16G16B16A16_SFLOAT;
-        rd->normal_image.format = VK_FORMAT_R16G16B16A16_SFLOAT;
-        rd->albedo_image.format = VK_FORMAT_R8G8B8A8_UNORM;
-        rd->metallic_roughness_image.format = VK_FORMAT_R8G8B8A8_UNORM;
-        result = create_image(width, height,usage, aspect, 1, &rd->position_image);
-        VK_CHECK_RESULT(result);
-        result = create_image(width, height, usage, aspect, 1, &rd->normal_image);
-        VK_CHECK_RESULT(result);
-        result = create_image(width, height, usage, aspect, 1, &rd->albedo_image);
-        VK_CHECK_RESULT(result);
-        result = create_image(width, height, usage, aspect, 1, &rd->metallic_roughness_image);
-        VK_CHECK_RESULT(result);
+        RgImageDesc desc = {0};
+        desc.width = rd->width;
+        desc.height = rd->height;
+        desc.aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+        desc.usage = VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+        /* written and read within the render pass, never stored */
+        desc.flags = RG_IMAGE_LAZILY_ALLOCATED;
+        desc.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+        set_attachment(rd, &rd->position_image, "position", &desc);
+        set_attachment(rd, &rd->normal_image, "normal", &desc);
+        desc.format = VK_FORMAT_R8G8B8A8_UNORM;
+        set_attachment(rd, &rd->albedo_image, "albedo", &desc);
+        set_attachment(rd, &rd->metallic_roughness_image, "metallic roughness", &desc);
     }
     /*}}}*/
 
@@ -928,30 +1189,82 @@ VkResult create_attachments(Renderer* rd) {
         VK_FORMAT_D16_UNORM_S8_UINT,
         VK_FORMAT_D16_UNORM
     };
+    RgImageDesc desc = {0};
+    desc.width = rd->width;
+    desc.height = rd->height;
+    desc.flags = RG_IMAGE_LAZILY_ALLOCATED;
     for (uint32_t i = 0; i < 5; i++) {
         VkFormatProperties format_props;
         get_physical_device_format_properties(depth_formats[i], &format_props);
         if (format_props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
-            rd->depth_image.format = depth_formats[i];
+            desc.format = depth_formats[i];
         }
     }
 
-    VkImageAspectFlags aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
-    if (rd->depth_image.format >= VK_FORMAT_D16_UNORM_S8_UINT) {
-        aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    desc.aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (desc.format >= VK_FORMAT_D16_UNORM_S8_UINT) {
+        desc.aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
     }
-    VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-    result = create_image(width, height, usage, aspect, 1, &rd->depth_image);
-    VK_CHECK_RESULT(result);
+    set_attachment(rd, &rd->depth_image, "depth", &desc);
     /*}}}*/
 
-    return result;
+    return VK_SUCCESS;
+}
+/*}}}*/
+
+/*{{{void renderer_scene_read(Renderer* rd, RgImage image)*/
+void renderer_scene_read(Renderer* rd, RgImage image) {
+    sx_assert_rel(rd->scene_passes[SCENE_MODE_DEFERRED] == RG_INVALID && "The scene passes were already added to the graph");
+    sx_assert_rel(rd->scene_reads_count < RG_MAX_PASS_ACCESSES && "Too many scene reads");
+    rd->scene_reads[rd->scene_reads_count++] = image;
 }
 /*}}}*/
 
-/*{{{void renderer_register_callback(Renderer* rd, draw_callback callback, uint32_t subpass_index)*/
-void renderer_register_callback(Renderer* rd, draw_callback callback, uint32_t subpass_index) {
-    rd->subpass_callbacks[subpass_index][rd->subpass_callbacks_count[subpass_index]] = callback;
+/*{{{void renderer_register_callback(Renderer* rd, draw_callback callback, uint32_t subpass_index, const char* name)*/
+void renderer_register_callback(Renderer* rd, draw_callback callback, uint32_t subpass_index,
+        const char* name) {
+    sx_assert_rel(subpass_index != 1 && "The composition subpass takes no callbacks");
+    uint32_t index = rd->subpass_callbacks_count[subpass_index];
+    sx_assert_rel(index < MAX_SUBPASS_CALLBACKS && "Too many subpass callbacks");
+    rd->subpass_callbacks[subpass_index][index] = callback;
+    rd->subpass_callback_names[subpass_index][index] = name;
     rd->subpass_callbacks_count[subpass_index]++;
 }
 /*}}}*/
+
+/*{{{void renderer_register_compute_callback(Renderer* rd, compute_callback callback)*/
+void renderer_register_compute_callback(Renderer* rd, compute_callback callback) {
+    rd->compute_callbacks[rd->compute_callbacks_count] = callback;
+    rd->compute_callbacks_count++;
+}
+/*}}}*/
+
+/*{{{VkResult renderer_create_scene_pipelines(Renderer* rd, GraphicPipelineInfo* info,*/
+VkResult renderer_create_scene_pipelines(Renderer* rd, GraphicPipelineInfo* info,
+        PipelineHandle pipelines[SCENE_MODE_COUNT]) {
+    VkRenderPass render_passes[SCENE_MODE_COUNT];
+    uint32_t subpasses[SCENE_MODE_COUNT];
+    render_passes[SCENE_MODE_DEFERRED] = rd->render_pass;
+    subpasses[SCENE_MODE_DEFERRED] = 2;
+    render_passes[SCENE_MODE_FORWARD] = rd->forward_render_pass;
+    subpasses[SCENE_MODE_FORWARD] = 0;
+    return request_graphic_pipelines(info, SCENE_MODE_COUNT, render_passes, subpasses, pipelines);
+}
+/*}}}*/
+
+/*{{{void renderer_wait_semaphore(Renderer* rd, VkSemaphore semaphore, VkPipelineStageFlags stage)*/
+void renderer_wait_semaphore(Renderer* rd, VkSemaphore semaphore, VkPipelineStageFlags stage) {
+    sx_assert_rel(rd->frame_wait_semaphores_count < MAX_FRAME_SEMAPHORES && "Too many frame wait semaphores");
+    rd->frame_wait_semaphores[rd->frame_wait_semaphores_count] = semaphore;
+    rd->frame_wait_stages[rd->frame_wait_semaphores_count] = stage;
+    rd->frame_wait_semaphores_count++;
+}
+/*}}}*/
+
+/*{{{void renderer_signal_semaphore(Renderer* rd, VkSemaphore semaphore)*/
+void renderer_signal_semaphore(Renderer* rd, VkSemaphore semaphore) {
+    sx_assert_rel(rd->frame_signal_semaphores_count < MAX_FRAME_SEMAPHORES && "Too many frame signal semaphores");
+    rd->frame_signal_semaphores[rd->frame_signal_semaphores_count] = semaphore;
+    rd->frame_signal_semaphores_count++;
+}
+/*}}}*/
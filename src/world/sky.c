@@ -1,18 +1,63 @@
 #include "world/sky.h"
+#include "world/lut_cache.h"
 #include "renderer/vk_renderer.h"
+#include "sx/hash.h"
 #include "sx/math.h"
+#include "sx/string.h"
 #include "vulkan/vulkan_core.h"
 
+#include <stdio.h>
+
 void sky_draw(VkCommandBuffer cmdbuffer);
+void sky_compute();
+void update_atmosphere_buffer(Sky* sky);
+static void record_lut_commands(Sky* sky, VkCommandBuffer cmdbuffer);
+static void record_aerial_perspective(VkCommandBuffer cmdbuffer, void* user);
+static void record_sky_view(VkCommandBuffer cmdbuffer, void* user);
 
 Sky* global_sky;
 
-Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
+/* high is the reference quality, lower tiers trade LUT resolution and integration steps for speed */
+static const SkyQuality sky_quality_tiers[SKY_QUALITY_COUNT] = {
+    [SKY_QUALITY_LOW] = {
+        .transmittance_width = 128, .transmittance_height = 32, .multi_scat_size = 16,
+        .sky_view_width = 96, .sky_view_height = 54,
+        .transmittance_samples = 20, .multi_scat_samples = 10, .raymarch_samples = 16,
+        .aerial_perspective_steps = 1,
+    },
+    [SKY_QUALITY_MEDIUM] = {
+        .transmittance_width = 256, .transmittance_height = 64, .multi_scat_size = 32,
+        .sky_view_width = 144, .sky_view_height = 81,
+        .transmittance_samples = 30, .multi_scat_samples = 15, .raymarch_samples = 24,
+        .aerial_perspective_steps = 1,
+    },
+    [SKY_QUALITY_HIGH] = {
+        .transmittance_width = 256, .transmittance_height = 64, .multi_scat_size = 32,
+        .sky_view_width = 192, .sky_view_height = 108,
+        .transmittance_samples = 50, .multi_scat_samples = 20, .raymarch_samples = 40,
+        .aerial_perspective_steps = 2,
+    },
+};
+
+Sky* sky_create(const sx_alloc* alloc, Renderer *rd, SkyQualityTier tier) {
     VkResult result;
     Sky* sky = sx_malloc(alloc, sizeof(*sky));
     global_sky = sky;
     sky->alloc = alloc;
     sky->rd = rd;
+
+    sx_assert_rel(tier < SKY_QUALITY_COUNT && "Invalid sky quality tier");
+    sky->quality = sky_quality_tiers[tier];
+    for (uint32_t i = 0; i < SKY_QUALITY_CONSTANT_COUNT; i++) {
+        sky->specialization_entries[i].constantID = i;
+        sky->specialization_entries[i].offset = i * sizeof(uint32_t);
+        sky->specialization_entries[i].size = sizeof(uint32_t);
+    }
+    sky->specialization.mapEntryCount = SKY_QUALITY_CONSTANT_COUNT;
+    sky->specialization.pMapEntries = sky->specialization_entries;
+    sky->specialization.dataSize = sizeof(SkyQuality);
+    sky->specialization.pData = &sky->quality;
+    const SkyQuality* quality = &sky->quality;
     sky->atmosphere.bottom_radius = 6371.f;
     sky->atmosphere.top_radius = 6471.f;
     sky->rayleigh_scattering_scale = 0.1f;
@@ -28,37 +73,59 @@ Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
     sun_dir = sx_vec3_norm( (sx_vec3){ { 0.f, 0.5f, -1.f } } );
     sky->atmosphere.sun_direction = (sx_vec4){ { sun_dir.x, sun_dir.y, sun_dir.z, 0.f } };
 
-    uint8_t empty_data[256 * 64 * 4] = { 0 };
-    uint8_t empty_data2[32 * 32 * 4] = { 0 };
+    const uint32_t transmittance_size = quality->transmittance_width * quality->transmittance_height * 4;
+    const uint32_t multi_scat_size = quality->multi_scat_size * quality->multi_scat_size * 4;
+    /* a cache hit skips both compute passes below, textures are created straight from the mapped entries */
+    uint64_t transmittance_key = lut_cache_key(&sky->atmosphere, quality->transmittance_width, quality->transmittance_height,
+                                               VK_FORMAT_R8G8B8A8_UNORM, quality->transmittance_samples);
+    uint64_t multi_scat_key = lut_cache_key(&sky->atmosphere, quality->multi_scat_size, quality->multi_scat_size,
+                                            VK_FORMAT_R8G8B8A8_UNORM, quality->multi_scat_samples);
+    sx_mem_block* transmittance_data = lut_cache_map(alloc, LUT_CACHE_DIR, transmittance_key, transmittance_size);
+    sx_mem_block* multi_scat_data = lut_cache_map(alloc, LUT_CACHE_DIR, multi_scat_key, multi_scat_size);
+    bool lut_cached = transmittance_data && multi_scat_data;
+    if (!lut_cached) {
+        if (transmittance_data) {
+            sx_file_unmap(transmittance_data);
+        }
+        if (multi_scat_data) {
+            sx_file_unmap(multi_scat_data);
+        }
+        transmittance_data = sx_mem_create_block(alloc, transmittance_size, NULL, 0);
+        multi_scat_data = sx_mem_create_block(alloc, multi_scat_size, NULL, 0);
+        sx_assert_rel(transmittance_data && multi_scat_data && "Could not allocate lut data");
+        sx_memset(transmittance_data->data, 0, transmittance_size);
+        sx_memset(multi_scat_data->data, 0, multi_scat_size);
+    }
+
+    sky->atmosphere_uniforms = uniform_arena_reserve(sizeof(Atmosphere));
+    update_atmosphere_buffer(sky);
+    /* the init compute below runs before the first frame, against slice 0 */
+    uint32_t uniform_offset = uniform_arena_dynamic_offset();
 
-    result = create_buffer(&sky->atmospher_ubo, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, sizeof(Atmosphere));
+    result = create_texture_from_data(&sky->transmittance_tex, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, alloc, transmittance_data->data,
+                                      quality->transmittance_width, quality->transmittance_height);
     VK_CHECK_RESULT(result);
 
-    result = create_texture_from_data(&sky->transmittance_tex, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, alloc, empty_data, 256, 64);
+    result = create_texture_from_data(&sky->multi_scat_tex, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, alloc, multi_scat_data->data,
+                                      quality->multi_scat_size, quality->multi_scat_size);
     VK_CHECK_RESULT(result);
+    if (lut_cached) {
+        sx_file_unmap(transmittance_data);
+        sx_file_unmap(multi_scat_data);
+    }
+    /* the LUTs are first touched by the compute submits below */
+    staging_wait_idle();
 
-    result = create_texture_from_data(&sky->multi_scat_tex, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, alloc, empty_data2, 32, 32);
+    result = create_storage_texture(&sky->sky_view_tex, VK_FORMAT_R16G16B16A16_SFLOAT, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                                    quality->sky_view_width, quality->sky_view_height, 1);
     VK_CHECK_RESULT(result);
+    sky->use_sky_view_lut = true;
 
     /* Descriptor Set Creation */
     {
-        VkDescriptorPoolSize pool_sizes[2];
-        pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        pool_sizes[0].descriptorCount = 1;
-        pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        pool_sizes[1].descriptorCount = 1;
-
-        DescriptorPoolInfo pool_info = {};
-        pool_info.pool_sizes = pool_sizes;
-        pool_info.pool_size_count = 2;
-        pool_info.max_sets = 1;
-
-        result = create_descriptor_pool(&pool_info, &sky->descriptor_pool);
-        VK_CHECK_RESULT(result);
-
-        VkDescriptorSetLayoutBinding layout_bindings[3];
+        VkDescriptorSetLayoutBinding layout_bindings[4];
         layout_bindings[0].binding = 0;
-        layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         layout_bindings[0].descriptorCount = 1;
         layout_bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
         layout_bindings[0].pImmutableSamplers = NULL;
@@ -75,32 +142,39 @@ Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
         layout_bindings[2].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
         layout_bindings[2].pImmutableSamplers = NULL;
 
+        layout_bindings[3].binding = 3;
+        layout_bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        layout_bindings[3].descriptorCount = 1;
+        layout_bindings[3].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        layout_bindings[3].pImmutableSamplers = NULL;
+
         DescriptorLayoutInfo layout_info;
         layout_info.bindings = layout_bindings;
-        layout_info.num_bindings = 3;
-        result = create_descriptor_layout(&layout_info, &sky->descriptor_layout);
+        layout_info.num_bindings = 4;
+        result = get_descriptor_layout(&layout_info, &sky->descriptor_layout);
         VK_CHECK_RESULT(result);
 
-        result = create_descriptor_sets(sky->descriptor_pool, &sky->descriptor_layout, 1, &sky->descriptor_set);
+        result = allocate_descriptor_sets(&sky->descriptor_layout, 1, &sky->descriptor_set);
         VK_CHECK_RESULT(result);
 
-        VkDescriptorBufferInfo buffer_info = {};
-        buffer_info.buffer = sky->atmospher_ubo.buffer;
-        buffer_info.offset = 0;
-        buffer_info.range = sky->atmospher_ubo.size;
+        VkDescriptorBufferInfo buffer_info = uniform_block_descriptor(sky->atmosphere_uniforms);
         uint32_t buffer_binding = 0;
         uint32_t buffer_descriptor_count = 1;
-        VkDescriptorType buffer_descriptor_types = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        VkDescriptorImageInfo image_info[2];
+        VkDescriptorType buffer_descriptor_types = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        VkDescriptorImageInfo image_info[3];
         image_info[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
         image_info[0].imageView = sky->transmittance_tex.image_buffer.image_view;
         image_info[0].sampler = sky->transmittance_tex.sampler;
         image_info[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
         image_info[1].imageView = sky->multi_scat_tex.image_buffer.image_view;
         image_info[1].sampler = sky->multi_scat_tex.sampler;
-        uint32_t image_bindings[2] = {1, 2};
-        uint32_t image_descriptor_count[2] = {1, 1};
-        VkDescriptorType image_descriptor_types[2] = {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER};
+        image_info[2].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        image_info[2].imageView = sky->sky_view_tex.image_buffer.image_view;
+        image_info[2].sampler = sky->sky_view_tex.sampler;
+        uint32_t image_bindings[3] = {1, 2, 3};
+        uint32_t image_descriptor_count[3] = {1, 1, 1};
+        VkDescriptorType image_descriptor_types[3] = {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                                      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER};
 
         DescriptorSetUpdateInfo update_info = {0};
         update_info.descriptor_set = sky->descriptor_set;
@@ -114,7 +188,7 @@ Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
         update_info.images_infos = image_info;
         update_info.image_descriptor_types = image_descriptor_types;
         update_info.image_bindings = image_bindings;
-        update_info.num_image_bindings = 2;
+        update_info.num_image_bindings = 3;
         update_info.image_descriptor_count = image_descriptor_count;
 
         update_descriptor_set(&update_info);
@@ -153,9 +227,16 @@ Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
             sky->descriptor_layout,
         };
 
+        VkPushConstantRange push_constant_range;
+        push_constant_range.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        push_constant_range.offset = 0;
+        push_constant_range.size = sizeof(uint32_t);
+
         PipelineLayoutInfo pipeline_layout_info = {0};
         pipeline_layout_info.descriptor_layouts = descriptor_set_layouts;
         pipeline_layout_info.descriptor_layout_count = 2;
+        pipeline_layout_info.push_constant_ranges = &push_constant_range;
+        pipeline_layout_info.push_constant_count = 1;
 
         result = create_pipeline_layout(&pipeline_layout_info, &sky->pipeline_layout);
         VK_CHECK_RESULT(result);
@@ -164,7 +245,8 @@ Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
 
         VkPipelineShaderStageCreateInfo shader_stages[2];
         shader_stages[0] = create_shader_module("shaders/render_sky.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
-        shader_stages[1] = create_shader_module("shaders/render_sky.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+        shader_stages[1] = create_specialized_shader_module("shaders/render_sky.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT,
+                                                            &sky->specialization);
 
         GraphicPipelineInfo graphic_pipeline_info;
         graphic_pipeline_info.vertex_input = &vertex_input_state_info;
@@ -173,13 +255,11 @@ Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
         graphic_pipeline_info.multisample = &multisample_state_info;
         graphic_pipeline_info.depth_stencil = &depth_stencil_state_info;
         graphic_pipeline_info.color_blend = &color_blend_state_info;
-        graphic_pipeline_info.render_pass = rd->render_pass;
-        graphic_pipeline_info.subpass = 2;
         graphic_pipeline_info.layout = &sky->pipeline_layout;
         graphic_pipeline_info.shader_stages = shader_stages;
         graphic_pipeline_info.shader_stages_count = 2;
 
-        result = create_graphic_pipeline(&graphic_pipeline_info, &sky->pipeline);
+        result = renderer_create_scene_pipelines(rd, &graphic_pipeline_info, sky->pipelines);
         VK_CHECK_RESULT(result);
     }
     VkImageSubresourceRange image_subresource_range;
@@ -192,23 +272,9 @@ Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
     /* transmittance compute */
     {
         {
-            VkDescriptorPoolSize pool_sizes[2];
-            pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            pool_sizes[0].descriptorCount = 1;
-            pool_sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-            pool_sizes[1].descriptorCount = 1;
-
-            DescriptorPoolInfo pool_info = {};
-            pool_info.pool_sizes = pool_sizes;
-            pool_info.pool_size_count = 2;
-            pool_info.max_sets = 1;
-
-            result = create_descriptor_pool(&pool_info, &sky->transmittance_descriptor_pool);
-            VK_CHECK_RESULT(result);
-
             VkDescriptorSetLayoutBinding layout_bindings[2];
             layout_bindings[0].binding = 0;
-            layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
             layout_bindings[0].descriptorCount = 1;
             layout_bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
             layout_bindings[0].pImmutableSamplers = NULL;
@@ -222,19 +288,16 @@ Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
             DescriptorLayoutInfo layout_info;
             layout_info.bindings = layout_bindings;
             layout_info.num_bindings = 2;
-            result = create_descriptor_layout(&layout_info, &sky->transmittance_descriptor_layout);
+            result = get_descriptor_layout(&layout_info, &sky->transmittance_descriptor_layout);
             VK_CHECK_RESULT(result);
 
-            result = create_descriptor_sets(sky->transmittance_descriptor_pool, &sky->transmittance_descriptor_layout, 1, &sky->transmittance_descriptor_set);
+            result = allocate_descriptor_sets(&sky->transmittance_descriptor_layout, 1, &sky->transmittance_descriptor_set);
             VK_CHECK_RESULT(result);
 
-            VkDescriptorBufferInfo buffer_info = {};
-            buffer_info.buffer = sky->atmospher_ubo.buffer;
-            buffer_info.offset = 0;
-            buffer_info.range = sky->atmospher_ubo.size;
+            VkDescriptorBufferInfo buffer_info = uniform_block_descriptor(sky->atmosphere_uniforms);
             uint32_t buffer_binding = 0;
             uint32_t buffer_descriptor_count = 1;
-            VkDescriptorType buffer_descriptor_types = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            VkDescriptorType buffer_descriptor_types = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
             VkDescriptorImageInfo image_info[1];
             image_info[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
             image_info[0].imageView = sky->transmittance_tex.image_buffer.image_view;
@@ -260,7 +323,8 @@ Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
 
             update_descriptor_set(&update_info);
         }
-        VkPipelineShaderStageCreateInfo shader_stage_info = create_shader_module("shaders/compute_transmittance.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+        VkPipelineShaderStageCreateInfo shader_stage_info = create_specialized_shader_module("shaders/compute_transmittance.comp.spv",
+                VK_SHADER_STAGE_COMPUTE_BIT, &sky->specialization);
 
         PipelineLayoutInfo pipeline_layout_info;
         pipeline_layout_info.descriptor_layout_count = 1;
@@ -288,21 +352,28 @@ Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
             image_memory_barrier.pNext = NULL;
             image_memory_barrier.srcAccessMask = 0;
             image_memory_barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-            image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            /* the uploaded texels are only kept when they came from the cache */
+            image_memory_barrier.oldLayout = lut_cached ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                                                        : VK_IMAGE_LAYOUT_UNDEFINED;
             image_memory_barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            image_memory_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            image_memory_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
             image_memory_barrier.image = sky->transmittance_tex.image_buffer.image;
             image_memory_barrier.subresourceRange = image_subresource_range;
-            vkCmdPipelineBarrier( rd->compute_cmdbuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1,
+            /* staging_wait_idle already waited for the upload on the host */
+            vkCmdPipelineBarrier( rd->compute_cmdbuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL, 1,
                     &image_memory_barrier);
         }
 
-        vkCmdBindPipeline(rd->compute_cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->transmittance_pipeline);
-        vkCmdBindDescriptorSets(rd->compute_cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->transmittance_pipeline_layout, 0, 1, 
-                                &sky->transmittance_descriptor_set, 0, NULL);
+        if (!lut_cached) {
+            vkCmdBindPipeline(rd->compute_cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->transmittance_pipeline);
+            vkCmdBindDescriptorSets(rd->compute_cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->transmittance_pipeline_layout, 0, 1, 
+                                    &sky->transmittance_descriptor_set, 1, &uniform_offset);
 
-        vkCmdDispatch(rd->compute_cmdbuffer, (uint32_t)sx_ceil(256 / (float)8),
-                                            (uint32_t)sx_ceil(64 / (float)8), 1);
+            vkCmdDispatch(rd->compute_cmdbuffer, (uint32_t)sx_ceil(quality->transmittance_width / (float)8),
+                                                (uint32_t)sx_ceil(quality->transmittance_height / (float)8), 1);
+        }
 
         result = vkEndCommandBuffer(rd->compute_cmdbuffer);
         sx_assert_rel(result == VK_SUCCESS && "Could not finish command buffer record");
@@ -318,7 +389,7 @@ Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
         submit_info.signal_semaphores = NULL;
         submit_info.wait_semaphores_count = 0;
         submit_info.wait_semaphores = NULL;
-        submit_info.wait_dst_stage_mask = 0;
+        submit_info.wait_dst_stage_masks = NULL;
         submit_info.fence = fence;
         submit_info.queue = COMPUTE;
         result = submit_commands(&submit_info);
@@ -333,25 +404,9 @@ Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
     /* multi scattering compute */
     {
         {
-            VkDescriptorPoolSize pool_sizes[3];
-            pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            pool_sizes[0].descriptorCount = 1;
-            pool_sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-            pool_sizes[1].descriptorCount = 1;
-            pool_sizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            pool_sizes[2].descriptorCount = 1;
-
-            DescriptorPoolInfo pool_info = {};
-            pool_info.pool_sizes = pool_sizes;
-            pool_info.pool_size_count = 3;
-            pool_info.max_sets = 1;
-
-            result = create_descriptor_pool(&pool_info, &sky->multi_scat_descriptor_pool);
-            VK_CHECK_RESULT(result);
-
             VkDescriptorSetLayoutBinding layout_bindings[3];
             layout_bindings[0].binding = 0;
-            layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
             layout_bindings[0].descriptorCount = 1;
             layout_bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
             layout_bindings[0].pImmutableSamplers = NULL;
@@ -371,19 +426,16 @@ Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
             DescriptorLayoutInfo layout_info;
             layout_info.bindings = layout_bindings;
             layout_info.num_bindings = 3;
-            result = create_descriptor_layout(&layout_info, &sky->multi_scat_descriptor_layout);
+            result = get_descriptor_layout(&layout_info, &sky->multi_scat_descriptor_layout);
             VK_CHECK_RESULT(result);
 
-            result = create_descriptor_sets(sky->multi_scat_descriptor_pool, &sky->multi_scat_descriptor_layout, 1, &sky->multi_scat_descriptor_set);
+            result = allocate_descriptor_sets(&sky->multi_scat_descriptor_layout, 1, &sky->multi_scat_descriptor_set);
             VK_CHECK_RESULT(result);
 
-            VkDescriptorBufferInfo buffer_info = {};
-            buffer_info.buffer = sky->atmospher_ubo.buffer;
-            buffer_info.offset = 0;
-            buffer_info.range = sky->atmospher_ubo.size;
+            VkDescriptorBufferInfo buffer_info = uniform_block_descriptor(sky->atmosphere_uniforms);
             uint32_t buffer_binding = 0;
             uint32_t buffer_descriptor_count = 1;
-            VkDescriptorType buffer_descriptor_types = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            VkDescriptorType buffer_descriptor_types = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
             VkDescriptorImageInfo image_info[2];
             image_info[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
             image_info[0].imageView = sky->multi_scat_tex.image_buffer.image_view;
@@ -412,7 +464,12 @@ Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
 
             update_descriptor_set(&update_info);
         }
-        VkPipelineShaderStageCreateInfo shader_stage_info = create_shader_module("shaders/compute_multi_scattering.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+        /* the shared memory tree reduction is the fallback for devices without subgroup arithmetic */
+        const char* multi_scat_shader = device_supports_subgroup_arithmetic(VK_SHADER_STAGE_COMPUTE_BIT)
+                                        ? "shaders/compute_multi_scattering_subgroup.comp.spv"
+                                        : "shaders/compute_multi_scattering.comp.spv";
+        VkPipelineShaderStageCreateInfo shader_stage_info = create_specialized_shader_module(multi_scat_shader,
+                VK_SHADER_STAGE_COMPUTE_BIT, &sky->specialization);
 
         PipelineLayoutInfo pipeline_layout_info;
         pipeline_layout_info.descriptor_layout_count = 1;
@@ -440,20 +497,27 @@ Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
             image_memory_barrier.pNext = NULL;
             image_memory_barrier.srcAccessMask = 0;
             image_memory_barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-            image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            /* the uploaded texels are only kept when they came from the cache */
+            image_memory_barrier.oldLayout = lut_cached ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                                                        : VK_IMAGE_LAYOUT_UNDEFINED;
             image_memory_barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            image_memory_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            image_memory_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
             image_memory_barrier.image = sky->multi_scat_tex.image_buffer.image;
             image_memory_barrier.subresourceRange = image_subresource_range;
-            vkCmdPipelineBarrier( rd->compute_cmdbuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1,
+            /* staging_wait_idle already waited for the upload on the host */
+            vkCmdPipelineBarrier( rd->compute_cmdbuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL, 1,
                     &image_memory_barrier);
         }
 
-        vkCmdBindPipeline(rd->compute_cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->multi_scat_pipeline);
-        vkCmdBindDescriptorSets(rd->compute_cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->multi_scat_pipeline_layout, 0, 1, 
-                                &sky->multi_scat_descriptor_set, 0, NULL);
+        if (!lut_cached) {
+            vkCmdBindPipeline(rd->compute_cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->multi_scat_pipeline);
+            vkCmdBindDescriptorSets(rd->compute_cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->multi_scat_pipeline_layout, 0, 1, 
+                                    &sky->multi_scat_descriptor_set, 1, &uniform_offset);
 
-        vkCmdDispatch(rd->compute_cmdbuffer, 32, 32, 1);
+            vkCmdDispatch(rd->compute_cmdbuffer, quality->multi_scat_size, quality->multi_scat_size, 1);
+        }
 
         result = vkEndCommandBuffer(rd->compute_cmdbuffer);
         sx_assert_rel(result == VK_SUCCESS && "Could not finish command buffer record");
@@ -469,7 +533,7 @@ Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
         submit_info.signal_semaphores = NULL;
         submit_info.wait_semaphores_count = 0;
         submit_info.wait_semaphores = NULL;
-        submit_info.wait_dst_stage_mask = 0;
+        submit_info.wait_dst_stage_masks = NULL;
         submit_info.fence = fence;
         submit_info.queue = COMPUTE;
         result = submit_commands(&submit_info);
@@ -480,89 +544,453 @@ Sky* sky_create(const sx_alloc* alloc, Renderer *rd) {
 
         destroy_fence(fence);
     }
-    result = create_fence(&sky->fence, false);
-    sx_assert_rel(result == VK_SUCCESS && "Could not create fence");
-    renderer_register_callback(sky->rd, sky_draw, 2);
+
+    /* sky view compute */
+    {
+        {
+            VkDescriptorSetLayoutBinding layout_bindings[4];
+            layout_bindings[0].binding = 0;
+            layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+            layout_bindings[0].descriptorCount = 1;
+            layout_bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            layout_bindings[0].pImmutableSamplers = NULL;
+
+            layout_bindings[1].binding = 1;
+            layout_bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            layout_bindings[1].descriptorCount = 1;
+            layout_bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            layout_bindings[1].pImmutableSamplers = NULL;
+
+            layout_bindings[2].binding = 2;
+            layout_bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            layout_bindings[2].descriptorCount = 1;
+            layout_bindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            layout_bindings[2].pImmutableSamplers = NULL;
+
+            layout_bindings[3].binding = 3;
+            layout_bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            layout_bindings[3].descriptorCount = 1;
+            layout_bindings[3].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            layout_bindings[3].pImmutableSamplers = NULL;
+
+            DescriptorLayoutInfo layout_info;
+            layout_info.bindings = layout_bindings;
+            layout_info.num_bindings = 4;
+            result = get_descriptor_layout(&layout_info, &sky->sky_view_descriptor_layout);
+            VK_CHECK_RESULT(result);
+
+            result = allocate_descriptor_sets(&sky->sky_view_descriptor_layout, 1, &sky->sky_view_descriptor_set);
+            VK_CHECK_RESULT(result);
+
+            VkDescriptorBufferInfo buffer_info = uniform_block_descriptor(sky->atmosphere_uniforms);
+            uint32_t buffer_binding = 0;
+            uint32_t buffer_descriptor_count = 1;
+            VkDescriptorType buffer_descriptor_types = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+            VkDescriptorImageInfo image_info[3];
+            image_info[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+            image_info[0].imageView = sky->sky_view_tex.image_buffer.image_view;
+            image_info[0].sampler = sky->sky_view_tex.sampler;
+            image_info[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+            image_info[1].imageView = sky->transmittance_tex.image_buffer.image_view;
+            image_info[1].sampler = sky->transmittance_tex.sampler;
+            image_info[2].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+            image_info[2].imageView = sky->multi_scat_tex.image_buffer.image_view;
+            image_info[2].sampler = sky->multi_scat_tex.sampler;
+            uint32_t image_bindings[3] = {1, 2, 3};
+            uint32_t image_descriptor_count[3] = {1, 1, 1};
+            VkDescriptorType image_descriptor_types[3] = {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                                          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER};
+
+            DescriptorSetUpdateInfo update_info = {0};
+            update_info.descriptor_set = sky->sky_view_descriptor_set;
+
+            update_info.buffer_infos = &buffer_info;
+            update_info.buffer_bindings = &buffer_binding;
+            update_info.buffer_descriptor_types = &buffer_descriptor_types;
+            update_info.num_buffer_bindings = 1;
+            update_info.buffer_descriptor_count = &buffer_descriptor_count;
+
+            update_info.images_infos = image_info;
+            update_info.image_descriptor_types = image_descriptor_types;
+            update_info.image_bindings = image_bindings;
+            update_info.num_image_bindings = 3;
+            update_info.image_descriptor_count = image_descriptor_count;
+
+            update_descriptor_set(&update_info);
+        }
+        VkPipelineShaderStageCreateInfo shader_stage_info = create_specialized_shader_module("shaders/compute_sky_view.comp.spv",
+                VK_SHADER_STAGE_COMPUTE_BIT, &sky->specialization);
+
+        /* set 0 is the renderer global ubo, the camera is read from it every frame */
+        VkDescriptorSetLayout descriptor_set_layouts[2] = {
+            rd->global_descriptor_layout,
+            sky->sky_view_descriptor_layout,
+        };
+
+        PipelineLayoutInfo pipeline_layout_info;
+        pipeline_layout_info.descriptor_layout_count = 2;
+        pipeline_layout_info.descriptor_layouts = descriptor_set_layouts;
+        pipeline_layout_info.push_constant_count = 0;
+        pipeline_layout_info.push_constant_ranges = NULL;
+
+        result = create_pipeline_layout(&pipeline_layout_info, &sky->sky_view_pipeline_layout);
+        sx_assert_rel(result == VK_SUCCESS && "Could not create pipeline layout");
+
+        ComputePipelineInfo pipeline_info;
+        pipeline_info.num_pipelines = 1;
+        pipeline_info.layouts = &sky->sky_view_pipeline_layout;
+        pipeline_info.shader = &shader_stage_info;
+
+        result = create_compute_pipeline(&pipeline_info, &sky->sky_view_pipeline);
+        sx_assert_rel(result == VK_SUCCESS && "Could not create compute pipeline");
+    }
+
+    /* aerial perspective compute */
+    {
+        {
+            VkDescriptorSetLayoutBinding layout_bindings[4];
+            layout_bindings[0].binding = 0;
+            layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+            layout_bindings[0].descriptorCount = 1;
+            layout_bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            layout_bindings[0].pImmutableSamplers = NULL;
+
+            layout_bindings[1].binding = 1;
+            layout_bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            layout_bindings[1].descriptorCount = 1;
+            layout_bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            layout_bindings[1].pImmutableSamplers = NULL;
+
+            layout_bindings[2].binding = 2;
+            layout_bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            layout_bindings[2].descriptorCount = 1;
+            layout_bindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            layout_bindings[2].pImmutableSamplers = NULL;
+
+            layout_bindings[3].binding = 3;
+            layout_bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            layout_bindings[3].descriptorCount = 1;
+            layout_bindings[3].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            layout_bindings[3].pImmutableSamplers = NULL;
+
+            DescriptorLayoutInfo layout_info;
+            layout_info.bindings = layout_bindings;
+            layout_info.num_bindings = 4;
+            result = get_descriptor_layout(&layout_info, &sky->aerial_perspective_descriptor_layout);
+            VK_CHECK_RESULT(result);
+
+            result = allocate_descriptor_sets(&sky->aerial_perspective_descriptor_layout, 1, &sky->aerial_perspective_descriptor_set);
+            VK_CHECK_RESULT(result);
+
+            VkDescriptorBufferInfo buffer_info = uniform_block_descriptor(sky->atmosphere_uniforms);
+            uint32_t buffer_binding = 0;
+            uint32_t buffer_descriptor_count = 1;
+            VkDescriptorType buffer_descriptor_types = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+            VkDescriptorImageInfo image_info[3];
+            image_info[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+            image_info[0].imageView = rd->aerial_perspective.image_buffer.image_view;
+            image_info[0].sampler = rd->aerial_perspective.sampler;
+            image_info[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+            image_info[1].imageView = sky->transmittance_tex.image_buffer.image_view;
+            image_info[1].sampler = sky->transmittance_tex.sampler;
+            image_info[2].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+            image_info[2].imageView = sky->multi_scat_tex.image_buffer.image_view;
+            image_info[2].sampler = sky->multi_scat_tex.sampler;
+            uint32_t image_bindings[3] = {1, 2, 3};
+            uint32_t image_descriptor_count[3] = {1, 1, 1};
+            VkDescriptorType image_descriptor_types[3] = {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                                          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER};
+
+            DescriptorSetUpdateInfo update_info = {0};
+            update_info.descriptor_set = sky->aerial_perspective_descriptor_set;
+
+            update_info.buffer_infos = &buffer_info;
+            update_info.buffer_bindings = &buffer_binding;
+            update_info.buffer_descriptor_types = &buffer_descriptor_types;
+            update_info.num_buffer_bindings = 1;
+            update_info.buffer_descriptor_count = &buffer_descriptor_count;
+
+            update_info.images_infos = image_info;
+            update_info.image_descriptor_types = image_descriptor_types;
+            update_info.image_bindings = image_bindings;
+            update_info.num_image_bindings = 3;
+            update_info.image_descriptor_count = image_descriptor_count;
+
+            update_descriptor_set(&update_info);
+        }
+        VkPipelineShaderStageCreateInfo shader_stage_info = create_specialized_shader_module("shaders/compute_aerial_perspective.comp.spv",
+                VK_SHADER_STAGE_COMPUTE_BIT, &sky->specialization);
+
+        VkDescriptorSetLayout descriptor_set_layouts[2] = {
+            rd->global_descriptor_layout,
+            sky->aerial_perspective_descriptor_layout,
+        };
+
+        PipelineLayoutInfo pipeline_layout_info;
+        pipeline_layout_info.descriptor_layout_count = 2;
+        pipeline_layout_info.descriptor_layouts = descriptor_set_layouts;
+        pipeline_layout_info.push_constant_count = 0;
+        pipeline_layout_info.push_constant_ranges = NULL;
+
+        result = create_pipeline_layout(&pipeline_layout_info, &sky->aerial_perspective_pipeline_layout);
+        sx_assert_rel(result == VK_SUCCESS && "Could not create pipeline layout");
+
+        ComputePipelineInfo pipeline_info;
+        pipeline_info.num_pipelines = 1;
+        pipeline_info.layouts = &sky->aerial_perspective_pipeline_layout;
+        pipeline_info.shader = &shader_stage_info;
+
+        result = create_compute_pipeline(&pipeline_info, &sky->aerial_perspective_pipeline);
+        sx_assert_rel(result == VK_SUCCESS && "Could not create compute pipeline");
+    }
+
+    if (!lut_cached) {
+        result = read_texture_data(&sky->transmittance_tex, VK_IMAGE_LAYOUT_GENERAL, transmittance_data->data,
+                                   quality->transmittance_width, quality->transmittance_height);
+        VK_CHECK_RESULT(result);
+        result = read_texture_data(&sky->multi_scat_tex, VK_IMAGE_LAYOUT_GENERAL, multi_scat_data->data,
+                                   quality->multi_scat_size, quality->multi_scat_size);
+        VK_CHECK_RESULT(result);
+        if (!lut_cache_store(alloc, LUT_CACHE_DIR, transmittance_key, transmittance_data->data, transmittance_size) ||
+            !lut_cache_store(alloc, LUT_CACHE_DIR, multi_scat_key, multi_scat_data->data, multi_scat_size)) {
+            printf("Could not write sky luts to %s\n", LUT_CACHE_DIR);
+        }
+        sx_mem_destroy_block(transmittance_data);
+        sx_mem_destroy_block(multi_scat_data);
+    }
+
+    result = create_command_buffer(COMPUTE, VK_COMMAND_BUFFER_LEVEL_PRIMARY, frames_in_flight(), sky->lut_cmdbuffers);
+    VK_CHECK_RESULT(result);
+
+    result = create_semaphore(&sky->lut_release_semaphore);
+    VK_CHECK_RESULT(result);
+    result = create_semaphore(&sky->lut_ready_semaphore);
+    VK_CHECK_RESULT(result);
+    sky->lut_release_pending = false;
+    sky->atmosphere_hash = sx_hash_xxh64(&sky->atmosphere, sizeof(Atmosphere), 0);
+
+    /* Render graph {{{*/
+    {
+        /* the LUTs are idle and in GENERAL once sky_create returns */
+        RgImageState idle_state = { .layout = VK_IMAGE_LAYOUT_GENERAL, .queue_family = VK_QUEUE_FAMILY_IGNORED };
+        sky->transmittance_state = idle_state;
+        sky->multi_scat_state = idle_state;
+        sky->sky_view_state = idle_state;
+        RenderGraph* graph = rd->graph;
+        sky->transmittance_image = rg_import_image(graph, "transmittance", sky->transmittance_tex.image_buffer.image,
+                                                   VK_IMAGE_ASPECT_COLOR_BIT, &sky->transmittance_state,
+                                                   RG_IMAGE_GENERAL_LAYOUT);
+        sky->multi_scat_image = rg_import_image(graph, "multi scattering", sky->multi_scat_tex.image_buffer.image,
+                                                VK_IMAGE_ASPECT_COLOR_BIT, &sky->multi_scat_state,
+                                                RG_IMAGE_GENERAL_LAYOUT);
+        sky->sky_view_image = rg_import_image(graph, "sky view", sky->sky_view_tex.image_buffer.image,
+                                              VK_IMAGE_ASPECT_COLOR_BIT, &sky->sky_view_state,
+                                              RG_IMAGE_GENERAL_LAYOUT);
+
+        RgPass pass = rg_add_pass(graph, "aerial perspective", record_aerial_perspective, sky, 0);
+        rg_read(graph, pass, sky->transmittance_image, RG_USAGE_SAMPLED_COMPUTE);
+        rg_read(graph, pass, sky->multi_scat_image, RG_USAGE_SAMPLED_COMPUTE);
+        rg_write(graph, pass, rd->aerial_perspective_image, RG_USAGE_STORAGE_WRITE_COMPUTE);
+
+        sky->sky_view_pass = rg_add_pass(graph, "sky view", record_sky_view, sky, 0);
+        rg_read(graph, sky->sky_view_pass, sky->transmittance_image, RG_USAGE_SAMPLED_COMPUTE);
+        rg_read(graph, sky->sky_view_pass, sky->multi_scat_image, RG_USAGE_SAMPLED_COMPUTE);
+        rg_write(graph, sky->sky_view_pass, sky->sky_view_image, RG_USAGE_STORAGE_WRITE_COMPUTE);
+
+        /* sampled by sky_draw */
+        renderer_scene_read(rd, sky->transmittance_image);
+        renderer_scene_read(rd, sky->multi_scat_image);
+        renderer_scene_read(rd, sky->sky_view_image);
+    }
+    /*}}}*/
+
+    renderer_register_compute_callback(sky->rd, sky_compute);
+    renderer_register_callback(sky->rd, sky_draw, 2, "sky");
 
     return sky;
 
 }
 
 void update_atmosphere_buffer(Sky* sky) {
-    copy_buffer(&sky->atmospher_ubo, &sky->atmosphere, sizeof(Atmosphere));
+    sky->gpu_atmosphere = sky->atmosphere;
+    uniform_block_write(sky->atmosphere_uniforms, &sky->gpu_atmosphere);
 }
 
-void sky_draw(VkCommandBuffer cmdbuffer) {
-    update_atmosphere_buffer(global_sky);
-    Renderer *rd = global_sky->rd;
-    Sky *sky = global_sky;
+static void record_lut_commands(Sky* sky, VkCommandBuffer cmdbuffer) {
     VkResult result;
+    uint32_t uniform_offset = uniform_arena_dynamic_offset();
     VkCommandBufferBeginInfo begin_info = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, 
                                             .flags = 0, .pInheritanceInfo = NULL};
-    result = vkBeginCommandBuffer(rd->compute_cmdbuffer, &begin_info);
+    result = vkBeginCommandBuffer(cmdbuffer, &begin_info);
     sx_assert_rel(result == VK_SUCCESS && "Could not begin command buffer");
+    gpu_profiler_begin_compute(cmdbuffer);
 
-    vkCmdBindPipeline(rd->compute_cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->transmittance_pipeline);
-    vkCmdBindDescriptorSets(rd->compute_cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->transmittance_pipeline_layout, 0, 1, 
-                            &sky->transmittance_descriptor_set, 0, NULL);
+    /* both LUTs are fully rewritten, the old texels and their ownership are discarded */
+    {
+        VkImageMemoryBarrier image_memory_barriers[2] = {0};
+        for (uint32_t i = 0; i < 2; i++) {
+            image_memory_barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            image_memory_barriers[i].srcAccessMask = 0;
+            image_memory_barriers[i].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            image_memory_barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            image_memory_barriers[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            image_memory_barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            image_memory_barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            image_memory_barriers[i].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            image_memory_barriers[i].subresourceRange.levelCount = 1;
+            image_memory_barriers[i].subresourceRange.layerCount = 1;
+        }
+        image_memory_barriers[0].image = sky->transmittance_tex.image_buffer.image;
+        image_memory_barriers[1].image = sky->multi_scat_tex.image_buffer.image;
+        vkCmdPipelineBarrier(cmdbuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL, 2, image_memory_barriers);
+    }
 
-    vkCmdDispatch(rd->compute_cmdbuffer, (uint32_t)sx_ceil(256 / (float)8),
-                                        (uint32_t)sx_ceil(64 / (float)8), 1);
+    vkCmdBindPipeline(cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->transmittance_pipeline);
+    vkCmdBindDescriptorSets(cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->transmittance_pipeline_layout, 0, 1, 
+                            &sky->transmittance_descriptor_set, 1, &uniform_offset);
 
-    result = vkEndCommandBuffer(rd->compute_cmdbuffer);
-    sx_assert_rel(result == VK_SUCCESS && "Could not finish command buffer record");
+    uint32_t scope = gpu_profiler_compute_begin(cmdbuffer, "transmittance LUT");
+    vkCmdDispatch(cmdbuffer, (uint32_t)sx_ceil(sky->quality.transmittance_width / (float)8),
+                                      (uint32_t)sx_ceil(sky->quality.transmittance_height / (float)8), 1);
+    gpu_profiler_compute_end(cmdbuffer, scope);
 
-    reset_fences(1, &sky->fence);
-
-    CommandSubmitInfo submit_info = {0};
-    submit_info.command_buffers_count = 1;
-    submit_info.command_buffers = &rd->compute_cmdbuffer;
-    submit_info.signal_semaphores_count = 0;
-    submit_info.signal_semaphores = NULL;
-    submit_info.wait_semaphores_count = 0;
-    submit_info.wait_semaphores = NULL;
-    submit_info.wait_dst_stage_mask = 0;
-    submit_info.fence = sky->fence;
-    submit_info.queue = COMPUTE;
-    result = submit_commands(&submit_info);
-    sx_assert_rel(result == VK_SUCCESS && "Failed to submit commands");
-
-    result = wait_fences(1, &sky->fence, true, 100000000000);
-    sx_assert_rel(result == VK_SUCCESS && "Failed to wait fence");
-    reset_fences(1, &sky->fence);
-
-    result = vkBeginCommandBuffer(rd->compute_cmdbuffer, &begin_info);
-    sx_assert_rel(result == VK_SUCCESS && "Could not begin command buffer");
+    /* multi scattering samples the transmittance written above */
+    {
+        VkImageMemoryBarrier image_memory_barrier = {};
+        image_memory_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        image_memory_barrier.pNext = NULL;
+        image_memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        image_memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        image_memory_barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        image_memory_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_memory_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_memory_barrier.image = sky->transmittance_tex.image_buffer.image;
+        image_memory_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        image_memory_barrier.subresourceRange.baseMipLevel = 0;
+        image_memory_barrier.subresourceRange.levelCount = 1;
+        image_memory_barrier.subresourceRange.baseArrayLayer = 0;
+        image_memory_barrier.subresourceRange.layerCount = 1;
+        vkCmdPipelineBarrier(cmdbuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL, 1,
+                &image_memory_barrier);
+    }
+
+    vkCmdBindPipeline(cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->multi_scat_pipeline);
+    vkCmdBindDescriptorSets(cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->multi_scat_pipeline_layout, 0, 1, 
+                            &sky->multi_scat_descriptor_set, 1, &uniform_offset);
 
-    vkCmdBindPipeline(rd->compute_cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->multi_scat_pipeline);
-    vkCmdBindDescriptorSets(rd->compute_cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->multi_scat_pipeline_layout, 0, 1, 
-                            &sky->multi_scat_descriptor_set, 0, NULL);
+    scope = gpu_profiler_compute_begin(cmdbuffer, "multi scattering LUT");
+    vkCmdDispatch(cmdbuffer, sky->quality.multi_scat_size, sky->quality.multi_scat_size, 1);
+    gpu_profiler_compute_end(cmdbuffer, scope);
 
-    vkCmdDispatch(rd->compute_cmdbuffer, 32, 32, 1);
+    /* handed back to the graphics queue, the render graph acquires them on first use */
+    rg_release_image(cmdbuffer, sky->transmittance_tex.image_buffer.image, VK_IMAGE_ASPECT_COLOR_BIT,
+                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, &sky->transmittance_state,
+                     get_queue_index(COMPUTE), get_queue_index(GRAPHICS));
+    rg_release_image(cmdbuffer, sky->multi_scat_tex.image_buffer.image, VK_IMAGE_ASPECT_COLOR_BIT,
+                     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, &sky->multi_scat_state,
+                     get_queue_index(COMPUTE), get_queue_index(GRAPHICS));
 
-    result = vkEndCommandBuffer(rd->compute_cmdbuffer);
+    result = vkEndCommandBuffer(cmdbuffer);
     sx_assert_rel(result == VK_SUCCESS && "Could not finish command buffer record");
+}
 
-    submit_info.command_buffers_count = 1;
-    submit_info.command_buffers = &rd->compute_cmdbuffer;
-    submit_info.signal_semaphores_count = 0;
-    submit_info.signal_semaphores = NULL;
-    submit_info.wait_semaphores_count = 0;
-    submit_info.wait_semaphores = NULL;
-    submit_info.wait_dst_stage_mask = 0;
-    submit_info.fence = sky->fence;
-    submit_info.queue = COMPUTE;
-    result = submit_commands(&submit_info);
-    sx_assert_rel(result == VK_SUCCESS && "Failed to submit commands");
-
-    result = wait_fences(1, &sky->fence, true, 100000000000);
-    sx_assert_rel(result == VK_SUCCESS && "Failed to wait fence");
+/*
+ * LUTs are only regenerated when the atmosphere hash changes. The frame that
+ * detects the change signals lut_release_semaphore once it is done sampling the
+ * old LUTs, the next frame submits the recorded compute work waiting on it and
+ * the graphics submit of that frame waits on lut_ready_semaphore. The CPU never
+ * blocks on the compute queue.
+ * The aerial perspective volume and the sky view LUT are then rebuilt from them
+ * for the current camera by the render graph passes below.
+ */
+void sky_compute() {
+    Renderer *rd = global_sky->rd;
+    Sky *sky = global_sky;
+    VkResult result;
+    uint64_t hash = sx_hash_xxh64(&sky->atmosphere, sizeof(Atmosphere), 0);
+
+    /* keeps sampling with the parameters of the current LUTs until they are rebuilt */
+    uniform_block_write(sky->atmosphere_uniforms, &sky->gpu_atmosphere);
+    if (sky->lut_release_pending) {
+        update_atmosphere_buffer(sky);
+        sky->atmosphere_hash = hash;
+        /* re-recorded so its dynamic offsets point at this frame's slice */
+        VkCommandBuffer lut_cmdbuffer = sky->lut_cmdbuffers[rd->resource_index];
+        record_lut_commands(sky, lut_cmdbuffer);
+
+        VkPipelineStageFlags wait_dst_stage_mask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        CommandSubmitInfo submit_info = {0};
+        submit_info.command_buffers_count = 1;
+        submit_info.command_buffers = &lut_cmdbuffer;
+        submit_info.wait_semaphores_count = 1;
+        submit_info.wait_semaphores = &sky->lut_release_semaphore;
+        submit_info.wait_dst_stage_masks = &wait_dst_stage_mask;
+        submit_info.signal_semaphores_count = 1;
+        submit_info.signal_semaphores = &sky->lut_ready_semaphore;
+        submit_info.fence = VK_NULL_HANDLE;
+        submit_info.queue = COMPUTE;
+        result = submit_commands(&submit_info);
+        sx_assert_rel(result == VK_SUCCESS && "Failed to submit commands");
+
+        renderer_wait_semaphore(rd, sky->lut_ready_semaphore,
+                                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+        sky->lut_release_pending = false;
+    } else if (hash != sky->atmosphere_hash) {
+        renderer_signal_semaphore(rd, sky->lut_release_semaphore);
+        sky->lut_release_pending = true;
+    }
+
+    rg_set_pass_enabled(rd->graph, sky->sky_view_pass, sky->use_sky_view_lut);
+}
+
+/* aerial perspective for the composition pass, one thread per froxel column */
+static void record_aerial_perspective(VkCommandBuffer cmdbuffer, void* user) {
+    Sky *sky = user;
+    Renderer *rd = sky->rd;
+    uint32_t uniform_offset = uniform_arena_dynamic_offset();
+
+    vkCmdBindPipeline(cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->aerial_perspective_pipeline);
+    vkCmdBindDescriptorSets(cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->aerial_perspective_pipeline_layout,
+            0, 1, &rd->global_descriptorset, 1, &uniform_offset);
+    vkCmdBindDescriptorSets(cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->aerial_perspective_pipeline_layout,
+            1, 1, &sky->aerial_perspective_descriptor_set, 1, &uniform_offset);
+    vkCmdDispatch(cmdbuffer, (uint32_t)sx_ceil(AERIAL_PERSPECTIVE_SIZE / (float)8),
+                             (uint32_t)sx_ceil(AERIAL_PERSPECTIVE_SIZE / (float)8), 1);
+}
+
+/* disabled with use_sky_view_lut */
+static void record_sky_view(VkCommandBuffer cmdbuffer, void* user) {
+    Sky *sky = user;
+    Renderer *rd = sky->rd;
+    uint32_t uniform_offset = uniform_arena_dynamic_offset();
+
+    vkCmdBindPipeline(cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->sky_view_pipeline);
+    vkCmdBindDescriptorSets(cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->sky_view_pipeline_layout,
+            0, 1, &rd->global_descriptorset, 1, &uniform_offset);
+    vkCmdBindDescriptorSets(cmdbuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sky->sky_view_pipeline_layout,
+            1, 1, &sky->sky_view_descriptor_set, 1, &uniform_offset);
+    vkCmdDispatch(cmdbuffer, (uint32_t)sx_ceil(sky->quality.sky_view_width / (float)8),
+                             (uint32_t)sx_ceil(sky->quality.sky_view_height / (float)8), 1);
+}
+
+void sky_draw(VkCommandBuffer cmdbuffer) {
+    VkPipeline pipeline = get_pipeline(global_sky->pipelines[global_sky->rd->scene_mode]);
+    if (pipeline == VK_NULL_HANDLE) {
+        return;
+    }
+    uint32_t use_sky_view_lut = global_sky->use_sky_view_lut;
+    uint32_t uniform_offset = uniform_arena_dynamic_offset();
 
     vkCmdBindDescriptorSets(cmdbuffer, 
             VK_PIPELINE_BIND_POINT_GRAPHICS, global_sky->pipeline_layout,
-            0, 1, &global_sky->rd->global_descriptorset, 0, NULL);
+            0, 1, &global_sky->rd->global_descriptorset, 1, &uniform_offset);
     vkCmdBindDescriptorSets(cmdbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, global_sky->pipeline_layout,
-            1, 1, &global_sky->descriptor_set, 0, NULL);
-    vkCmdBindPipeline(cmdbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, global_sky->pipeline);
+            1, 1, &global_sky->descriptor_set, 1, &uniform_offset);
+    vkCmdBindPipeline(cmdbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    vkCmdPushConstants(cmdbuffer, global_sky->pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT,
+            0, sizeof(uint32_t), &use_sky_view_lut);
     vkCmdDraw(cmdbuffer, 4, 1, 0, 0);
 }
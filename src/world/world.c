@@ -1,6 +1,7 @@
 #include "world/world.h"
 #include "device/device.h"
 #include "sx/math.h"
+#include "sx/trace.h"
 
 /*{{{World* create_world(const sx_alloc* alloc, uint32_t width, uint32_t height)*/
 World* create_world(const sx_alloc* alloc, uint32_t width, uint32_t height) {
@@ -9,7 +10,7 @@ World* create_world(const sx_alloc* alloc, uint32_t width, uint32_t height) {
     world->cam_translation_speed = 5000.f;
 
     world->renderer = create_renderer(world->alloc, width, height);
-    world->sky = sky_create(alloc, world->renderer);
+    world->sky = sky_create(alloc, world->renderer, SKY_QUALITY_HIGH);
     world->gui = nkgui_create(world->alloc, world->renderer);
 
     return world;
@@ -79,6 +80,7 @@ static sx_vec4 convert_to_vec4(struct nk_colorf color) {
 /*{{{void world_update(World* world, float dt)*/
 void world_update(World* world, float dt) {
 struct nk_context* ctx = &world->gui->context;
+    sx_trace_begin("world_update");
 
     nk_input_begin(ctx);
     sx_vec3 m = mouse_axis(device()->input_manager, MA_CURSOR);
@@ -106,6 +108,11 @@ struct nk_context* ctx = &world->gui->context;
             world->cam_translation_speed = nk_propertyf(ctx, "#Speed:", 100.0, world->cam_translation_speed, 100000.0f, 100.f, 100.f);
         }
 
+        {
+            nk_layout_row_dynamic(ctx, 30, 1);
+            world->sky->use_sky_view_lut = nk_check_label(ctx, "Sky-view LUT", world->sky->use_sky_view_lut);
+        }
+
         {
             nk_layout_row_dynamic(ctx, 30, 1);
             nk_label(ctx, "Sun direction:", NK_TEXT_LEFT);
@@ -180,19 +187,34 @@ struct nk_context* ctx = &world->gui->context;
             world->sky->atmosphere.mie_absorption = sx_vec4_mulf(convert_to_vec4(mie_color), world->sky->mie_absorption_scale);
         }
 
+        if (nk_tree_push(ctx, NK_TREE_TAB, "GPU timings", NK_MINIMIZED)) {
+            const GpuProfileScope* scopes;
+            uint32_t num_scopes = gpu_profiler_scopes(&scopes);
+            nk_layout_row_dynamic(ctx, 20, 2);
+            for (uint32_t i = 0; i < num_scopes; i++) {
+                nk_label(ctx, scopes[i].name, NK_TEXT_LEFT);
+                nk_labelf(ctx, NK_TEXT_RIGHT, "%.3f ms", gpu_profile_scope_average(&scopes[i]));
+            }
+            nk_tree_pop(ctx);
+        }
+
     }
     nk_end(&world->gui->context);
 
+    sx_trace_begin("nkgui_update");
     nkgui_update(world->gui);
+    sx_trace_end();
 
     renderer_render(world->renderer);
 
     nk_clear(&world->gui->context);
+    sx_trace_end();
 }
 /*}}}*/
 
 /*{{{void world_destroy(World* world)*/
 void world_destroy(World* world) {
+    renderer_destroy(world->renderer);
 }
 /*}}}*/
 
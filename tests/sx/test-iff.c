@@ -112,12 +112,36 @@ static void test_load_iff(const char* filename)
     }
 }
 
+static void test_map_iff(const char* filename) 
+{
+    sx_mem_block* mem = sx_file_map(sx_alloc_malloc(), filename);
+    if (mem) {
+        sx_mem_reader reader;
+        sx_mem_init_reader(&reader, mem->data, mem->size);
+        sx_iff_file iff;
+        sx_iff_init_from_mem_reader(&iff, &reader, 0, sx_alloc_malloc());
+
+        int level1 = sx_iff_get_chunk(&iff, LEVEL1_FOURCC, 0);
+        while (level1 != -1) {
+            // chunk data is compared in place, inside the mapping
+            const uint8_t* data = (const uint8_t*)mem->data + iff.chunks[level1].pos;
+            printf("Chunk [Level1] - size: %u, mapped data %s\n", (uint32_t)iff.chunks[level1].size,
+                   sx_memcmp(data, dummy_data, sizeof(dummy_data)) == 0 ? "matches" : "differs");
+            level1 = sx_iff_get_next_chunk(&iff, level1);
+        }
+
+        sx_iff_release(&iff);
+        sx_file_unmap(mem);
+    }
+}
+
 int main(int argc, char* argv[]) 
 {
     if (argc != 2) {
         puts("You must provide a command and a file:");
         puts("  test-iff load");
         puts("  test-iff save");
+        puts("  test-iff map");
         return -1;
     }
 
@@ -129,6 +153,8 @@ int main(int argc, char* argv[])
         test_load_iff("test.bin");
     } else if (strcmp(command, "append") == 0) {
         test_append_iff("test.bin");
+    } else if (strcmp(command, "map") == 0) {
+        test_map_iff("test.bin");
     }
 
     return 0;
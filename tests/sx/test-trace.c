@@ -0,0 +1,46 @@
+#include <stdio.h>
+
+#include "sx/allocator.h"
+#include "sx/os.h"
+#include "sx/threads.h"
+#include "sx/timer.h"
+#include "sx/trace.h"
+
+static int worker_thread_fn(void* user_data1, void* user_data2)
+{
+    for (int i = 0; i < 100; i++) {
+        sx_trace_begin("work");
+        sx_os_sleep(1);
+        sx_trace_end();
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    const sx_alloc* alloc = sx_alloc_malloc();
+    sx_tm_init();
+    sx_trace_init(alloc);
+    sx_trace_thread_name("Main");
+
+    sx_thread* thrd = sx_thread_create(alloc, worker_thread_fn, NULL, 0, "Worker", NULL);
+    if (!thrd) {
+        return -1;
+    }
+
+    // dump while the worker is still recording
+    for (int i = 0; i < 10; i++) {
+        sx_trace_begin("frame");
+        sx_os_sleep(5);
+        sx_trace_end();
+    }
+    if (!sx_trace_dump("test-trace.json")) {
+        puts("Could not write test-trace.json");
+        return -1;
+    }
+
+    sx_thread_destroy(thrd, alloc);
+    sx_trace_shutdown();
+    puts("Trace written to test-trace.json, open it in chrome://tracing");
+    return 0;
+}
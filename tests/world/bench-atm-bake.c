@@ -0,0 +1,96 @@
+#include "sx/allocator.h"
+#include "sx/jobs.h"
+#include "sx/os.h"
+#include "sx/string.h"
+#include "sx/timer.h"
+#include "world/atm_bake.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NUM_RUNS 5
+
+static Atmosphere default_atmosphere()
+{
+    Atmosphere atm;
+    atm.bottom_radius = 6371.f;
+    atm.top_radius = 6471.f;
+    atm.rayleigh_scattering = sx_vec4f(0.05802f * 0.1f, 0.13558f * 0.1f, 0.33100f * 0.1f, 0.f);
+    atm.mie_scattering = sx_vec4f(0.3996f * 0.01f, 0.3996f * 0.01f, 0.3996f * 0.01f, 0.f);
+    atm.mie_absorption = sx_vec4f(0.4440f * 0.01f, 0.4440f * 0.01f, 0.4440f * 0.01f, 0.f);
+    sx_vec3 sun_dir = sx_vec3_norm(sx_vec3f(0.f, 0.5f, -1.f));
+    atm.sun_direction = sx_vec4f(sun_dir.x, sun_dir.y, sun_dir.z, 0.f);
+    return atm;
+}
+
+typedef struct BakeResult {
+    double transmittance_ms;
+    double multi_scat_ms;
+} BakeResult;
+
+static BakeResult bake(sx_job_context* ctx, const Atmosphere* atm, AtmLut* transmittance, AtmLut* multi_scat)
+{
+    BakeResult best = { 1e9, 1e9 };
+    for (int i = 0; i < NUM_RUNS; i++) {
+        uint64_t start_tm = sx_tm_now();
+        atm_bake_transmittance(ctx, atm, transmittance);
+        double ms = sx_tm_ms(sx_tm_since(start_tm));
+        best.transmittance_ms = ms < best.transmittance_ms ? ms : best.transmittance_ms;
+
+        start_tm = sx_tm_now();
+        atm_bake_multi_scattering(ctx, atm, transmittance, multi_scat);
+        ms = sx_tm_ms(sx_tm_since(start_tm));
+        best.multi_scat_ms = ms < best.multi_scat_ms ? ms : best.multi_scat_ms;
+    }
+    return best;
+}
+
+static bool same_lut(const AtmLut* a, const AtmLut* b)
+{
+    return sx_memcmp(a->data, b->data, (size_t)a->width * a->height * 4 * sizeof(float)) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    const sx_alloc* alloc = sx_alloc_malloc();
+    int max_threads = argc > 1 ? atoi(argv[1]) : sx_os_numcores();
+    if (max_threads < 1)
+        max_threads = 1;
+
+    sx_tm_init();
+    Atmosphere atm = default_atmosphere();
+    AtmLut ref_transmittance = atm_lut_create(alloc, ATM_TRANSMITTANCE_WIDTH, ATM_TRANSMITTANCE_HEIGHT);
+    AtmLut ref_multi_scat = atm_lut_create(alloc, ATM_MULTI_SCAT_WIDTH, ATM_MULTI_SCAT_HEIGHT);
+    AtmLut transmittance = atm_lut_create(alloc, ATM_TRANSMITTANCE_WIDTH, ATM_TRANSMITTANCE_HEIGHT);
+    AtmLut multi_scat = atm_lut_create(alloc, ATM_MULTI_SCAT_WIDTH, ATM_MULTI_SCAT_HEIGHT);
+
+    printf("transmittance %ux%u, multi scattering %ux%u, best of %d runs\n", transmittance.width,
+           transmittance.height, multi_scat.width, multi_scat.height, NUM_RUNS);
+    BakeResult base = bake(NULL, &atm, &ref_transmittance, &ref_multi_scat);
+    printf("\t1 thread:  transmittance %8.3f ms  multi scattering %8.3f ms\n", base.transmittance_ms,
+           base.multi_scat_ms);
+
+    /* n threads = main thread + (n - 1) workers */
+    for (int n = 2; n <= max_threads; n++) {
+        sx_job_context* ctx = sx_job_create_context(alloc, &(sx_job_context_desc){ .num_threads = n - 1 });
+        if (!ctx) {
+            puts("Error: sx_job_create_context failed!");
+            return -1;
+        }
+
+        BakeResult r = bake(ctx, &atm, &transmittance, &multi_scat);
+        bool same = same_lut(&transmittance, &ref_transmittance) && same_lut(&multi_scat, &ref_multi_scat);
+        printf("\t%d threads: transmittance %8.3f ms (%.2fx)  multi scattering %8.3f ms (%.2fx)%s\n", n,
+               r.transmittance_ms, base.transmittance_ms / r.transmittance_ms, r.multi_scat_ms,
+               base.multi_scat_ms / r.multi_scat_ms, same ? "" : "  MISMATCH");
+        sx_job_destroy_context(ctx, alloc);
+        if (!same)
+            return -1;
+    }
+
+    atm_lut_destroy(alloc, &multi_scat);
+    atm_lut_destroy(alloc, &transmittance);
+    atm_lut_destroy(alloc, &ref_multi_scat);
+    atm_lut_destroy(alloc, &ref_transmittance);
+    return 0;
+}